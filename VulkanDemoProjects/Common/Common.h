@@ -5,6 +5,15 @@
 #include "vkh_initializers.h"
 #include "vkh_setup.h"
 #include "vkh_alloc.h"
+#include "vkh_timeline.h"
+#include "vkh_deletion_queue.h"
+#include "vkh_frame.h"
+#include "vkh_parallel_record.h"
+#include "vkh_command_cache.h"
+#include "vkh_render_queue.h"
+#include "vkh_batching.h"
+#include "vkh_cpu_culling.h"
+#include "vkh_gpu_culling.h"
 #include "debug.h"
 #include "os_init.h"
 #include "os_input.h"
@@ -12,4 +21,19 @@
 #include "vkh_mesh.h"
 #include "vkh_texture.h"
 #include "file_utils.h"
-#include "vkh_material.h"
\ No newline at end of file
+#include "hash_utils.h"
+#include "vkh_block_layout.h"
+#include "vkh_shader_cache.h"
+#include "vkh_reflection.h"
+#include "vkh_material.h"
+#include "vkh_uniform_ring.h"
+#include "vkh_tracked_buffer.h"
+#include "vkh_object_store.h"
+#include "vkh_gpu_timer.h"
+#include "vkh_memory_budget.h"
+#include "vkh_residency.h"
+#include "vkh_texture_streaming.h"
+#include "vkh_block_alloc.h"
+#include "vkh_buddy_alloc.h"
+#include "vkh_alloc_bench.h"
+#include "vkh_concurrent_alloc.h"
\ No newline at end of file
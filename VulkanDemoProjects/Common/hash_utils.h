@@ -0,0 +1,29 @@
+#pragma once
+#include <stdint.h>
+#include <stddef.h>
+
+//64 bit FNV-1a, used to key caches on the raw bytes of POD structs and file contents.
+//Structs being hashed this way must be memset to 0 before being filled in, so that padding bytes
+//don't make two identical descriptions hash differently
+
+#define HASH_FNV_OFFSET_BASIS 0xcbf29ce484222325ULL
+#define HASH_FNV_PRIME 0x100000001b3ULL
+
+uint64_t hashBytes(const void* data, size_t size, uint64_t seed = HASH_FNV_OFFSET_BASIS)
+{
+	const unsigned char* bytes = (const unsigned char*)data;
+	uint64_t hash = seed;
+
+	for (size_t i = 0; i < size; ++i)
+	{
+		hash ^= bytes[i];
+		hash *= HASH_FNV_PRIME;
+	}
+
+	return hash;
+}
+
+uint64_t hashCombine(uint64_t hash, uint64_t value)
+{
+	return hashBytes(&value, sizeof(uint64_t), hash);
+}
@@ -7,6 +7,8 @@
 #include "debug.h"
 
 #include "vkh_types.h"
+#include "vkh_timeline.h"
+#include "vkh_deletion_queue.h"
 
 namespace vkh
 {
@@ -69,33 +71,32 @@ namespace vkh
 		checkf(res == VK_SUCCESS, "Error creating vk semaphore");
 	}
 
-	void createFence(VkFence& outFence, VkDevice& device)
+	void createFence(VkFence& outFence, VkDevice& device, VkFenceCreateFlags flags = 0)
 	{
 		VkFenceCreateInfo fenceInfo = {};
 		fenceInfo.sType = VK_STRUCTURE_TYPE_FENCE_CREATE_INFO;
 		fenceInfo.pNext = NULL;
-		fenceInfo.flags = 0;
+		fenceInfo.flags = flags;
 		VkResult vk_res = vkCreateFence(device, &fenceInfo, NULL, &outFence);
 		checkf(vk_res == VK_SUCCESS, "Error creating vk fence");
 	}
 
 	void waitForFence(VkFence& fence, const VkDevice& device)
 	{
+		//blocks until the fence is signaled, a fence that's never submitted will hang here
 		if (fence)
 		{
-			if (vkGetFenceStatus(device, fence) == VK_SUCCESS)
-			{
-				vkWaitForFences(device, 1, &fence, true, 0);
-			}
+			VkResult res = vkWaitForFences(device, 1, &fence, VK_TRUE, UINT64_MAX);
+			checkf(res == VK_SUCCESS, "Error waiting for fence");
 		}
 	}
 
-	void createCommandPool(VkCommandPool& outPool, const VkDevice& lDevice, const VkhPhysicalDevice& physDevice, uint32_t queueFamilyIdx)
+	void createCommandPool(VkCommandPool& outPool, const VkDevice& lDevice, const VkhPhysicalDevice& physDevice, uint32_t queueFamilyIdx, VkCommandPoolCreateFlags flags = VK_COMMAND_POOL_CREATE_RESET_COMMAND_BUFFER_BIT)
 	{
 		VkCommandPoolCreateInfo poolInfo = {};
 		poolInfo.sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO;
 		poolInfo.queueFamilyIndex = queueFamilyIdx;
-		poolInfo.flags = VK_COMMAND_POOL_CREATE_RESET_COMMAND_BUFFER_BIT; // Optional
+		poolInfo.flags = flags;
 
 		VkResult res = vkCreateCommandPool(lDevice, &poolInfo, nullptr, &outPool);
 		checkf(res == VK_SUCCESS, "Error creating command pool");
@@ -166,46 +167,127 @@ namespace vkh
 		checkf(res == VK_SUCCESS, "Error creating render pass");
 	}
 
-	void createCommandBuffer(VkCommandBuffer& outBuffer, VkCommandPool& pool, const VkDevice& lDevice)
+	void createCommandBuffer(VkCommandBuffer& outBuffer, VkCommandPool& pool, const VkDevice& lDevice, VkCommandBufferLevel level = VK_COMMAND_BUFFER_LEVEL_PRIMARY)
 	{
 		VkCommandBufferAllocateInfo allocInfo = {};
 		allocInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
 		allocInfo.commandPool = pool;
-		allocInfo.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
+		allocInfo.level = level;
 		allocInfo.commandBufferCount = 1;
 
 		VkResult res = vkAllocateCommandBuffers(lDevice, &allocInfo, &outBuffer);
 		checkf(res == VK_SUCCESS, "Error creating command buffer");
 	}
 
-	uint32_t getMemoryType(const VkPhysicalDevice& device, uint32_t memoryTypeBitsRequirement, VkMemoryPropertyFlags requiredProperties)
+	//memory types are picked by flags first and heap size second. A type has to have every required flag to be picked at
+	//all, then each preferred flag it has counts for it and each avoided flag counts against it, and the biggest heap
+	//breaks any ties
+	struct MemoryTypePolicy
 	{
-		VkPhysicalDeviceMemoryProperties memProperties;
-		vkGetPhysicalDeviceMemoryProperties(device, &memProperties);
+		VkMemoryPropertyFlags	required;
+		VkMemoryPropertyFlags	preferred;
+		VkMemoryPropertyFlags	avoided;
+	};
+
+	uint32_t countFlagBits(VkFlags flags)
+	{
+		uint32_t count = 0;
+		for (; flags; flags &= flags - 1) count++;
+		return count;
+	}
+
+	//with nothing else asked for, avoid flags that weren't required. Staging buffers then stay out of the small BAR
+	//window on discrete gpus, device local buffers don't use it up either, and neither end up in lazily allocated memory
+	MemoryTypePolicy defaultMemoryTypePolicy(VkMemoryPropertyFlags required)
+	{
+		MemoryTypePolicy policy;
+		policy.required = required;
+		policy.preferred = 0;
+		policy.avoided = (VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT | VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_CACHED_BIT | VK_MEMORY_PROPERTY_LAZILY_ALLOCATED_BIT) & ~required;
+		return policy;
+	}
+
+	//0 if the type can't be used at all
+	uint64_t scoreMemoryType(const VkPhysicalDeviceMemoryProperties& memProperties, uint32_t memoryIndex, const MemoryTypePolicy& policy)
+	{
+		const VkMemoryType& type = memProperties.memoryTypes[memoryIndex];
+		if ((type.propertyFlags & policy.required) != policy.required) return 0;
+
+		//flags outweigh heap size, which is counted in MB so it fits in the bits below them
+		uint64_t flagScore = 32 + countFlagBits(type.propertyFlags & policy.preferred) - countFlagBits(type.propertyFlags & policy.avoided);
+		uint64_t heapMB = memProperties.memoryHeaps[type.heapIndex].size >> 20;
+		const uint64_t heapMask = (1ull << 40) - 1;
 
-		//The VkPhysicalDeviceMemoryProperties structure has two arraysL memoryTypes and memoryHeaps.
-		//Memory heaps are distinct memory resources like dedicated VRAM and swap space in RAM 
-		//for when VRAM runs out.The different types of memory exist within these heaps.Right now 
-		//we'll only concern ourselves with the type of memory and not the heap it comes from, 
-		//but you can imagine that this can affect performance.
+		return (flagScore << 40) | (heapMB < heapMask ? heapMB : heapMask);
+	}
+
+	//UINT32_MAX if there's no type in memoryTypeBitsRequirement with the required flags
+	uint32_t findMemoryType(const VkPhysicalDeviceMemoryProperties& memProperties, uint32_t memoryTypeBitsRequirement, const MemoryTypePolicy& policy)
+	{
+		uint32_t bestIndex = UINT32_MAX;
+		uint64_t bestScore = 0;
 
 		for (uint32_t memoryIndex = 0; memoryIndex < memProperties.memoryTypeCount; memoryIndex++)
 		{
-			const uint32_t memoryTypeBits = (1 << memoryIndex);
-			const bool isRequiredMemoryType = memoryTypeBitsRequirement & memoryTypeBits;
+			if (!(memoryTypeBitsRequirement & (1 << memoryIndex))) continue;
+
+			uint64_t score = scoreMemoryType(memProperties, memoryIndex, policy);
+			if (score > bestScore)
+			{
+				bestIndex = memoryIndex;
+				bestScore = score;
+			}
+		}
+
+		return bestIndex;
+	}
+
+	uint32_t getMemoryType(const VkPhysicalDevice& device, uint32_t memoryTypeBitsRequirement, VkMemoryPropertyFlags requiredProperties)
+	{
+		VkPhysicalDeviceMemoryProperties memProperties;
+		vkGetPhysicalDeviceMemoryProperties(device, &memProperties);
 
-			const VkMemoryPropertyFlags properties = memProperties.memoryTypes[memoryIndex].propertyFlags;
-			const bool hasRequiredProperties = (properties & requiredProperties) == requiredProperties;
+		uint32_t memoryIndex = findMemoryType(memProperties, memoryTypeBitsRequirement, defaultMemoryTypePolicy(requiredProperties));
+		checkf(memoryIndex != UINT32_MAX, "Could not find a valid memory type for requiredProperties");
+		return memoryIndex;
+	}
 
-			if (isRequiredMemoryType && hasRequiredProperties)
+	//true when the cpu can write to device local memory that's as big as the biggest device local heap, which is the
+	//case with resizable BAR, and on integrated gpus and software renderers where all memory is shared with the cpu.
+	//Without resizable BAR discrete gpus only map a 256MB window, which isn't worth filling with things that can be staged
+	bool hasDirectUploadMemory(const VkPhysicalDeviceMemoryProperties& memProperties)
+	{
+		VkDeviceSize largestDeviceHeap = 0;
+		for (uint32_t i = 0; i < memProperties.memoryHeapCount; ++i)
+		{
+			if (memProperties.memoryHeaps[i].flags & VK_MEMORY_HEAP_DEVICE_LOCAL_BIT)
 			{
-				return static_cast<int32_t>(memoryIndex);
+				largestDeviceHeap = memProperties.memoryHeaps[i].size > largestDeviceHeap ? memProperties.memoryHeaps[i].size : largestDeviceHeap;
 			}
+		}
 
+		const VkMemoryPropertyFlags directFlags = VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT | VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT;
+		for (uint32_t i = 0; i < memProperties.memoryTypeCount; ++i)
+		{
+			const VkMemoryType& type = memProperties.memoryTypes[i];
+			if ((type.propertyFlags & directFlags) == directFlags && memProperties.memoryHeaps[type.heapIndex].size >= largestDeviceHeap)
+			{
+				return true;
+			}
 		}
 
-		checkf(0, "Could not find a valid memory type for requiredProperties");
-		return 0;
+		return false;
+	}
+
+	//what to create buffers that are uploaded to with, so uploadToBuffer can write them directly when the gpu allows it
+	VkMemoryPropertyFlags uploadDestinationProperties(const VkhContext& ctxt)
+	{
+		return ctxt.gpu.directUpload ? VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT | VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT : VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT;
+	}
+
+	bool isHostVisible(const Allocation& memory, const VkhContext& ctxt)
+	{
+		return (ctxt.gpu.memProps.memoryTypes[memory.type].propertyFlags & VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT) != 0;
 	}
 
 	void createFrameBuffers(std::vector<VkFramebuffer>& outBuffers, const VkhSwapChain& swapChain, const VkImageView* depthBufferView, const VkRenderPass& renderPass, const VkDevice& device)
@@ -280,7 +362,9 @@ namespace vkh
 
 	}
 
-	void submitScratchCommandBuffer(VkhCommandBuffer& commandBuffer)
+	//submits without waiting for the work to finish, and returns the timeline value that marks it being done.
+	//The command buffer is freed by the deletion queue once the gpu is finished with it
+	uint64_t submitScratchCommandBufferAsync(VkhCommandBuffer& commandBuffer)
 	{
 		vkEndCommandBuffer(commandBuffer.buffer);
 
@@ -292,33 +376,54 @@ namespace vkh
 		submitInfo.commandBufferCount = 1;
 		submitInfo.pCommandBuffers = &commandBuffer.buffer;
 
-		VkQueue queue;
 		VkCommandPool pool;
 		if (commandBuffer.owningPool == ECommandPoolType::Graphics)
 		{
-			queue = ctxt.deviceQueues.graphicsQueue;
 			pool = ctxt.gfxCommandPool;
-
 		}
 		else if (commandBuffer.owningPool == ECommandPoolType::Transfer)
 		{
-			queue = ctxt.deviceQueues.transferQueue;
 			pool = ctxt.transferCommandPool;
 		}
 		else
 		{
-			queue = ctxt.deviceQueues.presentQueue;
 			pool = ctxt.presentCommandPool;
 		}
 
+		uint64_t submitValue = Timeline::submit(commandBuffer.owningPool, submitInfo);
+		DeletionQueue::freeCommandBuffer(pool, commandBuffer.buffer, commandBuffer.owningPool, submitValue);
 
-		vkQueueSubmit(queue, 1, &submitInfo, VK_NULL_HANDLE);
-		vkQueueWaitIdle(queue);
+		return submitValue;
+	}
 
-		vkFreeCommandBuffers(ctxt.device, pool, 1, &commandBuffer.buffer);
+	void submitScratchCommandBuffer(VkhCommandBuffer& commandBuffer)
+	{
+		//only waits for this submit, not everything else that's been queued up on the same queue
+		uint64_t submitValue = submitScratchCommandBufferAsync(commandBuffer);
+		Timeline::wait(commandBuffer.owningPool, submitValue);
 	}
 
 
+	//pipelines created with createBasicMaterial use dynamic viewport / scissor state, so this needs to be
+	//called on every command buffer before drawing with them
+	void setViewportAndScissor(VkCommandBuffer& commandBuffer, const VkExtent2D& extent)
+	{
+		VkViewport viewport = {};
+		viewport.x = 0.0f;
+		viewport.y = 0.0f;
+		viewport.width = static_cast<float>(extent.width);
+		viewport.height = static_cast<float>(extent.height);
+		viewport.minDepth = 0.0f;
+		viewport.maxDepth = 0.0f;
+
+		VkRect2D scissor = {};
+		scissor.offset = { 0, 0 };
+		scissor.extent = extent;
+
+		vkCmdSetViewport(commandBuffer, 0, 1, &viewport);
+		vkCmdSetScissor(commandBuffer, 0, 1, &scissor);
+	}
+
 	void copyBuffer(VkBuffer& srcBuffer, VkBuffer& dstBuffer, VkDeviceSize size, uint32_t srcOffset, uint32_t dstOffset, VkhCommandBuffer& buffer)
 	{
 		VkBufferCopy copyRegion = {};
@@ -328,13 +433,17 @@ namespace vkh
 		vkCmdCopyBuffer(buffer.buffer, srcBuffer, dstBuffer, 1, &copyRegion);
 	}
 
-	void copyBuffer(VkBuffer& srcBuffer, VkBuffer& dstBuffer, VkDeviceSize size, uint32_t srcOffset, uint32_t dstOffset, VkhContext& ctxt)
+	//doesn't wait for the copy to finish, returns the transfer timeline value to tag the source buffer's deletion with.
+	//Frames submitted with submitFrame wait for the copy on the gpu before they read dstBuffer
+	uint64_t copyBuffer(VkBuffer& srcBuffer, VkBuffer& dstBuffer, VkDeviceSize size, uint32_t srcOffset, uint32_t dstOffset, VkhContext& ctxt)
 	{
 		VkhCommandBuffer scratch = beginScratchCommandBuffer(ECommandPoolType::Transfer, ctxt);
 
 		copyBuffer(srcBuffer, dstBuffer, size, srcOffset, dstOffset, scratch);
 
-		submitScratchCommandBuffer(scratch);
+		uint64_t copyValue = submitScratchCommandBufferAsync(scratch);
+		Timeline::markUpload(ECommandPoolType::Transfer, copyValue);
+		return copyValue;
 	}
 
 	void createShaderModule(VkShaderModule& outModule, const char* binaryData, size_t dataSize, const VkhContext& ctxt)
@@ -342,13 +451,10 @@ namespace vkh
 		VkShaderModuleCreateInfo createInfo = {};
 		createInfo.sType = VK_STRUCTURE_TYPE_SHADER_MODULE_CREATE_INFO;
 
-		//data for vulkan is stored in uint32_t  -  so we have to temporarily copy it to a container that respects that alignment
-
-		std::vector<uint32_t> codeAligned;
-		codeAligned.resize((uint32_t)(dataSize / sizeof(uint32_t) + 1));
-
-		memcpy(&codeAligned[0], binaryData, dataSize);
-		createInfo.pCode = &codeAligned[0];
+		//data for vulkan is stored in uint32_t  -  so pCode has to respect that alignment. Buffers from loadBinaryFile
+		//come straight from calloc, which is already aligned for any fundamental type, so no copy is needed
+		checkf(((uintptr_t)binaryData % alignof(uint32_t)) == 0, "SPIR-V data passed to createShaderModule must be 4 byte aligned");
+		createInfo.pCode = (const uint32_t*)binaryData;
 		createInfo.codeSize = dataSize;
 
 		checkf(dataSize % 4 == 0, "Invalid data size for .spv file -> are you sure that it compiled correctly?");
@@ -358,7 +464,8 @@ namespace vkh
 
 	}
 
-	void createBuffer(VkBuffer& outBuffer, Allocation& bufferMemory, VkDeviceSize size, VkBufferUsageFlags usage, VkMemoryPropertyFlags properties, VkhContext& ctxt)
+	//just the buffer, without any memory bound to it
+	void createBufferHandle(VkBuffer& outBuffer, VkDeviceSize size, VkBufferUsageFlags usage, const VkhContext& ctxt)
 	{
 		VkBufferCreateInfo bufferInfo = {};
 		bufferInfo.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
@@ -383,12 +490,18 @@ namespace vkh
 
 		VkResult res = vkCreateBuffer(ctxt.device, &bufferInfo, nullptr, &outBuffer);
 		checkf(res == VK_SUCCESS, "Error creating buffer");
+	}
+
+	void createBuffer(VkBuffer& outBuffer, Allocation& bufferMemory, VkDeviceSize size, VkBufferUsageFlags usage, VkMemoryPropertyFlags properties, VkhContext& ctxt)
+	{
+		createBufferHandle(outBuffer, size, usage, ctxt);
 
 		VkMemoryRequirements memRequirements;
 		vkGetBufferMemoryRequirements(ctxt.device, outBuffer, &memRequirements);
 
 		AllocationCreateInfo allocInfo = {};
 		allocInfo.size = memRequirements.size;
+		allocInfo.alignment = memRequirements.alignment;
 		allocInfo.memoryTypeIndex = getMemoryType(ctxt.gpu.device, memRequirements.memoryTypeBits, properties);
 		allocInfo.usage = properties;
 
@@ -396,7 +509,8 @@ namespace vkh
 		vkBindBufferMemory(ctxt.device, outBuffer, bufferMemory.handle, bufferMemory.offset);
 	}
 
-	void copyDataToBuffer(VkBuffer* buffer, uint32_t dataSize, uint32_t dstOffset, char* data, VkhContext& ctxt)
+	//returns the transfer timeline value the copy signals
+	uint64_t copyDataToBuffer(VkBuffer* buffer, uint32_t dataSize, uint32_t dstOffset, char* data, VkhContext& ctxt)
 	{
 		VkBuffer stagingBuffer;
 		vkh::Allocation stagingMemory;
@@ -404,25 +518,45 @@ namespace vkh
 		vkh::createBuffer(stagingBuffer,
 			stagingMemory,
 			dataSize,
-			VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_SRC_BIT,
+			VK_BUFFER_USAGE_TRANSFER_SRC_BIT,
 			VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
 			ctxt);
 
 		void* mappedStagingBuffer;
 		vkMapMemory(ctxt.device, stagingMemory.handle, stagingMemory.offset, dataSize, 0, &mappedStagingBuffer);
 
-		memset(mappedStagingBuffer, 0, dataSize);
 		memcpy(mappedStagingBuffer, data, dataSize);
 
 		vkUnmapMemory(ctxt.device, stagingMemory.handle);
 
-		vkh::VkhCommandBuffer scratch = vkh::beginScratchCommandBuffer(vkh::ECommandPoolType::Transfer, ctxt);
-		vkh::copyBuffer(stagingBuffer, *buffer, dataSize, 0, dstOffset, scratch);
-		vkh::submitScratchCommandBuffer(scratch);
-		vkh::freeDeviceMemory(stagingMemory);
+		//the staging buffer is kept around until the copy is done, so there's no need to wait for it here
+		uint64_t copyValue = vkh::copyBuffer(stagingBuffer, *buffer, dataSize, 0, dstOffset, ctxt);
+		DeletionQueue::destroyBuffer(stagingBuffer, stagingMemory, ECommandPoolType::Transfer, copyValue);
+		return copyValue;
 	}
 
-	void createImage(VkImage& outImage, uint32_t width, uint32_t height, VkFormat format, VkImageTiling tiling, VkImageUsageFlags usage, const VkhContext& ctxt)
+	//writes straight into the buffer when its memory is host visible (see uploadDestinationProperties), and goes through
+	//a staging buffer and a copy on the transfer queue when it isn't. Returns the copy's timeline value, or 0 if there
+	//wasn't one.
+	//Neither path waits for frames in flight: the direct write lands as soon as memcpy returns, so only write ranges
+	//that nothing submitted still reads (eg: a pool's unused space, or a buffer that isn't bound to any frame yet)
+	uint64_t uploadToBuffer(VkBuffer& buffer, Allocation& memory, VkDeviceSize dstOffset, const void* data, VkDeviceSize dataSize, VkhContext& ctxt)
+	{
+		if (isHostVisible(memory, ctxt))
+		{
+			void* mapped;
+			VkResult res = vkMapMemory(ctxt.device, memory.handle, memory.offset + dstOffset, dataSize, 0, &mapped);
+			checkf(res == VK_SUCCESS, "Error mapping buffer memory");
+
+			memcpy(mapped, data, (size_t)dataSize);
+			vkUnmapMemory(ctxt.device, memory.handle);
+			return 0;
+		}
+
+		return copyDataToBuffer(&buffer, static_cast<uint32_t>(dataSize), static_cast<uint32_t>(dstOffset), (char*)data, ctxt);
+	}
+
+	void createImage(VkImage& outImage, uint32_t width, uint32_t height, VkFormat format, VkImageTiling tiling, VkImageUsageFlags usage, const VkhContext& ctxt, uint32_t mipLevels = 1)
 	{
 		VkImageCreateInfo imageInfo = {};
 		imageInfo.sType = VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO;
@@ -430,7 +564,7 @@ namespace vkh
 		imageInfo.extent.width = width;
 		imageInfo.extent.height = height;
 		imageInfo.extent.depth = 1;
-		imageInfo.mipLevels = 1;
+		imageInfo.mipLevels = mipLevels;
 		imageInfo.arrayLayers = 1;
 		imageInfo.format = format;
 		imageInfo.tiling = tiling;
@@ -443,10 +577,8 @@ namespace vkh
 		checkf(res == VK_SUCCESS, "Error creating vk image");
 	}
 
-	void copyBufferToImage(VkBuffer buffer, VkImage image, uint32_t width, uint32_t height, VkhContext& ctxt)
+	void copyBufferToImage(VkBuffer buffer, VkImage image, uint32_t width, uint32_t height, VkhCommandBuffer& commandBuffer)
 	{
-		VkhCommandBuffer commandBuffer = beginScratchCommandBuffer(ECommandPoolType::Transfer, ctxt);
-
 		VkBufferImageCopy region = {};
 		region.bufferOffset = 0;
 		region.bufferRowLength = 0;
@@ -469,16 +601,17 @@ namespace vkh
 			1,
 			&region
 		);
+	}
 
+	void copyBufferToImage(VkBuffer buffer, VkImage image, uint32_t width, uint32_t height, VkhContext& ctxt)
+	{
+		VkhCommandBuffer commandBuffer = beginScratchCommandBuffer(ECommandPoolType::Transfer, ctxt);
+		copyBufferToImage(buffer, image, width, height, commandBuffer);
 		submitScratchCommandBuffer(commandBuffer);
-
-
 	}
 
-	void transitionImageLayout(VkImage image, VkFormat format, VkImageLayout oldLayout, VkImageLayout newLayout, VkhContext& ctxt)
+	void transitionImageLayout(VkImage image, VkFormat format, VkImageLayout oldLayout, VkImageLayout newLayout, VkhCommandBuffer& commandBuffer)
 	{
-		VkhCommandBuffer commandBuffer = beginScratchCommandBuffer(ECommandPoolType::Graphics, ctxt);
-
 		VkImageMemoryBarrier barrier = {};
 		barrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
 		barrier.oldLayout = oldLayout;
@@ -528,10 +661,13 @@ namespace vkh
 			0, nullptr,
 			1, &barrier
 		);
+	}
 
-
+	void transitionImageLayout(VkImage image, VkFormat format, VkImageLayout oldLayout, VkImageLayout newLayout, VkhContext& ctxt)
+	{
+		VkhCommandBuffer commandBuffer = beginScratchCommandBuffer(ECommandPoolType::Graphics, ctxt);
+		transitionImageLayout(image, format, oldLayout, newLayout, commandBuffer);
 		submitScratchCommandBuffer(commandBuffer);
-
 	}
 
 	void allocMemoryForImage(Allocation& outMem, const VkImage& image, VkMemoryPropertyFlags properties, VkhContext& ctxt)
@@ -541,6 +677,7 @@ namespace vkh
 
 		AllocationCreateInfo createInfo;
 		createInfo.size = memRequirements.size;
+		createInfo.alignment = memRequirements.alignment;
 		createInfo.memoryTypeIndex = getMemoryType(ctxt.gpu.device, memRequirements.memoryTypeBits, properties);
 		createInfo.usage = properties;
 		allocateDeviceMemory(outMem, createInfo, ctxt);
@@ -549,35 +686,14 @@ namespace vkh
 
 	void createBuffer(VkBuffer& outBuffer, Allocation& bufferMemory, VkDeviceSize size, VkBufferUsageFlags usage, VkMemoryPropertyFlags properties, const VkhContext& ctxt)
 	{
-		VkBufferCreateInfo bufferInfo = {};
-		bufferInfo.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
-		bufferInfo.size = size;
-		bufferInfo.usage = usage;
-
-		//concurrent so it can be used by the graphics and transfer queues
-
-		std::vector<uint32_t> queues;
-		queues.push_back(ctxt.gpu.graphicsQueueFamilyIdx);
-
-		if (ctxt.gpu.graphicsQueueFamilyIdx != ctxt.gpu.transferQueueFamilyIdx)
-		{
-			queues.push_back(ctxt.gpu.transferQueueFamilyIdx);
-			bufferInfo.sharingMode = VK_SHARING_MODE_CONCURRENT;
-		}
-		else bufferInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
-
-
-		bufferInfo.pQueueFamilyIndices = &queues[0];
-		bufferInfo.queueFamilyIndexCount = static_cast<uint32_t>(queues.size());
-
-		VkResult res = vkCreateBuffer(ctxt.device, &bufferInfo, nullptr, &outBuffer);
-		checkf(res == VK_SUCCESS, "Error creating Buffer");
+		createBufferHandle(outBuffer, size, usage, ctxt);
 
 		VkMemoryRequirements memRequirements;
 		vkGetBufferMemoryRequirements(ctxt.device, outBuffer, &memRequirements);
 
 		AllocationCreateInfo allocInfo = {};
 		allocInfo.size = memRequirements.size;
+		allocInfo.alignment = memRequirements.alignment;
 		allocInfo.memoryTypeIndex = getMemoryType(ctxt.gpu.device, memRequirements.memoryTypeBits, properties);
 		allocInfo.usage = properties;
 
@@ -0,0 +1,495 @@
+#pragma once
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <intrin.h>
+#include <vector>
+#include "vkh_block_alloc.h"
+#include "vkh_buddy_alloc.h"
+#include "os_init.h"
+
+//Runs the same synthetic allocation traces through the buddy heap, the block allocator's first fit free list and a
+//TLSF (two level segregated fit) heap, on the cpu, and prints how long each one takes per operation and how
+//fragmented it leaves the heap. None of it touches the gpu, the heaps only deal in offsets, so it can be run before
+//there's a vulkan context (or without one at all).
+//
+//A trace is a list of slots to toggle: if the slot holds an allocation it's freed, otherwise something of the op's
+//size is allocated into it. Toggling random slots keeps about half of them full, so the heap sits at a steady level
+//of use while allocations come and go in a random order
+
+#define ALLOC_BENCH_HEAP_SIZE (64 * 1024 * 1024)
+#define ALLOC_BENCH_OPS 200000
+
+//what the first fit and TLSF heaps round sizes up to, standing in for a typical resource alignment
+#define ALLOC_BENCH_ALIGNMENT 256
+
+//each first level size class of the TLSF heap is split into 2^TLSF_SL_LOG2 second level classes
+#define TLSF_SL_LOG2 4
+#define TLSF_SL_COUNT (1 << TLSF_SL_LOG2)
+#define TLSF_FL_COUNT 32
+
+namespace vkh::AllocBench
+{
+	const uint32_t NO_BLOCK = UINT32_MAX;
+
+	struct TraceOp
+	{
+		uint32_t		slot;
+		VkDeviceSize	size;
+	};
+
+	struct TraceResult
+	{
+		double			msPerMillionOps;
+		uint32_t		failedAllocs;
+
+		//failed even though there was enough free memory in total, just not in one piece
+		uint32_t		fragmentedFails;
+
+		//measured at the end of the trace, before the leftovers are freed
+		float			largestFreeFraction;
+		VkDeviceSize	requestedBytes;
+		VkDeviceSize	usedBytes;
+	};
+
+	inline uint32_t bitScanReverse(uint32_t mask)
+	{
+		unsigned long idx;
+		_BitScanReverse(&idx, mask);
+		return idx;
+	}
+
+	inline uint32_t bitScanForward(uint32_t mask)
+	{
+		unsigned long idx;
+		_BitScanForward(&idx, mask);
+		return idx;
+	}
+
+	//TLSF
+
+	//blocks cover the heap end to end, in order, linked to their physical neighbours. Free ones are also in the free
+	//list for their size class
+	struct TlsfBlock
+	{
+		VkDeviceSize	offset;
+		VkDeviceSize	size;
+		uint32_t		prevPhys;
+		uint32_t		nextPhys;
+		uint32_t		prevFree;
+		uint32_t		nextFree;
+		bool			free;
+	};
+
+	struct TlsfHeap
+	{
+		std::vector<TlsfBlock>	blocks;
+		std::vector<uint32_t>	unusedBlocks;
+
+		//a bit for every size class that has a free block in it
+		uint32_t				flBitmap;
+		uint32_t				slBitmaps[TLSF_FL_COUNT];
+		uint32_t				freeHeads[TLSF_FL_COUNT][TLSF_SL_COUNT];
+
+		VkDeviceSize			size;
+		VkDeviceSize			freeBytes;
+	};
+
+	void tlsfMapping(VkDeviceSize size, uint32_t& outFl, uint32_t& outSl)
+	{
+		uint32_t size32 = static_cast<uint32_t>(size);
+		if (size32 < TLSF_SL_COUNT)
+		{
+			outFl = 0;
+			outSl = size32;
+			return;
+		}
+
+		uint32_t msb = bitScanReverse(size32);
+		outFl = msb - TLSF_SL_LOG2 + 1;
+		outSl = (size32 >> (msb - TLSF_SL_LOG2)) - TLSF_SL_COUNT;
+	}
+
+	void tlsfInsertFree(TlsfHeap& heap, uint32_t blockIdx)
+	{
+		TlsfBlock& block = heap.blocks[blockIdx];
+		uint32_t fl, sl;
+		tlsfMapping(block.size, fl, sl);
+
+		block.free = true;
+		block.prevFree = NO_BLOCK;
+		block.nextFree = heap.freeHeads[fl][sl];
+		if (block.nextFree != NO_BLOCK) heap.blocks[block.nextFree].prevFree = blockIdx;
+
+		heap.freeHeads[fl][sl] = blockIdx;
+		heap.flBitmap |= 1u << fl;
+		heap.slBitmaps[fl] |= 1u << sl;
+		heap.freeBytes += block.size;
+	}
+
+	void tlsfRemoveFree(TlsfHeap& heap, uint32_t blockIdx)
+	{
+		TlsfBlock& block = heap.blocks[blockIdx];
+		uint32_t fl, sl;
+		tlsfMapping(block.size, fl, sl);
+
+		if (block.prevFree != NO_BLOCK) heap.blocks[block.prevFree].nextFree = block.nextFree;
+		else heap.freeHeads[fl][sl] = block.nextFree;
+		if (block.nextFree != NO_BLOCK) heap.blocks[block.nextFree].prevFree = block.prevFree;
+
+		if (heap.freeHeads[fl][sl] == NO_BLOCK)
+		{
+			heap.slBitmaps[fl] &= ~(1u << sl);
+			if (heap.slBitmaps[fl] == 0) heap.flBitmap &= ~(1u << fl);
+		}
+
+		block.free = false;
+		heap.freeBytes -= block.size;
+	}
+
+	uint32_t tlsfNewBlock(TlsfHeap& heap)
+	{
+		if (heap.unusedBlocks.size() > 0)
+		{
+			uint32_t idx = heap.unusedBlocks.back();
+			heap.unusedBlocks.pop_back();
+			return idx;
+		}
+
+		heap.blocks.push_back({});
+		return static_cast<uint32_t>(heap.blocks.size() - 1);
+	}
+
+	void initTlsfHeap(TlsfHeap& heap, VkDeviceSize size)
+	{
+		checkf(size <= UINT32_MAX, "The TLSF heap's size classes only go up to 4GB");
+
+		heap.blocks.clear();
+		heap.unusedBlocks.clear();
+		heap.flBitmap = 0;
+		memset(heap.slBitmaps, 0, sizeof(heap.slBitmaps));
+		memset(heap.freeHeads, 0xFF, sizeof(heap.freeHeads));
+		heap.size = size;
+		heap.freeBytes = 0;
+
+		uint32_t idx = tlsfNewBlock(heap);
+		TlsfBlock& block = heap.blocks[idx];
+		block.offset = 0;
+		block.size = size;
+		block.prevPhys = NO_BLOCK;
+		block.nextPhys = NO_BLOCK;
+		tlsfInsertFree(heap, idx);
+	}
+
+	//size has to be a multiple of ALLOC_BENCH_ALIGNMENT, which keeps every block's offset aligned too
+	bool tlsfAlloc(TlsfHeap& heap, VkDeviceSize size, uint32_t& outBlock, VkDeviceSize& outOffset)
+	{
+		if (size > heap.size) return false;
+
+		//round up to the next size class, so any block in the class that's found is big enough
+		VkDeviceSize searchSize = size;
+		if (size >= TLSF_SL_COUNT)
+		{
+			searchSize += (1ull << (bitScanReverse(static_cast<uint32_t>(size)) - TLSF_SL_LOG2)) - 1;
+		}
+
+		uint32_t fl, sl;
+		tlsfMapping(searchSize, fl, sl);
+		if (fl >= TLSF_FL_COUNT) return false;
+
+		uint32_t slMap = heap.slBitmaps[fl] & (~0u << sl);
+		if (slMap == 0)
+		{
+			uint32_t flMap = fl + 1 < TLSF_FL_COUNT ? heap.flBitmap & (~0u << (fl + 1)) : 0;
+			if (flMap == 0) return false;
+
+			fl = bitScanForward(flMap);
+			slMap = heap.slBitmaps[fl];
+		}
+
+		sl = bitScanForward(slMap);
+		uint32_t blockIdx = heap.freeHeads[fl][sl];
+		tlsfRemoveFree(heap, blockIdx);
+
+		//whatever's left over goes back as a free block of its own
+		if (heap.blocks[blockIdx].size - size >= ALLOC_BENCH_ALIGNMENT)
+		{
+			uint32_t restIdx = tlsfNewBlock(heap);
+			TlsfBlock& block = heap.blocks[blockIdx];
+			TlsfBlock& rest = heap.blocks[restIdx];
+
+			rest.offset = block.offset + size;
+			rest.size = block.size - size;
+			rest.prevPhys = blockIdx;
+			rest.nextPhys = block.nextPhys;
+			if (rest.nextPhys != NO_BLOCK) heap.blocks[rest.nextPhys].prevPhys = restIdx;
+
+			block.size = size;
+			block.nextPhys = restIdx;
+			tlsfInsertFree(heap, restIdx);
+		}
+
+		outBlock = blockIdx;
+		outOffset = heap.blocks[blockIdx].offset;
+		return true;
+	}
+
+	void tlsfFree(TlsfHeap& heap, uint32_t blockIdx)
+	{
+		//merge with free neighbours straight away, so there are never two free blocks next to each other
+		uint32_t prev = heap.blocks[blockIdx].prevPhys;
+		if (prev != NO_BLOCK && heap.blocks[prev].free)
+		{
+			tlsfRemoveFree(heap, prev);
+			TlsfBlock& block = heap.blocks[blockIdx];
+			heap.blocks[prev].size += block.size;
+			heap.blocks[prev].nextPhys = block.nextPhys;
+			if (block.nextPhys != NO_BLOCK) heap.blocks[block.nextPhys].prevPhys = prev;
+
+			heap.unusedBlocks.push_back(blockIdx);
+			blockIdx = prev;
+		}
+
+		uint32_t next = heap.blocks[blockIdx].nextPhys;
+		if (next != NO_BLOCK && heap.blocks[next].free)
+		{
+			tlsfRemoveFree(heap, next);
+			TlsfBlock& block = heap.blocks[blockIdx];
+			block.size += heap.blocks[next].size;
+			block.nextPhys = heap.blocks[next].nextPhys;
+			if (block.nextPhys != NO_BLOCK) heap.blocks[block.nextPhys].prevPhys = blockIdx;
+
+			heap.unusedBlocks.push_back(next);
+		}
+
+		tlsfInsertFree(heap, blockIdx);
+	}
+
+	VkDeviceSize tlsfLargestFree(const TlsfHeap& heap)
+	{
+		if (heap.flBitmap == 0) return 0;
+
+		uint32_t fl = bitScanReverse(heap.flBitmap);
+		uint32_t sl = bitScanReverse(heap.slBitmaps[fl]);
+
+		//blocks in a size class aren't all the same size
+		VkDeviceSize largest = 0;
+		for (uint32_t idx = heap.freeHeads[fl][sl]; idx != NO_BLOCK; idx = heap.blocks[idx].nextFree)
+		{
+			largest = heap.blocks[idx].size > largest ? heap.blocks[idx].size : largest;
+		}
+		return largest;
+	}
+
+	//FIRST FIT
+
+	struct FirstFitHeap
+	{
+		std::vector<allocators::block::FreeRange>	freeRanges;
+		VkDeviceSize								freeBytes;
+	};
+
+	//TRACE HEAPS
+	//the same calls for each heap, so runTrace can drive any of them. Handles are whatever the heap needs to free
+	//the allocation again, alongside its offset and size
+
+	void initHeap(allocators::buddy::BuddyHeap& heap)
+	{
+		allocators::buddy::initBuddyHeap(heap, ALLOC_BENCH_HEAP_SIZE, BUDDY_MIN_BLOCK_SIZE);
+	}
+
+	bool allocFromHeap(allocators::buddy::BuddyHeap& heap, VkDeviceSize size, uint32_t& outHandle, VkDeviceSize& outOffset)
+	{
+		outHandle = 0;
+		return allocators::buddy::buddyAlloc(heap, size, outOffset);
+	}
+
+	void freeToHeap(allocators::buddy::BuddyHeap& heap, uint32_t handle, VkDeviceSize offset, VkDeviceSize size)
+	{
+		allocators::buddy::buddyFree(heap, offset);
+	}
+
+	void heapUsage(const allocators::buddy::BuddyHeap& heap, VkDeviceSize& outUsed, VkDeviceSize& outLargestFree)
+	{
+		outUsed = heap.used;
+		outLargestFree = allocators::buddy::largestFreeBlock(heap);
+	}
+
+	void initHeap(FirstFitHeap& heap)
+	{
+		heap.freeRanges.clear();
+		heap.freeRanges.push_back({ 0, ALLOC_BENCH_HEAP_SIZE });
+		heap.freeBytes = ALLOC_BENCH_HEAP_SIZE;
+	}
+
+	bool allocFromHeap(FirstFitHeap& heap, VkDeviceSize size, uint32_t& outHandle, VkDeviceSize& outOffset)
+	{
+		outHandle = 0;
+		if (!allocators::block::allocFromRanges(heap.freeRanges, size, ALLOC_BENCH_ALIGNMENT, outOffset)) return false;
+
+		heap.freeBytes -= size;
+		return true;
+	}
+
+	void freeToHeap(FirstFitHeap& heap, uint32_t handle, VkDeviceSize offset, VkDeviceSize size)
+	{
+		allocators::block::freeToRanges(heap.freeRanges, offset, size);
+		heap.freeBytes += size;
+	}
+
+	void heapUsage(const FirstFitHeap& heap, VkDeviceSize& outUsed, VkDeviceSize& outLargestFree)
+	{
+		outUsed = ALLOC_BENCH_HEAP_SIZE - heap.freeBytes;
+		outLargestFree = 0;
+		for (uint32_t i = 0; i < heap.freeRanges.size(); ++i)
+		{
+			outLargestFree = heap.freeRanges[i].size > outLargestFree ? heap.freeRanges[i].size : outLargestFree;
+		}
+	}
+
+	void initHeap(TlsfHeap& heap)
+	{
+		initTlsfHeap(heap, ALLOC_BENCH_HEAP_SIZE);
+	}
+
+	bool allocFromHeap(TlsfHeap& heap, VkDeviceSize size, uint32_t& outHandle, VkDeviceSize& outOffset)
+	{
+		return tlsfAlloc(heap, size, outHandle, outOffset);
+	}
+
+	void freeToHeap(TlsfHeap& heap, uint32_t handle, VkDeviceSize offset, VkDeviceSize size)
+	{
+		tlsfFree(heap, handle);
+	}
+
+	void heapUsage(const TlsfHeap& heap, VkDeviceSize& outUsed, VkDeviceSize& outLargestFree)
+	{
+		outUsed = heap.size - heap.freeBytes;
+		outLargestFree = tlsfLargestFree(heap);
+	}
+
+	//TRACES
+
+	//sizes are rounded up to ALLOC_BENCH_ALIGNMENT. With powerOfTwo set they're powers of two between minSize and
+	//maxSize (which should be powers of two too), with each power equally likely, like a set of square textures
+	void makeTrace(std::vector<TraceOp>& outTrace, uint32_t slotCount, VkDeviceSize minSize, VkDeviceSize maxSize, bool powerOfTwo, uint32_t seed)
+	{
+		srand(seed);
+		outTrace.resize(ALLOC_BENCH_OPS);
+
+		uint32_t minPower = 0;
+		uint32_t maxPower = 0;
+		while ((1ull << minPower) < minSize) minPower++;
+		while ((1ull << maxPower) < maxSize) maxPower++;
+
+		for (uint32_t i = 0; i < ALLOC_BENCH_OPS; ++i)
+		{
+			//rand() only goes up to 32767 on windows, so build bigger numbers out of two calls
+			uint32_t r = (static_cast<uint32_t>(rand()) << 15) | static_cast<uint32_t>(rand());
+
+			VkDeviceSize size;
+			if (powerOfTwo) size = 1ull << (minPower + r % (maxPower - minPower + 1));
+			else size = minSize + r % (maxSize - minSize + 1);
+
+			outTrace[i].slot = static_cast<uint32_t>(rand()) % slotCount;
+			outTrace[i].size = allocators::block::alignUp(size, ALLOC_BENCH_ALIGNMENT);
+		}
+	}
+
+	template<typename Heap>
+	TraceResult runTrace(Heap& heap, const std::vector<TraceOp>& trace, uint32_t slotCount)
+	{
+		struct Slot
+		{
+			bool			live;
+			uint32_t		handle;
+			VkDeviceSize	offset;
+			VkDeviceSize	size;
+		};
+
+		std::vector<Slot> slots(slotCount);
+		TraceResult result = {};
+		initHeap(heap);
+
+		double start = OS::getMilliseconds();
+
+		for (uint32_t i = 0; i < trace.size(); ++i)
+		{
+			Slot& slot = slots[trace[i].slot];
+			if (slot.live)
+			{
+				freeToHeap(heap, slot.handle, slot.offset, slot.size);
+				result.requestedBytes -= slot.size;
+				slot.live = false;
+				continue;
+			}
+
+			slot.size = trace[i].size;
+			if (allocFromHeap(heap, slot.size, slot.handle, slot.offset))
+			{
+				result.requestedBytes += slot.size;
+				slot.live = true;
+				continue;
+			}
+
+			result.failedAllocs++;
+
+			VkDeviceSize used, largestFree;
+			heapUsage(heap, used, largestFree);
+			if (ALLOC_BENCH_HEAP_SIZE - used >= slot.size) result.fragmentedFails++;
+		}
+
+		result.msPerMillionOps = (OS::getMilliseconds() - start) * (1000000.0 / trace.size());
+
+		VkDeviceSize largestFree;
+		heapUsage(heap, result.usedBytes, largestFree);
+		VkDeviceSize freeBytes = ALLOC_BENCH_HEAP_SIZE - result.usedBytes;
+		result.largestFreeFraction = freeBytes > 0 ? (float)largestFree / (float)freeBytes : 1.0f;
+
+		for (uint32_t i = 0; i < slots.size(); ++i)
+		{
+			if (slots[i].live) freeToHeap(heap, slots[i].handle, slots[i].offset, slots[i].size);
+		}
+
+		return result;
+	}
+
+	void printResult(const char* name, const TraceResult& result)
+	{
+		float wasted = result.usedBytes > 0 ? 100.0f * (float)(result.usedBytes - result.requestedBytes) / (float)result.usedBytes : 0.0f;
+
+		printf("  %-10s %8.1f ms per 1M ops, %5u failed allocations (%5u with enough free memory), %3.0f%% of free memory in one piece, %3.0f%% lost to rounding\n",
+			name, result.msPerMillionOps, result.failedAllocs, result.fragmentedFails, result.largestFreeFraction * 100.0f, wasted);
+	}
+
+	//slotCount is about twice as many allocations as are live at once
+	void benchmarkTrace(const char* traceName, uint32_t slotCount, VkDeviceSize minSize, VkDeviceSize maxSize, bool powerOfTwo)
+	{
+		std::vector<TraceOp> trace;
+		makeTrace(trace, slotCount, minSize, maxSize, powerOfTwo, 1234);
+
+		printf("ALLOCATOR BENCHMARK: %s, %u ops over %u slots in a %u MB heap\n", traceName, ALLOC_BENCH_OPS, slotCount, ALLOC_BENCH_HEAP_SIZE / (1024 * 1024));
+
+		//the heaps are big enough that they shouldn't live on the stack
+		static allocators::buddy::BuddyHeap buddyHeap;
+		static FirstFitHeap firstFitHeap;
+		static TlsfHeap tlsfHeap;
+
+		printResult("buddy", runTrace(buddyHeap, trace, slotCount));
+		printResult("first fit", runTrace(firstFitHeap, trace, slotCount));
+		printResult("tlsf", runTrace(tlsfHeap, trace, slotCount));
+	}
+
+	void run()
+	{
+		//square textures from 64x64 to 1024x1024 at 4 bytes a pixel, with no mips
+		benchmarkTrace("power of two textures", 96, 16 * 1024, 4 * 1024 * 1024, true);
+
+		//anything from 1KB to 1MB, like a mix of buffers and non power of two images
+		benchmarkTrace("mixed sizes", 192, 1024, 1024 * 1024, false);
+
+		//lots of little buffers, smaller than the buddy heap's smallest block
+		benchmarkTrace("small buffers", 4096, 256, 32 * 1024, false);
+	}
+}
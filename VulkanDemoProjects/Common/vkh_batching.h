@@ -0,0 +1,271 @@
+#pragma once
+#include "vkh.h"
+#include "vkh_render_queue.h"
+#include "vkh_deletion_queue.h"
+#include <vector>
+
+//Turns a sorted render queue into instanced, indirect draws. Neighbouring packets that draw the same part of the same
+//buffers become one VkDrawIndexedIndirectCommand with an instance each, and runs of commands that share a pipeline,
+//descriptor set and vertex / index buffers become one batch, drawn with a single vkCmdDrawIndexedIndirect. Meshes only
+//end up in the same batch if they share buffers, so put them in a MeshPool to get the most out of this.
+//
+//Each packet's push constant bytes are copied into the instance buffer instead of being pushed, in draw order, so a
+//shader reads them back with gl_InstanceIndex (every command's firstInstance points at its first entry). Bind the
+//instance buffer as a storage buffer in the descriptor set the packets use.
+//
+//There's also a count buffer with one draw count per batch. On devices with VK_AMD_draw_indirect_count the batches
+//read their counts from it, so something on the gpu (like a culling pass) can shrink them without the cpu knowing.
+//Everywhere else the counts recorded at build time are used, and the fallbacks get worse from there: one indirect
+//call per command without multiDrawIndirect, and direct draws without drawIndirectFirstInstance
+
+namespace vkh
+{
+	struct IndirectBatch
+	{
+		VkPipeline			pipeline;
+		VkPipelineLayout	pipelineLayout;
+		VkDescriptorSet		descriptorSet;
+		VkBuffer			vertexBuffer;
+		VkBuffer			indexBuffer;
+
+		uint32_t			firstCommand;
+		uint32_t			commandCount;
+	};
+
+	struct BatchStats
+	{
+		uint64_t	drawCalls;
+		uint64_t	binds;
+		uint64_t	instances;
+	};
+
+	struct BatchedDraws
+	{
+		//all host visible, and rebuilt from scratch every time buildBatches is called
+		VkBuffer		instanceBuffer;
+		Allocation		instanceMemory;
+		VkBuffer		indirectBuffer;
+		Allocation		indirectMemory;
+		VkBuffer		countBuffer;
+		Allocation		countMemory;
+
+		std::vector<IndirectBatch>					batches;
+
+		//a cpu side copy, for devices without drawIndirectFirstInstance
+		std::vector<VkDrawIndexedIndirectCommand>	commands;
+
+		uint32_t		instanceStride;
+		uint32_t		instanceCount;
+
+		//bumped by every build, so anything recorded from the batches can tell when it's stale
+		uint64_t		version;
+		BatchStats		stats;
+	};
+
+	void writeToHostBuffer(VkBuffer& outBuffer, Allocation& outMemory, const void* data, VkDeviceSize size, VkBufferUsageFlags usage, VkhContext& ctxt)
+	{
+		createBuffer(outBuffer, outMemory, size, usage, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, ctxt);
+
+		void* mapped;
+		VkResult res = vkMapMemory(ctxt.device, outMemory.handle, outMemory.offset, size, 0, &mapped);
+		checkf(res == VK_SUCCESS, "Error mapping batch buffer");
+
+		memcpy(mapped, data, (size_t)size);
+		vkUnmapMemory(ctxt.device, outMemory.handle);
+	}
+
+	//frames that are still in flight might be reading the old buffers, so they go through the deletion queue
+	void releaseBatchBuffers(BatchedDraws& batches)
+	{
+		if (batches.instanceBuffer == VK_NULL_HANDLE) return;
+
+		uint64_t lastUse = Timeline::submittedValue(ECommandPoolType::Graphics);
+		DeletionQueue::destroyBuffer(batches.instanceBuffer, batches.instanceMemory, ECommandPoolType::Graphics, lastUse);
+		DeletionQueue::destroyBuffer(batches.indirectBuffer, batches.indirectMemory, ECommandPoolType::Graphics, lastUse);
+		DeletionQueue::destroyBuffer(batches.countBuffer, batches.countMemory, ECommandPoolType::Graphics, lastUse);
+
+		batches.instanceBuffer = VK_NULL_HANDLE;
+		batches.indirectBuffer = VK_NULL_HANDLE;
+		batches.countBuffer = VK_NULL_HANDLE;
+	}
+
+	//the queue has to be sorted already. Every packet needs the same push constant size, since that's the instance stride
+	void buildBatches(BatchedDraws& outBatches, const RenderQueue& queue, VkhContext& ctxt)
+	{
+		releaseBatchBuffers(outBatches);
+
+		outBatches.batches.clear();
+		outBatches.commands.clear();
+		outBatches.instanceCount = 0;
+		outBatches.instanceStride = queue.packets.size() > 0 ? queue.packets[0].pushConstantSize : 0;
+		outBatches.version++;
+
+		std::vector<uint8_t> instanceData;
+		instanceData.resize(queue.sorted.size() * outBatches.instanceStride);
+
+		for (uint32_t i = 0; i < queue.sorted.size(); ++i)
+		{
+			const DrawPacket& packet = queue.packets[queue.sorted[i].packetIdx];
+			checkf(packet.pushConstantSize == outBatches.instanceStride, "Batched draws need the same amount of instance data per packet");
+
+			memcpy(&instanceData[i * outBatches.instanceStride], packet.pushConstants, packet.pushConstantSize);
+
+			IndirectBatch* batch = outBatches.batches.size() > 0 ? &outBatches.batches.back() : nullptr;
+			bool sameBatch = batch &&
+				batch->pipeline == packet.pipeline &&
+				batch->pipelineLayout == packet.pipelineLayout &&
+				batch->descriptorSet == packet.descriptorSet &&
+				batch->vertexBuffer == packet.vertexBuffer &&
+				batch->indexBuffer == packet.indexBuffer;
+
+			if (!sameBatch)
+			{
+				IndirectBatch newBatch;
+				newBatch.pipeline = packet.pipeline;
+				newBatch.pipelineLayout = packet.pipelineLayout;
+				newBatch.descriptorSet = packet.descriptorSet;
+				newBatch.vertexBuffer = packet.vertexBuffer;
+				newBatch.indexBuffer = packet.indexBuffer;
+				newBatch.firstCommand = static_cast<uint32_t>(outBatches.commands.size());
+				newBatch.commandCount = 0;
+				outBatches.batches.push_back(newBatch);
+				batch = &outBatches.batches.back();
+			}
+
+			VkDrawIndexedIndirectCommand* command = batch->commandCount > 0 ? &outBatches.commands.back() : nullptr;
+			bool sameMesh = command &&
+				command->firstIndex == packet.firstIndex &&
+				command->indexCount == packet.indexCount &&
+				command->vertexOffset == packet.vertexOffset;
+
+			if (sameMesh)
+			{
+				command->instanceCount++;
+			}
+			else
+			{
+				VkDrawIndexedIndirectCommand newCommand;
+				newCommand.indexCount = packet.indexCount;
+				newCommand.instanceCount = 1;
+				newCommand.firstIndex = packet.firstIndex;
+				newCommand.vertexOffset = packet.vertexOffset;
+				newCommand.firstInstance = i;
+				outBatches.commands.push_back(newCommand);
+				batch->commandCount++;
+			}
+
+			outBatches.instanceCount++;
+		}
+
+		if (outBatches.batches.size() == 0) return;
+
+		std::vector<uint32_t> counts;
+		counts.resize(outBatches.batches.size());
+		for (uint32_t i = 0; i < counts.size(); ++i)
+		{
+			counts[i] = outBatches.batches[i].commandCount;
+		}
+
+		//storage buffer usage on the indirect and count buffers is so that a compute pass can rewrite them
+		writeToHostBuffer(outBatches.instanceBuffer, outBatches.instanceMemory, instanceData.data(), instanceData.size(),
+			VK_BUFFER_USAGE_STORAGE_BUFFER_BIT, ctxt);
+		writeToHostBuffer(outBatches.indirectBuffer, outBatches.indirectMemory, outBatches.commands.data(), outBatches.commands.size() * sizeof(VkDrawIndexedIndirectCommand),
+			VK_BUFFER_USAGE_INDIRECT_BUFFER_BIT | VK_BUFFER_USAGE_STORAGE_BUFFER_BIT, ctxt);
+		writeToHostBuffer(outBatches.countBuffer, outBatches.countMemory, counts.data(), counts.size() * sizeof(uint32_t),
+			VK_BUFFER_USAGE_INDIRECT_BUFFER_BIT | VK_BUFFER_USAGE_STORAGE_BUFFER_BIT, ctxt);
+	}
+
+	void recordBatches(BatchedDraws& batches, VkCommandBuffer commandBuffer, VkhContext& ctxt)
+	{
+		const uint32_t stride = sizeof(VkDrawIndexedIndirectCommand);
+		BatchStats stats = {};
+
+		VkPipeline boundPipeline = VK_NULL_HANDLE;
+		VkDescriptorSet boundSet = VK_NULL_HANDLE;
+		VkPipelineLayout boundLayout = VK_NULL_HANDLE;
+		VkBuffer boundVertexBuffer = VK_NULL_HANDLE;
+		VkBuffer boundIndexBuffer = VK_NULL_HANDLE;
+
+		for (uint32_t b = 0; b < batches.batches.size(); ++b)
+		{
+			const IndirectBatch& batch = batches.batches[b];
+
+			if (batch.pipeline != boundPipeline)
+			{
+				vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, batch.pipeline);
+				boundPipeline = batch.pipeline;
+				stats.binds++;
+			}
+
+			if (batch.descriptorSet != boundSet || batch.pipelineLayout != boundLayout)
+			{
+				vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, batch.pipelineLayout, 0, 1, &batch.descriptorSet, 0, 0);
+				boundSet = batch.descriptorSet;
+				boundLayout = batch.pipelineLayout;
+				stats.binds++;
+			}
+
+			if (batch.vertexBuffer != boundVertexBuffer || batch.indexBuffer != boundIndexBuffer)
+			{
+				VkDeviceSize vertexOffset = 0;
+				vkCmdBindVertexBuffers(commandBuffer, 0, 1, &batch.vertexBuffer, &vertexOffset);
+				vkCmdBindIndexBuffer(commandBuffer, batch.indexBuffer, 0, VK_INDEX_TYPE_UINT32);
+				boundVertexBuffer = batch.vertexBuffer;
+				boundIndexBuffer = batch.indexBuffer;
+				stats.binds += 2;
+			}
+
+			VkDeviceSize commandOffset = batch.firstCommand * stride;
+
+			if (!ctxt.gpu.features.drawIndirectFirstInstance)
+			{
+				//indirect commands can't offset into the instance buffer, but direct draws always can
+				for (uint32_t i = 0; i < batch.commandCount; ++i)
+				{
+					const VkDrawIndexedIndirectCommand& command = batches.commands[batch.firstCommand + i];
+					vkCmdDrawIndexed(commandBuffer, command.indexCount, command.instanceCount, command.firstIndex, command.vertexOffset, command.firstInstance);
+					stats.drawCalls++;
+				}
+			}
+			else if (ctxt.cmdDrawIndexedIndirectCount)
+			{
+				ctxt.cmdDrawIndexedIndirectCount(commandBuffer, batches.indirectBuffer, commandOffset, batches.countBuffer, b * sizeof(uint32_t), batch.commandCount, stride);
+				stats.drawCalls++;
+			}
+			else if (ctxt.gpu.features.multiDrawIndirect)
+			{
+				vkCmdDrawIndexedIndirect(commandBuffer, batches.indirectBuffer, commandOffset, batch.commandCount, stride);
+				stats.drawCalls++;
+			}
+			else
+			{
+				for (uint32_t i = 0; i < batch.commandCount; ++i)
+				{
+					vkCmdDrawIndexedIndirect(commandBuffer, batches.indirectBuffer, commandOffset + i * stride, 1, stride);
+					stats.drawCalls++;
+				}
+			}
+		}
+
+		stats.instances = batches.instanceCount;
+
+		batches.stats.drawCalls += stats.drawCalls;
+		batches.stats.binds += stats.binds;
+		batches.stats.instances += stats.instances;
+	}
+
+	//returns the totals since the last call
+	BatchStats consumeBatchStats(BatchedDraws& batches)
+	{
+		BatchStats stats = batches.stats;
+		batches.stats = {};
+		return stats;
+	}
+
+	void destroyBatches(BatchedDraws& batches)
+	{
+		releaseBatchBuffers(batches);
+		batches.batches.clear();
+		batches.commands.clear();
+	}
+}
@@ -0,0 +1,740 @@
+#pragma once
+#include <stdint.h>
+#include <algorithm>
+#include <vector>
+#include "vkh.h"
+#include "vkh_types.h"
+#include "vkh_initializers.h"
+#include "vkh_deletion_queue.h"
+#include "os_init.h"
+
+//Block allocator, packs allocations into large VkDeviceMemory blocks instead of giving each one its own, and frees a
+//block back to the driver as soon as nothing's left in it. Only memory the cpu can't see is packed, host visible
+//memory gets mapped with vkMapMemory, which can't be done twice on the same VkDeviceMemory, so those allocations (and
+//anything too big to share a block) get dedicated memory like the passthrough allocator.
+//
+//Freeing things leaves holes, and a block that's mostly holes still holds on to all of its memory. defragment() moves
+//the live allocations out of sparsely used blocks and into denser ones, so the sparse blocks empty out and get freed.
+//Only allocations that have been registered as movable can be moved, since their buffer or image has to be recreated
+//at the new location and whoever owns them needs to hear about it
+
+//how much memory each block asks the driver for
+#define BLOCK_ALLOCATOR_BLOCK_SIZE (64 * 1024 * 1024)
+
+//allocations at least this big get their own memory rather than taking up most of a block
+#define BLOCK_ALLOCATOR_DEDICATED_SIZE (BLOCK_ALLOCATOR_BLOCK_SIZE / 2)
+
+//blocks using less than this fraction of their size are emptied by defragment()
+#define DEFRAG_SPARSE_BLOCK_RATIO 0.5f
+
+namespace vkh::allocators::block
+{
+	struct FreeRange
+	{
+		VkDeviceSize	offset;
+		VkDeviceSize	size;
+	};
+
+	//handle is null for slots that have been freed and can be reused
+	struct MemoryBlock
+	{
+		VkDeviceMemory			handle;
+		uint32_t				type;
+		VkDeviceSize			size;
+		VkDeviceSize			used;
+		uint32_t				liveCount;
+
+		//sorted by offset, neighbouring ranges are always merged
+		std::vector<FreeRange>	freeRanges;
+
+		//being emptied by defragment(), so nothing gets moved into it
+		bool					evacuating;
+	};
+
+	enum class EMovableType : uint8_t
+	{
+		None,
+		Buffer,
+		Image
+	};
+
+	//called after an allocation has moved, with the owner's allocation, buffer / image and view already updated.
+	//Anything else that refers to them (descriptor sets, cached command buffers) has to be updated here
+	typedef void(*OnMovedFn)(const Allocation& newAlloc, void* userData);
+
+	struct Movable
+	{
+		EMovableType		type;
+		Allocation*			owner;
+		OnMovedFn			onMoved;
+		void*				userData;
+
+		VkBuffer*			buffer;
+		VkDeviceSize		bufferSize;
+		VkBufferUsageFlags	bufferUsage;
+
+		VkImage*			image;
+		VkImageView*		view;
+		VkImageCreateInfo	imageInfo;
+		VkImageLayout		layout;
+		VkImageAspectFlags	aspect;
+	};
+
+	//block is UINT32_MAX for dedicated allocations, offset and size are the range taken up in the block,
+	//after rounding up for alignment
+	struct SubAllocation
+	{
+		bool			live;
+		uint32_t		block;
+		VkDeviceSize	offset;
+		VkDeviceSize	size;
+		VkDeviceSize	alignment;
+		Movable			movable;
+	};
+
+	struct DefragStats
+	{
+		uint64_t		moves;
+		VkDeviceSize	bytesMoved;
+		uint64_t		blocksReleased;
+	};
+
+	struct AllocatorState
+	{
+		std::vector<MemoryBlock>	blocks;
+		std::vector<SubAllocation>	subAllocs;
+		std::vector<uint32_t>		freeSubAllocs;
+
+		//bytes taken from the driver for each memory type, blocks and dedicated allocations both
+		std::vector<size_t>			memTypeAllocSizes;
+		uint32_t					driverAllocs;
+
+		//linear and optimal resources can end up next to each other in a block
+		VkDeviceSize				granularity;
+
+		DefragStats					stats;
+		VkhContext*					context;
+	};
+
+	AllocatorState state;
+
+	//ALLOCATOR INTERFACE / INSTALLATION
+	void activate(VkhContext* context);
+	void alloc(Allocation& outAlloc, AllocationCreateInfo createInfo);
+	void free(Allocation& handle);
+	size_t allocatedSize(uint32_t memoryType);
+	uint32_t numAllocs();
+
+	AllocatorInterface allocImpl = { activate, alloc, free, allocatedSize, numAllocs };
+
+	void activate(VkhContext* context)
+	{
+		context->allocator = allocImpl;
+		state.context = context;
+
+		state.blocks.clear();
+		state.subAllocs.clear();
+		state.freeSubAllocs.clear();
+		state.memTypeAllocSizes.assign(context->gpu.memProps.memoryTypeCount, 0);
+		state.driverAllocs = 0;
+		state.granularity = context->gpu.deviceProps.limits.bufferImageGranularity;
+		state.stats = {};
+	}
+
+	//IMPLEMENTATION
+
+	VkDeviceSize alignUp(VkDeviceSize value, VkDeviceSize alignment)
+	{
+		return alignment > 1 ? ((value + alignment - 1) / alignment) * alignment : value;
+	}
+
+	//first fit, returns false if there's no range big enough
+	bool allocFromRanges(std::vector<FreeRange>& ranges, VkDeviceSize size, VkDeviceSize alignment, VkDeviceSize& outOffset)
+	{
+		for (uint32_t i = 0; i < ranges.size(); ++i)
+		{
+			FreeRange range = ranges[i];
+			VkDeviceSize offset = alignUp(range.offset, alignment);
+			if (offset + size > range.offset + range.size) continue;
+
+			//whatever's left on either side of the allocation stays free
+			VkDeviceSize tailOffset = offset + size;
+			VkDeviceSize tailSize = range.offset + range.size - tailOffset;
+			VkDeviceSize headSize = offset - range.offset;
+
+			ranges.erase(ranges.begin() + i);
+			if (tailSize > 0) ranges.insert(ranges.begin() + i, { tailOffset, tailSize });
+			if (headSize > 0) ranges.insert(ranges.begin() + i, { range.offset, headSize });
+
+			outOffset = offset;
+			return true;
+		}
+
+		return false;
+	}
+
+	void freeToRanges(std::vector<FreeRange>& ranges, VkDeviceSize offset, VkDeviceSize size)
+	{
+		uint32_t idx = 0;
+		while (idx < ranges.size() && ranges[idx].offset < offset) idx++;
+
+		ranges.insert(ranges.begin() + idx, { offset, size });
+
+		if (idx + 1 < ranges.size() && ranges[idx].offset + ranges[idx].size == ranges[idx + 1].offset)
+		{
+			ranges[idx].size += ranges[idx + 1].size;
+			ranges.erase(ranges.begin() + idx + 1);
+		}
+
+		if (idx > 0 && ranges[idx - 1].offset + ranges[idx - 1].size == ranges[idx].offset)
+		{
+			ranges[idx - 1].size += ranges[idx].size;
+			ranges.erase(ranges.begin() + idx);
+		}
+	}
+
+	VkDeviceMemory allocDriverMemory(VkDeviceSize size, uint32_t memoryType)
+	{
+		VkDeviceMemory memory;
+		VkMemoryAllocateInfo allocInfo = vkh::memoryAllocateInfo(size, memoryType);
+		VkResult res = vkAllocateMemory(state.context->device, &allocInfo, nullptr, &memory);
+
+		checkf(res != VK_ERROR_OUT_OF_DEVICE_MEMORY, "Out of device memory");
+		checkf(res != VK_ERROR_TOO_MANY_OBJECTS, "Attempting to create too many allocations");
+		checkf(res == VK_SUCCESS, "Error allocating memory in block allocator");
+
+		state.driverAllocs++;
+		state.memTypeAllocSizes[memoryType] += size;
+		return memory;
+	}
+
+	void freeDriverMemory(VkDeviceMemory memory, VkDeviceSize size, uint32_t memoryType)
+	{
+		vkFreeMemory(state.context->device, memory, nullptr);
+		state.driverAllocs--;
+		state.memTypeAllocSizes[memoryType] -= size;
+	}
+
+	uint32_t newBlock(uint32_t memoryType)
+	{
+		MemoryBlock block = {};
+		block.handle = allocDriverMemory(BLOCK_ALLOCATOR_BLOCK_SIZE, memoryType);
+		block.type = memoryType;
+		block.size = BLOCK_ALLOCATOR_BLOCK_SIZE;
+		block.freeRanges.push_back({ 0, block.size });
+
+		for (uint32_t i = 0; i < state.blocks.size(); ++i)
+		{
+			if (state.blocks[i].handle == VK_NULL_HANDLE)
+			{
+				state.blocks[i] = block;
+				return i;
+			}
+		}
+
+		state.blocks.push_back(block);
+		return static_cast<uint32_t>(state.blocks.size() - 1);
+	}
+
+	uint32_t newSubAllocation()
+	{
+		if (state.freeSubAllocs.size() > 0)
+		{
+			uint32_t id = state.freeSubAllocs.back();
+			state.freeSubAllocs.pop_back();
+			return id;
+		}
+
+		state.subAllocs.push_back({});
+		return static_cast<uint32_t>(state.subAllocs.size() - 1);
+	}
+
+	bool allocFromBlock(uint32_t blockIdx, VkDeviceSize size, VkDeviceSize alignment, VkDeviceSize& outOffset)
+	{
+		MemoryBlock& block = state.blocks[blockIdx];
+		if (block.size - block.used < size) return false;
+		if (!allocFromRanges(block.freeRanges, size, alignment, outOffset)) return false;
+
+		block.used += size;
+		block.liveCount++;
+		return true;
+	}
+
+	bool isHostVisibleType(uint32_t memoryType)
+	{
+		return (state.context->gpu.memProps.memoryTypes[memoryType].propertyFlags & VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT) != 0;
+	}
+
+	void alloc(Allocation& outAlloc, AllocationCreateInfo createInfo)
+	{
+		uint32_t id = newSubAllocation();
+		SubAllocation& sub = state.subAllocs[id];
+		sub = {};
+		sub.live = true;
+
+		outAlloc.type = createInfo.memoryTypeIndex;
+		outAlloc.id = id;
+		outAlloc.size = createInfo.size;
+		outAlloc.context = state.context;
+
+		if (isHostVisibleType(createInfo.memoryTypeIndex) || createInfo.size >= BLOCK_ALLOCATOR_DEDICATED_SIZE)
+		{
+			sub.block = UINT32_MAX;
+			sub.offset = 0;
+			sub.size = createInfo.size;
+
+			outAlloc.handle = allocDriverMemory(createInfo.size, createInfo.memoryTypeIndex);
+			outAlloc.offset = 0;
+			return;
+		}
+
+		//rounding both ends to the granularity means a linear resource never shares a page with an optimal one
+		VkDeviceSize alignment = std::max(std::max(createInfo.alignment, state.granularity), (VkDeviceSize)1);
+		VkDeviceSize size = alignUp(createInfo.size, state.granularity);
+
+		uint32_t blockIdx = UINT32_MAX;
+		VkDeviceSize offset = 0;
+		for (uint32_t i = 0; i < state.blocks.size(); ++i)
+		{
+			const MemoryBlock& block = state.blocks[i];
+			if (block.handle == VK_NULL_HANDLE || block.type != createInfo.memoryTypeIndex || block.evacuating) continue;
+
+			if (allocFromBlock(i, size, alignment, offset))
+			{
+				blockIdx = i;
+				break;
+			}
+		}
+
+		if (blockIdx == UINT32_MAX)
+		{
+			blockIdx = newBlock(createInfo.memoryTypeIndex);
+			bool fits = allocFromBlock(blockIdx, size, alignment, offset);
+			checkf(fits, "Allocation doesn't fit in an empty block");
+		}
+
+		sub.block = blockIdx;
+		sub.offset = offset;
+		sub.size = size;
+		sub.alignment = alignment;
+
+		outAlloc.handle = state.blocks[blockIdx].handle;
+		outAlloc.offset = offset;
+	}
+
+	void free(Allocation& allocation)
+	{
+		SubAllocation& sub = state.subAllocs[allocation.id];
+		checkf(sub.live, "Freeing an allocation that isn't live");
+
+		if (sub.block == UINT32_MAX)
+		{
+			freeDriverMemory(allocation.handle, sub.size, allocation.type);
+		}
+		else
+		{
+			MemoryBlock& block = state.blocks[sub.block];
+			freeToRanges(block.freeRanges, sub.offset, sub.size);
+			block.used -= sub.size;
+			block.liveCount--;
+
+			if (block.liveCount == 0)
+			{
+				freeDriverMemory(block.handle, block.size, block.type);
+				block.handle = VK_NULL_HANDLE;
+				block.freeRanges.clear();
+				block.evacuating = false;
+				state.stats.blocksReleased++;
+			}
+		}
+
+		sub = {};
+		state.freeSubAllocs.push_back(allocation.id);
+	}
+
+	size_t allocatedSize(uint32_t memoryType)
+	{
+		return state.memTypeAllocSizes[memoryType];
+	}
+
+	//driver allocations, not how many allocations have been handed out
+	uint32_t numAllocs()
+	{
+		return state.driverAllocs;
+	}
+
+	//MOVABLE ALLOCATIONS
+
+	//alloc has to stay at the same address for as long as it's registered, and the buffer has to be usable as both
+	//a transfer source and destination. Only buffers that the gpu reads, or that are written by uploads, can be moved:
+	//copies are made on the transfer queue, which doesn't wait for anything the graphics queue writes
+	void registerMovableBuffer(Allocation* alloc, VkBuffer* buffer, VkDeviceSize size, VkBufferUsageFlags usage, OnMovedFn onMoved, void* userData)
+	{
+		checkf((usage & VK_BUFFER_USAGE_TRANSFER_SRC_BIT) && (usage & VK_BUFFER_USAGE_TRANSFER_DST_BIT), "Movable buffers need to be transfer sources and destinations");
+
+		Movable& movable = state.subAllocs[alloc->id].movable;
+		movable = {};
+		movable.type = EMovableType::Buffer;
+		movable.owner = alloc;
+		movable.onMoved = onMoved;
+		movable.userData = userData;
+		movable.buffer = buffer;
+		movable.bufferSize = size;
+		movable.bufferUsage = usage;
+	}
+
+	//imageInfo is what the image was created with, and needs the transfer src and dst usage bits. layout is the layout
+	//the image is kept in between uses, the moved image is left in it too
+	void registerMovableImage(Allocation* alloc, VkImage* image, VkImageView* view, const VkImageCreateInfo& imageInfo, VkImageLayout layout, VkImageAspectFlags aspect, OnMovedFn onMoved, void* userData)
+	{
+		checkf((imageInfo.usage & VK_IMAGE_USAGE_TRANSFER_SRC_BIT) && (imageInfo.usage & VK_IMAGE_USAGE_TRANSFER_DST_BIT), "Movable images need to be transfer sources and destinations");
+		checkf(imageInfo.imageType == VK_IMAGE_TYPE_2D && imageInfo.arrayLayers == 1, "Only single layer 2D images can be moved");
+
+		Movable& movable = state.subAllocs[alloc->id].movable;
+		movable = {};
+		movable.type = EMovableType::Image;
+		movable.owner = alloc;
+		movable.onMoved = onMoved;
+		movable.userData = userData;
+		movable.image = image;
+		movable.view = view;
+		movable.imageInfo = imageInfo;
+		movable.imageInfo.pQueueFamilyIndices = nullptr;
+		movable.imageInfo.queueFamilyIndexCount = 0;
+		movable.imageInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+		movable.layout = layout;
+		movable.aspect = aspect;
+	}
+
+	//call this before destroying a movable resource (or queueing it up for destruction), so it doesn't get moved
+	//in the meantime
+	void unregisterMovable(const Allocation& alloc)
+	{
+		state.subAllocs[alloc.id].movable = {};
+	}
+
+	//DEFRAGMENTATION
+
+	bool moreUsedBlock(uint32_t a, uint32_t b)
+	{
+		return state.blocks[a].used > state.blocks[b].used;
+	}
+
+	bool lessUsedBlock(uint32_t a, uint32_t b)
+	{
+		return state.blocks[a].used < state.blocks[b].used;
+	}
+
+	//the most used block of a type that size fits in, so moved allocations fill up blocks that are already dense
+	bool allocFromDensestBlock(uint32_t memoryType, VkDeviceSize size, VkDeviceSize alignment, uint32_t& outBlock, VkDeviceSize& outOffset)
+	{
+		std::vector<uint32_t> byUsage;
+		for (uint32_t i = 0; i < state.blocks.size(); ++i)
+		{
+			const MemoryBlock& block = state.blocks[i];
+			if (block.handle == VK_NULL_HANDLE || block.type != memoryType || block.evacuating) continue;
+			byUsage.push_back(i);
+		}
+
+		std::sort(byUsage.begin(), byUsage.end(), moreUsedBlock);
+
+		for (uint32_t i = 0; i < byUsage.size(); ++i)
+		{
+			if (allocFromBlock(byUsage[i], size, alignment, outOffset))
+			{
+				outBlock = byUsage[i];
+				return true;
+			}
+		}
+
+		return false;
+	}
+
+	//blocks that are worth emptying, least used first. A block with anything in it that can't move would never
+	//empty out, so it's left alone
+	void findSparseBlocks(std::vector<uint32_t>& outBlocks)
+	{
+		for (uint32_t i = 0; i < state.blocks.size(); ++i)
+		{
+			const MemoryBlock& block = state.blocks[i];
+			if (block.handle == VK_NULL_HANDLE || block.used >= (VkDeviceSize)(block.size * DEFRAG_SPARSE_BLOCK_RATIO)) continue;
+			outBlocks.push_back(i);
+		}
+
+		for (uint32_t i = 0; i < state.subAllocs.size(); ++i)
+		{
+			const SubAllocation& sub = state.subAllocs[i];
+			if (!sub.live || sub.block == UINT32_MAX || sub.movable.type != EMovableType::None) continue;
+
+			outBlocks.erase(std::remove(outBlocks.begin(), outBlocks.end(), sub.block), outBlocks.end());
+		}
+
+		std::sort(outBlocks.begin(), outBlocks.end(), lessUsedBlock);
+	}
+
+	void imageBarrier(VkCommandBuffer commandBuffer, VkImage image, const Movable& movable, VkImageLayout oldLayout, VkImageLayout newLayout,
+		VkAccessFlags srcAccess, VkAccessFlags dstAccess, VkPipelineStageFlags srcStage, VkPipelineStageFlags dstStage)
+	{
+		VkImageMemoryBarrier barrier = {};
+		barrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
+		barrier.oldLayout = oldLayout;
+		barrier.newLayout = newLayout;
+		barrier.srcAccessMask = srcAccess;
+		barrier.dstAccessMask = dstAccess;
+		barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+		barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+		barrier.image = image;
+		barrier.subresourceRange.aspectMask = movable.aspect;
+		barrier.subresourceRange.baseMipLevel = 0;
+		barrier.subresourceRange.levelCount = movable.imageInfo.mipLevels;
+		barrier.subresourceRange.baseArrayLayer = 0;
+		barrier.subresourceRange.layerCount = 1;
+
+		vkCmdPipelineBarrier(commandBuffer, srcStage, dstStage, 0, 0, nullptr, 0, nullptr, 1, &barrier);
+	}
+
+	void recordBufferMove(const Movable& movable, VkBuffer newBuffer, VkCommandBuffer commandBuffer)
+	{
+		VkBufferCopy region = {};
+		region.size = movable.bufferSize;
+		vkCmdCopyBuffer(commandBuffer, *movable.buffer, newBuffer, 1, &region);
+	}
+
+	void recordImageMove(const Movable& movable, VkImage newImage, VkCommandBuffer commandBuffer)
+	{
+		VkImage oldImage = *movable.image;
+
+		imageBarrier(commandBuffer, oldImage, movable, movable.layout, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL,
+			VK_ACCESS_MEMORY_WRITE_BIT, VK_ACCESS_TRANSFER_READ_BIT, VK_PIPELINE_STAGE_ALL_COMMANDS_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT);
+		imageBarrier(commandBuffer, newImage, movable, VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
+			0, VK_ACCESS_TRANSFER_WRITE_BIT, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT);
+
+		std::vector<VkImageCopy> regions(movable.imageInfo.mipLevels);
+		for (uint32_t mip = 0; mip < movable.imageInfo.mipLevels; ++mip)
+		{
+			VkImageCopy& region = regions[mip];
+			region = {};
+			region.srcSubresource.aspectMask = movable.aspect;
+			region.srcSubresource.mipLevel = mip;
+			region.srcSubresource.layerCount = 1;
+			region.dstSubresource = region.srcSubresource;
+			region.extent.width = std::max(movable.imageInfo.extent.width >> mip, 1u);
+			region.extent.height = std::max(movable.imageInfo.extent.height >> mip, 1u);
+			region.extent.depth = 1;
+		}
+
+		vkCmdCopyImage(commandBuffer, oldImage, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL, newImage, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
+			static_cast<uint32_t>(regions.size()), regions.data());
+
+		//anything submitted after this on the graphics queue can read the new image straight away
+		imageBarrier(commandBuffer, newImage, movable, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, movable.layout,
+			VK_ACCESS_TRANSFER_WRITE_BIT, VK_ACCESS_MEMORY_READ_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_ALL_COMMANDS_BIT);
+	}
+
+	//a move that's been recorded, but not submitted yet
+	struct PendingMove
+	{
+		uint32_t		subId;
+		Allocation		oldAlloc;
+		VkBuffer		oldBuffer;
+		VkImage			oldImage;
+		VkImageView		oldView;
+	};
+
+	//the copies from one defragment() call, the command buffers are only begun once something needs them
+	struct MoveCommands
+	{
+		VkhCommandBuffer	transfer;
+		VkhCommandBuffer	graphics;
+		bool				recordedTransfer;
+		bool				recordedGraphics;
+	};
+
+	//moves a sub allocation into another block, returns false if no other block has room for it
+	bool moveSubAllocation(uint32_t subId, MoveCommands& cmds, std::vector<PendingMove>& outMoves)
+	{
+		VkhContext& ctxt = *state.context;
+		SubAllocation sub = state.subAllocs[subId];
+		Movable movable = sub.movable;
+		Allocation& owner = *movable.owner;
+
+		//the new resource is created the same way as the old one, so it has the same size and alignment requirements
+		uint32_t dstBlock;
+		VkDeviceSize dstOffset;
+		if (!allocFromDensestBlock(owner.type, sub.size, sub.alignment, dstBlock, dstOffset)) return false;
+
+		uint32_t newId = newSubAllocation();
+		SubAllocation& newSub = state.subAllocs[newId];
+		newSub.live = true;
+		newSub.block = dstBlock;
+		newSub.offset = dstOffset;
+		newSub.size = sub.size;
+		newSub.alignment = sub.alignment;
+
+		Allocation newAlloc = owner;
+		newAlloc.id = newId;
+		newAlloc.handle = state.blocks[dstBlock].handle;
+		newAlloc.offset = dstOffset;
+
+		PendingMove move = {};
+		move.subId = newId;
+		move.oldAlloc = owner;
+
+		if (movable.type == EMovableType::Buffer)
+		{
+			VkBuffer newBuffer;
+			createBufferHandle(newBuffer, movable.bufferSize, movable.bufferUsage, ctxt);
+			vkBindBufferMemory(ctxt.device, newBuffer, newAlloc.handle, newAlloc.offset);
+
+			if (!cmds.recordedTransfer)
+			{
+				cmds.transfer = beginScratchCommandBuffer(ECommandPoolType::Transfer, ctxt);
+				cmds.recordedTransfer = true;
+
+				//uploads earlier on the transfer queue might not have landed yet
+				VkMemoryBarrier barrier = {};
+				barrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+				barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+				barrier.dstAccessMask = VK_ACCESS_TRANSFER_READ_BIT;
+				vkCmdPipelineBarrier(cmds.transfer.buffer, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT, 0, 1, &barrier, 0, nullptr, 0, nullptr);
+			}
+
+			recordBufferMove(movable, newBuffer, cmds.transfer.buffer);
+			move.oldBuffer = *movable.buffer;
+			*movable.buffer = newBuffer;
+		}
+		else
+		{
+			VkImage newImage;
+			VkResult res = vkCreateImage(ctxt.device, &movable.imageInfo, nullptr, &newImage);
+			checkf(res == VK_SUCCESS, "Error creating image to move into");
+			vkBindImageMemory(ctxt.device, newImage, newAlloc.handle, newAlloc.offset);
+
+			if (!cmds.recordedGraphics)
+			{
+				cmds.graphics = beginScratchCommandBuffer(ECommandPoolType::Graphics, ctxt);
+				cmds.recordedGraphics = true;
+			}
+
+			recordImageMove(movable, newImage, cmds.graphics.buffer);
+
+			move.oldImage = *movable.image;
+			move.oldView = movable.view ? *movable.view : VK_NULL_HANDLE;
+			*movable.image = newImage;
+
+			if (movable.view)
+			{
+				createImageView(*movable.view, movable.imageInfo.format, movable.aspect, movable.imageInfo.mipLevels, newImage, ctxt.device);
+			}
+		}
+
+		//the old allocation stays live until the deletion queue frees it, but it isn't movable any more
+		owner = newAlloc;
+		state.subAllocs[newId].movable = movable;
+		state.subAllocs[subId].movable = {};
+
+		state.stats.moves++;
+		state.stats.bytesMoved += sub.size;
+		outMoves.push_back(move);
+		return true;
+	}
+
+	//moves allocations out of sparsely used blocks until there's nothing left to move or budgetMs has gone by,
+	//so it can be called once a frame without causing a hitch. Buffers are copied on the transfer queue and
+	//images on the graphics queue, since they aren't shared between queue families. The old resources and their
+	//memory go through the deletion queue, and their blocks are freed once the last of them is gone.
+	//Returns whether it stopped with work left to do
+	bool defragment(VkhContext& ctxt, double budgetMs)
+	{
+		double start = OS::getMilliseconds();
+
+		std::vector<uint32_t> sparseBlocks;
+		findSparseBlocks(sparseBlocks);
+		if (sparseBlocks.size() == 0) return false;
+
+		//sparse blocks can be filled up from even sparser ones, but anything that's had allocations moved into it
+		//isn't emptied again in the same pass
+		std::vector<bool> receivedMoves(state.blocks.size(), false);
+
+		MoveCommands cmds = {};
+		std::vector<PendingMove> moves;
+		bool outOfTime = false;
+
+		//a linear search for each block's allocations, which is fine for the number of allocations the demos have
+		for (uint32_t i = 0; i < sparseBlocks.size() && !outOfTime; ++i)
+		{
+			uint32_t blockIdx = sparseBlocks[i];
+			if (receivedMoves[blockIdx]) continue;
+
+			state.blocks[blockIdx].evacuating = true;
+
+			for (uint32_t subId = 0; subId < state.subAllocs.size(); ++subId)
+			{
+				const SubAllocation& sub = state.subAllocs[subId];
+				if (!sub.live || sub.block != blockIdx || sub.movable.type == EMovableType::None) continue;
+
+				//nowhere to put it, so the rest of this block won't fit either
+				if (!moveSubAllocation(subId, cmds, moves)) break;
+				receivedMoves[state.subAllocs[moves.back().subId].block] = true;
+
+				if (OS::getMilliseconds() - start > budgetMs)
+				{
+					outOfTime = true;
+					break;
+				}
+			}
+
+			state.blocks[blockIdx].evacuating = false;
+		}
+
+		if (cmds.recordedTransfer)
+		{
+			uint64_t transferValue = submitScratchCommandBufferAsync(cmds.transfer);
+			Timeline::markUpload(ECommandPoolType::Transfer, transferValue);
+		}
+
+		if (cmds.recordedGraphics)
+		{
+			submitScratchCommandBufferAsync(cmds.graphics);
+		}
+
+		//frames already in flight still use the old resources. The next frame waits for the transfer copies (they're
+		//marked as an upload) and comes after the graphics copies, so once it's done nothing uses them any more
+		uint64_t lastUse = Timeline::nextValue(ECommandPoolType::Graphics);
+
+		for (uint32_t i = 0; i < moves.size(); ++i)
+		{
+			const PendingMove& move = moves[i];
+			if (move.oldBuffer) DeletionQueue::destroyBuffer(move.oldBuffer, move.oldAlloc, ECommandPoolType::Graphics, lastUse);
+			else DeletionQueue::destroyImage(move.oldImage, move.oldView, move.oldAlloc, ECommandPoolType::Graphics, lastUse);
+
+			const Movable& movable = state.subAllocs[move.subId].movable;
+			if (movable.onMoved) movable.onMoved(*movable.owner, movable.userData);
+		}
+
+		return outOfTime;
+	}
+
+	//returns the totals since the last call
+	DefragStats consumeDefragStats()
+	{
+		DefragStats stats = state.stats;
+		state.stats = {};
+		return stats;
+	}
+
+	//how much of the memory in blocks is being used, between 0 and 1
+	float blockUsage()
+	{
+		VkDeviceSize used = 0;
+		VkDeviceSize total = 0;
+		for (uint32_t i = 0; i < state.blocks.size(); ++i)
+		{
+			if (state.blocks[i].handle == VK_NULL_HANDLE) continue;
+			used += state.blocks[i].used;
+			total += state.blocks[i].size;
+		}
+
+		return total > 0 ? (float)used / (float)total : 1.0f;
+	}
+}
@@ -0,0 +1,302 @@
+#pragma once
+#include <glm/glm.hpp>
+#include <stdint.h>
+#include <string.h>
+#include <tuple>
+
+//Works out where glsl puts each member of a uniform (std140) or storage / push constant (std430) block at compile time,
+//from the list of c++ types the members are written from, instead of padding a c++ struct by hand until it matches:
+//
+//	typedef vkh::Std140Block<float, glm::vec4, int32_t> MyBlock;
+//	static_assert(MyBlock::offset(1) == 16, "...");
+//	vkh::writeBlock<MyBlock>(mapped, 1.0f, glm::vec4(1.0f), 2);
+//
+//writeBlock copies each value straight to its offset in one pass, so it can write into mapped memory, and
+//writeBlockElement does the same for an entry in an array of blocks. Padding bytes are never written to.
+//
+//The Packed versions order the members to waste as little space on padding as they can, eg: a float, vec4, int block
+//takes 48 bytes as an std140 array element in that order, but 32 as vec4, float, int. The shader has to declare the
+//members in the packed order (declarationIndex gives it), so they're only for blocks whose glsl can change to match.
+//Values are still passed to writeBlock in the order they're listed in the type.
+//
+//Members can be 32 bit scalars, glm vectors of them, mat3 / mat4 (column major) and fixed size arrays of any of those
+
+namespace vkh
+{
+	enum class EBlockPacking : uint8_t
+	{
+		Std140,
+		Std430
+	};
+
+	enum class EBlockOrder : uint8_t
+	{
+		Declared,
+		Packed
+	};
+
+	constexpr uint32_t alignBlockOffset(uint32_t offset, uint32_t alignment)
+	{
+		return (offset + alignment - 1) & ~(alignment - 1);
+	}
+
+	//not defined for anything glsl doesn't have a matching type for, so those fail to compile
+	template<EBlockPacking P, typename T>
+	struct BlockMember;
+
+	//the same in both packings. 3 component vectors align like 4 component ones, but only take 12 bytes, so a scalar
+	//can go straight after one
+	template<typename T, uint32_t Size, uint32_t Alignment>
+	struct BlockVectorMember
+	{
+		static constexpr uint32_t size = Size;
+		static constexpr uint32_t alignment = Alignment;
+
+		static void write(char* dst, const T& value)
+		{
+			memcpy(dst, &value, Size);
+		}
+	};
+
+	template<EBlockPacking P> struct BlockMember<P, float> : BlockVectorMember<float, 4, 4> {};
+	template<EBlockPacking P> struct BlockMember<P, int32_t> : BlockVectorMember<int32_t, 4, 4> {};
+	template<EBlockPacking P> struct BlockMember<P, uint32_t> : BlockVectorMember<uint32_t, 4, 4> {};
+	template<EBlockPacking P> struct BlockMember<P, glm::vec2> : BlockVectorMember<glm::vec2, 8, 8> {};
+	template<EBlockPacking P> struct BlockMember<P, glm::ivec2> : BlockVectorMember<glm::ivec2, 8, 8> {};
+	template<EBlockPacking P> struct BlockMember<P, glm::uvec2> : BlockVectorMember<glm::uvec2, 8, 8> {};
+	template<EBlockPacking P> struct BlockMember<P, glm::vec3> : BlockVectorMember<glm::vec3, 12, 16> {};
+	template<EBlockPacking P> struct BlockMember<P, glm::ivec3> : BlockVectorMember<glm::ivec3, 12, 16> {};
+	template<EBlockPacking P> struct BlockMember<P, glm::uvec3> : BlockVectorMember<glm::uvec3, 12, 16> {};
+	template<EBlockPacking P> struct BlockMember<P, glm::vec4> : BlockVectorMember<glm::vec4, 16, 16> {};
+	template<EBlockPacking P> struct BlockMember<P, glm::ivec4> : BlockVectorMember<glm::ivec4, 16, 16> {};
+	template<EBlockPacking P> struct BlockMember<P, glm::uvec4> : BlockVectorMember<glm::uvec4, 16, 16> {};
+
+	//matrices are arrays of column vectors, and vec3 columns are padded out to 16 bytes in both packings
+	template<EBlockPacking P>
+	struct BlockMember<P, glm::mat3>
+	{
+		static constexpr uint32_t size = 48;
+		static constexpr uint32_t alignment = 16;
+
+		static void write(char* dst, const glm::mat3& value)
+		{
+			for (uint32_t c = 0; c < 3; ++c)
+			{
+				memcpy(dst + c * 16, &value[c], sizeof(glm::vec3));
+			}
+		}
+	};
+
+	template<EBlockPacking P> struct BlockMember<P, glm::mat4> : BlockVectorMember<glm::mat4, 64, 16> {};
+
+	//std140 rounds every array element up to 16 bytes, so a float[4] takes 64 bytes in a uniform block but 16 in a storage block
+	template<EBlockPacking P, typename T, size_t N>
+	struct BlockMember<P, T[N]>
+	{
+		typedef BlockMember<P, T> Element;
+
+		static constexpr uint32_t alignment = P == EBlockPacking::Std140 ? alignBlockOffset(Element::alignment, 16) : Element::alignment;
+		static constexpr uint32_t stride = alignBlockOffset(Element::size, alignment);
+		static constexpr uint32_t size = stride * static_cast<uint32_t>(N);
+
+		static void write(char* dst, const T (&value)[N])
+		{
+			for (uint32_t i = 0; i < N; ++i)
+			{
+				Element::write(dst + i * stride, value[i]);
+			}
+		}
+	};
+
+	//everything below is a single return statement, recursing instead of looping, since VS2015 only has C++11 constexpr
+
+	//member sizes and alignments, looked up by the member's index in the type
+	template<EBlockPacking P, typename... Members>
+	struct BlockMemberList;
+
+	template<EBlockPacking P>
+	struct BlockMemberList<P>
+	{
+		static constexpr uint32_t size(uint32_t) { return 0; }
+		static constexpr uint32_t alignment(uint32_t) { return 0; }
+		static constexpr uint32_t maxAlignment() { return 0; }
+	};
+
+	template<EBlockPacking P, typename First, typename... Rest>
+	struct BlockMemberList<P, First, Rest...>
+	{
+		typedef BlockMemberList<P, Rest...> Next;
+
+		static constexpr uint32_t size(uint32_t member)
+		{
+			return member == 0 ? BlockMember<P, First>::size : Next::size(member - 1);
+		}
+
+		static constexpr uint32_t alignment(uint32_t member)
+		{
+			return member == 0 ? BlockMember<P, First>::alignment : Next::alignment(member - 1);
+		}
+
+		static constexpr uint32_t maxAlignment()
+		{
+			return BlockMember<P, First>::alignment > Next::maxAlignment() ? BlockMember<P, First>::alignment : Next::maxAlignment();
+		}
+	};
+
+	template<EBlockPacking P, typename... Members>
+	constexpr uint32_t blockMemberSize(uint32_t member)
+	{
+		return BlockMemberList<P, Members...>::size(member);
+	}
+
+	template<EBlockPacking P, typename... Members>
+	constexpr uint32_t blockMemberAlignment(uint32_t member)
+	{
+		return BlockMemberList<P, Members...>::alignment(member);
+	}
+
+	//Packed blocks are filled greedily, taking whichever member needs the least padding to go next, the most strictly
+	//aligned one out of those, and then the first one listed. placed has a bit set for every member already in the block
+	template<EBlockPacking P, typename... Members>
+	struct BlockPacker
+	{
+		typedef BlockMemberList<P, Members...> List;
+		static constexpr uint32_t count = sizeof...(Members);
+		static_assert(count <= 32, "Packed blocks can have at most 32 members");
+
+		static constexpr uint32_t padding(uint32_t offset, uint32_t member)
+		{
+			return alignBlockOffset(offset, List::alignment(member)) - offset;
+		}
+
+		static constexpr bool better(uint32_t offset, uint32_t member, uint32_t best)
+		{
+			return best == count || padding(offset, member) < padding(offset, best) ||
+				(padding(offset, member) == padding(offset, best) && List::alignment(member) > List::alignment(best));
+		}
+
+		//the member to place next, out of member and the ones listed after it
+		static constexpr uint32_t pick(uint32_t placed, uint32_t offset, uint32_t member, uint32_t best)
+		{
+			return member == count ? best :
+				(placed & (1u << member)) ? pick(placed, offset, member + 1, best) :
+				pick(placed, offset, member + 1, better(offset, member, best) ? member : best);
+		}
+
+		static constexpr uint32_t memberEnd(uint32_t offset, uint32_t member)
+		{
+			return alignBlockOffset(offset, List::alignment(member)) + List::size(member);
+		}
+
+		static constexpr uint32_t declarationIndexAt(uint32_t position, uint32_t p, uint32_t placed, uint32_t offset, uint32_t member)
+		{
+			return p == position ? member : declarationIndex(position, p + 1, placed | (1u << member), memberEnd(offset, member));
+		}
+
+		static constexpr uint32_t declarationIndex(uint32_t position, uint32_t p, uint32_t placed, uint32_t offset)
+		{
+			return p >= count ? count : declarationIndexAt(position, p, placed, offset, pick(placed, offset, 0, count));
+		}
+	};
+
+	//which member goes at a position in the block, see BlockPacker for the order packed blocks use
+	template<EBlockPacking P, EBlockOrder O, typename... Members>
+	constexpr uint32_t blockDeclarationIndex(uint32_t position)
+	{
+		return O == EBlockOrder::Declared ? position : BlockPacker<P, Members...>::declarationIndex(position, 0, 0, 0);
+	}
+
+	template<EBlockPacking P, EBlockOrder O, typename... Members>
+	struct BlockOffsets
+	{
+		typedef BlockMemberList<P, Members...> List;
+		static constexpr uint32_t count = sizeof...(Members);
+
+		static constexpr uint32_t offsetAt(uint32_t member, uint32_t p, uint32_t offset, uint32_t idx)
+		{
+			return idx == member ? alignBlockOffset(offset, List::alignment(idx)) :
+				offsetFrom(member, p + 1, alignBlockOffset(offset, List::alignment(idx)) + List::size(idx));
+		}
+
+		//walks the members in declaration order from position p, which starts at offset
+		static constexpr uint32_t offsetFrom(uint32_t member, uint32_t p, uint32_t offset)
+		{
+			return p == count ? offset : offsetAt(member, p, offset, blockDeclarationIndex<P, O, Members...>(p));
+		}
+	};
+
+	//passing the member count gives where the last member ends
+	template<EBlockPacking P, EBlockOrder O, typename... Members>
+	constexpr uint32_t blockMemberOffset(uint32_t member)
+	{
+		return BlockOffsets<P, O, Members...>::offsetFrom(member, 0, 0);
+	}
+
+	//std140 also rounds a block's alignment up to 16 bytes, which is what makes its array strides a multiple of 16
+	template<EBlockPacking P, typename... Members>
+	constexpr uint32_t blockAlignment()
+	{
+		return BlockMemberList<P, Members...>::maxAlignment() > (P == EBlockPacking::Std140 ? 16u : 4u) ?
+			BlockMemberList<P, Members...>::maxAlignment() : (P == EBlockPacking::Std140 ? 16u : 4u);
+	}
+
+	template<EBlockPacking P, EBlockOrder O, typename... Members>
+	struct BlockLayout
+	{
+		static_assert(sizeof...(Members) > 0, "Blocks need at least one member");
+
+		static constexpr EBlockPacking packing = P;
+		static constexpr uint32_t memberCount = sizeof...(Members);
+
+		//size is where the last member ends, stride is how far apart the blocks are in an array of them
+		static constexpr uint32_t size = blockMemberOffset<P, O, Members...>(sizeof...(Members));
+		static constexpr uint32_t alignment = blockAlignment<P, Members...>();
+		static constexpr uint32_t stride = alignBlockOffset(size, alignment);
+
+		//members are numbered in the order they're listed in the type
+		static constexpr uint32_t offset(uint32_t member)
+		{
+			return blockMemberOffset<P, O, Members...>(member);
+		}
+
+		//the member the shader has to declare at each position, only different from position for packed blocks
+		static constexpr uint32_t declarationIndex(uint32_t position)
+		{
+			return blockDeclarationIndex<P, O, Members...>(position);
+		}
+
+		template<uint32_t I>
+		using MemberType = typename std::tuple_element<I, std::tuple<Members...>>::type;
+	};
+
+	template<typename... Members> using Std140Block = BlockLayout<EBlockPacking::Std140, EBlockOrder::Declared, Members...>;
+	template<typename... Members> using Std430Block = BlockLayout<EBlockPacking::Std430, EBlockOrder::Declared, Members...>;
+	template<typename... Members> using PackedStd140Block = BlockLayout<EBlockPacking::Std140, EBlockOrder::Packed, Members...>;
+	template<typename... Members> using PackedStd430Block = BlockLayout<EBlockPacking::Std430, EBlockOrder::Packed, Members...>;
+
+	template<uint32_t... I> struct BlockMemberIndices {};
+	template<uint32_t N, uint32_t... I> struct MakeBlockMemberIndices : MakeBlockMemberIndices<N - 1, N - 1, I...> {};
+	template<uint32_t... I> struct MakeBlockMemberIndices<0, I...> { typedef BlockMemberIndices<I...> type; };
+
+	template<typename Layout, uint32_t... I, typename... Values>
+	void writeBlockMembers(char* dst, BlockMemberIndices<I...>, const Values&... values)
+	{
+		//the offsets are forced to compile time constants, so all that's left is the copies
+		int expand[] = { (BlockMember<Layout::packing, typename Layout::template MemberType<I>>::write(dst + std::integral_constant<uint32_t, Layout::offset(I)>::value, values), 0)... };
+		(void)expand;
+	}
+
+	//values go in the order the members are listed in the layout type
+	template<typename Layout, typename... Values>
+	void writeBlock(void* dst, const Values&... values)
+	{
+		static_assert(sizeof...(Values) == Layout::memberCount, "writeBlock needs a value for every member of the block");
+		writeBlockMembers<Layout>(static_cast<char*>(dst), typename MakeBlockMemberIndices<sizeof...(Values)>::type(), values...);
+	}
+
+	template<typename Layout, typename... Values>
+	void writeBlockElement(void* dst, uint32_t element, const Values&... values)
+	{
+		writeBlock<Layout>(static_cast<char*>(dst) + element * Layout::stride, values...);
+	}
+}
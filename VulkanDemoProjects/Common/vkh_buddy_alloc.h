@@ -0,0 +1,392 @@
+#pragma once
+#include <stdint.h>
+#include <vector>
+#include "vkh.h"
+#include "vkh_types.h"
+#include "vkh_initializers.h"
+
+//Buddy allocator, for when most allocations are power of two sized, like textures. Each heap is a power of two sized
+//VkDeviceMemory that's split in half, and in half again, until there's a block that fits the allocation. Allocating
+//and freeing are both O(log n), and a freed block merges with its buddy straight away if that's free too, so a heap
+//never ends up with two free halves of the same block. The price is that every allocation is rounded up to a power
+//of two, which is nothing for power of two textures but can waste nearly half of anything else.
+//
+//BuddyHeap is the algorithm on its own. It hands out ranges of [0, size) and knows nothing about vulkan, so it can be
+//tested and benchmarked without a gpu (see vkh_alloc_bench.h). The allocator interface below puts one in each
+//VkDeviceMemory heap. Like the block allocator, host visible memory and big allocations get memory of their own
+
+//size of each heap, has to be a power of two
+#define BUDDY_HEAP_SIZE (64 * 1024 * 1024)
+
+//the smallest block handed out, anything smaller is rounded up to it
+#define BUDDY_MIN_BLOCK_SIZE (4 * 1024)
+
+//allocations bigger than this get their own memory
+#define BUDDY_DEDICATED_SIZE (BUDDY_HEAP_SIZE / 2)
+
+namespace vkh::allocators::buddy
+{
+	const uint32_t BUDDY_NO_NODE = UINT32_MAX;
+
+	//unused nodes are inside an allocated block or a free block that hasn't been split
+	enum class EBuddyNode : uint8_t
+	{
+		Unused,
+		Free,
+		Split,
+		Allocated
+	};
+
+	struct BuddyHeap
+	{
+		VkDeviceSize			size;
+		VkDeviceSize			minBlockSize;
+
+		//level 0 is the whole heap, the last level is blocks of minBlockSize
+		uint32_t				levelCount;
+
+		//an implicit binary tree, node i's children are 2i + 1 and 2i + 2, and level l starts at node 2^l - 1
+		std::vector<EBuddyNode>	nodes;
+
+		//a doubly linked list of free nodes for each level, threaded through the node indices
+		std::vector<uint32_t>	freeHeads;
+		std::vector<uint32_t>	freeNext;
+		std::vector<uint32_t>	freePrev;
+
+		//in whole blocks, so it includes what was lost to rounding up
+		VkDeviceSize			used;
+		uint32_t				liveCount;
+	};
+
+	//size and minBlockSize have to be powers of two
+	void initBuddyHeap(BuddyHeap& heap, VkDeviceSize size, VkDeviceSize minBlockSize)
+	{
+		checkf((size & (size - 1)) == 0 && (minBlockSize & (minBlockSize - 1)) == 0, "Buddy heap sizes have to be powers of two");
+		checkf(minBlockSize <= size, "Buddy heap is smaller than its smallest block");
+
+		heap.size = size;
+		heap.minBlockSize = minBlockSize;
+		heap.levelCount = 1;
+		while ((minBlockSize << (heap.levelCount - 1)) < size) heap.levelCount++;
+
+		uint32_t nodeCount = (1u << heap.levelCount) - 1;
+		heap.nodes.assign(nodeCount, EBuddyNode::Unused);
+		heap.freeHeads.assign(heap.levelCount, BUDDY_NO_NODE);
+		heap.freeNext.assign(nodeCount, BUDDY_NO_NODE);
+		heap.freePrev.assign(nodeCount, BUDDY_NO_NODE);
+		heap.used = 0;
+		heap.liveCount = 0;
+
+		heap.nodes[0] = EBuddyNode::Free;
+		heap.freeHeads[0] = 0;
+	}
+
+	inline VkDeviceSize blockSize(const BuddyHeap& heap, uint32_t level)
+	{
+		return heap.size >> level;
+	}
+
+	inline uint32_t firstNode(uint32_t level)
+	{
+		return (1u << level) - 1;
+	}
+
+	inline VkDeviceSize nodeOffset(const BuddyHeap& heap, uint32_t node, uint32_t level)
+	{
+		return (node - firstNode(level)) * blockSize(heap, level);
+	}
+
+	//the deepest level with blocks big enough for size
+	uint32_t levelForSize(const BuddyHeap& heap, VkDeviceSize size)
+	{
+		uint32_t level = heap.levelCount - 1;
+		while (level > 0 && blockSize(heap, level) < size) level--;
+		return level;
+	}
+
+	void pushFree(BuddyHeap& heap, uint32_t node, uint32_t level)
+	{
+		heap.nodes[node] = EBuddyNode::Free;
+		heap.freePrev[node] = BUDDY_NO_NODE;
+		heap.freeNext[node] = heap.freeHeads[level];
+		if (heap.freeHeads[level] != BUDDY_NO_NODE) heap.freePrev[heap.freeHeads[level]] = node;
+		heap.freeHeads[level] = node;
+	}
+
+	void removeFree(BuddyHeap& heap, uint32_t node, uint32_t level)
+	{
+		uint32_t prev = heap.freePrev[node];
+		uint32_t next = heap.freeNext[node];
+
+		if (prev != BUDDY_NO_NODE) heap.freeNext[prev] = next;
+		else heap.freeHeads[level] = next;
+
+		if (next != BUDDY_NO_NODE) heap.freePrev[next] = prev;
+		heap.nodes[node] = EBuddyNode::Unused;
+	}
+
+	//blocks are aligned to their own size, so any alignment up to size is met for free. Returns false if there's no
+	//free block big enough
+	bool buddyAlloc(BuddyHeap& heap, VkDeviceSize size, VkDeviceSize& outOffset)
+	{
+		if (size > heap.size) return false;
+
+		uint32_t level = levelForSize(heap, size);
+
+		//the smallest free block that's big enough, which gets split in half until it's the right size
+		int32_t freeLevel = static_cast<int32_t>(level);
+		while (freeLevel >= 0 && heap.freeHeads[freeLevel] == BUDDY_NO_NODE) freeLevel--;
+		if (freeLevel < 0) return false;
+
+		uint32_t node = heap.freeHeads[freeLevel];
+		removeFree(heap, node, freeLevel);
+
+		for (uint32_t l = freeLevel; l < level; ++l)
+		{
+			heap.nodes[node] = EBuddyNode::Split;
+			pushFree(heap, 2 * node + 2, l + 1);
+			node = 2 * node + 1;
+		}
+
+		heap.nodes[node] = EBuddyNode::Allocated;
+		heap.used += blockSize(heap, level);
+		heap.liveCount++;
+
+		outOffset = nodeOffset(heap, node, level);
+		return true;
+	}
+
+	//returns the size of the block that was freed
+	VkDeviceSize buddyFree(BuddyHeap& heap, VkDeviceSize offset)
+	{
+		checkf(offset < heap.size && offset % heap.minBlockSize == 0, "Freeing an offset that isn't in the buddy heap");
+
+		//the allocated block is the first one above the smallest block at offset that isn't unused
+		uint32_t level = heap.levelCount - 1;
+		uint32_t node = firstNode(level) + static_cast<uint32_t>(offset / heap.minBlockSize);
+		while (heap.nodes[node] == EBuddyNode::Unused && level > 0)
+		{
+			node = (node - 1) / 2;
+			level--;
+		}
+
+		checkf(heap.nodes[node] == EBuddyNode::Allocated, "Freeing a buddy block that isn't allocated");
+
+		VkDeviceSize freedSize = blockSize(heap, level);
+		heap.used -= freedSize;
+		heap.liveCount--;
+		heap.nodes[node] = EBuddyNode::Unused;
+
+		//merge with the buddy for as long as it's free
+		while (level > 0)
+		{
+			uint32_t buddy = (node & 1) ? node + 1 : node - 1;
+			if (heap.nodes[buddy] != EBuddyNode::Free) break;
+
+			removeFree(heap, buddy, level);
+			node = (node - 1) / 2;
+			level--;
+
+			//was split, but both of its halves are back together now
+			heap.nodes[node] = EBuddyNode::Unused;
+		}
+
+		pushFree(heap, node, level);
+		return freedSize;
+	}
+
+	//the biggest allocation that would still fit
+	VkDeviceSize largestFreeBlock(const BuddyHeap& heap)
+	{
+		for (uint32_t level = 0; level < heap.levelCount; ++level)
+		{
+			if (heap.freeHeads[level] != BUDDY_NO_NODE) return blockSize(heap, level);
+		}
+		return 0;
+	}
+
+	//handle is null for slots that have been freed and can be reused
+	struct BuddyMemory
+	{
+		VkDeviceMemory	handle;
+		uint32_t		type;
+		BuddyHeap		heap;
+	};
+
+	struct BuddyUsage
+	{
+		uint32_t		heapCount;
+
+		//what was asked for, and what it took up once it was rounded up to whole blocks
+		VkDeviceSize	requestedBytes;
+		VkDeviceSize	blockBytes;
+	};
+
+	struct AllocatorState
+	{
+		std::vector<BuddyMemory>	heaps;
+
+		//bytes taken from the driver for each memory type, heaps and dedicated allocations both
+		std::vector<size_t>			memTypeAllocSizes;
+		uint32_t					driverAllocs;
+
+		VkDeviceSize				granularity;
+		VkDeviceSize				requestedBytes;
+		VkhContext*					context;
+	};
+
+	AllocatorState state;
+
+	//ALLOCATOR INTERFACE / INSTALLATION
+	void activate(VkhContext* context);
+	void alloc(Allocation& outAlloc, AllocationCreateInfo createInfo);
+	void free(Allocation& handle);
+	size_t allocatedSize(uint32_t memoryType);
+	uint32_t numAllocs();
+
+	AllocatorInterface allocImpl = { activate, alloc, free, allocatedSize, numAllocs };
+
+	void activate(VkhContext* context)
+	{
+		context->allocator = allocImpl;
+		state.context = context;
+
+		state.heaps.clear();
+		state.memTypeAllocSizes.assign(context->gpu.memProps.memoryTypeCount, 0);
+		state.driverAllocs = 0;
+		state.granularity = context->gpu.deviceProps.limits.bufferImageGranularity;
+		state.requestedBytes = 0;
+	}
+
+	//IMPLEMENTATION
+
+	VkDeviceMemory allocDriverMemory(VkDeviceSize size, uint32_t memoryType)
+	{
+		VkDeviceMemory memory;
+		VkMemoryAllocateInfo allocInfo = vkh::memoryAllocateInfo(size, memoryType);
+		VkResult res = vkAllocateMemory(state.context->device, &allocInfo, nullptr, &memory);
+
+		checkf(res != VK_ERROR_OUT_OF_DEVICE_MEMORY, "Out of device memory");
+		checkf(res != VK_ERROR_TOO_MANY_OBJECTS, "Attempting to create too many allocations");
+		checkf(res == VK_SUCCESS, "Error allocating memory in buddy allocator");
+
+		state.driverAllocs++;
+		state.memTypeAllocSizes[memoryType] += size;
+		return memory;
+	}
+
+	void freeDriverMemory(VkDeviceMemory memory, VkDeviceSize size, uint32_t memoryType)
+	{
+		vkFreeMemory(state.context->device, memory, nullptr);
+		state.driverAllocs--;
+		state.memTypeAllocSizes[memoryType] -= size;
+	}
+
+	uint32_t newHeap(uint32_t memoryType)
+	{
+		uint32_t idx = 0;
+		while (idx < state.heaps.size() && state.heaps[idx].handle != VK_NULL_HANDLE) idx++;
+		if (idx == state.heaps.size()) state.heaps.push_back({});
+
+		BuddyMemory& memory = state.heaps[idx];
+		memory.handle = allocDriverMemory(BUDDY_HEAP_SIZE, memoryType);
+		memory.type = memoryType;
+		initBuddyHeap(memory.heap, BUDDY_HEAP_SIZE, BUDDY_MIN_BLOCK_SIZE);
+		return idx;
+	}
+
+	void alloc(Allocation& outAlloc, AllocationCreateInfo createInfo)
+	{
+		outAlloc.type = createInfo.memoryTypeIndex;
+		outAlloc.size = createInfo.size;
+		outAlloc.context = state.context;
+
+		bool hostVisible = (state.context->gpu.memProps.memoryTypes[createInfo.memoryTypeIndex].propertyFlags & VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT) != 0;
+		if (hostVisible || createInfo.size > BUDDY_DEDICATED_SIZE)
+		{
+			outAlloc.handle = allocDriverMemory(createInfo.size, createInfo.memoryTypeIndex);
+			outAlloc.offset = 0;
+			outAlloc.id = UINT32_MAX;
+			return;
+		}
+
+		//blocks are aligned to their size, and a block at least as big as the granularity never shares a page
+		//with its neighbours
+		VkDeviceSize size = createInfo.size;
+		if (size < createInfo.alignment) size = createInfo.alignment;
+		if (size < state.granularity) size = state.granularity;
+
+		uint32_t heapIdx = UINT32_MAX;
+		VkDeviceSize offset = 0;
+		for (uint32_t i = 0; i < state.heaps.size(); ++i)
+		{
+			BuddyMemory& memory = state.heaps[i];
+			if (memory.handle == VK_NULL_HANDLE || memory.type != createInfo.memoryTypeIndex) continue;
+
+			if (buddyAlloc(memory.heap, size, offset))
+			{
+				heapIdx = i;
+				break;
+			}
+		}
+
+		if (heapIdx == UINT32_MAX)
+		{
+			heapIdx = newHeap(createInfo.memoryTypeIndex);
+			bool fits = buddyAlloc(state.heaps[heapIdx].heap, size, offset);
+			checkf(fits, "Allocation doesn't fit in an empty buddy heap");
+		}
+
+		state.requestedBytes += createInfo.size;
+
+		outAlloc.handle = state.heaps[heapIdx].handle;
+		outAlloc.offset = offset;
+		outAlloc.id = heapIdx;
+	}
+
+	void free(Allocation& allocation)
+	{
+		if (allocation.id == UINT32_MAX)
+		{
+			freeDriverMemory(allocation.handle, allocation.size, allocation.type);
+			return;
+		}
+
+		BuddyMemory& memory = state.heaps[allocation.id];
+		buddyFree(memory.heap, allocation.offset);
+		state.requestedBytes -= allocation.size;
+
+		//nothing left in the heap, so give it back
+		if (memory.heap.liveCount == 0)
+		{
+			freeDriverMemory(memory.handle, memory.heap.size, memory.type);
+			memory.handle = VK_NULL_HANDLE;
+		}
+	}
+
+	size_t allocatedSize(uint32_t memoryType)
+	{
+		return state.memTypeAllocSizes[memoryType];
+	}
+
+	//driver allocations, not how many allocations have been handed out
+	uint32_t numAllocs()
+	{
+		return state.driverAllocs;
+	}
+
+	BuddyUsage usage()
+	{
+		BuddyUsage usage = {};
+		usage.requestedBytes = state.requestedBytes;
+
+		for (uint32_t i = 0; i < state.heaps.size(); ++i)
+		{
+			if (state.heaps[i].handle == VK_NULL_HANDLE) continue;
+			usage.heapCount++;
+			usage.blockBytes += state.heaps[i].heap.used;
+		}
+
+		return usage;
+	}
+}
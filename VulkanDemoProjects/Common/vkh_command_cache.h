@@ -0,0 +1,135 @@
+#pragma once
+#include "vkh_types.h"
+#include "vkh.h"
+#include "hash_utils.h"
+#include <vector>
+
+//Keeps a recorded primary command buffer per swap chain image, so frames whose inputs haven't changed can resubmit
+//what was recorded last time instead of recording it again. The caller hashes everything the recording depends on
+//(pipelines, descriptor sets, push constant values, mesh buffers, the framebuffer) with hashInput, and acquire only
+//asks for a re-record when that hash changes. Anything the hash can't see, like a swap chain recreation that happens
+//to hand back the same handles, needs an explicit invalidateAll
+
+namespace vkh::CommandCache
+{
+	struct CachedCommandBuffer
+	{
+		VkCommandBuffer		buffer;
+		uint64_t			inputHash;
+
+		//graphics timeline value of the last submit that used this buffer, it can't be reset or resubmitted before then
+		uint64_t			timelineValue;
+		bool				valid;
+	};
+
+	struct CacheStats
+	{
+		uint64_t			reRecords;
+		uint64_t			reuses;
+	};
+
+	struct CommandCacheState
+	{
+		VkDevice							device;
+		VkCommandPool						pool;
+		std::vector<CachedCommandBuffer>	entries;
+		CacheStats							stats;
+	};
+
+	CommandCacheState state;
+
+	void init(VkhContext& ctxt)
+	{
+		state.device = ctxt.device;
+		state.stats = {};
+
+		//buffers get reset one at a time as they go stale, so this pool can't be transient
+		createCommandPool(state.pool, ctxt.device, ctxt.gpu, ctxt.gpu.graphicsQueueFamilyIdx, VK_COMMAND_POOL_CREATE_RESET_COMMAND_BUFFER_BIT);
+	}
+
+	uint64_t hashInput(uint64_t hash, const void* data, size_t size)
+	{
+		return hashBytes(data, size, hash);
+	}
+
+	template<typename T>
+	uint64_t hashInput(uint64_t hash, const T& value)
+	{
+		return hashBytes(&value, sizeof(T), hash);
+	}
+
+	//outBuffer is always the buffer to submit for this image. Returns true if it has to be recorded first, in which
+	//case it's already been reset and just needs vkBeginCommandBuffer (without ONE_TIME_SUBMIT, since it'll be reused)
+	bool acquire(uint32_t imageIdx, uint64_t inputHash, VkCommandBuffer& outBuffer)
+	{
+		while (state.entries.size() <= imageIdx)
+		{
+			CachedCommandBuffer entry = {};
+			createCommandBuffer(entry.buffer, state.pool, state.device);
+			state.entries.push_back(entry);
+		}
+
+		CachedCommandBuffer& entry = state.entries[imageIdx];
+
+		//almost always complete already, the frame ring has usually waited on a later value than this
+		Timeline::wait(ECommandPoolType::Graphics, entry.timelineValue);
+
+		outBuffer = entry.buffer;
+
+		if (entry.valid && entry.inputHash == inputHash)
+		{
+			state.stats.reuses++;
+			return false;
+		}
+
+		vkResetCommandBuffer(entry.buffer, 0);
+		entry.inputHash = inputHash;
+		entry.valid = true;
+		state.stats.reRecords++;
+		return true;
+	}
+
+	//call with the timeline value that submitFrame recorded for the frame the buffer was submitted in
+	void markSubmitted(uint32_t imageIdx, uint64_t timelineValue)
+	{
+		state.entries[imageIdx].timelineValue = timelineValue;
+	}
+
+	//drops the buffers for images past imageCount, for when a recreated swap chain hands back fewer images than
+	//before. Entries for any extra images get created by acquire the first time they're used
+	void resize(uint32_t imageCount)
+	{
+		while (state.entries.size() > imageCount)
+		{
+			CachedCommandBuffer& entry = state.entries.back();
+			Timeline::wait(ECommandPoolType::Graphics, entry.timelineValue);
+			vkFreeCommandBuffers(state.device, state.pool, 1, &entry.buffer);
+			state.entries.pop_back();
+		}
+	}
+
+	void invalidateAll()
+	{
+		for (uint32_t i = 0; i < state.entries.size(); ++i)
+		{
+			state.entries[i].valid = false;
+		}
+	}
+
+	CacheStats stats()
+	{
+		return state.stats;
+	}
+
+	void destroy()
+	{
+		for (uint32_t i = 0; i < state.entries.size(); ++i)
+		{
+			Timeline::wait(ECommandPoolType::Graphics, state.entries[i].timelineValue);
+		}
+
+		//freeing the pool frees the buffers allocated from it
+		vkDestroyCommandPool(state.device, state.pool, nullptr);
+		state.entries.clear();
+	}
+}
@@ -0,0 +1,365 @@
+#pragma once
+#include <stdint.h>
+#include <stdlib.h>
+#include <atomic>
+#include <mutex>
+#include <vector>
+#include "vkh.h"
+#include "vkh_types.h"
+#include "vkh_initializers.h"
+
+//Concurrent allocator, for when resources are created from more than one thread at once (eg: loading or streaming
+//textures on worker threads). Small allocations are served from fixed size slots, with one size class for each power
+//of two from CONCURRENT_MIN_SLOT_SIZE up to CONCURRENT_MAX_SLOT_SIZE. Slots are cut out of chunks of VkDeviceMemory,
+//and the free ones live in a shard for their memory type and size class, each with its own lock.
+//
+//On top of that every thread keeps a small cache of free slots for each shard. Allocating and freeing only touch the
+//calling thread's cache. A shard's lock is only taken to move a batch of slots in or out of a cache when it runs
+//empty or fills up, so threads that allocate at the same time almost never wait on each other.
+//
+//Anything bigger than the largest slot, and anything in host visible memory (which can't be mapped twice), takes the
+//global path. That means a dedicated vkAllocateMemory, which is safe to call from any thread. Chunks are kept for
+//reuse until the allocator is deactivated
+
+#define CONCURRENT_MIN_SLOT_SIZE (4 * 1024)
+#define CONCURRENT_SIZE_CLASS_COUNT 7
+#define CONCURRENT_MAX_SLOT_SIZE (CONCURRENT_MIN_SLOT_SIZE << (CONCURRENT_SIZE_CLASS_COUNT - 1))
+
+//each chunk is at least this big, and holds at least CONCURRENT_MIN_SLOTS_PER_CHUNK slots
+#define CONCURRENT_MIN_CHUNK_SIZE (4 * 1024 * 1024)
+#define CONCURRENT_MIN_SLOTS_PER_CHUNK 64
+
+//free slots each thread holds on to per memory type and size class, half of them move at a time
+#define CONCURRENT_THREAD_CACHE_SIZE 32
+#define CONCURRENT_CACHE_BATCH (CONCURRENT_THREAD_CACHE_SIZE / 2)
+
+namespace vkh::allocators::concurrent
+{
+	struct Slot
+	{
+		VkDeviceMemory	handle;
+		VkDeviceSize	offset;
+	};
+
+	struct Shard
+	{
+		std::mutex					lock;
+		std::vector<Slot>			freeSlots;
+		std::vector<VkDeviceMemory>	chunks;
+		VkDeviceSize				chunkSize;
+	};
+
+	struct SlotCache
+	{
+		Slot			slots[CONCURRENT_THREAD_CACHE_SIZE];
+		uint32_t		count;
+	};
+
+	struct ThreadCache
+	{
+		SlotCache		caches[VK_MAX_MEMORY_TYPES][CONCURRENT_SIZE_CLASS_COUNT];
+	};
+
+	struct ConcurrentStats
+	{
+		uint64_t		cacheRefills;
+		uint64_t		cacheFlushes;
+		uint64_t		chunkAllocs;
+		uint64_t		dedicatedAllocs;
+	};
+
+	struct AllocatorState
+	{
+		Shard						shards[VK_MAX_MEMORY_TYPES][CONCURRENT_SIZE_CLASS_COUNT];
+
+		//bytes taken from the driver for each memory type, chunks and dedicated allocations both
+		std::atomic<size_t>			memTypeAllocSizes[VK_MAX_MEMORY_TYPES];
+		std::atomic<uint32_t>		driverAllocs;
+
+		//only touched alongside a shard's lock or on the global path, never on a cache hit, so they don't add contention
+		std::atomic<uint64_t>		cacheRefills;
+		std::atomic<uint64_t>		cacheFlushes;
+		std::atomic<uint64_t>		chunkAllocs;
+		std::atomic<uint64_t>		dedicatedAllocs;
+
+		//every thread's cache, so they can all be freed on deactivate
+		std::mutex					threadCacheLock;
+		std::vector<ThreadCache*>	threadCaches;
+
+		//off sends every slot allocation straight to its shard, for comparing against
+		bool						useThreadCaches;
+
+		VkDeviceSize				granularity;
+		VkhContext*					context;
+	};
+
+	AllocatorState state;
+	thread_local ThreadCache* threadCache = nullptr;
+
+	//ALLOCATOR INTERFACE / INSTALLATION
+	void activate(VkhContext* context);
+	void alloc(Allocation& outAlloc, AllocationCreateInfo createInfo);
+	void free(Allocation& handle);
+	size_t allocatedSize(uint32_t memoryType);
+	uint32_t numAllocs();
+
+	AllocatorInterface allocImpl = { activate, alloc, free, allocatedSize, numAllocs };
+
+	void activate(VkhContext* context)
+	{
+		context->allocator = allocImpl;
+		state.context = context;
+		state.granularity = context->gpu.deviceProps.limits.bufferImageGranularity;
+		state.useThreadCaches = true;
+
+		for (uint32_t type = 0; type < VK_MAX_MEMORY_TYPES; ++type)
+		{
+			state.memTypeAllocSizes[type] = 0;
+
+			for (uint32_t sizeClass = 0; sizeClass < CONCURRENT_SIZE_CLASS_COUNT; ++sizeClass)
+			{
+				VkDeviceSize slotSize = (VkDeviceSize)CONCURRENT_MIN_SLOT_SIZE << sizeClass;
+				VkDeviceSize chunkSize = slotSize * CONCURRENT_MIN_SLOTS_PER_CHUNK;
+				state.shards[type][sizeClass].chunkSize = chunkSize > CONCURRENT_MIN_CHUNK_SIZE ? chunkSize : CONCURRENT_MIN_CHUNK_SIZE;
+			}
+		}
+
+		state.driverAllocs = 0;
+		state.cacheRefills = 0;
+		state.cacheFlushes = 0;
+		state.chunkAllocs = 0;
+		state.dedicatedAllocs = 0;
+	}
+
+	//frees every chunk and thread cache. Nothing else can be using the allocator by then, and anything that took the
+	//global path has to have been freed already
+	void deactivate(VkhContext* context)
+	{
+		for (uint32_t type = 0; type < VK_MAX_MEMORY_TYPES; ++type)
+		{
+			for (uint32_t sizeClass = 0; sizeClass < CONCURRENT_SIZE_CLASS_COUNT; ++sizeClass)
+			{
+				Shard& shard = state.shards[type][sizeClass];
+				for (uint32_t i = 0; i < shard.chunks.size(); ++i)
+				{
+					vkFreeMemory(context->device, shard.chunks[i], nullptr);
+					state.driverAllocs--;
+					state.memTypeAllocSizes[type] -= shard.chunkSize;
+				}
+
+				shard.chunks.clear();
+				shard.freeSlots.clear();
+			}
+		}
+
+		for (uint32_t i = 0; i < state.threadCaches.size(); ++i)
+		{
+			::free(state.threadCaches[i]);
+		}
+
+		state.threadCaches.clear();
+		threadCache = nullptr;
+	}
+
+	//IMPLEMENTATION
+
+	VkDeviceMemory allocDriverMemory(VkDeviceSize size, uint32_t memoryType)
+	{
+		VkDeviceMemory memory;
+		VkMemoryAllocateInfo allocInfo = vkh::memoryAllocateInfo(size, memoryType);
+		VkResult res = vkAllocateMemory(state.context->device, &allocInfo, nullptr, &memory);
+
+		checkf(res != VK_ERROR_OUT_OF_DEVICE_MEMORY, "Out of device memory");
+		checkf(res != VK_ERROR_TOO_MANY_OBJECTS, "Attempting to create too many allocations");
+		checkf(res == VK_SUCCESS, "Error allocating memory in concurrent allocator");
+
+		state.driverAllocs++;
+		state.memTypeAllocSizes[memoryType] += size;
+		return memory;
+	}
+
+	//the smallest size class that fits size, CONCURRENT_SIZE_CLASS_COUNT if it's too big for any of them
+	uint32_t sizeClassFor(VkDeviceSize size)
+	{
+		uint32_t sizeClass = 0;
+		while (sizeClass < CONCURRENT_SIZE_CLASS_COUNT && ((VkDeviceSize)CONCURRENT_MIN_SLOT_SIZE << sizeClass) < size) sizeClass++;
+		return sizeClass;
+	}
+
+	//needs the shard's lock to be held
+	void addChunk(Shard& shard, uint32_t memoryType, uint32_t sizeClass)
+	{
+		VkDeviceMemory chunk = allocDriverMemory(shard.chunkSize, memoryType);
+		shard.chunks.push_back(chunk);
+		state.chunkAllocs++;
+
+		//pushed in reverse, so slots get handed out from the start of the chunk
+		VkDeviceSize slotSize = (VkDeviceSize)CONCURRENT_MIN_SLOT_SIZE << sizeClass;
+		for (VkDeviceSize offset = shard.chunkSize; offset >= slotSize; offset -= slotSize)
+		{
+			Slot slot = { chunk, offset - slotSize };
+			shard.freeSlots.push_back(slot);
+		}
+	}
+
+	//moves up to count free slots from the shard into outSlots, adding a chunk if it's run out. Returns how many moved
+	uint32_t takeFromShard(uint32_t memoryType, uint32_t sizeClass, Slot* outSlots, uint32_t count)
+	{
+		Shard& shard = state.shards[memoryType][sizeClass];
+		std::lock_guard<std::mutex> lock(shard.lock);
+
+		if (shard.freeSlots.size() == 0) addChunk(shard, memoryType, sizeClass);
+
+		uint32_t taken = 0;
+		while (taken < count && shard.freeSlots.size() > 0)
+		{
+			outSlots[taken++] = shard.freeSlots.back();
+			shard.freeSlots.pop_back();
+		}
+		return taken;
+	}
+
+	void returnToShard(uint32_t memoryType, uint32_t sizeClass, const Slot* slots, uint32_t count)
+	{
+		Shard& shard = state.shards[memoryType][sizeClass];
+		std::lock_guard<std::mutex> lock(shard.lock);
+		shard.freeSlots.insert(shard.freeSlots.end(), slots, slots + count);
+	}
+
+	ThreadCache& getThreadCache()
+	{
+		if (!threadCache)
+		{
+			threadCache = (ThreadCache*)calloc(1, sizeof(ThreadCache));
+
+			std::lock_guard<std::mutex> lock(state.threadCacheLock);
+			state.threadCaches.push_back(threadCache);
+		}
+
+		return *threadCache;
+	}
+
+	Slot allocSlot(uint32_t memoryType, uint32_t sizeClass)
+	{
+		Slot slot;
+		if (!state.useThreadCaches)
+		{
+			takeFromShard(memoryType, sizeClass, &slot, 1);
+			return slot;
+		}
+
+		SlotCache& cache = getThreadCache().caches[memoryType][sizeClass];
+		if (cache.count == 0)
+		{
+			cache.count = takeFromShard(memoryType, sizeClass, cache.slots, CONCURRENT_CACHE_BATCH);
+			state.cacheRefills++;
+		}
+
+		return cache.slots[--cache.count];
+	}
+
+	void freeSlot(uint32_t memoryType, uint32_t sizeClass, const Slot& slot)
+	{
+		if (!state.useThreadCaches)
+		{
+			returnToShard(memoryType, sizeClass, &slot, 1);
+			return;
+		}
+
+		//slots can be freed on a different thread to the one that allocated them, they just end up in its cache
+		SlotCache& cache = getThreadCache().caches[memoryType][sizeClass];
+		if (cache.count == CONCURRENT_THREAD_CACHE_SIZE)
+		{
+			cache.count -= CONCURRENT_CACHE_BATCH;
+			returnToShard(memoryType, sizeClass, cache.slots + cache.count, CONCURRENT_CACHE_BATCH);
+			state.cacheFlushes++;
+		}
+
+		cache.slots[cache.count++] = slot;
+	}
+
+	//gives the calling thread's free slots back to the shards, so other threads can use them. Worker threads should
+	//call this before they exit, anything left in their caches can't be used again until the allocator is deactivated
+	void flushThreadCache()
+	{
+		if (!threadCache) return;
+
+		for (uint32_t type = 0; type < VK_MAX_MEMORY_TYPES; ++type)
+		{
+			for (uint32_t sizeClass = 0; sizeClass < CONCURRENT_SIZE_CLASS_COUNT; ++sizeClass)
+			{
+				SlotCache& cache = threadCache->caches[type][sizeClass];
+				if (cache.count == 0) continue;
+
+				returnToShard(type, sizeClass, cache.slots, cache.count);
+				cache.count = 0;
+			}
+		}
+	}
+
+	void alloc(Allocation& outAlloc, AllocationCreateInfo createInfo)
+	{
+		outAlloc.type = createInfo.memoryTypeIndex;
+		outAlloc.size = createInfo.size;
+		outAlloc.context = state.context;
+
+		//slots are aligned to their size, and a slot at least as big as the granularity never shares a page with
+		//its neighbours
+		VkDeviceSize slotSize = createInfo.size;
+		if (slotSize < createInfo.alignment) slotSize = createInfo.alignment;
+		if (slotSize < state.granularity) slotSize = state.granularity;
+
+		uint32_t sizeClass = sizeClassFor(slotSize);
+		bool hostVisible = (state.context->gpu.memProps.memoryTypes[createInfo.memoryTypeIndex].propertyFlags & VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT) != 0;
+
+		if (hostVisible || sizeClass == CONCURRENT_SIZE_CLASS_COUNT)
+		{
+			outAlloc.handle = allocDriverMemory(createInfo.size, createInfo.memoryTypeIndex);
+			outAlloc.offset = 0;
+			outAlloc.id = UINT32_MAX;
+			state.dedicatedAllocs++;
+			return;
+		}
+
+		Slot slot = allocSlot(createInfo.memoryTypeIndex, sizeClass);
+		outAlloc.handle = slot.handle;
+		outAlloc.offset = slot.offset;
+		outAlloc.id = sizeClass;
+	}
+
+	void free(Allocation& allocation)
+	{
+		if (allocation.id == UINT32_MAX)
+		{
+			vkFreeMemory(state.context->device, allocation.handle, nullptr);
+			state.driverAllocs--;
+			state.memTypeAllocSizes[allocation.type] -= allocation.size;
+			return;
+		}
+
+		Slot slot = { allocation.handle, allocation.offset };
+		freeSlot(allocation.type, allocation.id, slot);
+	}
+
+	size_t allocatedSize(uint32_t memoryType)
+	{
+		return state.memTypeAllocSizes[memoryType];
+	}
+
+	//driver allocations, not how many allocations have been handed out
+	uint32_t numAllocs()
+	{
+		return state.driverAllocs;
+	}
+
+	//returns the totals since the last call
+	ConcurrentStats consumeStats()
+	{
+		ConcurrentStats stats;
+		stats.cacheRefills = state.cacheRefills.exchange(0);
+		stats.cacheFlushes = state.cacheFlushes.exchange(0);
+		stats.chunkAllocs = state.chunkAllocs.exchange(0);
+		stats.dedicatedAllocs = state.dedicatedAllocs.exchange(0);
+		return stats;
+	}
+}
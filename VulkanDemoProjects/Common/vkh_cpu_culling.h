@@ -0,0 +1,228 @@
+#pragma once
+#include <glm/glm.hpp>
+#include <intrin.h>
+#include <immintrin.h>
+#include <vector>
+#include <stdint.h>
+
+//Frustum culls bounding spheres on the cpu. The spheres are stored as separate x / y / z / radius arrays, so that
+//the SSE and AVX2 paths can load 4 or 8 of them at once straight from memory and test them against all six planes
+//without any shuffling. Each path writes the indices of the visible spheres, in ascending order, to a compact list
+//that can be handed straight to draw submission.
+//
+//cullSpheres picks the widest path the cpu supports. The others are there to compare against, and the scalar path
+//is also the reference the gpu culling pass gets checked against (see sphereInFrustum)
+
+namespace vkh
+{
+	enum class ECullPath : uint8_t
+	{
+		Scalar,
+		SSE,
+		AVX2
+	};
+
+	struct CullSpheres
+	{
+		//world space
+		std::vector<float>	x;
+		std::vector<float>	y;
+		std::vector<float>	z;
+		std::vector<float>	radius;
+	};
+
+	//planes point inwards, and are normalized so that distances from them are in world units. Expects vulkan's 0 to 1 depth range
+	void extractFrustumPlanes(const glm::mat4& viewProj, glm::vec4* outPlanes)
+	{
+		glm::vec4 rows[4];
+		for (uint32_t r = 0; r < 4; ++r)
+		{
+			rows[r] = glm::vec4(viewProj[0][r], viewProj[1][r], viewProj[2][r], viewProj[3][r]);
+		}
+
+		outPlanes[0] = rows[3] + rows[0];
+		outPlanes[1] = rows[3] - rows[0];
+		outPlanes[2] = rows[3] + rows[1];
+		outPlanes[3] = rows[3] - rows[1];
+		outPlanes[4] = rows[2];
+		outPlanes[5] = rows[3] - rows[2];
+
+		for (uint32_t i = 0; i < 6; ++i)
+		{
+			outPlanes[i] /= glm::length(glm::vec3(outPlanes[i]));
+		}
+	}
+
+	//for a sphere in object space. The transform's largest axis scale is applied to the radius
+	bool sphereInFrustum(const glm::vec4* planes, const glm::mat4& transform, const glm::vec4& sphere)
+	{
+		glm::vec3 center = glm::vec3(transform * glm::vec4(glm::vec3(sphere), 1.0f));
+		float scale = glm::max(glm::max(glm::length(glm::vec3(transform[0])), glm::length(glm::vec3(transform[1]))), glm::length(glm::vec3(transform[2])));
+		float radius = sphere.w * scale;
+
+		for (uint32_t i = 0; i < 6; ++i)
+		{
+			if (glm::dot(glm::vec3(planes[i]), center) + planes[i].w < -radius) return false;
+		}
+		return true;
+	}
+
+	uint32_t addCullSphere(CullSpheres& spheres, const glm::vec3& center, float radius)
+	{
+		spheres.x.push_back(center.x);
+		spheres.y.push_back(center.y);
+		spheres.z.push_back(center.z);
+		spheres.radius.push_back(radius);
+		return static_cast<uint32_t>(spheres.x.size() - 1);
+	}
+
+	uint32_t cullSphereCount(const CullSpheres& spheres)
+	{
+		return static_cast<uint32_t>(spheres.x.size());
+	}
+
+	//handles [first, count), and is also how the simd paths finish off whatever doesn't fill a whole register.
+	//Every path adds up the plane distance in the same order, so they all agree exactly on spheres right at the edge
+	uint32_t cullSpheresScalar(const CullSpheres& spheres, const glm::vec4* planes, uint32_t first, uint32_t* outVisible, uint32_t visibleCount = 0)
+	{
+		uint32_t count = cullSphereCount(spheres);
+
+		for (uint32_t i = first; i < count; ++i)
+		{
+			bool visible = true;
+			for (uint32_t p = 0; p < 6; ++p)
+			{
+				float dist = planes[p].x * spheres.x[i] + planes[p].y * spheres.y[i] + planes[p].z * spheres.z[i] + planes[p].w;
+				visible = visible && dist >= -spheres.radius[i];
+			}
+
+			//written unconditionally, and only kept if visible, so there's no branch on the result
+			outVisible[visibleCount] = i;
+			visibleCount += visible ? 1 : 0;
+		}
+
+		return visibleCount;
+	}
+
+	uint32_t cullSpheresSSE(const CullSpheres& spheres, const glm::vec4* planes, uint32_t* outVisible)
+	{
+		uint32_t count = cullSphereCount(spheres);
+		uint32_t simdCount = count & ~3u;
+		uint32_t visibleCount = 0;
+
+		__m128 planeX[6], planeY[6], planeZ[6], planeW[6];
+		for (uint32_t p = 0; p < 6; ++p)
+		{
+			planeX[p] = _mm_set1_ps(planes[p].x);
+			planeY[p] = _mm_set1_ps(planes[p].y);
+			planeZ[p] = _mm_set1_ps(planes[p].z);
+			planeW[p] = _mm_set1_ps(planes[p].w);
+		}
+
+		const __m128 zero = _mm_setzero_ps();
+
+		for (uint32_t i = 0; i < simdCount; i += 4)
+		{
+			__m128 x = _mm_loadu_ps(&spheres.x[i]);
+			__m128 y = _mm_loadu_ps(&spheres.y[i]);
+			__m128 z = _mm_loadu_ps(&spheres.z[i]);
+			__m128 negRadius = _mm_sub_ps(zero, _mm_loadu_ps(&spheres.radius[i]));
+
+			__m128 inside = _mm_castsi128_ps(_mm_set1_epi32(-1));
+			for (uint32_t p = 0; p < 6; ++p)
+			{
+				__m128 dist = _mm_add_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(planeX[p], x), _mm_mul_ps(planeY[p], y)), _mm_mul_ps(planeZ[p], z)), planeW[p]);
+				inside = _mm_and_ps(inside, _mm_cmpge_ps(dist, negRadius));
+			}
+
+			uint32_t mask = static_cast<uint32_t>(_mm_movemask_ps(inside));
+			for (uint32_t j = 0; j < 4; ++j)
+			{
+				outVisible[visibleCount] = i + j;
+				visibleCount += (mask >> j) & 1;
+			}
+		}
+
+		return cullSpheresScalar(spheres, planes, simdCount, outVisible, visibleCount);
+	}
+
+	uint32_t cullSpheresAVX2(const CullSpheres& spheres, const glm::vec4* planes, uint32_t* outVisible)
+	{
+		uint32_t count = cullSphereCount(spheres);
+		uint32_t simdCount = count & ~7u;
+		uint32_t visibleCount = 0;
+
+		__m256 planeX[6], planeY[6], planeZ[6], planeW[6];
+		for (uint32_t p = 0; p < 6; ++p)
+		{
+			planeX[p] = _mm256_set1_ps(planes[p].x);
+			planeY[p] = _mm256_set1_ps(planes[p].y);
+			planeZ[p] = _mm256_set1_ps(planes[p].z);
+			planeW[p] = _mm256_set1_ps(planes[p].w);
+		}
+
+		const __m256 zero = _mm256_setzero_ps();
+
+		for (uint32_t i = 0; i < simdCount; i += 8)
+		{
+			__m256 x = _mm256_loadu_ps(&spheres.x[i]);
+			__m256 y = _mm256_loadu_ps(&spheres.y[i]);
+			__m256 z = _mm256_loadu_ps(&spheres.z[i]);
+			__m256 negRadius = _mm256_sub_ps(zero, _mm256_loadu_ps(&spheres.radius[i]));
+
+			__m256 inside = _mm256_castsi256_ps(_mm256_set1_epi32(-1));
+			for (uint32_t p = 0; p < 6; ++p)
+			{
+				__m256 dist = _mm256_add_ps(_mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(planeX[p], x), _mm256_mul_ps(planeY[p], y)), _mm256_mul_ps(planeZ[p], z)), planeW[p]);
+				inside = _mm256_and_ps(inside, _mm256_cmp_ps(dist, negRadius, _CMP_GE_OQ));
+			}
+
+			uint32_t mask = static_cast<uint32_t>(_mm256_movemask_ps(inside));
+			for (uint32_t j = 0; j < 8; ++j)
+			{
+				outVisible[visibleCount] = i + j;
+				visibleCount += (mask >> j) & 1;
+			}
+		}
+
+		return cullSpheresScalar(spheres, planes, simdCount, outVisible, visibleCount);
+	}
+
+	//the os has to save ymm registers on context switches too, or they can't be used even if the cpu has them
+	bool cpuSupportsAVX2()
+	{
+		int info[4];
+		__cpuid(info, 1);
+		bool osxsave = (info[2] & (1 << 27)) != 0;
+		if (!osxsave) return false;
+
+		if ((_xgetbv(0) & 6) != 6) return false;
+
+		__cpuid(info, 0);
+		if (info[0] < 7) return false;
+
+		__cpuidex(info, 7, 0);
+		return (info[1] & (1 << 5)) != 0;
+	}
+
+	ECullPath bestCullPath()
+	{
+		static ECullPath best = cpuSupportsAVX2() ? ECullPath::AVX2 : ECullPath::SSE;
+		return best;
+	}
+
+	//outVisible is resized to fit every sphere (the simd paths write a whole register's worth of indices at a time),
+	//and the return value is how many of them are visible
+	uint32_t cullSpheres(const CullSpheres& spheres, const glm::vec4* planes, std::vector<uint32_t>& outVisible, ECullPath path = bestCullPath())
+	{
+		outVisible.resize(cullSphereCount(spheres));
+		if (outVisible.size() == 0) return 0;
+
+		switch (path)
+		{
+			case ECullPath::AVX2: return cullSpheresAVX2(spheres, planes, outVisible.data());
+			case ECullPath::SSE: return cullSpheresSSE(spheres, planes, outVisible.data());
+			default: return cullSpheresScalar(spheres, planes, 0, outVisible.data());
+		}
+	}
+}
@@ -0,0 +1,157 @@
+#pragma once
+#include "vkh_types.h"
+#include "vkh_timeline.h"
+#include <vector>
+
+//Resources that the gpu might still be using can't be destroyed straight away. Instead they're queued up here,
+//tagged with a point on a queue's timeline, and destroyed by collect() once the gpu has gone past that point.
+//Anything used by the frame that's currently being recorded can be tagged with Timeline::nextValue(Graphics)
+
+namespace vkh::DeletionQueue
+{
+	//any of the handles can be null, whatever's set gets destroyed
+	struct DeferredDeletion
+	{
+		ECommandPoolType	queue;
+		uint64_t			value;
+
+		VkBuffer			buffer;
+		VkImage				image;
+		VkImageView			imageView;
+		VkCommandPool		commandPool;
+		VkCommandBuffer		commandBuffer;
+		Allocation			memory;
+		bool				ownsMemory;
+	};
+
+	struct DeletionStats
+	{
+		uint32_t		pendingCount;
+		VkDeviceSize	pendingBytes;
+		uint64_t		totalDeleted;
+	};
+
+	struct DeletionQueueState
+	{
+		std::vector<DeferredDeletion>	pending;
+		DeletionStats					stats;
+	};
+
+	DeletionQueueState state;
+
+	void enqueue(DeferredDeletion& deletion)
+	{
+		state.pending.push_back(deletion);
+		state.stats.pendingCount++;
+		state.stats.pendingBytes += deletion.ownsMemory ? deletion.memory.size : 0;
+	}
+
+	void destroyBuffer(VkBuffer buffer, const Allocation& memory, ECommandPoolType queue, uint64_t value)
+	{
+		DeferredDeletion deletion = {};
+		deletion.queue = queue;
+		deletion.value = value;
+		deletion.buffer = buffer;
+		deletion.memory = memory;
+		deletion.ownsMemory = true;
+		enqueue(deletion);
+	}
+
+	void destroyImage(VkImage image, VkImageView view, const Allocation& memory, ECommandPoolType queue, uint64_t value)
+	{
+		DeferredDeletion deletion = {};
+		deletion.queue = queue;
+		deletion.value = value;
+		deletion.image = image;
+		deletion.imageView = view;
+		deletion.memory = memory;
+		deletion.ownsMemory = true;
+		enqueue(deletion);
+	}
+
+	void freeMemory(const Allocation& memory, ECommandPoolType queue, uint64_t value)
+	{
+		DeferredDeletion deletion = {};
+		deletion.queue = queue;
+		deletion.value = value;
+		deletion.memory = memory;
+		deletion.ownsMemory = true;
+		enqueue(deletion);
+	}
+
+	void freeCommandBuffer(VkCommandPool pool, VkCommandBuffer commandBuffer, ECommandPoolType queue, uint64_t value)
+	{
+		DeferredDeletion deletion = {};
+		deletion.queue = queue;
+		deletion.value = value;
+		deletion.commandPool = pool;
+		deletion.commandBuffer = commandBuffer;
+		enqueue(deletion);
+	}
+
+	void destroyNow(DeferredDeletion& deletion, VkhContext& ctxt)
+	{
+		if (deletion.commandBuffer) vkFreeCommandBuffers(ctxt.device, deletion.commandPool, 1, &deletion.commandBuffer);
+		if (deletion.imageView) vkDestroyImageView(ctxt.device, deletion.imageView, nullptr);
+		if (deletion.image) vkDestroyImage(ctxt.device, deletion.image, nullptr);
+		if (deletion.buffer) vkDestroyBuffer(ctxt.device, deletion.buffer, nullptr);
+
+		if (deletion.ownsMemory)
+		{
+			ctxt.allocator.free(deletion.memory);
+			state.stats.pendingBytes -= deletion.memory.size;
+		}
+
+		state.stats.pendingCount--;
+		state.stats.totalDeleted++;
+	}
+
+	//destroys everything the gpu is finished with. Only queries each timeline once, so it's cheap to call every frame
+	void collect(VkhContext& ctxt)
+	{
+		if (state.pending.size() == 0) return;
+
+		uint64_t completed[TIMELINE_QUEUE_COUNT];
+		for (uint32_t i = 0; i < TIMELINE_QUEUE_COUNT; ++i)
+		{
+			completed[i] = Timeline::completedValue((ECommandPoolType)i);
+		}
+
+		uint32_t keptCount = 0;
+		for (uint32_t i = 0; i < state.pending.size(); ++i)
+		{
+			DeferredDeletion& deletion = state.pending[i];
+			if (deletion.value <= completed[deletion.queue])
+			{
+				destroyNow(deletion, ctxt);
+			}
+			else
+			{
+				state.pending[keptCount++] = deletion;
+			}
+		}
+
+		state.pending.resize(keptCount);
+	}
+
+	//waits for the gpu to finish with everything in the queue, and destroys all of it. Only for teardown: anything tagged
+	//with a value that was never submitted (eg: evicted after the last frame) only waits for what has been submitted,
+	//so nothing can be submitted after this that still uses it
+	void flush(VkhContext& ctxt)
+	{
+		for (uint32_t i = 0; i < state.pending.size(); ++i)
+		{
+			DeferredDeletion& deletion = state.pending[i];
+			uint64_t submitted = Timeline::submittedValue(deletion.queue);
+			Timeline::wait(deletion.queue, deletion.value < submitted ? deletion.value : submitted);
+			destroyNow(deletion, ctxt);
+		}
+
+		state.pending.clear();
+	}
+
+	DeletionStats stats()
+	{
+		return state.stats;
+	}
+}
@@ -0,0 +1,166 @@
+#pragma once
+#include "vkh_types.h"
+#include "vkh.h"
+#include "os_init.h"
+
+//A ring of frame contexts, so the cpu can record the next frame while the gpu is still working on the previous ones.
+//Each frame has its own semaphores, command pool and transient buffer, and acquireFrame blocks until the graphics
+//timeline reaches the value of the last submit that used a slot, which keeps the cpu at most framesInFlight frames ahead.
+//More frames in flight gives the cpu more slack before it stalls, at the cost of more latency between input and display
+
+#define DEFAULT_FRAMES_IN_FLIGHT 2
+#define MAX_FRAMES_IN_FLIGHT 4
+#define DEFAULT_TRANSIENT_BUFFER_SIZE (256 * 1024)
+
+//Frame command pools are transient and get reset as a whole without releasing their memory, so the driver can reuse the
+//same command memory every time the frame comes around. Set to 0 to go back to resetting the command buffer on its own
+//with RELEASE_RESOURCES, to compare recording times between the two
+#ifndef RESET_WHOLE_FRAME_POOL
+#define RESET_WHOLE_FRAME_POOL 1
+#endif
+
+namespace vkh
+{
+	void createTransientBuffer(VkhTransientBuffer& outBuffer, VkDeviceSize size, VkhContext& ctxt)
+	{
+		outBuffer.size = size;
+		outBuffer.head = 0;
+
+		vkh::createBuffer(outBuffer.buffer,
+			outBuffer.memory,
+			size,
+			VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT | VK_BUFFER_USAGE_VERTEX_BUFFER_BIT | VK_BUFFER_USAGE_INDEX_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_SRC_BIT,
+			VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
+			ctxt);
+
+		//stays mapped for as long as the buffer exists
+		VkResult res = vkMapMemory(ctxt.device, outBuffer.memory.handle, outBuffer.memory.offset, size, 0, (void**)&outBuffer.mapped);
+		checkf(res == VK_SUCCESS, "Error mapping transient buffer");
+	}
+
+	//alignment has to be a power of 2, eg: minUniformBufferOffsetAlignment for anything bound as a uniform buffer
+	TransientAllocation allocTransient(VkhFrameContext& frame, VkDeviceSize size, VkDeviceSize alignment)
+	{
+		VkhTransientBuffer& transient = frame.transientBuffer;
+
+		VkDeviceSize offset = (transient.head + alignment - 1) & ~(alignment - 1);
+		checkf(offset + size <= transient.size, "Transient buffer is out of space for this frame");
+
+		transient.head = offset + size;
+
+		TransientAllocation alloc;
+		alloc.buffer = transient.buffer;
+		alloc.offset = offset;
+		alloc.data = transient.mapped + offset;
+		return alloc;
+	}
+
+	void createFrameContexts(VkhContext& ctxt, uint32_t framesInFlight, VkDeviceSize transientBufferSize)
+	{
+		if (framesInFlight == 0) framesInFlight = DEFAULT_FRAMES_IN_FLIGHT;
+		if (transientBufferSize == 0) transientBufferSize = DEFAULT_TRANSIENT_BUFFER_SIZE;
+
+		checkf(framesInFlight <= MAX_FRAMES_IN_FLIGHT, "Too many frames in flight requested");
+
+		ctxt.frames.resize(framesInFlight);
+		ctxt.frameIdx = framesInFlight - 1;
+		ctxt.frameStats = {};
+
+		for (uint32_t i = 0; i < framesInFlight; ++i)
+		{
+			VkhFrameContext& frame = ctxt.frames[i];
+
+			createVkSemaphore(frame.imageAvailableSemaphore, ctxt.device);
+			createVkSemaphore(frame.renderFinishedSemaphore, ctxt.device);
+
+			//value 0 is always complete, so the first wait on each frame returns immediately
+			frame.timelineValue = 0;
+
+#if RESET_WHOLE_FRAME_POOL
+			createCommandPool(frame.commandPool, ctxt.device, ctxt.gpu, ctxt.gpu.graphicsQueueFamilyIdx, VK_COMMAND_POOL_CREATE_TRANSIENT_BIT);
+#else
+			createCommandPool(frame.commandPool, ctxt.device, ctxt.gpu, ctxt.gpu.graphicsQueueFamilyIdx);
+#endif
+			createCommandBuffer(frame.commandBuffer, frame.commandPool, ctxt.device);
+
+			createTransientBuffer(frame.transientBuffer, transientBufferSize, ctxt);
+		}
+	}
+
+	//moves to the next frame in the ring, and waits for the gpu to finish the last frame that used it.
+	//Nothing in the frame is reset here, so it's fine to bail out of a frame after this (eg: if acquiring a
+	//swap chain image fails), the frame's timeline value will still be complete the next time around
+	VkhFrameContext& acquireFrame(VkhContext& ctxt)
+	{
+		ctxt.frameIdx = (ctxt.frameIdx + 1) % ctxt.frames.size();
+		VkhFrameContext& frame = ctxt.frames[ctxt.frameIdx];
+
+		double waitStart = OS::getMilliseconds();
+		Timeline::wait(ECommandPoolType::Graphics, frame.timelineValue);
+
+		ctxt.frameStats.waitMs += OS::getMilliseconds() - waitStart;
+		ctxt.frameStats.frameCount++;
+
+		DeletionQueue::collect(ctxt);
+
+		return frame;
+	}
+
+	//call once the frame is definitely going to be submitted with submitFrame
+	void resetFrame(VkhFrameContext& frame, VkhContext& ctxt)
+	{
+		frame.recordStartMs = OS::getMilliseconds();
+
+#if RESET_WHOLE_FRAME_POOL
+		//every command buffer allocated from the pool goes back to the initial state, but the pool hangs on to its memory
+		VkResult res = vkResetCommandPool(ctxt.device, frame.commandPool, 0);
+		checkf(res == VK_SUCCESS, "Error resetting frame command pool");
+#else
+		vkResetCommandBuffer(frame.commandBuffer, VK_COMMAND_BUFFER_RESET_RELEASE_RESOURCES_BIT);
+#endif
+
+		frame.transientBuffer.head = 0;
+	}
+
+	//submits to the graphics queue, and records the timeline value that acquireFrame waits on when the frame comes around again.
+	//Uploads don't block when they're submitted, so the frame waits on the gpu for any that haven't finished yet
+	void submitFrame(VkhFrameContext& frame, const VkSubmitInfo& submitInfo, VkhContext& ctxt)
+	{
+		ctxt.frameStats.recordMs += OS::getMilliseconds() - frame.recordStartMs;
+
+		Timeline::TimelineWait uploadWaits[TIMELINE_QUEUE_COUNT];
+		uint32_t uploadWaitCount = Timeline::pendingUploadWaits(uploadWaits, VK_PIPELINE_STAGE_ALL_COMMANDS_BIT);
+
+		frame.timelineValue = Timeline::submit(ECommandPoolType::Graphics, submitInfo, uploadWaits, uploadWaitCount);
+	}
+
+	//returns the totals since the last call, so callers can average them over whatever window they like
+	VkhFrameStats consumeFrameStats(VkhContext& ctxt)
+	{
+		VkhFrameStats stats = ctxt.frameStats;
+		ctxt.frameStats = {};
+		return stats;
+	}
+
+	void destroyFrameContexts(VkhContext& ctxt)
+	{
+		DeletionQueue::flush(ctxt);
+
+		for (uint32_t i = 0; i < ctxt.frames.size(); ++i)
+		{
+			VkhFrameContext& frame = ctxt.frames[i];
+
+			Timeline::wait(ECommandPoolType::Graphics, frame.timelineValue);
+
+			vkUnmapMemory(ctxt.device, frame.transientBuffer.memory.handle);
+			vkDestroyBuffer(ctxt.device, frame.transientBuffer.buffer, nullptr);
+			freeDeviceMemory(frame.transientBuffer.memory);
+
+			vkDestroyCommandPool(ctxt.device, frame.commandPool, nullptr);
+			vkDestroySemaphore(ctxt.device, frame.imageAvailableSemaphore, nullptr);
+			vkDestroySemaphore(ctxt.device, frame.renderFinishedSemaphore, nullptr);
+		}
+
+		ctxt.frames.clear();
+	}
+}
@@ -0,0 +1,274 @@
+#pragma once
+#include "vkh.h"
+#include "vkh_batching.h"
+#include "vkh_material.h"
+#include "vkh_deletion_queue.h"
+#include "vkh_cpu_culling.h"
+#include "vkh_block_layout.h"
+#include <glm/glm.hpp>
+#include <vector>
+
+//Frustum culls batched draws on the gpu. A compute pass (cull_instances.comp) tests a bounding sphere per instance
+//against the frustum planes, and appends every instance that survives to its indirect command, copying its instance
+//data into a culled instance buffer packed from the command's firstInstance. The commands' instanceCounts are
+//cleared before the pass runs, so the draws only ever see visible instances, and the cpu cost of drawing stays at one
+//indirect call per batch however many objects there are. Shaders have to read culledInstanceBuffer instead of the
+//batches' own instance buffer.
+//
+//There's no occlusion culling, since none of the demos have a depth buffer to build a hierarchy from. The frustum
+//test itself is sphereInFrustum in vkh_cpu_culling.h, and the shader has to be kept in sync with it
+
+#define CULL_WORKGROUP_SIZE 64
+
+namespace vkh
+{
+	//what the caller knows about each draw packet, xyz of the sphere is its centre in object space and w its radius
+	struct CullBounds
+	{
+		glm::mat4	transform;
+		glm::vec4	sphere;
+	};
+
+	//std430 layout of CullObject in cull_instances.comp, one per instance in draw order
+	struct CullObject
+	{
+		glm::mat4	transform;
+		glm::vec4	sphere;
+		uint32_t	commandIdx;
+		uint32_t	pad[3];
+	};
+
+	struct CullPushConstants
+	{
+		glm::vec4	planes[6];
+		uint32_t	objectCount;
+		uint32_t	instanceWords;
+	};
+
+	typedef Std430Block<glm::mat4, glm::vec4, uint32_t> CullObjectLayout;
+	typedef Std430Block<glm::vec4[6], uint32_t, uint32_t> CullPushConstantLayout;
+
+	static_assert(sizeof(CullObject) == CullObjectLayout::stride && offsetof(CullObject, commandIdx) == CullObjectLayout::offset(2), "CullObject doesn't match the shader's layout");
+	static_assert(sizeof(CullPushConstants) == CullPushConstantLayout::size && offsetof(CullPushConstants, objectCount) == CullPushConstantLayout::offset(1), "CullPushConstants doesn't match the shader's layout");
+
+	struct GpuCulling
+	{
+		VkPipeline				pipeline;
+		VkPipelineLayout		pipelineLayout;
+		VkDescriptorSetLayout	descSetLayout;
+		VkDescriptorSet			descriptorSet;
+
+		//rebuilt along with the batches, by buildCullObjects
+		VkBuffer				objectBuffer;
+		Allocation				objectMemory;
+		VkBuffer				clearedCommandBuffer;
+		Allocation				clearedCommandMemory;
+		VkBuffer				culledInstanceBuffer;
+		Allocation				culledInstanceMemory;
+
+		//a cpu side copy, so the gpu's results can be checked with cullReference
+		std::vector<CullObject>	objects;
+		uint32_t				instanceWords;
+		VkDeviceSize			commandBytes;
+
+		//bumped by every build, so anything recorded from the culling pass can tell when it's stale
+		uint64_t				version;
+	};
+
+	//culled commands are drawn through the indirect buffer, the direct draw fallback in recordBatches can't see their
+	//counts. Devices without drawIndirectFirstInstance have to draw their batches unculled (or cull them on the cpu)
+	bool gpuCullingSupported(const VkhContext& ctxt)
+	{
+		return ctxt.gpu.features.drawIndirectFirstInstance == VK_TRUE;
+	}
+
+	//the descriptor pool needs room for the shader's 4 storage buffers. Check gpuCullingSupported first
+	void createGpuCulling(GpuCulling& outCulling, const char* shaderPath, VkhContext& ctxt)
+	{
+		VkhComputeCreateInfo createInfo = {};
+		createInfo.outPipeline = &outCulling.pipeline;
+		createInfo.outPipelineLayout = &outCulling.pipelineLayout;
+
+		checkf(gpuCullingSupported(ctxt), "Gpu culling needs drawIndirectFirstInstance");
+
+		createComputeMaterial(shaderPath, ctxt, createInfo);
+		outCulling.descSetLayout = createInfo.descSetLayouts[0];
+
+		VkDescriptorSetAllocateInfo allocInfo = vkh::descriptorSetAllocateInfo(&outCulling.descSetLayout, 1, ctxt.descriptorPool);
+		VkResult res = vkAllocateDescriptorSets(ctxt.device, &allocInfo, &outCulling.descriptorSet);
+		checkf(res == VK_SUCCESS, "Error allocating culling descriptor set");
+	}
+
+	void releaseCullBuffers(GpuCulling& culling)
+	{
+		if (culling.objectBuffer == VK_NULL_HANDLE) return;
+
+		uint64_t lastUse = Timeline::submittedValue(ECommandPoolType::Graphics);
+		DeletionQueue::destroyBuffer(culling.objectBuffer, culling.objectMemory, ECommandPoolType::Graphics, lastUse);
+		DeletionQueue::destroyBuffer(culling.clearedCommandBuffer, culling.clearedCommandMemory, ECommandPoolType::Graphics, lastUse);
+		DeletionQueue::destroyBuffer(culling.culledInstanceBuffer, culling.culledInstanceMemory, ECommandPoolType::Graphics, lastUse);
+
+		culling.objectBuffer = VK_NULL_HANDLE;
+		culling.clearedCommandBuffer = VK_NULL_HANDLE;
+		culling.culledInstanceBuffer = VK_NULL_HANDLE;
+	}
+
+	//call after every buildBatches. packetBounds has one entry per packet, in the order they were added to the queue
+	void buildCullObjects(GpuCulling& culling, const BatchedDraws& batches, const RenderQueue& queue, const CullBounds* packetBounds, VkhContext& ctxt)
+	{
+		releaseCullBuffers(culling);
+
+		culling.objects.resize(batches.instanceCount);
+		culling.version++;
+
+		checkf(batches.instanceStride % sizeof(uint32_t) == 0, "Culled instance data has to be a whole number of uints");
+		culling.instanceWords = batches.instanceStride / sizeof(uint32_t);
+
+		//firstInstance of each command is the sorted index of its first instance
+		std::vector<VkDrawIndexedIndirectCommand> clearedCommands = batches.commands;
+		for (uint32_t c = 0; c < clearedCommands.size(); ++c)
+		{
+			VkDrawIndexedIndirectCommand& command = clearedCommands[c];
+			for (uint32_t i = command.firstInstance; i < command.firstInstance + command.instanceCount; ++i)
+			{
+				const CullBounds& bounds = packetBounds[queue.sorted[i].packetIdx];
+
+				CullObject& object = culling.objects[i];
+				object = {};
+				object.transform = bounds.transform;
+				object.sphere = bounds.sphere;
+				object.commandIdx = c;
+			}
+
+			command.instanceCount = 0;
+		}
+
+		if (culling.objects.size() == 0) return;
+
+		culling.commandBytes = clearedCommands.size() * sizeof(VkDrawIndexedIndirectCommand);
+
+		writeToHostBuffer(culling.objectBuffer, culling.objectMemory, culling.objects.data(), culling.objects.size() * sizeof(CullObject),
+			VK_BUFFER_USAGE_STORAGE_BUFFER_BIT, ctxt);
+		writeToHostBuffer(culling.clearedCommandBuffer, culling.clearedCommandMemory, clearedCommands.data(), culling.commandBytes,
+			VK_BUFFER_USAGE_TRANSFER_SRC_BIT, ctxt);
+
+		//only ever touched by the gpu
+		createBuffer(culling.culledInstanceBuffer, culling.culledInstanceMemory, batches.instanceCount * batches.instanceStride,
+			VK_BUFFER_USAGE_STORAGE_BUFFER_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, ctxt);
+
+		VkDescriptorBufferInfo bufferInfos[4] = {};
+		bufferInfos[0].buffer = culling.objectBuffer;
+		bufferInfos[1].buffer = batches.instanceBuffer;
+		bufferInfos[2].buffer = culling.culledInstanceBuffer;
+		bufferInfos[3].buffer = batches.indirectBuffer;
+
+		VkWriteDescriptorSet setWrites[4];
+		for (uint32_t i = 0; i < 4; ++i)
+		{
+			bufferInfos[i].offset = 0;
+			bufferInfos[i].range = VK_WHOLE_SIZE;
+
+			setWrites[i] = {};
+			setWrites[i].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+			setWrites[i].dstSet = culling.descriptorSet;
+			setWrites[i].dstBinding = i;
+			setWrites[i].dstArrayElement = 0;
+			setWrites[i].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+			setWrites[i].descriptorCount = 1;
+			setWrites[i].pBufferInfo = &bufferInfos[i];
+		}
+
+		vkUpdateDescriptorSets(ctxt.device, 4, setWrites, 0, nullptr);
+	}
+
+	//has to be recorded outside of a render pass, before the batches are drawn. The indirect and culled instance buffers
+	//are shared by every frame in flight, so this also waits for earlier submits to finish drawing from them, and makes
+	//the last cull pass's writes to them available before they're overwritten
+	void recordCulling(GpuCulling& culling, BatchedDraws& batches, VkCommandBuffer commandBuffer, const glm::vec4* planes)
+	{
+		if (culling.objects.size() == 0) return;
+
+		VkMemoryBarrier reuseBarrier = {};
+		reuseBarrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+		reuseBarrier.srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT;
+		reuseBarrier.dstAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT | VK_ACCESS_SHADER_WRITE_BIT;
+		vkCmdPipelineBarrier(commandBuffer,
+			VK_PIPELINE_STAGE_DRAW_INDIRECT_BIT | VK_PIPELINE_STAGE_VERTEX_SHADER_BIT | VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+			VK_PIPELINE_STAGE_TRANSFER_BIT | VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+			0, 1, &reuseBarrier, 0, nullptr, 0, nullptr);
+
+		VkBufferCopy copyRegion = {};
+		copyRegion.size = culling.commandBytes;
+		vkCmdCopyBuffer(commandBuffer, culling.clearedCommandBuffer, batches.indirectBuffer, 1, &copyRegion);
+
+		VkMemoryBarrier clearBarrier = {};
+		clearBarrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+		clearBarrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+		clearBarrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT;
+		vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, 0, 1, &clearBarrier, 0, nullptr, 0, nullptr);
+
+		CullPushConstants pushConstants;
+		memcpy(pushConstants.planes, planes, sizeof(pushConstants.planes));
+		pushConstants.objectCount = static_cast<uint32_t>(culling.objects.size());
+		pushConstants.instanceWords = culling.instanceWords;
+
+		vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, culling.pipeline);
+		vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, culling.pipelineLayout, 0, 1, &culling.descriptorSet, 0, nullptr);
+		vkCmdPushConstants(commandBuffer, culling.pipelineLayout, VK_SHADER_STAGE_COMPUTE_BIT, 0, sizeof(CullPushConstants), &pushConstants);
+		vkCmdDispatch(commandBuffer, (pushConstants.objectCount + CULL_WORKGROUP_SIZE - 1) / CULL_WORKGROUP_SIZE, 1, 1);
+
+		//host read is for readCulledCounts
+		VkMemoryBarrier cullBarrier = {};
+		cullBarrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+		cullBarrier.srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT;
+		cullBarrier.dstAccessMask = VK_ACCESS_INDIRECT_COMMAND_READ_BIT | VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_HOST_READ_BIT;
+		vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_PIPELINE_STAGE_DRAW_INDIRECT_BIT | VK_PIPELINE_STAGE_VERTEX_SHADER_BIT | VK_PIPELINE_STAGE_HOST_BIT,
+			0, 1, &cullBarrier, 0, nullptr, 0, nullptr);
+	}
+
+	//reads back how many instances of each command survived the last culling pass. The indirect buffer is host visible,
+	//but the caller has to wait for the submit that culled into it to finish first
+	void readCulledCounts(const BatchedDraws& batches, VkhContext& ctxt, std::vector<uint32_t>& outCounts)
+	{
+		outCounts.resize(batches.commands.size());
+		if (outCounts.size() == 0) return;
+
+		VkDeviceSize size = batches.commands.size() * sizeof(VkDrawIndexedIndirectCommand);
+
+		void* mapped;
+		VkResult res = vkMapMemory(ctxt.device, batches.indirectMemory.handle, batches.indirectMemory.offset, size, 0, &mapped);
+		checkf(res == VK_SUCCESS, "Error mapping indirect buffer for readback");
+
+		const VkDrawIndexedIndirectCommand* commands = (const VkDrawIndexedIndirectCommand*)mapped;
+		for (uint32_t i = 0; i < outCounts.size(); ++i)
+		{
+			outCounts[i] = commands[i].instanceCount;
+		}
+
+		vkUnmapMemory(ctxt.device, batches.indirectMemory.handle);
+	}
+
+	//what readCulledCounts should return for the same planes
+	void cullReference(const GpuCulling& culling, const BatchedDraws& batches, const glm::vec4* planes, std::vector<uint32_t>& outCounts)
+	{
+		outCounts.assign(batches.commands.size(), 0);
+
+		for (uint32_t i = 0; i < culling.objects.size(); ++i)
+		{
+			const CullObject& object = culling.objects[i];
+			if (sphereInFrustum(planes, object.transform, object.sphere))
+			{
+				outCounts[object.commandIdx]++;
+			}
+		}
+	}
+
+	void destroyGpuCulling(GpuCulling& culling, VkhContext& ctxt)
+	{
+		releaseCullBuffers(culling);
+
+		Timeline::wait(ECommandPoolType::Graphics, Timeline::submittedValue(ECommandPoolType::Graphics));
+		vkDestroyPipeline(ctxt.device, culling.pipeline, nullptr);
+		culling.objects.clear();
+	}
+}
@@ -0,0 +1,73 @@
+#pragma once
+#include "vkh.h"
+#include <vector>
+
+//Times work on the gpu with timestamp queries. Write a timestamp before and after the work in the same command
+//buffer, and once it's finished, gpuTimerMs gives the time between them. Only for the graphics queue, since that's
+//the only one the demos time anything on
+
+namespace vkh
+{
+	struct GpuTimer
+	{
+		VkQueryPool		pool;
+		uint32_t		queryCount;
+		double			nsPerTick;
+		uint64_t		validMask;
+	};
+
+	void createGpuTimer(GpuTimer& outTimer, uint32_t queryCount, VkhContext& ctxt)
+	{
+		uint32_t familyCount = 0;
+		vkGetPhysicalDeviceQueueFamilyProperties(ctxt.gpu.device, &familyCount, nullptr);
+
+		std::vector<VkQueueFamilyProperties> families(familyCount);
+		vkGetPhysicalDeviceQueueFamilyProperties(ctxt.gpu.device, &familyCount, families.data());
+
+		uint32_t validBits = families[ctxt.gpu.graphicsQueueFamilyIdx].timestampValidBits;
+		checkf(validBits > 0, "The graphics queue doesn't support timestamps");
+
+		outTimer.queryCount = queryCount;
+		outTimer.nsPerTick = ctxt.gpu.deviceProps.limits.timestampPeriod;
+		outTimer.validMask = validBits >= 64 ? ~0ull : (1ull << validBits) - 1;
+
+		VkQueryPoolCreateInfo poolInfo = {};
+		poolInfo.sType = VK_STRUCTURE_TYPE_QUERY_POOL_CREATE_INFO;
+		poolInfo.queryType = VK_QUERY_TYPE_TIMESTAMP;
+		poolInfo.queryCount = queryCount;
+
+		VkResult res = vkCreateQueryPool(ctxt.device, &poolInfo, nullptr, &outTimer.pool);
+		checkf(res == VK_SUCCESS, "Error creating timestamp query pool");
+	}
+
+	//queries have to be reset before they're written again, outside of a render pass
+	void resetGpuTimer(GpuTimer& timer, VkCommandBuffer commandBuffer)
+	{
+		vkCmdResetQueryPool(commandBuffer, timer.pool, 0, timer.queryCount);
+	}
+
+	//BOTTOM_OF_PIPE after some work waits for all of it to finish, TOP_OF_PIPE before it doesn't wait for anything
+	void writeGpuTimestamp(GpuTimer& timer, VkCommandBuffer commandBuffer, uint32_t query, VkPipelineStageFlagBits stage)
+	{
+		vkCmdWriteTimestamp(commandBuffer, stage, timer.pool, query);
+	}
+
+	//blocks until both queries have been written
+	double gpuTimerMs(GpuTimer& timer, uint32_t firstQuery, uint32_t lastQuery, VkhContext& ctxt)
+	{
+		uint64_t ticks[2];
+		VkResult res = vkGetQueryPoolResults(ctxt.device, timer.pool, firstQuery, 1, sizeof(uint64_t), &ticks[0], sizeof(uint64_t), VK_QUERY_RESULT_64_BIT | VK_QUERY_RESULT_WAIT_BIT);
+		checkf(res == VK_SUCCESS, "Error reading timestamp query");
+		res = vkGetQueryPoolResults(ctxt.device, timer.pool, lastQuery, 1, sizeof(uint64_t), &ticks[1], sizeof(uint64_t), VK_QUERY_RESULT_64_BIT | VK_QUERY_RESULT_WAIT_BIT);
+		checkf(res == VK_SUCCESS, "Error reading timestamp query");
+
+		uint64_t elapsed = ((ticks[1] & timer.validMask) - (ticks[0] & timer.validMask)) & timer.validMask;
+		return (elapsed * timer.nsPerTick) / 1000000.0;
+	}
+
+	void destroyGpuTimer(GpuTimer& timer, VkhContext& ctxt)
+	{
+		vkDestroyQueryPool(ctxt.device, timer.pool, nullptr);
+		timer.pool = VK_NULL_HANDLE;
+	}
+}
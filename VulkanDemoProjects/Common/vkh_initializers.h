@@ -24,7 +24,7 @@ namespace vkh
 		return layoutBinding;
 	}
 
-	inline VkDescriptorSetLayoutCreateInfo descriptorSetLayoutCreateInfo(VkDescriptorSetLayoutBinding* bindings, uint32_t bindingCount)
+	inline VkDescriptorSetLayoutCreateInfo descriptorSetLayoutCreateInfo(const VkDescriptorSetLayoutBinding* bindings, uint32_t bindingCount)
 	{
 		VkDescriptorSetLayoutCreateInfo layoutInfo = {};
 		layoutInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO;
@@ -139,6 +139,15 @@ namespace vkh
 		return info;
 	}
 
+	inline VkPipelineDynamicStateCreateInfo pipelineDynamicStateCreateInfo(const VkDynamicState* dynamicStates, uint32_t dynamicStateCount)
+	{
+		VkPipelineDynamicStateCreateInfo info = {};
+		info.sType = VK_STRUCTURE_TYPE_PIPELINE_DYNAMIC_STATE_CREATE_INFO;
+		info.pDynamicStates = dynamicStates;
+		info.dynamicStateCount = dynamicStateCount;
+		return info;
+	}
+
 	inline VkPipelineRasterizationStateCreateInfo pipelineRasterizationStateCreateInfo(VkPolygonMode polygonMode, float lineWidth = 1.0f)
 	{
 		VkPipelineRasterizationStateCreateInfo outInfo = {};
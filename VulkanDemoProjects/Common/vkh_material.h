@@ -1,71 +1,455 @@
 #pragma once
 #include "vkh.h"
 #include "file_utils.h"
+#include "hash_utils.h"
+#include "vkh_shader_cache.h"
+#include "vkh_reflection.h"
 #include "vkh_initializers.h"
 #include "vkh_mesh.h"
 #include <vector>
 
+#define MAX_MATERIAL_DESC_SET_LAYOUTS 4
+#define MAX_MATERIAL_PUSH_CONSTANT_RANGES 4
+#define MAX_MATERIAL_VERTEX_ATTRIBUTES 8
+#define MAX_DESC_SET_LAYOUT_BINDINGS 16
+
 namespace vkh
 {
 	struct VkhMaterialCreateInfo
 	{
 		VkRenderPass renderPass;
 
+		//if left empty, set layouts are built from the shaders' reflected bindings, and written back here.
+		//those layouts belong to the PipelineRegistry, and are destroyed along with it
 		std::vector<VkDescriptorSetLayout> descSetLayouts;
 		VkPipelineLayout* outPipelineLayout;
 		VkPipeline* outPipeline;
+
+		//optional, lets one shader module be built into several pipeline variants
+		const VkSpecializationInfo* vertSpecialization;
+		const VkSpecializationInfo* fragSpecialization;
 	};
 
-	void createBasicMaterial(const char* vShaderPath, const char* fShaderPath, VkhContext& ctxt, VkhMaterialCreateInfo& createInfo)
+	//set and pipeline layouts work the same way as for graphics materials, but the pipeline itself isn't
+	//registered anywhere, so the caller owns it and destroys it with vkDestroyPipeline
+	struct VkhComputeCreateInfo
 	{
-		VkPipelineShaderStageCreateInfo shaderStages[2];
+		std::vector<VkDescriptorSetLayout> descSetLayouts;
+		VkPipelineLayout* outPipelineLayout;
+		VkPipeline* outPipeline;
 
-		shaderStages[0] = vkh::shaderPipelineStageCreateInfo(VK_SHADER_STAGE_VERTEX_BIT);
-		DataBuffer* vShaderData = loadBinaryFile(vShaderPath);
-		vkh::createShaderModule(shaderStages[0].module, vShaderData->data, vShaderData->size, ctxt);
+		const VkSpecializationInfo* specialization;
+	};
 
-		shaderStages[1] = vkh::shaderPipelineStageCreateInfo(VK_SHADER_STAGE_FRAGMENT_BIT);
-		DataBuffer* fShaderData = loadBinaryFile(fShaderPath);
-		vkh::createShaderModule(shaderStages[1].module, fShaderData->data, fShaderData->size, ctxt);
+	//owns the storage a VkSpecializationInfo points at. info is refreshed after every add,
+	//so it's safe to pass &info around as long as this struct outlives the material creation call
+	struct VkhSpecializationData
+	{
+		std::vector<VkSpecializationMapEntry> mapEntries;
+		std::vector<char> data;
+		VkSpecializationInfo info;
+	};
+
+	template<typename T>
+	void addSpecializationConstant(VkhSpecializationData& specData, uint32_t constantId, T value)
+	{
+		VkSpecializationMapEntry entry;
+		entry.constantID = constantId;
+		entry.offset = static_cast<uint32_t>(specData.data.size());
+		entry.size = sizeof(T);
+
+		specData.mapEntries.push_back(entry);
+		specData.data.resize(specData.data.size() + sizeof(T));
+		memcpy(&specData.data[entry.offset], &value, sizeof(T));
+
+		specData.info.mapEntryCount = static_cast<uint32_t>(specData.mapEntries.size());
+		specData.info.pMapEntries = specData.mapEntries.data();
+		specData.info.dataSize = specData.data.size();
+		specData.info.pData = specData.data.data();
+	}
+
+	//0 for no specialization, so unspecialized pipelines keep hashing the same way
+	uint64_t hashSpecializationInfo(const VkSpecializationInfo* specInfo)
+	{
+		if (!specInfo || specInfo->mapEntryCount == 0) return 0;
+
+		uint64_t hash = hashBytes(specInfo->pMapEntries, sizeof(VkSpecializationMapEntry) * specInfo->mapEntryCount);
+		return hashBytes(specInfo->pData, specInfo->dataSize, hash);
+	}
+
+	//Keys are hashed and compared as raw bytes, so they have to be memset to 0 before being filled in
+
+	struct DescriptorSetLayoutKey
+	{
+		VkDescriptorSetLayoutBinding	bindings[MAX_DESC_SET_LAYOUT_BINDINGS];
+		uint32_t						bindingCount;
+	};
 
-		VkPipelineLayoutCreateInfo pipelineLayoutInfo = vkh::pipelineLayoutCreateInfo(createInfo.descSetLayouts.data(), createInfo.descSetLayouts.size());
+	struct PipelineLayoutKey
+	{
+		VkDescriptorSetLayout	setLayouts[MAX_MATERIAL_DESC_SET_LAYOUTS];
+		VkPushConstantRange		pushConstantRanges[MAX_MATERIAL_PUSH_CONSTANT_RANGES];
+		uint32_t				setLayoutCount;
+		uint32_t				pushConstantRangeCount;
+	};
 
-		VkPushConstantRange pushConstantRange = {};
-		pushConstantRange.offset = 0;
-		pushConstantRange.size = sizeof(int);
-		pushConstantRange.stageFlags = VK_SHADER_STAGE_FRAGMENT_BIT;
+	struct GraphicsPipelineKey
+	{
+		uint64_t							vertShaderHash;
+		uint64_t							fragShaderHash;
+		uint64_t							vertSpecializationHash;
+		uint64_t							fragSpecializationHash;
+		VkVertexInputAttributeDescription	vertexAttributes[MAX_MATERIAL_VERTEX_ATTRIBUTES];
+		uint32_t							vertexAttributeCount;
+		uint32_t							vertexStride;
+		VkPrimitiveTopology					topology;
+		VkPolygonMode						polygonMode;
+		VkCullModeFlags						cullMode;
+		VkBool32							blendEnabled;
+		VkColorComponentFlags				colorWriteMask;
+		VkBool32							depthTestEnabled;
+		VkBool32							depthWriteEnabled;
+		VkCompareOp							depthCompareOp;
+		uint32_t							subpass;
+		VkRenderPass						renderPass;
+		VkPipelineLayout					layout;
+	};
+}
 
-		pipelineLayoutInfo.pPushConstantRanges = &pushConstantRange;
-		pipelineLayoutInfo.pushConstantRangeCount = 1;
+//Every material that's created goes through here, so that materials with identical state share the
+//same VkDescriptorSetLayout / VkPipelineLayout / VkPipeline instead of creating a new one each time
 
-		VkResult res = vkCreatePipelineLayout(ctxt.device, &pipelineLayoutInfo, nullptr, createInfo.outPipelineLayout);
+namespace vkh::PipelineRegistry
+{
+	struct DescSetLayoutEntry
+	{
+		uint64_t				hash;
+		DescriptorSetLayoutKey	key;
+		VkDescriptorSetLayout	layout;
+	};
+
+	struct LayoutEntry
+	{
+		uint64_t			hash;
+		PipelineLayoutKey	key;
+		VkPipelineLayout	layout;
+	};
+
+	struct PipelineEntry
+	{
+		uint64_t			hash;
+		GraphicsPipelineKey	key;
+		VkPipeline			pipeline;
+
+		//each pipeline holds a reference to its shader modules in the shader cache
+		VkShaderModule		vertModule;
+		VkShaderModule		fragModule;
+	};
+
+	struct RegistryStats
+	{
+		uint32_t descSetLayoutRequests;
+		uint32_t descSetLayoutsCreated;
+		uint32_t layoutRequests;
+		uint32_t layoutsCreated;
+		uint32_t pipelineRequests;
+		uint32_t pipelinesCreated;
+	};
+
+	struct RegistryState
+	{
+		std::vector<DescSetLayoutEntry>	descSetLayouts;
+		std::vector<LayoutEntry>		layouts;
+		std::vector<PipelineEntry>		pipelines;
+		RegistryStats					stats;
+	};
+
+	RegistryState state;
+
+	VkDescriptorSetLayout getOrCreateDescriptorSetLayout(const DescriptorSetLayoutKey& key, VkhContext& ctxt)
+	{
+		state.stats.descSetLayoutRequests++;
+
+		uint64_t hash = hashBytes(&key, sizeof(DescriptorSetLayoutKey));
+		for (uint32_t i = 0; i < state.descSetLayouts.size(); ++i)
+		{
+			const DescSetLayoutEntry& entry = state.descSetLayouts[i];
+			if (entry.hash == hash && memcmp(&entry.key, &key, sizeof(DescriptorSetLayoutKey)) == 0)
+			{
+				return entry.layout;
+			}
+		}
+
+		VkDescriptorSetLayoutCreateInfo layoutInfo = vkh::descriptorSetLayoutCreateInfo(key.bindings, key.bindingCount);
+
+		DescSetLayoutEntry newEntry;
+		newEntry.hash = hash;
+		newEntry.key = key;
+
+		VkResult res = vkCreateDescriptorSetLayout(ctxt.device, &layoutInfo, nullptr, &newEntry.layout);
+		checkf(res == VK_SUCCESS, "Error creating descriptor set layout");
+
+		state.descSetLayouts.push_back(newEntry);
+		state.stats.descSetLayoutsCreated++;
+
+		return newEntry.layout;
+	}
+
+	VkPipelineLayout getOrCreatePipelineLayout(const PipelineLayoutKey& key, VkhContext& ctxt)
+	{
+		state.stats.layoutRequests++;
+
+		uint64_t hash = hashBytes(&key, sizeof(PipelineLayoutKey));
+		for (uint32_t i = 0; i < state.layouts.size(); ++i)
+		{
+			const LayoutEntry& entry = state.layouts[i];
+			if (entry.hash == hash && memcmp(&entry.key, &key, sizeof(PipelineLayoutKey)) == 0)
+			{
+				return entry.layout;
+			}
+		}
+
+		VkPipelineLayoutCreateInfo pipelineLayoutInfo = vkh::pipelineLayoutCreateInfo(key.setLayouts, key.setLayoutCount);
+		pipelineLayoutInfo.pPushConstantRanges = key.pushConstantRangeCount > 0 ? key.pushConstantRanges : nullptr;
+		pipelineLayoutInfo.pushConstantRangeCount = key.pushConstantRangeCount;
+
+		LayoutEntry newEntry;
+		newEntry.hash = hash;
+		newEntry.key = key;
+
+		VkResult res = vkCreatePipelineLayout(ctxt.device, &pipelineLayoutInfo, nullptr, &newEntry.layout);
 		checkf(res == VK_SUCCESS, "Error creating pipeline layout");
 
-		VkVertexInputBindingDescription bindingDescription = vkh::vertexInputBindingDescription(0, sizeof(vkh::Vertex), VK_VERTEX_INPUT_RATE_VERTEX);
+		state.layouts.push_back(newEntry);
+		state.stats.layoutsCreated++;
+
+		return newEntry.layout;
+	}
+
+	//returns VK_NULL_HANDLE if nothing matching the key has been registered yet
+	VkPipeline findPipeline(const GraphicsPipelineKey& key)
+	{
+		state.stats.pipelineRequests++;
+
+		uint64_t hash = hashBytes(&key, sizeof(GraphicsPipelineKey));
+		for (uint32_t i = 0; i < state.pipelines.size(); ++i)
+		{
+			const PipelineEntry& entry = state.pipelines[i];
+			if (entry.hash == hash && memcmp(&entry.key, &key, sizeof(GraphicsPipelineKey)) == 0)
+			{
+				return entry.pipeline;
+			}
+		}
+
+		return VK_NULL_HANDLE;
+	}
+
+	void registerPipeline(const GraphicsPipelineKey& key, VkPipeline pipeline, VkShaderModule vertModule, VkShaderModule fragModule)
+	{
+		PipelineEntry newEntry;
+		newEntry.hash = hashBytes(&key, sizeof(GraphicsPipelineKey));
+		newEntry.key = key;
+		newEntry.pipeline = pipeline;
+		newEntry.vertModule = vertModule;
+		newEntry.fragModule = fragModule;
+
+		state.pipelines.push_back(newEntry);
+		state.stats.pipelinesCreated++;
+	}
+
+	//the caller is responsible for making sure none of these objects are still in use by the gpu
+	void destroyAll(VkhContext& ctxt)
+	{
+		for (uint32_t i = 0; i < state.pipelines.size(); ++i)
+		{
+			vkDestroyPipeline(ctxt.device, state.pipelines[i].pipeline, nullptr);
+			ShaderCache::release(state.pipelines[i].vertModule, ctxt);
+			ShaderCache::release(state.pipelines[i].fragModule, ctxt);
+		}
+
+		for (uint32_t i = 0; i < state.layouts.size(); ++i)
+		{
+			vkDestroyPipelineLayout(ctxt.device, state.layouts[i].layout, nullptr);
+		}
+
+		for (uint32_t i = 0; i < state.descSetLayouts.size(); ++i)
+		{
+			vkDestroyDescriptorSetLayout(ctxt.device, state.descSetLayouts[i].layout, nullptr);
+		}
+
+		state.pipelines.clear();
+		state.layouts.clear();
+		state.descSetLayouts.clear();
+	}
+
+	RegistryStats stats()
+	{
+		return state.stats;
+	}
+}
+
+namespace vkh
+{
+	//does nothing if outLayouts already has layouts in it, so callers can supply their own
+	void getReflectedSetLayouts(const Reflection::ShaderInterface& shaderInterface, std::vector<VkDescriptorSetLayout>& outLayouts, VkhContext& ctxt)
+	{
+		if (outLayouts.size() > 0) return;
+
+		std::vector<VkDescriptorSetLayoutBinding> setBindings;
+		uint32_t setCount = Reflection::setCount(shaderInterface);
+
+		for (uint32_t set = 0; set < setCount; ++set)
+		{
+			Reflection::setLayoutBindings(shaderInterface, set, setBindings);
+			checkf(setBindings.size() <= MAX_DESC_SET_LAYOUT_BINDINGS, "Too many bindings in a single descriptor set");
+
+			DescriptorSetLayoutKey setKey;
+			memset(&setKey, 0, sizeof(DescriptorSetLayoutKey));
+			setKey.bindingCount = static_cast<uint32_t>(setBindings.size());
+			for (uint32_t i = 0; i < setKey.bindingCount; ++i)
+			{
+				setKey.bindings[i] = setBindings[i];
+			}
+
+			outLayouts.push_back(PipelineRegistry::getOrCreateDescriptorSetLayout(setKey, ctxt));
+		}
+	}
+
+	VkPipelineLayout getReflectedPipelineLayout(const Reflection::ShaderInterface& shaderInterface, const std::vector<VkDescriptorSetLayout>& setLayouts, VkhContext& ctxt)
+	{
+		PipelineLayoutKey layoutKey;
+		memset(&layoutKey, 0, sizeof(PipelineLayoutKey));
+
+		checkf(setLayouts.size() <= MAX_MATERIAL_DESC_SET_LAYOUTS, "Too many descriptor set layouts for a single material");
+		layoutKey.setLayoutCount = static_cast<uint32_t>(setLayouts.size());
+		for (uint32_t i = 0; i < layoutKey.setLayoutCount; ++i)
+		{
+			layoutKey.setLayouts[i] = setLayouts[i];
+		}
+
+		if (shaderInterface.pushConstants.size > 0)
+		{
+			layoutKey.pushConstantRangeCount = 1;
+			layoutKey.pushConstantRanges[0] = shaderInterface.pushConstants;
+		}
+
+		return PipelineRegistry::getOrCreatePipelineLayout(layoutKey, ctxt);
+	}
+
+	void createComputeMaterial(const char* shaderPath, VkhContext& ctxt, VkhComputeCreateInfo& createInfo)
+	{
+		ShaderModule shader = ShaderCache::acquire(shaderPath, ctxt);
+
+		Reflection::ShaderInterface shaderInterface;
+		Reflection::reflect(shader.code, shader.codeSize, shaderInterface, createInfo.specialization);
+		checkf(shaderInterface.stageFlags == VK_SHADER_STAGE_COMPUTE_BIT, "Compute materials need a compute shader");
+
+		getReflectedSetLayouts(shaderInterface, createInfo.descSetLayouts, ctxt);
+		*createInfo.outPipelineLayout = getReflectedPipelineLayout(shaderInterface, createInfo.descSetLayouts, ctxt);
+
+		VkComputePipelineCreateInfo pipelineInfo = {};
+		pipelineInfo.sType = VK_STRUCTURE_TYPE_COMPUTE_PIPELINE_CREATE_INFO;
+		pipelineInfo.stage = vkh::shaderPipelineStageCreateInfo(VK_SHADER_STAGE_COMPUTE_BIT);
+		pipelineInfo.stage.module = shader.handle;
+		pipelineInfo.stage.pSpecializationInfo = createInfo.specialization;
+		pipelineInfo.layout = *createInfo.outPipelineLayout;
+		pipelineInfo.basePipelineHandle = VK_NULL_HANDLE;
+		pipelineInfo.basePipelineIndex = -1;
+
+		VkResult res = vkCreateComputePipelines(ctxt.device, VK_NULL_HANDLE, 1, &pipelineInfo, nullptr, createInfo.outPipeline);
+		checkf(res == VK_SUCCESS, "Error creating compute pipeline");
+
+		//nothing else holds on to compute modules, and the pipeline doesn't need it once it's been created
+		ShaderCache::release(shader.handle, ctxt);
+	}
+
+	void createBasicMaterial(const char* vShaderPath, const char* fShaderPath, VkhContext& ctxt, VkhMaterialCreateInfo& createInfo)
+	{
+		ShaderModule vShader = ShaderCache::acquire(vShaderPath, ctxt);
+		ShaderModule fShader = ShaderCache::acquire(fShaderPath, ctxt);
+
+		Reflection::ShaderInterface shaderInterface;
+		Reflection::ShaderInterface fragInterface;
+		Reflection::reflect(vShader.code, vShader.codeSize, shaderInterface, createInfo.vertSpecialization);
+		Reflection::reflect(fShader.code, fShader.codeSize, fragInterface, createInfo.fragSpecialization);
+		Reflection::merge(shaderInterface, fragInterface);
+
+		getReflectedSetLayouts(shaderInterface, createInfo.descSetLayouts, ctxt);
+		*createInfo.outPipelineLayout = getReflectedPipelineLayout(shaderInterface, createInfo.descSetLayouts, ctxt);
 
 		const vkh::VertexRenderData* vertexLayout = vkh::Mesh::vertexRenderData();
+		checkf(vertexLayout->attrCount <= MAX_MATERIAL_VERTEX_ATTRIBUTES, "Too many vertex attributes for a single material");
+
+		GraphicsPipelineKey pipelineKey;
+		memset(&pipelineKey, 0, sizeof(GraphicsPipelineKey));
+		pipelineKey.vertShaderHash = vShader.contentHash;
+		pipelineKey.fragShaderHash = fShader.contentHash;
+		pipelineKey.vertSpecializationHash = hashSpecializationInfo(createInfo.vertSpecialization);
+		pipelineKey.fragSpecializationHash = hashSpecializationInfo(createInfo.fragSpecialization);
+		pipelineKey.vertexAttributeCount = vertexLayout->attrCount;
+		memcpy(pipelineKey.vertexAttributes, vertexLayout->attrDescriptions, sizeof(VkVertexInputAttributeDescription) * vertexLayout->attrCount);
+		pipelineKey.vertexStride = sizeof(vkh::Vertex);
+		pipelineKey.topology = VK_PRIMITIVE_TOPOLOGY_TRIANGLE_LIST;
+		pipelineKey.polygonMode = VK_POLYGON_MODE_FILL;
+		pipelineKey.cullMode = VK_CULL_MODE_BACK_BIT;
+		pipelineKey.blendEnabled = VK_FALSE;
+		pipelineKey.colorWriteMask = VK_COLOR_COMPONENT_R_BIT | VK_COLOR_COMPONENT_G_BIT | VK_COLOR_COMPONENT_B_BIT | VK_COLOR_COMPONENT_A_BIT;
+		pipelineKey.depthTestEnabled = VK_TRUE;
+		pipelineKey.depthWriteEnabled = VK_TRUE;
+		pipelineKey.depthCompareOp = VK_COMPARE_OP_LESS;
+		pipelineKey.subpass = 0;
+		pipelineKey.renderPass = createInfo.renderPass;
+		pipelineKey.layout = *createInfo.outPipelineLayout;
+
+		*createInfo.outPipeline = PipelineRegistry::findPipeline(pipelineKey);
+		if (*createInfo.outPipeline != VK_NULL_HANDLE)
+		{
+			//the registered pipeline already holds references to these modules
+			ShaderCache::release(vShader.handle, ctxt);
+			ShaderCache::release(fShader.handle, ctxt);
+			return;
+		}
+
+		VkPipelineShaderStageCreateInfo shaderStages[2];
+
+		shaderStages[0] = vkh::shaderPipelineStageCreateInfo(VK_SHADER_STAGE_VERTEX_BIT);
+		shaderStages[0].module = vShader.handle;
+		shaderStages[0].pSpecializationInfo = createInfo.vertSpecialization;
+
+		shaderStages[1] = vkh::shaderPipelineStageCreateInfo(VK_SHADER_STAGE_FRAGMENT_BIT);
+		shaderStages[1].module = fShader.handle;
+		shaderStages[1].pSpecializationInfo = createInfo.fragSpecialization;
+
+		//everything below is built from pipelineKey, so that the key always describes the pipeline that actually gets created
+		VkVertexInputBindingDescription bindingDescription = vkh::vertexInputBindingDescription(0, pipelineKey.vertexStride, VK_VERTEX_INPUT_RATE_VERTEX);
 
 		VkPipelineVertexInputStateCreateInfo vertexInputInfo = vkh::pipelineVertexInputStateCreateInfo();
 		vertexInputInfo.vertexBindingDescriptionCount = 1;
-		vertexInputInfo.vertexAttributeDescriptionCount = vertexLayout->attrCount;
+		vertexInputInfo.vertexAttributeDescriptionCount = pipelineKey.vertexAttributeCount;
 		vertexInputInfo.pVertexBindingDescriptions = &bindingDescription;
-		vertexInputInfo.pVertexAttributeDescriptions = &vertexLayout->attrDescriptions[0];
+		vertexInputInfo.pVertexAttributeDescriptions = &pipelineKey.vertexAttributes[0];
+
+		VkPipelineInputAssemblyStateCreateInfo inputAssembly = vkh::pipelineInputAssemblyStateCreateInfo(pipelineKey.topology, VK_FALSE);
 
-		VkPipelineInputAssemblyStateCreateInfo inputAssembly = vkh::pipelineInputAssemblyStateCreateInfo(VK_PRIMITIVE_TOPOLOGY_TRIANGLE_LIST, VK_FALSE);
-		VkViewport viewport = vkh::viewport(0, 0, static_cast<float>(ctxt.swapChain.extent.width), static_cast<float>(ctxt.swapChain.extent.height));
-		VkRect2D scissor = vkh::rect2D(0, 0, ctxt.swapChain.extent.width, ctxt.swapChain.extent.height);
-		VkPipelineViewportStateCreateInfo viewportState = vkh::pipelineViewportStateCreateInfo(&viewport, 1, &scissor, 1);
+		//viewport and scissor are set when recording command buffers (see setViewportAndScissor), so that the
+		//pipeline doesn't depend on the swap chain extent, and doesn't need rebuilding when the window is resized
+		VkPipelineViewportStateCreateInfo viewportState = vkh::pipelineViewportStateCreateInfo(nullptr, 1, nullptr, 1);
+
+		VkDynamicState dynamicStates[] = { VK_DYNAMIC_STATE_VIEWPORT, VK_DYNAMIC_STATE_SCISSOR };
+		VkPipelineDynamicStateCreateInfo dynamicState = vkh::pipelineDynamicStateCreateInfo(dynamicStates, 2);
+
+		VkPipelineRasterizationStateCreateInfo rasterizer = vkh::pipelineRasterizationStateCreateInfo(pipelineKey.polygonMode);
+		rasterizer.cullMode = pipelineKey.cullMode;
 
-		VkPipelineRasterizationStateCreateInfo rasterizer = vkh::pipelineRasterizationStateCreateInfo(VK_POLYGON_MODE_FILL);
 		VkPipelineMultisampleStateCreateInfo multisampling = vkh::pipelineMultisampleStateCreateInfo();
 
-		VkPipelineColorBlendAttachmentState colorBlendAttachment = vkh::pipelineColorBlendAttachmentState(VK_COLOR_COMPONENT_R_BIT | VK_COLOR_COMPONENT_G_BIT | VK_COLOR_COMPONENT_B_BIT | VK_COLOR_COMPONENT_A_BIT, VK_FALSE);
+		VkPipelineColorBlendAttachmentState colorBlendAttachment = vkh::pipelineColorBlendAttachmentState(pipelineKey.colorWriteMask, pipelineKey.blendEnabled);
 		VkPipelineColorBlendStateCreateInfo colorBlending = vkh::pipelineColorBlendStateCreateInfo(colorBlendAttachment);
 
 		VkPipelineDepthStencilStateCreateInfo depthStencil = vkh::pipelineDepthStencilStateCreateInfo(
-			VK_TRUE,
-			VK_TRUE,
-			VK_COMPARE_OP_LESS);
+			pipelineKey.depthTestEnabled,
+			pipelineKey.depthWriteEnabled,
+			pipelineKey.depthCompareOp);
 
 		VkGraphicsPipelineCreateInfo pipelineInfo = {};
 		pipelineInfo.sType = VK_STRUCTURE_TYPE_GRAPHICS_PIPELINE_CREATE_INFO;
@@ -78,21 +462,20 @@ namespace vkh
 		pipelineInfo.pMultisampleState = &multisampling;
 		pipelineInfo.pDepthStencilState = nullptr; // Optional
 		pipelineInfo.pColorBlendState = &colorBlending;
-		pipelineInfo.pDynamicState = nullptr; // Optional
-		pipelineInfo.layout = *createInfo.outPipelineLayout;
-		pipelineInfo.renderPass = createInfo.renderPass;
+		pipelineInfo.pDynamicState = &dynamicState;
+		pipelineInfo.layout = pipelineKey.layout;
+		pipelineInfo.renderPass = pipelineKey.renderPass;
 		pipelineInfo.pDepthStencilState = &depthStencil;
 
-		pipelineInfo.subpass = 0;
+		pipelineInfo.subpass = pipelineKey.subpass;
 
 		//can use this to create new pipelines by deriving from old ones
 		pipelineInfo.basePipelineHandle = VK_NULL_HANDLE;
 		pipelineInfo.basePipelineIndex = -1;
 
-		res = vkCreateGraphicsPipelines(ctxt.device, VK_NULL_HANDLE, 1, &pipelineInfo, nullptr, createInfo.outPipeline);
+		VkResult res = vkCreateGraphicsPipelines(ctxt.device, VK_NULL_HANDLE, 1, &pipelineInfo, nullptr, createInfo.outPipeline);
 		checkf(res == VK_SUCCESS, "Error creating graphics pipeline");
 
-		freeDataBuffer(vShaderData);
-		freeDataBuffer(fShaderData);
+		PipelineRegistry::registerPipeline(pipelineKey, *createInfo.outPipeline, vShader.handle, fShader.handle);
 	}
-}
\ No newline at end of file
+}
@@ -0,0 +1,118 @@
+#pragma once
+#include "vkh_types.h"
+#include "debug.h"
+
+//How much of each memory heap we can use and how much is used already. With VK_EXT_memory_budget the driver tells
+//us both, including what other processes are using, otherwise the budget is a fraction of the heap's size and the
+//usage is whatever our own allocator has handed out from it. update() refreshes the numbers, call it once a frame
+//or before anything that needs to know whether an allocation will fit
+
+//the vulkan headers in external/ predate VK_EXT_memory_budget, so declare what we need from it here
+#ifndef VK_EXT_memory_budget
+#define VK_EXT_memory_budget 1
+#define VK_EXT_MEMORY_BUDGET_EXTENSION_NAME "VK_EXT_memory_budget"
+
+#define VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_MEMORY_BUDGET_PROPERTIES_EXT ((VkStructureType)1000237000)
+
+typedef struct VkPhysicalDeviceMemoryBudgetPropertiesEXT
+{
+	VkStructureType		sType;
+	void*				pNext;
+	VkDeviceSize		heapBudget[VK_MAX_MEMORY_HEAPS];
+	VkDeviceSize		heapUsage[VK_MAX_MEMORY_HEAPS];
+} VkPhysicalDeviceMemoryBudgetPropertiesEXT;
+#endif
+
+//how much of a heap to treat as ours when the driver can't tell us, leaving room for other processes and the driver
+#define MEMORY_BUDGET_FALLBACK_PERCENT 80
+
+namespace vkh::MemoryBudget
+{
+	struct HeapBudget
+	{
+		VkDeviceSize	budget;
+		VkDeviceSize	usage;
+	};
+
+	struct MemoryBudgetState
+	{
+		bool											useExtension;
+		PFN_vkGetPhysicalDeviceMemoryProperties2KHR		getMemoryProperties2;
+
+		HeapBudget										heaps[VK_MAX_MEMORY_HEAPS];
+		VkhContext*										context;
+	};
+
+	MemoryBudgetState state;
+
+	void update();
+
+	//useExtension is whether VK_EXT_memory_budget was enabled on the device, needs the allocator to be active
+	void init(VkhContext& ctxt, bool useExtension)
+	{
+		state.context = &ctxt;
+		state.useExtension = useExtension;
+		state.getMemoryProperties2 = nullptr;
+
+		if (useExtension)
+		{
+			state.getMemoryProperties2 = (PFN_vkGetPhysicalDeviceMemoryProperties2KHR)vkGetInstanceProcAddr(ctxt.instance, "vkGetPhysicalDeviceMemoryProperties2KHR");
+			state.useExtension = state.getMemoryProperties2 != nullptr;
+		}
+
+		printf("Memory budget: %s\n", state.useExtension ? VK_EXT_MEMORY_BUDGET_EXTENSION_NAME : "estimated from heap sizes");
+		update();
+	}
+
+	void update()
+	{
+		const VkPhysicalDeviceMemoryProperties& memProps = state.context->gpu.memProps;
+
+		if (state.useExtension)
+		{
+			VkPhysicalDeviceMemoryBudgetPropertiesEXT budgetProps = {};
+			budgetProps.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_MEMORY_BUDGET_PROPERTIES_EXT;
+
+			VkPhysicalDeviceMemoryProperties2KHR memProps2 = {};
+			memProps2.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_MEMORY_PROPERTIES_2_KHR;
+			memProps2.pNext = &budgetProps;
+
+			state.getMemoryProperties2(state.context->gpu.device, &memProps2);
+
+			for (uint32_t i = 0; i < memProps.memoryHeapCount; ++i)
+			{
+				state.heaps[i].budget = budgetProps.heapBudget[i];
+				state.heaps[i].usage = budgetProps.heapUsage[i];
+			}
+			return;
+		}
+
+		for (uint32_t i = 0; i < memProps.memoryHeapCount; ++i)
+		{
+			state.heaps[i].budget = (memProps.memoryHeaps[i].size / 100) * MEMORY_BUDGET_FALLBACK_PERCENT;
+			state.heaps[i].usage = 0;
+		}
+
+		for (uint32_t i = 0; i < memProps.memoryTypeCount; ++i)
+		{
+			state.heaps[memProps.memoryTypes[i].heapIndex].usage += state.context->allocator.allocatedSize(i);
+		}
+	}
+
+	//as of the last update
+	HeapBudget heapBudget(uint32_t heapIdx)
+	{
+		return state.heaps[heapIdx];
+	}
+
+	uint32_t heapForMemoryType(uint32_t memoryType)
+	{
+		return state.context->gpu.memProps.memoryTypes[memoryType].heapIndex;
+	}
+
+	//whether size more bytes fit in a heap's budget, as of the last update
+	bool fitsInBudget(uint32_t heapIdx, VkDeviceSize size)
+	{
+		return state.heaps[heapIdx].usage + size <= state.heaps[heapIdx].budget;
+	}
+}
@@ -31,6 +31,33 @@ namespace vkh
 		uint32_t vCount;
 		uint32_t iCount;
 	};
+
+	//one vertex and one index buffer shared by many meshes, so draws of different meshes can share the same binds
+	//and be issued from a single indirect buffer
+	struct MeshPool
+	{
+		VkBuffer vBuffer;
+		VkBuffer iBuffer;
+
+		Allocation vBufferMemory;
+		Allocation iBufferMemory;
+
+		uint32_t vCount;
+		uint32_t iCount;
+		uint32_t vCapacity;
+		uint32_t iCapacity;
+	};
+
+	//where a mesh lives inside a MeshPool, in the terms vkCmdDrawIndexed wants
+	struct PooledMesh
+	{
+		VkBuffer vBuffer;
+		VkBuffer iBuffer;
+
+		uint32_t firstIndex;
+		uint32_t iCount;
+		int32_t vertexOffset;
+	};
 }
 
 namespace vkh::Mesh
@@ -64,7 +91,7 @@ namespace vkh::Mesh
 			m.vBufferMemory,
 			vBufferSize,
 			VK_BUFFER_USAGE_TRANSFER_DST_BIT | VK_BUFFER_USAGE_VERTEX_BUFFER_BIT,
-			VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,
+			uploadDestinationProperties(ctxt),
 			ctxt
 		);
 
@@ -72,54 +99,75 @@ namespace vkh::Mesh
 			m.iBufferMemory,
 			iBufferSize,
 			VK_BUFFER_USAGE_TRANSFER_DST_BIT | VK_BUFFER_USAGE_INDEX_BUFFER_BIT,
-			VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,
+			uploadDestinationProperties(ctxt),
 			ctxt
 		);
 
+		//written directly if the gpu allows it, otherwise staged and copied on the transfer queue
+		uploadToBuffer(m.vBuffer, m.vBufferMemory, 0, vertices, sizeof(Vertex) * vertexCount, ctxt);
+		uploadToBuffer(m.iBuffer, m.iBufferMemory, 0, indices, iBufferSize, ctxt);
+	}
 
-		//transfer data to the above buffers
-		VkBuffer stagingBuffer;
-		Allocation stagingMemory;
-
-		createBuffer(stagingBuffer,
-			stagingMemory,
-			vBufferSize,
-			VK_BUFFER_USAGE_TRANSFER_SRC_BIT | VK_BUFFER_USAGE_VERTEX_BUFFER_BIT,
-			VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
+	void createPool(MeshPool& outPool, uint32_t vertexCapacity, uint32_t indexCapacity, VkhContext& ctxt)
+	{
+		outPool.vCount = 0;
+		outPool.iCount = 0;
+		outPool.vCapacity = vertexCapacity;
+		outPool.iCapacity = indexCapacity;
+
+		createBuffer(outPool.vBuffer,
+			outPool.vBufferMemory,
+			sizeof(Vertex) * vertexCapacity,
+			VK_BUFFER_USAGE_TRANSFER_DST_BIT | VK_BUFFER_USAGE_VERTEX_BUFFER_BIT,
+			uploadDestinationProperties(ctxt),
 			ctxt
 		);
 
-		void* data;
-		vkMapMemory(ctxt.device, stagingMemory.handle, stagingMemory.offset, vBufferSize, 0, &data);
-		memcpy(data, vertices, (size_t)vBufferSize);
-		vkUnmapMemory(ctxt.device, stagingMemory.handle);
-
-		//copy to device local here
-		copyBuffer(stagingBuffer, m.vBuffer, vBufferSize, 0, 0, ctxt);
-		freeDeviceMemory(stagingMemory);
-		vkDestroyBuffer(ctxt.device, stagingBuffer, nullptr);
-
-		createBuffer(stagingBuffer,
-			stagingMemory,
-			iBufferSize,
-			VK_BUFFER_USAGE_TRANSFER_SRC_BIT | VK_BUFFER_USAGE_INDEX_BUFFER_BIT,
-			VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
+		createBuffer(outPool.iBuffer,
+			outPool.iBufferMemory,
+			sizeof(uint32_t) * indexCapacity,
+			VK_BUFFER_USAGE_TRANSFER_DST_BIT | VK_BUFFER_USAGE_INDEX_BUFFER_BIT,
+			uploadDestinationProperties(ctxt),
 			ctxt
 		);
+	}
 
-		vkMapMemory(ctxt.device, stagingMemory.handle, stagingMemory.offset, iBufferSize, 0, &data);
-		memcpy(data, indices, (size_t)iBufferSize);
-		vkUnmapMemory(ctxt.device, stagingMemory.handle);
-
-		copyBuffer(stagingBuffer, m.iBuffer, iBufferSize, 0, 0, ctxt);
-		freeDeviceMemory(stagingMemory);
-		vkDestroyBuffer(ctxt.device, stagingBuffer, nullptr);
+	//indices stay relative to the mesh's own vertices, vertexOffset takes care of where they ended up in the pool
+	PooledMesh addToPool(MeshPool& pool, VkhContext& ctxt, Vertex* vertices, uint32_t vertexCount, uint32_t* indices, uint32_t indexCount)
+	{
+		checkf(pool.vCount + vertexCount <= pool.vCapacity, "Mesh pool is out of vertex space");
+		checkf(pool.iCount + indexCount <= pool.iCapacity, "Mesh pool is out of index space");
+
+		PooledMesh mesh;
+		mesh.vBuffer = pool.vBuffer;
+		mesh.iBuffer = pool.iBuffer;
+		mesh.firstIndex = pool.iCount;
+		mesh.iCount = indexCount;
+		mesh.vertexOffset = static_cast<int32_t>(pool.vCount);
+
+		uploadToBuffer(pool.vBuffer, pool.vBufferMemory, sizeof(Vertex) * pool.vCount, vertices, sizeof(Vertex) * vertexCount, ctxt);
+		uploadToBuffer(pool.iBuffer, pool.iBufferMemory, sizeof(uint32_t) * pool.iCount, indices, sizeof(uint32_t) * indexCount, ctxt);
+
+		pool.vCount += vertexCount;
+		pool.iCount += indexCount;
+		return mesh;
 	}
 
-	void quad(MeshAsset& outAsset, VkhContext& ctxt, float width = 2.0f, float height = 2.0f, float xOffset = 0.0f, float yOffset = 0.0f)
+	//frames in flight can still be drawing from the pool, so its buffers go through the deletion queue
+	void destroyPool(MeshPool& pool)
 	{
-		std::vector<Vertex> verts;
+		uint64_t lastUse = Timeline::submittedValue(ECommandPoolType::Graphics);
+		DeletionQueue::destroyBuffer(pool.vBuffer, pool.vBufferMemory, ECommandPoolType::Graphics, lastUse);
+		DeletionQueue::destroyBuffer(pool.iBuffer, pool.iBufferMemory, ECommandPoolType::Graphics, lastUse);
+		pool.vBuffer = VK_NULL_HANDLE;
+		pool.iBuffer = VK_NULL_HANDLE;
+		pool.vCount = 0;
+		pool.iCount = 0;
+	}
 
+	//outVerts needs room for 4 vertices, and outIndices for 6 indices
+	void quadVertices(Vertex* outVerts, uint32_t* outIndices, float width = 2.0f, float height = 2.0f, float xOffset = 0.0f, float yOffset = 0.0f)
+	{
 		float wComp = width / 2.0f;
 		float hComp = height / 2.0f;
 
@@ -128,13 +176,21 @@ namespace vkh::Mesh
 		glm::vec3 rbCorner = glm::vec3(wComp + xOffset, lbCorner.y, 0.0f);
 		glm::vec3 rtCorner = glm::vec3(rbCorner.x, ltCorner.y, 0.0f);
 
-		verts.push_back({ rtCorner,  glm::vec2(1.0f,1.0f), glm::vec4(1.0f,1.0f,1.0f,1.0f) });
-		verts.push_back({ ltCorner, glm::vec2(0.0f,1.0f), glm::vec4(0.0f,1.0f,1.0f,1.0f) });
-		verts.push_back({ lbCorner,glm::vec2(0.0f,0.0f), glm::vec4(1.0f,1.0f,1.0f,1.0f) });
-		verts.push_back({ rbCorner, glm::vec2(1.0f,0.0f), glm::vec4(1.0f,1.0f,1.0f,1.0f) });
+		outVerts[0] = { rtCorner,  glm::vec2(1.0f,1.0f), glm::vec4(1.0f,1.0f,1.0f,1.0f) };
+		outVerts[1] = { ltCorner, glm::vec2(0.0f,1.0f), glm::vec4(0.0f,1.0f,1.0f,1.0f) };
+		outVerts[2] = { lbCorner,glm::vec2(0.0f,0.0f), glm::vec4(1.0f,1.0f,1.0f,1.0f) };
+		outVerts[3] = { rbCorner, glm::vec2(1.0f,0.0f), glm::vec4(1.0f,1.0f,1.0f,1.0f) };
 
 		uint32_t indices[6] = { 0,2,1,2,0,3 };
+		memcpy(outIndices, indices, sizeof(indices));
+	}
+
+	void quad(MeshAsset& outAsset, VkhContext& ctxt, float width = 2.0f, float height = 2.0f, float xOffset = 0.0f, float yOffset = 0.0f)
+	{
+		Vertex verts[4];
+		uint32_t indices[6];
+		quadVertices(verts, indices, width, height, xOffset, yOffset);
 
-		make(outAsset, ctxt, &verts[0], static_cast<uint32_t>(verts.size()), &indices[0], 6);
+		make(outAsset, ctxt, &verts[0], 4, &indices[0], 6);
 	}
 }
\ No newline at end of file
@@ -0,0 +1,82 @@
+#pragma once
+#include "vkh.h"
+#include "vkh_tracked_buffer.h"
+
+//Per object data in a readonly std430 storage buffer, for when there's more of it than fits in a uniform buffer.
+//Uniform buffers top out at maxUniformBufferRange, which is only 64KB on a lot of hardware, where storage buffers can
+//usually be as big as memory allows (maxStorageBufferRange is at least 128MB). Shaders index it with a push constant
+//or gl_InstanceIndex, eg:
+//
+//	layout(binding = 0, set = 0) readonly buffer OBJECTS { Data48 entries[]; } objects;
+//
+//Entries are written to a cpu side copy (objectStoreEntry, or writeBlockElement from vkh_block_layout.h with a std430
+//layout), and uploadObjectStore copies the entries written since the last upload to the device local buffer. It only
+//copies the ones that were written, so changing a handful of entries in a big store doesn't upload all of it
+
+namespace vkh
+{
+	struct ObjectStore
+	{
+		TrackedBuffer	tracked;
+
+		uint32_t		stride;
+		uint32_t		capacity;
+	};
+
+	//stride is the std430 array stride of one entry
+	void createObjectStore(ObjectStore& outStore, uint32_t stride, uint32_t capacity, VkhContext& ctxt)
+	{
+		VkDeviceSize size = (VkDeviceSize)stride * capacity;
+		checkf(size <= ctxt.gpu.deviceProps.limits.maxStorageBufferRange, "Object store is bigger than a storage buffer can be");
+
+		outStore.stride = stride;
+		outStore.capacity = capacity;
+		createTrackedBuffer(outStore.tracked, size, VK_BUFFER_USAGE_STORAGE_BUFFER_BIT, ctxt);
+	}
+
+	//returns where to write the entry, and marks it to go up with the next upload
+	char* objectStoreEntry(ObjectStore& store, uint32_t idx)
+	{
+		checkf(idx < store.capacity, "Writing past the end of an object store");
+
+		return trackedBufferData(store.tracked, (VkDeviceSize)idx * store.stride, store.stride);
+	}
+
+	void writeObjects(ObjectStore& store, uint32_t first, uint32_t count, const void* entries)
+	{
+		if (count == 0) return;
+
+		checkf(first + count <= store.capacity, "Writing past the end of an object store");
+		writeTrackedBuffer(store.tracked, (VkDeviceSize)first * store.stride, entries, (VkDeviceSize)count * store.stride);
+	}
+
+	//returns the transfer timeline value the upload signals, or 0 if nothing had been written
+	uint64_t uploadObjectStore(ObjectStore& store, VkhContext& ctxt)
+	{
+		return flushTrackedBuffer(store.tracked, ctxt);
+	}
+
+	void writeObjectStoreDescriptor(ObjectStore& store, VkDescriptorSet set, uint32_t binding, VkhContext& ctxt)
+	{
+		VkDescriptorBufferInfo bufferInfo = {};
+		bufferInfo.buffer = store.tracked.buffer;
+		bufferInfo.offset = 0;
+		bufferInfo.range = VK_WHOLE_SIZE;
+
+		VkWriteDescriptorSet setWrite = {};
+		setWrite.sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+		setWrite.dstSet = set;
+		setWrite.dstBinding = binding;
+		setWrite.dstArrayElement = 0;
+		setWrite.descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+		setWrite.descriptorCount = 1;
+		setWrite.pBufferInfo = &bufferInfo;
+
+		vkUpdateDescriptorSets(ctxt.device, 1, &setWrite, 0, nullptr);
+	}
+
+	void destroyObjectStore(ObjectStore& store)
+	{
+		destroyTrackedBuffer(store.tracked);
+	}
+}
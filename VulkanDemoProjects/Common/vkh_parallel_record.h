@@ -0,0 +1,227 @@
+#pragma once
+#include "vkh_types.h"
+#include "vkh.h"
+#include <vector>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+
+//Splits a list of draws across worker threads, each recording its share into a secondary command buffer that the
+//primary then runs with vkCmdExecuteCommands. Every thread gets its own command pool per frame in flight, since pools
+//can't be used from more than one thread at once, and the pools are reset whole when the frame comes back around.
+//The calling thread records the first chunk itself, so threadCount includes it
+
+#define MAX_RECORD_THREADS 16
+
+//splitting tiny draw lists costs more in thread handoff than it saves, so every chunk gets at least this many draws
+#define MIN_DRAWS_PER_THREAD 64
+
+namespace vkh::ParallelRecord
+{
+	//records draws [firstDraw, firstDraw + drawCount) into commandBuffer. Secondary command buffers don't inherit
+	//bound state or dynamic state from the primary, so this has to set the viewport, scissor and descriptor sets itself
+	typedef void(*RecordFunc)(VkCommandBuffer commandBuffer, uint32_t firstDraw, uint32_t drawCount, void* userData);
+
+	struct RecordJob
+	{
+		RecordFunc						func;
+		void*							userData;
+		VkCommandBufferInheritanceInfo	inheritance;
+		uint32_t						drawCount;
+		uint32_t						drawsPerChunk;
+		uint32_t						chunkCount;
+		uint32_t						frameIdx;
+	};
+
+	struct ThreadFrameData
+	{
+		VkCommandPool					pool;
+		VkCommandBuffer					secondary;
+	};
+
+	struct ParallelRecordState
+	{
+		VkDevice						device;
+		uint32_t						threadCount;
+
+		//indexed by frameIdx * threadCount + threadIdx
+		std::vector<ThreadFrameData>	frameData;
+		std::vector<std::thread>		workers;
+
+		std::mutex						lock;
+		std::condition_variable			jobReady;
+		std::condition_variable			jobDone;
+		RecordJob						job;
+		uint64_t						jobGeneration;
+		uint32_t						workersBusy;
+		bool							shuttingDown;
+	};
+
+	ParallelRecordState state;
+
+	void recordChunk(uint32_t threadIdx, const RecordJob& job)
+	{
+		ThreadFrameData& data = state.frameData[job.frameIdx * state.threadCount + threadIdx];
+
+		//acquireFrame already waited for the gpu to finish the last submit that used this frame
+		VkResult res = vkResetCommandPool(state.device, data.pool, 0);
+		checkf(res == VK_SUCCESS, "Error resetting parallel record command pool");
+
+		VkCommandBufferBeginInfo beginInfo = {};
+		beginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+		beginInfo.flags = VK_COMMAND_BUFFER_USAGE_RENDER_PASS_CONTINUE_BIT | VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+		beginInfo.pInheritanceInfo = &job.inheritance;
+
+		res = vkBeginCommandBuffer(data.secondary, &beginInfo);
+		checkf(res == VK_SUCCESS, "Error beginning secondary command buffer");
+
+		uint32_t firstDraw = threadIdx * job.drawsPerChunk;
+		uint32_t drawCount = job.drawCount - firstDraw < job.drawsPerChunk ? job.drawCount - firstDraw : job.drawsPerChunk;
+		job.func(data.secondary, firstDraw, drawCount, job.userData);
+
+		res = vkEndCommandBuffer(data.secondary);
+		checkf(res == VK_SUCCESS, "Error ending secondary command buffer");
+	}
+
+	void workerMain(uint32_t threadIdx)
+	{
+		uint64_t seenGeneration = 0;
+
+		while (true)
+		{
+			std::unique_lock<std::mutex> lock(state.lock);
+			while (!state.shuttingDown && state.jobGeneration == seenGeneration)
+			{
+				state.jobReady.wait(lock);
+			}
+
+			if (state.shuttingDown) return;
+
+			seenGeneration = state.jobGeneration;
+			RecordJob job = state.job;
+
+			//workers past the last chunk have nothing to do this time, and weren't counted in workersBusy
+			if (threadIdx >= job.chunkCount) continue;
+
+			lock.unlock();
+			recordChunk(threadIdx, job);
+			lock.lock();
+
+			if (--state.workersBusy == 0)
+			{
+				state.jobDone.notify_one();
+			}
+		}
+	}
+
+	//threadCount of 0 uses one thread per core. Has to be called after the frame contexts are created
+	void init(VkhContext& ctxt, uint32_t threadCount)
+	{
+		if (threadCount == 0) threadCount = std::thread::hardware_concurrency();
+		if (threadCount == 0) threadCount = 1;
+		if (threadCount > MAX_RECORD_THREADS) threadCount = MAX_RECORD_THREADS;
+
+		state.device = ctxt.device;
+		state.threadCount = threadCount;
+		state.jobGeneration = 0;
+		state.workersBusy = 0;
+		state.shuttingDown = false;
+
+		uint32_t frameCount = static_cast<uint32_t>(ctxt.frames.size());
+		state.frameData.resize(frameCount * threadCount);
+
+		for (uint32_t i = 0; i < state.frameData.size(); ++i)
+		{
+			ThreadFrameData& data = state.frameData[i];
+			createCommandPool(data.pool, ctxt.device, ctxt.gpu, ctxt.gpu.graphicsQueueFamilyIdx, VK_COMMAND_POOL_CREATE_TRANSIENT_BIT);
+			createCommandBuffer(data.secondary, data.pool, ctxt.device, VK_COMMAND_BUFFER_LEVEL_SECONDARY);
+		}
+
+		//thread 0 is whoever calls record()
+		for (uint32_t i = 1; i < threadCount; ++i)
+		{
+			state.workers.push_back(std::thread(workerMain, i));
+		}
+	}
+
+	uint32_t threadCount()
+	{
+		return state.threadCount;
+	}
+
+	//records drawCount draws for the current frame, and fills outSecondaries (which needs room for threadCount()
+	//buffers) with the secondary command buffers to execute, in draw order. Returns how many were written.
+	//The inheritance info has to name the render pass and subpass the secondaries will be executed in
+	uint32_t record(VkhContext& ctxt, const VkCommandBufferInheritanceInfo& inheritance, uint32_t drawCount, RecordFunc func, void* userData, VkCommandBuffer* outSecondaries)
+	{
+		if (drawCount == 0) return 0;
+
+		uint32_t drawsPerChunk = (drawCount + state.threadCount - 1) / state.threadCount;
+		if (drawsPerChunk < MIN_DRAWS_PER_THREAD) drawsPerChunk = MIN_DRAWS_PER_THREAD;
+
+		RecordJob job;
+		job.func = func;
+		job.userData = userData;
+		job.inheritance = inheritance;
+		job.drawCount = drawCount;
+		job.drawsPerChunk = drawsPerChunk;
+		job.chunkCount = (drawCount + drawsPerChunk - 1) / drawsPerChunk;
+		job.frameIdx = ctxt.frameIdx;
+
+		if (job.chunkCount > 1)
+		{
+			std::unique_lock<std::mutex> lock(state.lock);
+			state.job = job;
+			state.workersBusy = job.chunkCount - 1;
+			state.jobGeneration++;
+			lock.unlock();
+
+			state.jobReady.notify_all();
+		}
+
+		recordChunk(0, job);
+
+		if (job.chunkCount > 1)
+		{
+			std::unique_lock<std::mutex> lock(state.lock);
+			while (state.workersBusy > 0)
+			{
+				state.jobDone.wait(lock);
+			}
+		}
+
+		for (uint32_t i = 0; i < job.chunkCount; ++i)
+		{
+			outSecondaries[i] = state.frameData[job.frameIdx * state.threadCount + i].secondary;
+		}
+
+		return job.chunkCount;
+	}
+
+	//waits for the frames to finish with the secondaries before destroying the pools, so call it before the frame contexts are destroyed
+	void destroy(VkhContext& ctxt)
+	{
+		{
+			std::unique_lock<std::mutex> lock(state.lock);
+			state.shuttingDown = true;
+		}
+		state.jobReady.notify_all();
+
+		for (uint32_t i = 0; i < state.workers.size(); ++i)
+		{
+			state.workers[i].join();
+		}
+		state.workers.clear();
+
+		for (uint32_t i = 0; i < ctxt.frames.size(); ++i)
+		{
+			Timeline::wait(ECommandPoolType::Graphics, ctxt.frames[i].timelineValue);
+		}
+
+		for (uint32_t i = 0; i < state.frameData.size(); ++i)
+		{
+			vkDestroyCommandPool(state.device, state.frameData[i].pool, nullptr);
+		}
+		state.frameData.clear();
+	}
+}
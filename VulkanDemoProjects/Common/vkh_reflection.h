@@ -0,0 +1,419 @@
+#pragma once
+#include "vkh.h"
+#include "file_utils.h"
+#include "vkh_initializers.h"
+#include <vulkan/spirv.h>
+#include <vector>
+
+//Pulls the descriptor bindings and push constant block out of a SPIR-V binary, so that descriptor set layouts,
+//pipeline layouts and descriptor pool sizes can be built from what a shader actually declares, instead of
+//being written out by hand for every demo. This only reads the binary, and doesn't need a device, so it can
+//be run on shaders before the vulkan context exists
+
+#define MAX_REFLECTED_DESC_SETS 4
+
+namespace vkh::Reflection
+{
+	struct ReflectedBinding
+	{
+		uint32_t			set;
+		uint32_t			binding;
+		VkDescriptorType	type;
+		uint32_t			descriptorCount;
+		VkShaderStageFlags	stageFlags;
+	};
+
+	struct ShaderInterface
+	{
+		VkShaderStageFlags				stageFlags;
+		std::vector<ReflectedBinding>	bindings;
+
+		//size is 0 if the shader doesn't use push constants
+		VkPushConstantRange				pushConstants;
+	};
+
+	//everything we need to know about an id, filled in during a single pass over the module
+	struct IdInfo
+	{
+		const uint32_t*	inst;
+		uint32_t		set;
+		uint32_t		binding;
+		uint32_t		specId;
+		uint32_t		arrayStride;
+		bool			hasSet;
+		bool			hasBinding;
+		bool			hasSpecId;
+		bool			isBufferBlock;
+	};
+
+	struct MemberDecoration
+	{
+		uint32_t structId;
+		uint32_t member;
+		uint32_t offset;
+		uint32_t matrixStride;
+	};
+
+	struct ParseState
+	{
+		std::vector<IdInfo>				ids;
+		std::vector<MemberDecoration>	members;
+		const VkSpecializationInfo*		specInfo;
+	};
+
+	uint32_t instOpcode(const uint32_t* inst) { return inst[0] & SpvOpCodeMask; }
+	uint32_t instWordCount(const uint32_t* inst) { return inst[0] >> SpvWordCountShift; }
+
+	const MemberDecoration* findMember(const ParseState& state, uint32_t structId, uint32_t member)
+	{
+		for (uint32_t i = 0; i < state.members.size(); ++i)
+		{
+			if (state.members[i].structId == structId && state.members[i].member == member)
+			{
+				return &state.members[i];
+			}
+		}
+
+		return nullptr;
+	}
+
+	MemberDecoration& findOrAddMember(ParseState& state, uint32_t structId, uint32_t member)
+	{
+		const MemberDecoration* existing = findMember(state, structId, member);
+		if (existing)
+		{
+			return state.members[existing - state.members.data()];
+		}
+
+		MemberDecoration newMember = {};
+		newMember.structId = structId;
+		newMember.member = member;
+		state.members.push_back(newMember);
+		return state.members.back();
+	}
+
+	//returns the value of an OpConstant or OpSpecConstant, using the value from specInfo if one was provided for it
+	uint32_t constantValue(const ParseState& state, uint32_t id)
+	{
+		const IdInfo& info = state.ids[id];
+		checkf(info.inst, "Reflection: array length is not a constant");
+
+		uint32_t op = instOpcode(info.inst);
+		checkf(op == SpvOpConstant || op == SpvOpSpecConstant, "Reflection: only constant and spec constant array lengths are supported");
+
+		uint32_t value = info.inst[3];
+
+		if (op == SpvOpSpecConstant && info.hasSpecId && state.specInfo)
+		{
+			for (uint32_t i = 0; i < state.specInfo->mapEntryCount; ++i)
+			{
+				const VkSpecializationMapEntry& entry = state.specInfo->pMapEntries[i];
+				if (entry.constantID == info.specId)
+				{
+					value = 0;
+					memcpy(&value, (const char*)state.specInfo->pData + entry.offset, entry.size < sizeof(uint32_t) ? entry.size : sizeof(uint32_t));
+					break;
+				}
+			}
+		}
+
+		return value;
+	}
+
+	//size in bytes of a type inside a buffer block, using the explicit layout decorations the compiler writes out
+	uint32_t typeSize(const ParseState& state, uint32_t typeId, uint32_t matrixStride = 0)
+	{
+		const uint32_t* inst = state.ids[typeId].inst;
+
+		switch (instOpcode(inst))
+		{
+			case SpvOpTypeBool: return 4;
+			case SpvOpTypeInt:
+			case SpvOpTypeFloat: return inst[2] / 8;
+			case SpvOpTypeVector: return typeSize(state, inst[2]) * inst[3];
+			case SpvOpTypeMatrix: return matrixStride > 0 ? matrixStride * inst[3] : typeSize(state, inst[2]) * inst[3];
+			case SpvOpTypeArray: return state.ids[typeId].arrayStride * constantValue(state, inst[3]);
+			case SpvOpTypeRuntimeArray: return 0;
+			case SpvOpTypeStruct:
+			{
+				uint32_t size = 0;
+				uint32_t memberCount = instWordCount(inst) - 2;
+				for (uint32_t m = 0; m < memberCount; ++m)
+				{
+					const MemberDecoration* member = findMember(state, typeId, m);
+					checkf(member, "Reflection: buffer block member is missing an offset decoration");
+					if (!member) continue;
+
+					uint32_t memberEnd = member->offset + typeSize(state, inst[2 + m], member->matrixStride);
+					size = memberEnd > size ? memberEnd : size;
+				}
+				return size;
+			}
+		}
+
+		checkf(0, "Reflection: unsupported type in buffer block");
+		return 0;
+	}
+
+	VkShaderStageFlags stageForExecutionModel(uint32_t model)
+	{
+		switch (model)
+		{
+			case SpvExecutionModelVertex: return VK_SHADER_STAGE_VERTEX_BIT;
+			case SpvExecutionModelTessellationControl: return VK_SHADER_STAGE_TESSELLATION_CONTROL_BIT;
+			case SpvExecutionModelTessellationEvaluation: return VK_SHADER_STAGE_TESSELLATION_EVALUATION_BIT;
+			case SpvExecutionModelGeometry: return VK_SHADER_STAGE_GEOMETRY_BIT;
+			case SpvExecutionModelFragment: return VK_SHADER_STAGE_FRAGMENT_BIT;
+			case SpvExecutionModelGLCompute: return VK_SHADER_STAGE_COMPUTE_BIT;
+		}
+
+		checkf(0, "Reflection: unsupported execution model");
+		return 0;
+	}
+
+	VkDescriptorType descriptorTypeForImage(const uint32_t* imageInst, bool combinedWithSampler)
+	{
+		uint32_t dim = imageInst[3];
+		uint32_t sampled = imageInst[7];
+
+		if (dim == SpvDimSubpassData) return VK_DESCRIPTOR_TYPE_INPUT_ATTACHMENT;
+		if (dim == SpvDimBuffer) return sampled == 2 ? VK_DESCRIPTOR_TYPE_STORAGE_TEXEL_BUFFER : VK_DESCRIPTOR_TYPE_UNIFORM_TEXEL_BUFFER;
+		if (sampled == 2) return VK_DESCRIPTOR_TYPE_STORAGE_IMAGE;
+
+		return combinedWithSampler ? VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER : VK_DESCRIPTOR_TYPE_SAMPLED_IMAGE;
+	}
+
+	//specInfo is only used to resolve array sizes that come from specialization constants, and can be null
+	bool reflect(const uint32_t* code, size_t codeSize, ShaderInterface& outInterface, const VkSpecializationInfo* specInfo = nullptr)
+	{
+		outInterface.stageFlags = 0;
+		outInterface.bindings.clear();
+		outInterface.pushConstants = {};
+
+		size_t wordCount = codeSize / sizeof(uint32_t);
+		if (wordCount < 5 || code[0] != SpvMagicNumber)
+		{
+			checkf(0, "Reflection: data is not a SPIR-V module");
+			return false;
+		}
+
+		ParseState state;
+		state.ids.resize(code[3]);
+		memset(state.ids.data(), 0, sizeof(IdInfo) * state.ids.size());
+		state.specInfo = specInfo;
+
+		std::vector<const uint32_t*> variables;
+
+		//the instructions we care about all have their result id in a fixed place, so a single pass is enough to
+		//record them, and types can be resolved afterwards once everything they refer to has been seen
+		const uint32_t* inst = code + 5;
+		const uint32_t* end = code + wordCount;
+		while (inst < end)
+		{
+			uint32_t op = instOpcode(inst);
+			uint32_t count = instWordCount(inst);
+			if (count == 0 || inst + count > end)
+			{
+				checkf(0, "Reflection: malformed SPIR-V instruction");
+				return false;
+			}
+
+			switch (op)
+			{
+				case SpvOpEntryPoint:
+				{
+					outInterface.stageFlags |= stageForExecutionModel(inst[1]);
+				}break;
+				case SpvOpDecorate:
+				{
+					IdInfo& info = state.ids[inst[1]];
+					if (inst[2] == SpvDecorationDescriptorSet) { info.set = inst[3]; info.hasSet = true; }
+					else if (inst[2] == SpvDecorationBinding) { info.binding = inst[3]; info.hasBinding = true; }
+					else if (inst[2] == SpvDecorationSpecId) { info.specId = inst[3]; info.hasSpecId = true; }
+					else if (inst[2] == SpvDecorationArrayStride) { info.arrayStride = inst[3]; }
+					else if (inst[2] == SpvDecorationBufferBlock) { info.isBufferBlock = true; }
+				}break;
+				case SpvOpMemberDecorate:
+				{
+					if (inst[3] == SpvDecorationOffset) findOrAddMember(state, inst[1], inst[2]).offset = inst[4];
+					else if (inst[3] == SpvDecorationMatrixStride) findOrAddMember(state, inst[1], inst[2]).matrixStride = inst[4];
+				}break;
+				case SpvOpTypeVoid: case SpvOpTypeBool: case SpvOpTypeInt: case SpvOpTypeFloat:
+				case SpvOpTypeVector: case SpvOpTypeMatrix: case SpvOpTypeImage: case SpvOpTypeSampler:
+				case SpvOpTypeSampledImage: case SpvOpTypeArray: case SpvOpTypeRuntimeArray:
+				case SpvOpTypeStruct: case SpvOpTypePointer:
+				{
+					state.ids[inst[1]].inst = inst;
+				}break;
+				case SpvOpConstant: case SpvOpSpecConstant:
+				{
+					state.ids[inst[2]].inst = inst;
+				}break;
+				case SpvOpVariable:
+				{
+					state.ids[inst[2]].inst = inst;
+					variables.push_back(inst);
+				}break;
+			}
+
+			inst += count;
+		}
+
+		for (uint32_t i = 0; i < variables.size(); ++i)
+		{
+			const uint32_t* var = variables[i];
+			uint32_t storageClass = var[3];
+
+			if (storageClass != SpvStorageClassUniform && storageClass != SpvStorageClassUniformConstant &&
+				storageClass != SpvStorageClassStorageBuffer && storageClass != SpvStorageClassPushConstant)
+			{
+				continue;
+			}
+
+			const uint32_t* pointerType = state.ids[var[1]].inst;
+			uint32_t typeId = pointerType[3];
+
+			if (storageClass == SpvStorageClassPushConstant)
+			{
+				uint32_t blockSize = typeSize(state, typeId);
+
+				//blocks are laid out from offset 0 in everything glslang generates, so the range always starts there
+				outInterface.pushConstants.stageFlags = outInterface.stageFlags;
+				outInterface.pushConstants.offset = 0;
+				outInterface.pushConstants.size = blockSize > outInterface.pushConstants.size ? blockSize : outInterface.pushConstants.size;
+				continue;
+			}
+
+			//arrays of resources become a single binding with a descriptor count
+			uint32_t descriptorCount = 1;
+			while (instOpcode(state.ids[typeId].inst) == SpvOpTypeArray)
+			{
+				descriptorCount *= constantValue(state, state.ids[typeId].inst[3]);
+				typeId = state.ids[typeId].inst[2];
+			}
+
+			checkf(instOpcode(state.ids[typeId].inst) != SpvOpTypeRuntimeArray, "Reflection: runtime sized descriptor arrays aren't supported");
+
+			const IdInfo& varInfo = state.ids[var[2]];
+			const uint32_t* typeInst = state.ids[typeId].inst;
+
+			ReflectedBinding binding;
+			binding.set = varInfo.set;
+			binding.binding = varInfo.binding;
+			binding.descriptorCount = descriptorCount;
+			binding.stageFlags = outInterface.stageFlags;
+
+			if (storageClass == SpvStorageClassStorageBuffer) binding.type = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+			else if (storageClass == SpvStorageClassUniform) binding.type = state.ids[typeId].isBufferBlock ? VK_DESCRIPTOR_TYPE_STORAGE_BUFFER : VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER;
+			else if (instOpcode(typeInst) == SpvOpTypeSampler) binding.type = VK_DESCRIPTOR_TYPE_SAMPLER;
+			else if (instOpcode(typeInst) == SpvOpTypeSampledImage) binding.type = descriptorTypeForImage(state.ids[typeInst[2]].inst, true);
+			else if (instOpcode(typeInst) == SpvOpTypeImage) binding.type = descriptorTypeForImage(typeInst, false);
+			else
+			{
+				//plain uniforms outside of a block aren't allowed in vulkan glsl, so this shouldn't happen
+				checkf(0, "Reflection: unsupported uniform type");
+				continue;
+			}
+
+			checkf(varInfo.hasBinding, "Reflection: descriptor is missing a binding decoration");
+			checkf(binding.set < MAX_REFLECTED_DESC_SETS, "Reflection: descriptor set index is too high");
+			outInterface.bindings.push_back(binding);
+		}
+
+		return true;
+	}
+
+	bool reflectFile(const char* path, ShaderInterface& outInterface, const VkSpecializationInfo* specInfo = nullptr)
+	{
+		DataBuffer* spirv = loadBinaryFile(path);
+		bool success = reflect((const uint32_t*)spirv->data, spirv->size, outInterface, specInfo);
+		freeDataBuffer(spirv);
+
+		return success;
+	}
+
+	//combines the interfaces of every stage in a pipeline, bindings used by more than one stage end up with the stage flags of all of them
+	void merge(ShaderInterface& into, const ShaderInterface& other)
+	{
+		into.stageFlags |= other.stageFlags;
+
+		for (uint32_t i = 0; i < other.bindings.size(); ++i)
+		{
+			const ReflectedBinding& otherBinding = other.bindings[i];
+			bool found = false;
+
+			for (uint32_t j = 0; j < into.bindings.size(); ++j)
+			{
+				ReflectedBinding& binding = into.bindings[j];
+				if (binding.set == otherBinding.set && binding.binding == otherBinding.binding)
+				{
+					checkf(binding.type == otherBinding.type && binding.descriptorCount == otherBinding.descriptorCount, "Reflection: shader stages disagree about a descriptor binding");
+					binding.stageFlags |= otherBinding.stageFlags;
+					found = true;
+					break;
+				}
+			}
+
+			if (!found)
+			{
+				into.bindings.push_back(otherBinding);
+			}
+		}
+
+		if (other.pushConstants.size > 0)
+		{
+			into.pushConstants.stageFlags |= other.pushConstants.stageFlags;
+			into.pushConstants.size = other.pushConstants.size > into.pushConstants.size ? other.pushConstants.size : into.pushConstants.size;
+		}
+	}
+
+	//number of descriptor set layouts a pipeline using this interface needs, including any empty ones before the highest used set
+	uint32_t setCount(const ShaderInterface& shaderInterface)
+	{
+		uint32_t count = 0;
+		for (uint32_t i = 0; i < shaderInterface.bindings.size(); ++i)
+		{
+			uint32_t setEnd = shaderInterface.bindings[i].set + 1;
+			count = setEnd > count ? setEnd : count;
+		}
+		return count;
+	}
+
+	//bindings for one set, sorted by binding index so that identical sets always produce identical layout descriptions
+	void setLayoutBindings(const ShaderInterface& shaderInterface, uint32_t set, std::vector<VkDescriptorSetLayoutBinding>& outBindings)
+	{
+		outBindings.clear();
+
+		for (uint32_t i = 0; i < shaderInterface.bindings.size(); ++i)
+		{
+			const ReflectedBinding& binding = shaderInterface.bindings[i];
+			if (binding.set != set) continue;
+
+			VkDescriptorSetLayoutBinding layoutBinding = vkh::descriptorSetLayoutBinding(binding.type, binding.stageFlags, binding.binding, binding.descriptorCount);
+
+			uint32_t insertIdx = 0;
+			while (insertIdx < outBindings.size() && outBindings[insertIdx].binding < layoutBinding.binding) insertIdx++;
+			outBindings.insert(outBindings.begin() + insertIdx, layoutBinding);
+		}
+	}
+
+	//adds enough descriptors to the pool sizes for setCopies allocations of every set in the interface
+	void addDescriptorPoolSizes(const ShaderInterface& shaderInterface, std::vector<VkDescriptorType>& types, std::vector<uint32_t>& typeCounts, uint32_t setCopies = 1)
+	{
+		for (uint32_t i = 0; i < shaderInterface.bindings.size(); ++i)
+		{
+			const ReflectedBinding& binding = shaderInterface.bindings[i];
+
+			uint32_t typeIdx = 0;
+			while (typeIdx < types.size() && types[typeIdx] != binding.type) typeIdx++;
+
+			if (typeIdx == types.size())
+			{
+				types.push_back(binding.type);
+				typeCounts.push_back(0);
+			}
+
+			typeCounts[typeIdx] += binding.descriptorCount * setCopies;
+		}
+	}
+}
@@ -0,0 +1,252 @@
+#pragma once
+#include "vkh.h"
+#include "hash_utils.h"
+#include <vector>
+#include <unordered_map>
+#include <mutex>
+#include <string.h>
+
+//Collects draws as packets, sorts them by a 64 bit key built from their state, and records them emitting only the
+//binds that actually change between neighbouring draws. The key is laid out from most to least expensive state to
+//change, so sorting groups draws by pass, then pipeline, then descriptor set, then mesh:
+//
+//	bits 56-63: pass, 40-55: pipeline, 24-39: descriptor set, 0-23: mesh
+//
+//Handles are mapped to small ids in the order the queue first sees them, so the key only orders draws into groups,
+//it says nothing about which pipeline is cheaper than another
+
+#define MAX_DRAW_PUSH_CONSTANT_SIZE 16
+
+#define RENDER_QUEUE_PASS_SHIFT 56
+#define RENDER_QUEUE_PIPELINE_SHIFT 40
+#define RENDER_QUEUE_DESC_SET_SHIFT 24
+#define RENDER_QUEUE_MAX_PIPELINES (1 << 16)
+#define RENDER_QUEUE_MAX_DESC_SETS (1 << 16)
+#define RENDER_QUEUE_MAX_MESHES (1 << 24)
+
+namespace vkh
+{
+	struct DrawPacket
+	{
+		uint8_t				pass;
+		VkPipeline			pipeline;
+		VkPipelineLayout	pipelineLayout;
+		VkDescriptorSet		descriptorSet;
+		VkBuffer			vertexBuffer;
+		VkBuffer			indexBuffer;
+		uint32_t			indexCount;
+
+		//non zero for meshes that share their buffers with others, eg: from a MeshPool
+		uint32_t			firstIndex;
+		int32_t				vertexOffset;
+
+		//pushed for every draw, since this is usually the per draw data. Batched draws write it to the
+		//instance buffer instead, see vkh_batching.h
+		VkShaderStageFlags	pushConstantStages;
+		uint32_t			pushConstantSize;
+		uint8_t				pushConstants[MAX_DRAW_PUSH_CONSTANT_SIZE];
+	};
+
+	struct RenderQueueStats
+	{
+		uint64_t	draws;
+		uint64_t	pipelineBinds;
+		uint64_t	pipelineBindsAvoided;
+		uint64_t	descriptorSetBinds;
+		uint64_t	descriptorSetBindsAvoided;
+		uint64_t	meshBinds;
+		uint64_t	meshBindsAvoided;
+	};
+
+	struct RenderQueueSortEntry
+	{
+		uint64_t	key;
+		uint32_t	packetIdx;
+	};
+
+	struct RenderQueue
+	{
+		std::vector<DrawPacket>				packets;
+		std::vector<RenderQueueSortEntry>	sorted;
+		std::vector<RenderQueueSortEntry>	sortScratch;
+
+		std::unordered_map<uint64_t, uint32_t>	pipelineIds;
+		std::unordered_map<uint64_t, uint32_t>	descSetIds;
+		std::unordered_map<uint64_t, uint32_t>	meshIds;
+
+		//bumped whenever the contents change, so anything recorded from the queue can tell when it's stale
+		uint64_t							version;
+
+		//record can be called from several threads at once, one per chunk of the queue
+		std::mutex							statsLock;
+		RenderQueueStats					stats;
+	};
+
+	uint32_t renderQueueId(std::unordered_map<uint64_t, uint32_t>& ids, uint64_t handle, uint32_t maxIds)
+	{
+		std::unordered_map<uint64_t, uint32_t>::iterator it = ids.find(handle);
+		if (it != ids.end()) return it->second;
+
+		uint32_t id = static_cast<uint32_t>(ids.size());
+		checkf(id < maxIds, "Too many unique handles in render queue");
+
+		ids[handle] = id;
+		return id;
+	}
+
+	//ids aren't cleared here, so the same handles keep the same ids (and the same relative order) from frame to frame
+	void resetRenderQueue(RenderQueue& queue)
+	{
+		queue.packets.clear();
+		queue.sorted.clear();
+		queue.version++;
+	}
+
+	void addDraw(RenderQueue& queue, const DrawPacket& packet)
+	{
+		checkf(packet.pushConstantSize <= MAX_DRAW_PUSH_CONSTANT_SIZE, "Draw packet push constants are too big");
+
+		uint64_t pipelineId = renderQueueId(queue.pipelineIds, (uint64_t)packet.pipeline, RENDER_QUEUE_MAX_PIPELINES);
+		uint64_t descSetId = renderQueueId(queue.descSetIds, (uint64_t)packet.descriptorSet, RENDER_QUEUE_MAX_DESC_SETS);
+		uint64_t meshId = renderQueueId(queue.meshIds, hashCombine((uint64_t)packet.vertexBuffer, packet.firstIndex), RENDER_QUEUE_MAX_MESHES);
+
+		RenderQueueSortEntry entry;
+		entry.key = ((uint64_t)packet.pass << RENDER_QUEUE_PASS_SHIFT) | (pipelineId << RENDER_QUEUE_PIPELINE_SHIFT) | (descSetId << RENDER_QUEUE_DESC_SET_SHIFT) | meshId;
+		entry.packetIdx = static_cast<uint32_t>(queue.packets.size());
+
+		queue.packets.push_back(packet);
+		queue.sorted.push_back(entry);
+		queue.version++;
+	}
+
+	//LSD radix sort, 8 bits per pass. Passes where every key has the same byte are skipped, which with the small ids
+	//most scenes end up with is most of them. Stable, so draws with equal keys keep the order they were added in
+	void sortRenderQueue(RenderQueue& queue)
+	{
+		uint32_t count = static_cast<uint32_t>(queue.sorted.size());
+		queue.sortScratch.resize(count);
+
+		RenderQueueSortEntry* src = queue.sorted.data();
+		RenderQueueSortEntry* dst = queue.sortScratch.data();
+
+		for (uint32_t shift = 0; shift < 64; shift += 8)
+		{
+			uint32_t offsets[256] = {};
+			for (uint32_t i = 0; i < count; ++i)
+			{
+				offsets[(src[i].key >> shift) & 0xFF]++;
+			}
+
+			if (count == 0 || offsets[(src[0].key >> shift) & 0xFF] == count) continue;
+
+			uint32_t total = 0;
+			for (uint32_t b = 0; b < 256; ++b)
+			{
+				uint32_t bucketCount = offsets[b];
+				offsets[b] = total;
+				total += bucketCount;
+			}
+
+			for (uint32_t i = 0; i < count; ++i)
+			{
+				dst[offsets[(src[i].key >> shift) & 0xFF]++] = src[i];
+			}
+
+			RenderQueueSortEntry* tmp = src;
+			src = dst;
+			dst = tmp;
+		}
+
+		if (src != queue.sorted.data())
+		{
+			queue.sorted.swap(queue.sortScratch);
+		}
+	}
+
+	uint32_t renderQueueSize(const RenderQueue& queue)
+	{
+		return static_cast<uint32_t>(queue.sorted.size());
+	}
+
+	//records sorted draws [firstDraw, firstDraw + drawCount). Assumes nothing is bound when it starts, so each chunk of
+	//a queue split across secondary command buffers binds its own state. Viewport and scissor are left to the caller
+	void recordRenderQueue(RenderQueue& queue, VkCommandBuffer commandBuffer, uint32_t firstDraw, uint32_t drawCount)
+	{
+		RenderQueueStats stats = {};
+
+		VkPipeline boundPipeline = VK_NULL_HANDLE;
+		VkPipelineLayout boundLayout = VK_NULL_HANDLE;
+		VkDescriptorSet boundSet = VK_NULL_HANDLE;
+		VkBuffer boundVertexBuffer = VK_NULL_HANDLE;
+		VkBuffer boundIndexBuffer = VK_NULL_HANDLE;
+
+		for (uint32_t i = firstDraw; i < firstDraw + drawCount; ++i)
+		{
+			const DrawPacket& packet = queue.packets[queue.sorted[i].packetIdx];
+
+			if (packet.pipeline != boundPipeline)
+			{
+				vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, packet.pipeline);
+				boundPipeline = packet.pipeline;
+				stats.pipelineBinds++;
+			}
+			else
+			{
+				stats.pipelineBindsAvoided++;
+			}
+
+			//a set bound through one layout isn't guaranteed to survive a switch to another, so a layout change rebinds too
+			if (packet.descriptorSet != boundSet || packet.pipelineLayout != boundLayout)
+			{
+				vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, packet.pipelineLayout, 0, 1, &packet.descriptorSet, 0, 0);
+				boundSet = packet.descriptorSet;
+				boundLayout = packet.pipelineLayout;
+				stats.descriptorSetBinds++;
+			}
+			else
+			{
+				stats.descriptorSetBindsAvoided++;
+			}
+
+			if (packet.vertexBuffer != boundVertexBuffer || packet.indexBuffer != boundIndexBuffer)
+			{
+				VkDeviceSize vertexOffset = 0;
+				vkCmdBindVertexBuffers(commandBuffer, 0, 1, &packet.vertexBuffer, &vertexOffset);
+				vkCmdBindIndexBuffer(commandBuffer, packet.indexBuffer, 0, VK_INDEX_TYPE_UINT32);
+				boundVertexBuffer = packet.vertexBuffer;
+				boundIndexBuffer = packet.indexBuffer;
+				stats.meshBinds++;
+			}
+			else
+			{
+				stats.meshBindsAvoided++;
+			}
+
+			if (packet.pushConstantSize > 0)
+			{
+				vkCmdPushConstants(commandBuffer, packet.pipelineLayout, packet.pushConstantStages, 0, packet.pushConstantSize, packet.pushConstants);
+			}
+
+			vkCmdDrawIndexed(commandBuffer, packet.indexCount, 1, packet.firstIndex, packet.vertexOffset, 0);
+			stats.draws++;
+		}
+
+		std::unique_lock<std::mutex> lock(queue.statsLock);
+		queue.stats.draws += stats.draws;
+		queue.stats.pipelineBinds += stats.pipelineBinds;
+		queue.stats.pipelineBindsAvoided += stats.pipelineBindsAvoided;
+		queue.stats.descriptorSetBinds += stats.descriptorSetBinds;
+		queue.stats.descriptorSetBindsAvoided += stats.descriptorSetBindsAvoided;
+		queue.stats.meshBinds += stats.meshBinds;
+		queue.stats.meshBindsAvoided += stats.meshBindsAvoided;
+	}
+
+	//returns the totals since the last call
+	RenderQueueStats consumeRenderQueueStats(RenderQueue& queue)
+	{
+		std::unique_lock<std::mutex> lock(queue.statsLock);
+		RenderQueueStats stats = queue.stats;
+		queue.stats = {};
+		return stats;
+	}
+}
@@ -0,0 +1,282 @@
+#pragma once
+#include "vkh.h"
+#include "vkh_deletion_queue.h"
+#include "vkh_memory_budget.h"
+#include "vkh_mesh.h"
+#include "vkh_texture.h"
+#include <string>
+#include <vector>
+
+//Textures and meshes that are loaded when they're used and evicted when they haven't been used for a while and
+//memory is tight, so a working set bigger than the gpu's memory slows down instead of failing an allocation.
+//Resources are added with where to load them from, and useTexture / useMesh load them if they aren't resident and
+//mark them as used this frame. Before anything is loaded, the least recently used resources on the same heap are
+//evicted until it fits in the heap's budget (and in the byte limit, if one was set).
+//
+//Evicting or reloading a resource changes its handles, and anything that holds on to them (descriptor sets, cached
+//command buffers) has to be updated. version() changes whenever that happens. Evicted resources go through the
+//deletion queue, so frames in flight can keep using them
+
+namespace vkh::Residency
+{
+	enum class EResourceType : uint8_t
+	{
+		Texture,
+		Mesh
+	};
+
+	struct ResidentResource
+	{
+		EResourceType	type;
+		bool			resident;
+		uint64_t		lastUsedFrame;
+
+		//what the resource took up the last time it was loaded, 0 before that
+		VkDeviceSize	size;
+		uint32_t		heapIdx;
+
+		//where to load from
+		std::string				path;
+		std::vector<Vertex>		vertices;
+		std::vector<uint32_t>	indices;
+
+		TextureAsset	texture;
+		MeshAsset		mesh;
+	};
+
+	struct ResidencyStats
+	{
+		uint64_t		evictions;
+		uint64_t		reloads;
+		VkDeviceSize	evictedBytes;
+		VkDeviceSize	reloadedBytes;
+	};
+
+	struct ResidencyState
+	{
+		std::vector<ResidentResource>	resources;
+		uint64_t						frame;
+		uint64_t						version;
+
+		//0 to only go by the memory budget
+		VkDeviceSize					byteLimit;
+		VkDeviceSize					residentBytes;
+
+		ResidencyStats					stats;
+		VkhContext*						context;
+	};
+
+	ResidencyState state;
+
+	//byteLimit caps how much the resources here can take up between them, on top of the memory budget
+	void init(VkDeviceSize byteLimit, VkhContext& ctxt)
+	{
+		state.resources.clear();
+		state.frame = 1;
+		state.version = 0;
+		state.byteLimit = byteLimit;
+		state.residentBytes = 0;
+		state.stats = {};
+		state.context = &ctxt;
+	}
+
+	//returns the id to use it with, nothing's loaded until then
+	uint32_t addTexture(const char* filepath)
+	{
+		ResidentResource resource = {};
+		resource.type = EResourceType::Texture;
+		resource.path = filepath;
+		state.resources.push_back(resource);
+		return static_cast<uint32_t>(state.resources.size() - 1);
+	}
+
+	//keeps a copy of the data to load the mesh from again after it's evicted
+	uint32_t addMesh(const Vertex* vertices, uint32_t vertexCount, const uint32_t* indices, uint32_t indexCount)
+	{
+		ResidentResource resource = {};
+		resource.type = EResourceType::Mesh;
+		resource.vertices.assign(vertices, vertices + vertexCount);
+		resource.indices.assign(indices, indices + indexCount);
+		state.resources.push_back(resource);
+		return static_cast<uint32_t>(state.resources.size() - 1);
+	}
+
+	void evict(uint32_t id)
+	{
+		ResidentResource& resource = state.resources[id];
+		if (!resource.resident) return;
+
+		//anything recorded for the frame that's being built could still use it
+		uint64_t lastUse = Timeline::nextValue(ECommandPoolType::Graphics);
+
+		if (resource.type == EResourceType::Texture)
+		{
+			DeletionQueue::destroyImage(resource.texture.image, resource.texture.view, resource.texture.deviceMemory, ECommandPoolType::Graphics, lastUse);
+		}
+		else
+		{
+			DeletionQueue::destroyBuffer(resource.mesh.vBuffer, resource.mesh.vBufferMemory, ECommandPoolType::Graphics, lastUse);
+			DeletionQueue::destroyBuffer(resource.mesh.iBuffer, resource.mesh.iBufferMemory, ECommandPoolType::Graphics, lastUse);
+		}
+
+		resource.resident = false;
+		state.residentBytes -= resource.size;
+		state.version++;
+		state.stats.evictions++;
+		state.stats.evictedBytes += resource.size;
+	}
+
+	//the least recently used resident resource on a heap that hasn't been used since frame, UINT32_MAX if there isn't one.
+	//A linear search, which is fine for the number of resources the demos have
+	uint32_t leastRecentlyUsed(uint32_t heapIdx, uint64_t frame)
+	{
+		uint32_t best = UINT32_MAX;
+		for (uint32_t i = 0; i < state.resources.size(); ++i)
+		{
+			const ResidentResource& resource = state.resources[i];
+			if (!resource.resident || resource.heapIdx != heapIdx || resource.lastUsedFrame >= frame) continue;
+
+			if (best == UINT32_MAX || resource.lastUsedFrame < state.resources[best].lastUsedFrame)
+			{
+				best = i;
+			}
+		}
+		return best;
+	}
+
+	//evicts resources that haven't been used since frame until size more bytes fit on the heap. Evicted memory isn't
+	//freed until the gpu is done with it, so it won't show up in the budget's usage yet, and is counted here instead.
+	//Returns false if it couldn't make enough room
+	bool makeRoom(uint32_t heapIdx, VkDeviceSize size, uint64_t frame)
+	{
+		MemoryBudget::update();
+		MemoryBudget::HeapBudget heap = MemoryBudget::heapBudget(heapIdx);
+		VkDeviceSize evicted = 0;
+
+		for (;;)
+		{
+			VkDeviceSize heapUsage = heap.usage > evicted ? heap.usage - evicted : 0;
+			bool fitsHeap = heapUsage + size <= heap.budget;
+			bool fitsLimit = state.byteLimit == 0 || state.residentBytes + size <= state.byteLimit;
+			if (fitsHeap && fitsLimit) return true;
+
+			uint32_t victim = leastRecentlyUsed(heapIdx, frame);
+			if (victim == UINT32_MAX) return false;
+
+			evicted += state.resources[victim].size;
+			evict(victim);
+		}
+	}
+
+	//reload is whether it's been loaded before
+	void load(uint32_t id, bool reload)
+	{
+		ResidentResource& resource = state.resources[id];
+		VkhContext& ctxt = *state.context;
+
+		//the size isn't known until it's been loaded once, after that make room for it first
+		if (resource.size > 0)
+		{
+			makeRoom(resource.heapIdx, resource.size, state.frame);
+		}
+
+		if (resource.type == EResourceType::Texture)
+		{
+			Texture::make(resource.texture, resource.path.c_str(), ctxt);
+			resource.size = resource.texture.deviceMemory.size;
+			resource.heapIdx = MemoryBudget::heapForMemoryType(resource.texture.deviceMemory.type);
+		}
+		else
+		{
+			Mesh::make(resource.mesh, ctxt, resource.vertices.data(), static_cast<uint32_t>(resource.vertices.size()), resource.indices.data(), static_cast<uint32_t>(resource.indices.size()));
+			resource.size = resource.mesh.vBufferMemory.size + resource.mesh.iBufferMemory.size;
+			resource.heapIdx = MemoryBudget::heapForMemoryType(resource.mesh.vBufferMemory.type);
+		}
+
+		if (reload)
+		{
+			state.stats.reloads++;
+			state.stats.reloadedBytes += resource.size;
+		}
+
+		resource.resident = true;
+		state.residentBytes += resource.size;
+		state.version++;
+
+		//the first load of something might have gone over, so catch up now that its size is known. It's marked as used
+		//this frame already, so it won't be the one that goes
+		makeRoom(resource.heapIdx, 0, state.frame);
+	}
+
+	void touch(uint32_t id)
+	{
+		ResidentResource& resource = state.resources[id];
+		bool usedBefore = resource.lastUsedFrame > 0;
+		resource.lastUsedFrame = state.frame;
+
+		if (!resource.resident) load(id, usedBefore);
+	}
+
+	const TextureAsset& useTexture(uint32_t id)
+	{
+		checkf(state.resources[id].type == EResourceType::Texture, "Using a resident mesh as a texture");
+		touch(id);
+		return state.resources[id].texture;
+	}
+
+	const MeshAsset& useMesh(uint32_t id)
+	{
+		checkf(state.resources[id].type == EResourceType::Mesh, "Using a resident texture as a mesh");
+		touch(id);
+		return state.resources[id].mesh;
+	}
+
+	//doesn't count as a use, so it won't load the texture or keep it from being evicted. For things like rewriting
+	//descriptors, which need whatever's resident without changing the eviction order
+	const TextureAsset& texture(uint32_t id)
+	{
+		checkf(state.resources[id].type == EResourceType::Texture, "Using a resident mesh as a texture");
+		checkf(state.resources[id].resident, "Texture isn't resident");
+		return state.resources[id].texture;
+	}
+
+	bool isResident(uint32_t id)
+	{
+		return state.resources[id].resident;
+	}
+
+	//resources used before this are candidates for eviction, call it once at the start of every frame
+	void beginFrame()
+	{
+		state.frame++;
+	}
+
+	//changes every time something is loaded or evicted
+	uint64_t version()
+	{
+		return state.version;
+	}
+
+	VkDeviceSize residentBytes()
+	{
+		return state.residentBytes;
+	}
+
+	//returns the totals since the last call
+	ResidencyStats consumeStats()
+	{
+		ResidencyStats stats = state.stats;
+		state.stats = {};
+		return stats;
+	}
+
+	void destroy()
+	{
+		for (uint32_t i = 0; i < state.resources.size(); ++i)
+		{
+			evict(i);
+		}
+
+		state.resources.clear();
+	}
+}
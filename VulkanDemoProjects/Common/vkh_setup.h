@@ -2,12 +2,21 @@
 #include "vkh_types.h"
 #include "vkh.h"
 #include "vkh_alloc.h"
+#include "vkh_frame.h"
+#include "vkh_memory_budget.h"
 namespace vkh
 {
 	struct VkhContextCreateInfo
 	{
 		std::vector<VkDescriptorType> types;
 		std::vector<uint32_t> typeCounts;
+
+		//0 uses the defaults in vkh_frame.h
+		uint32_t framesInFlight;
+		VkDeviceSize transientBufferSize;
+
+		//null uses the passthrough allocator
+		AllocatorInterface* allocator;
 	};
 
 	const uint32_t INVALID_QUEUE_FAMILY_IDX = -1;
@@ -133,6 +142,17 @@ namespace vkh
 
 		checkf(allExtensionsFound, "Failed to find all required vulkan extensions");
 
+		//optional, timelines fall back to fences and the memory budget to estimating from heap sizes without it
+		ctxt.physicalDeviceProperties2 = false;
+		for (uint32_t i = 0; i < extensions.size(); ++i)
+		{
+			if (strcmp(extensions[i].extensionName, VK_KHR_GET_PHYSICAL_DEVICE_PROPERTIES_2_EXTENSION_NAME) == 0)
+			{
+				requiredExtensions.push_back(VK_KHR_GET_PHYSICAL_DEVICE_PROPERTIES_2_EXTENSION_NAME);
+				ctxt.physicalDeviceProperties2 = true;
+			}
+		}
+
 		//create instance with all extensions
 
 		VkInstanceCreateInfo inst_info;
@@ -308,6 +328,9 @@ namespace vkh
 		vkGetPhysicalDeviceProperties(outDevice, &ctxt.gpu.deviceProps);
 		printf("Max mem allocations: %i\n", ctxt.gpu.deviceProps.limits.maxMemoryAllocationCount);
 
+		ctxt.gpu.directUpload = hasDirectUploadMemory(ctxt.gpu.memProps);
+		printf("Direct uploads to device local memory: %s\n", ctxt.gpu.directUpload ? "yes" : "no");
+
 		//get queue families while we're here
 		vkGetPhysicalDeviceQueueFamilyProperties(outDevice, &ctxt.gpu.queueFamilyCount, nullptr);
 
@@ -367,6 +390,32 @@ namespace vkh
 		checkf(foundGfx && foundPresent && foundTransfer, "Failed to find all required device queues");
 	}
 
+	bool deviceSupportsExtension(VkPhysicalDevice gpu, const char* extensionName)
+	{
+		uint32_t extensionCount;
+		vkEnumerateDeviceExtensionProperties(gpu, nullptr, &extensionCount, nullptr);
+
+		std::vector<VkExtensionProperties> availableExtensions;
+		availableExtensions.resize(extensionCount);
+		vkEnumerateDeviceExtensionProperties(gpu, nullptr, &extensionCount, availableExtensions.data());
+
+		for (uint32_t i = 0; i < availableExtensions.size(); ++i)
+		{
+			if (strcmp(availableExtensions[i].extensionName, extensionName) == 0)
+			{
+				return true;
+			}
+		}
+
+		return false;
+	}
+
+	//VK_EXT_memory_budget needs VK_KHR_get_physical_device_properties2 on the instance as well
+	bool deviceSupportsMemoryBudget(const VkhContext& ctxt)
+	{
+		return ctxt.physicalDeviceProperties2 && deviceSupportsExtension(ctxt.gpu.device, VK_EXT_MEMORY_BUDGET_EXTENSION_NAME);
+	}
+
 	void createLogicalDevice(VkhContext& ctxt)
 	{
 		const VkhPhysicalDevice& physDevice = ctxt.gpu;
@@ -413,8 +462,36 @@ namespace vkh
 		VkPhysicalDeviceFeatures deviceFeatures = {};
 		deviceFeatures.samplerAnisotropy = VK_TRUE;
 
+		//batched draws use these when they're there, and fall back to one call per draw command when they aren't
+		deviceFeatures.multiDrawIndirect = physDevice.features.multiDrawIndirect;
+		deviceFeatures.drawIndirectFirstInstance = physDevice.features.drawIndirectFirstInstance;
+
+		bool useDrawIndirectCount = deviceSupportsExtension(physDevice.device, VK_AMD_DRAW_INDIRECT_COUNT_EXTENSION_NAME);
+		if (useDrawIndirectCount)
+		{
+			deviceExtensions.push_back(VK_AMD_DRAW_INDIRECT_COUNT_EXTENSION_NAME);
+		}
+
+		if (deviceSupportsMemoryBudget(ctxt))
+		{
+			deviceExtensions.push_back(VK_EXT_MEMORY_BUDGET_EXTENSION_NAME);
+		}
+
 		VkDeviceCreateInfo createInfo = {};
 		createInfo.sType = VK_STRUCTURE_TYPE_DEVICE_CREATE_INFO;
+
+		//optional, queue timelines fall back to fences without it. The extension depends on
+		//VK_KHR_get_physical_device_properties2, so it's only enabled if the instance has that too
+		VkPhysicalDeviceTimelineSemaphoreFeaturesKHR timelineFeatures = {};
+		bool useTimelineSemaphores = ctxt.physicalDeviceProperties2 && deviceSupportsExtension(physDevice.device, VK_KHR_TIMELINE_SEMAPHORE_EXTENSION_NAME);
+		if (useTimelineSemaphores)
+		{
+			deviceExtensions.push_back(VK_KHR_TIMELINE_SEMAPHORE_EXTENSION_NAME);
+
+			timelineFeatures.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_TIMELINE_SEMAPHORE_FEATURES_KHR;
+			timelineFeatures.timelineSemaphore = VK_TRUE;
+			createInfo.pNext = &timelineFeatures;
+		}
 		createInfo.pQueueCreateInfos = queueCreateInfos.data();
 		createInfo.queueCreateInfoCount = static_cast<uint32_t>(queueCreateInfos.size());
 
@@ -451,6 +528,14 @@ namespace vkh
 		vkGetDeviceQueue(outDevice, physDevice.transferQueueFamilyIdx, 0, &ctxt.deviceQueues.transferQueue);
 		vkGetDeviceQueue(outDevice, physDevice.presentQueueFamilyIdx, 0, &ctxt.deviceQueues.presentQueue);
 
+		Timeline::init(ctxt, useTimelineSemaphores);
+
+		ctxt.cmdDrawIndexedIndirectCount = nullptr;
+		if (useDrawIndirectCount)
+		{
+			ctxt.cmdDrawIndexedIndirectCount = (PFN_vkCmdDrawIndexedIndirectCountAMD)vkGetDeviceProcAddr(outDevice, "vkCmdDrawIndexedIndirectCountAMD");
+		}
+
 	}
 
 	void createSwapchainForSurface(VkhContext& ctxt)
@@ -557,7 +642,9 @@ namespace vkh
 		createInfo.presentMode = desiredPresentMode;
 		createInfo.clipped = VK_TRUE;
 		createInfo.pNext = NULL;
-		createInfo.oldSwapchain = VK_NULL_HANDLE;
+
+		//null on first creation, when recreating this lets the driver reuse resources from the old swap chain
+		createInfo.oldSwapchain = outSwapChain.swapChain;
 
 		VkResult res = vkCreateSwapchainKHR(lDevice, &createInfo, nullptr, &outSwapChain.swapChain);
 		checkf(res == VK_SUCCESS, "Error creating Vulkan Swapchain");
@@ -579,6 +666,35 @@ namespace vkh
 		}
 	}
 
+	//Only the swap chain and its image views get rebuilt here - pipelines use dynamic viewport / scissor state, so
+	//they survive a resize untouched. Anything created from the swap chain images (like framebuffers) needs to be
+	//recreated by the caller, and the driver is free to hand back a different number of images than before, so
+	//anything kept per image needs resizing too. Returns false if the surface currently has no area (ie/ the window is minimized), in
+	//which case nothing is changed and the caller should try again later
+	bool recreateSwapchain(VkhContext& ctxt)
+	{
+		VkSurfaceCapabilitiesKHR capabilities;
+		vkGetPhysicalDeviceSurfaceCapabilitiesKHR(ctxt.gpu.device, ctxt.surface.surface, &capabilities);
+
+		if (capabilities.currentExtent.width == 0 || capabilities.currentExtent.height == 0)
+		{
+			return false;
+		}
+
+		vkDeviceWaitIdle(ctxt.device);
+
+		VkSwapchainKHR oldSwapChain = ctxt.swapChain.swapChain;
+
+		for (uint32_t i = 0; i < ctxt.swapChain.imageViews.size(); ++i)
+		{
+			vkDestroyImageView(ctxt.device, ctxt.swapChain.imageViews[i], nullptr);
+		}
+
+		createSwapchainForSurface(ctxt);
+		vkDestroySwapchainKHR(ctxt.device, oldSwapChain, nullptr);
+		return true;
+	}
+
 	void initContext(VkhContextCreateInfo& info, const char* appName, HINSTANCE Instance, HWND wndHdl, VkhContext& ctxt)
 	{
 		createInstance(ctxt, appName);
@@ -588,7 +704,9 @@ namespace vkh
 		createPhysicalDevice(ctxt);
 		createLogicalDevice(ctxt);
 
-		vkh::allocators::passthrough::activate(&ctxt);
+		if (info.allocator) info.allocator->activate(&ctxt);
+		else vkh::allocators::passthrough::activate(&ctxt);
+		MemoryBudget::init(ctxt, deviceSupportsMemoryBudget(ctxt));
 
 		createSwapchainForSurface(ctxt);
 		createCommandPool(ctxt.gfxCommandPool, ctxt.device, ctxt.gpu, ctxt.gpu.graphicsQueueFamilyIdx);
@@ -597,14 +715,6 @@ namespace vkh
 
 		createDescriptorPool(ctxt.descriptorPool, ctxt.device, info.types, info.typeCounts);
 
-		createVkSemaphore(ctxt.imageAvailableSemaphore, ctxt.device);
-		createVkSemaphore(ctxt.renderFinishedSemaphore, ctxt.device);
-
-		ctxt.frameFences.resize(ctxt.swapChain.imageViews.size());
-
-		for (uint32_t i = 0; i < ctxt.frameFences.size(); ++i)
-		{
-			createFence(ctxt.frameFences[i], ctxt.device);
-		}
+		createFrameContexts(ctxt, info.framesInFlight, info.transientBufferSize);
 	}
 }
\ No newline at end of file
@@ -0,0 +1,159 @@
+#pragma once
+#include "vkh.h"
+#include "file_utils.h"
+#include "hash_utils.h"
+#include <string>
+#include <vector>
+
+//Shader modules are shared between every material that uses the same .spv file. Files are looked up by path first,
+//and then by a hash of their contents, so two paths that point at identical SPIR-V also end up sharing a module.
+//Modules are refcounted, and destroyed once the last user releases them
+
+namespace vkh
+{
+	struct ShaderModule
+	{
+		VkShaderModule	handle;
+		uint64_t		contentHash;
+
+		//owned by the cache, valid until the module is released
+		const uint32_t*	code;
+		size_t			codeSize;
+	};
+}
+
+namespace vkh::ShaderCache
+{
+	struct CacheEntry
+	{
+		ShaderModule	module;
+		DataBuffer*		spirv;
+		uint32_t		refCount;
+	};
+
+	struct PathAlias
+	{
+		std::string		path;
+		uint32_t		entryIdx;
+	};
+
+	struct CacheStats
+	{
+		uint32_t acquires;
+		uint32_t fileLoads;
+		uint32_t modulesCreated;
+		uint32_t modulesDestroyed;
+	};
+
+	struct CacheState
+	{
+		std::vector<CacheEntry>	entries;
+		std::vector<PathAlias>	paths;
+		CacheStats				stats;
+	};
+
+	CacheState state;
+
+	ShaderModule acquireEntry(uint32_t entryIdx)
+	{
+		state.entries[entryIdx].refCount++;
+		return state.entries[entryIdx].module;
+	}
+
+	ShaderModule acquire(const char* path, VkhContext& ctxt)
+	{
+		state.stats.acquires++;
+
+		for (uint32_t i = 0; i < state.paths.size(); ++i)
+		{
+			if (state.paths[i].path == path)
+			{
+				return acquireEntry(state.paths[i].entryIdx);
+			}
+		}
+
+		DataBuffer* spirv = loadBinaryFile(path);
+		state.stats.fileLoads++;
+
+		uint64_t contentHash = hashBytes(spirv->data, spirv->size);
+
+		uint32_t freeIdx = static_cast<uint32_t>(state.entries.size());
+		for (uint32_t i = 0; i < state.entries.size(); ++i)
+		{
+			CacheEntry& entry = state.entries[i];
+			if (entry.refCount == 0)
+			{
+				freeIdx = i;
+				continue;
+			}
+
+			if (entry.module.contentHash == contentHash && entry.spirv->size == spirv->size && memcmp(entry.spirv->data, spirv->data, spirv->size) == 0)
+			{
+				freeDataBuffer(spirv);
+				state.paths.push_back({ path, i });
+				return acquireEntry(i);
+			}
+		}
+
+		CacheEntry newEntry;
+		newEntry.spirv = spirv;
+		newEntry.refCount = 0;
+		newEntry.module.contentHash = contentHash;
+		newEntry.module.code = (const uint32_t*)spirv->data;
+		newEntry.module.codeSize = spirv->size;
+		vkh::createShaderModule(newEntry.module.handle, spirv->data, spirv->size, ctxt);
+		state.stats.modulesCreated++;
+
+		if (freeIdx == state.entries.size())
+		{
+			state.entries.push_back(newEntry);
+		}
+		else
+		{
+			state.entries[freeIdx] = newEntry;
+		}
+
+		state.paths.push_back({ path, freeIdx });
+		return acquireEntry(freeIdx);
+	}
+
+	void release(VkShaderModule module, VkhContext& ctxt)
+	{
+		for (uint32_t i = 0; i < state.entries.size(); ++i)
+		{
+			CacheEntry& entry = state.entries[i];
+			if (entry.refCount == 0 || entry.module.handle != module)
+			{
+				continue;
+			}
+
+			entry.refCount--;
+			if (entry.refCount == 0)
+			{
+				vkDestroyShaderModule(ctxt.device, entry.module.handle, nullptr);
+				freeDataBuffer(entry.spirv);
+				entry.spirv = nullptr;
+				entry.module = {};
+				state.stats.modulesDestroyed++;
+
+				for (uint32_t p = 0; p < state.paths.size();)
+				{
+					if (state.paths[p].entryIdx == i)
+					{
+						state.paths[p] = state.paths.back();
+						state.paths.pop_back();
+					}
+					else ++p;
+				}
+			}
+			return;
+		}
+
+		checkf(0, "Attempting to release a shader module that isn't in the shader cache");
+	}
+
+	CacheStats stats()
+	{
+		return state.stats;
+	}
+}
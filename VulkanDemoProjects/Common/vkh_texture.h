@@ -68,14 +68,18 @@ namespace vkh::Texture
 		allocMemoryForImage(t.deviceMemory, t.image, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, ctxt);
 		vkBindImageMemory(ctxt.device, t.image, t.deviceMemory.handle, t.deviceMemory.offset);
 
-		vkh::transitionImageLayout(t.image, t.format, VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, ctxt);
-		vkh::copyBufferToImage(stagingBuffer, t.image, t.width, t.height, ctxt);
+		//both transitions and the copy go in one command buffer on the graphics queue, so they're ordered by the
+		//barriers instead of by waiting on the cpu between each step
+		vkh::VkhCommandBuffer scratch = vkh::beginScratchCommandBuffer(vkh::ECommandPoolType::Graphics, ctxt);
+		vkh::transitionImageLayout(t.image, t.format, VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, scratch);
+		vkh::copyBufferToImage(stagingBuffer, t.image, t.width, t.height, scratch);
+		vkh::transitionImageLayout(t.image, t.format, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL, scratch);
 
-		vkh::transitionImageLayout(t.image, t.format, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL, ctxt);
+		uint64_t uploadValue = vkh::submitScratchCommandBufferAsync(scratch);
+		Timeline::markUpload(vkh::ECommandPoolType::Graphics, uploadValue);
 
 		vkh::createImageView(t.view, t.format, VK_IMAGE_ASPECT_COLOR_BIT, 1, t.image, ctxt.device);
 
-		vkDestroyBuffer(ctxt.device, stagingBuffer, nullptr);
-		vkh::freeDeviceMemory(stagingBufferMemory);
+		DeletionQueue::destroyBuffer(stagingBuffer, stagingBufferMemory, vkh::ECommandPoolType::Graphics, uploadValue);
 	}
 }
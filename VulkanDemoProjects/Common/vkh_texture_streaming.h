@@ -0,0 +1,353 @@
+#pragma once
+#include "vkh.h"
+#include "vkh_texture.h"
+#include <algorithm>
+#include <vector>
+
+//Textures that can be drawn as soon as their smallest mips are on the gpu, and load the bigger ones as they're needed.
+//The whole mip chain is built on the cpu when the texture is created, but only the tail (mips no bigger than
+//STREAMING_TEXTURE_TAIL_SIZE) goes to the gpu straight away. After that, requestMip says which level a texture
+//should have (mipForScreenSize works it out from how big it is on screen), and update moves textures towards it,
+//uploading at most one new level per texture per step, most important textures first.
+//
+//The image only ever holds the resident levels, so memory tracks what's being drawn. Changing them means making a new
+//image, copying over the levels it keeps, and uploading the new ones. The new view starts at the most detailed
+//resident level, which clamps sampling to what's there, and anything holding on to the old view (descriptor sets,
+//cached command buffers) has to be updated when update returns true. The old image goes through the deletion queue
+
+//mips at or below this size are uploaded when a texture is created
+#define STREAMING_TEXTURE_TAIL_SIZE 32
+#define STREAMING_TEXTURE_MAX_MIPS 16
+
+namespace vkh
+{
+	struct StreamingTexture
+	{
+		VkImage			image;
+		Allocation		memory;
+		VkImageView		view;
+		VkFormat		format;
+
+		uint32_t		width;
+		uint32_t		height;
+		uint32_t		mipCount;
+
+		//levels [residentMip, mipCount) are on the gpu, and are levels [0, mipCount - residentMip) of image
+		uint32_t		residentMip;
+		uint32_t		tailMip;
+		uint32_t		desiredMip;
+		float			priority;
+
+		//the whole chain, rgba8
+		std::vector<uint8_t>	pixels;
+		VkDeviceSize			mipOffsets[STREAMING_TEXTURE_MAX_MIPS];
+	};
+}
+
+namespace vkh::TextureStreaming
+{
+	struct StreamingStats
+	{
+		uint64_t		mipsUploaded;
+		uint64_t		mipsDropped;
+		VkDeviceSize	bytesUploaded;
+	};
+
+	struct StreamingState
+	{
+		StreamingStats	stats;
+	};
+
+	StreamingState state;
+
+	uint32_t mipWidth(const StreamingTexture& tex, uint32_t mip)
+	{
+		return std::max(tex.width >> mip, 1u);
+	}
+
+	uint32_t mipHeight(const StreamingTexture& tex, uint32_t mip)
+	{
+		return std::max(tex.height >> mip, 1u);
+	}
+
+	VkDeviceSize mipSize(const StreamingTexture& tex, uint32_t mip)
+	{
+		return (VkDeviceSize)mipWidth(tex, mip) * mipHeight(tex, mip) * 4;
+	}
+
+	//2x2 box filter, odd sized levels repeat their last row / column
+	void downsample(const uint8_t* src, uint32_t srcWidth, uint32_t srcHeight, uint8_t* dst, uint32_t dstWidth, uint32_t dstHeight)
+	{
+		for (uint32_t y = 0; y < dstHeight; ++y)
+		{
+			uint32_t y0 = std::min(y * 2, srcHeight - 1);
+			uint32_t y1 = std::min(y * 2 + 1, srcHeight - 1);
+
+			for (uint32_t x = 0; x < dstWidth; ++x)
+			{
+				uint32_t x0 = std::min(x * 2, srcWidth - 1);
+				uint32_t x1 = std::min(x * 2 + 1, srcWidth - 1);
+
+				for (uint32_t c = 0; c < 4; ++c)
+				{
+					uint32_t sum = src[(y0 * srcWidth + x0) * 4 + c] + src[(y0 * srcWidth + x1) * 4 + c]
+						+ src[(y1 * srcWidth + x0) * 4 + c] + src[(y1 * srcWidth + x1) * 4 + c];
+					dst[(y * dstWidth + x) * 4 + c] = static_cast<uint8_t>((sum + 2) / 4);
+				}
+			}
+		}
+	}
+
+	void imageBarrier(VkCommandBuffer commandBuffer, VkImage image, uint32_t firstMip, uint32_t mipCount,
+		VkImageLayout oldLayout, VkImageLayout newLayout, VkAccessFlags srcAccess, VkAccessFlags dstAccess, VkPipelineStageFlags srcStage, VkPipelineStageFlags dstStage)
+	{
+		VkImageMemoryBarrier barrier = {};
+		barrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
+		barrier.oldLayout = oldLayout;
+		barrier.newLayout = newLayout;
+		barrier.srcAccessMask = srcAccess;
+		barrier.dstAccessMask = dstAccess;
+		barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+		barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+		barrier.image = image;
+		barrier.subresourceRange.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+		barrier.subresourceRange.baseMipLevel = firstMip;
+		barrier.subresourceRange.levelCount = mipCount;
+		barrier.subresourceRange.baseArrayLayer = 0;
+		barrier.subresourceRange.layerCount = 1;
+
+		vkCmdPipelineBarrier(commandBuffer, srcStage, dstStage, 0, 0, nullptr, 0, nullptr, 1, &barrier);
+	}
+
+	//replaces the image with one that holds levels [newResidentMip, mipCount), keeping whatever levels the old one had
+	//and uploading the rest
+	void setResidentMip(StreamingTexture& tex, uint32_t newResidentMip, VkhContext& ctxt)
+	{
+		bool hasOldImage = tex.image != VK_NULL_HANDLE;
+		VkImage oldImage = tex.image;
+		VkImageView oldView = tex.view;
+		Allocation oldMemory = tex.memory;
+		uint32_t oldResidentMip = hasOldImage ? tex.residentMip : tex.mipCount;
+
+		uint32_t levelCount = tex.mipCount - newResidentMip;
+		createImage(tex.image, mipWidth(tex, newResidentMip), mipHeight(tex, newResidentMip), tex.format, VK_IMAGE_TILING_OPTIMAL,
+			VK_IMAGE_USAGE_TRANSFER_DST_BIT | VK_IMAGE_USAGE_TRANSFER_SRC_BIT | VK_IMAGE_USAGE_SAMPLED_BIT, ctxt, levelCount);
+
+		allocMemoryForImage(tex.memory, tex.image, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, ctxt);
+		vkBindImageMemory(ctxt.device, tex.image, tex.memory.handle, tex.memory.offset);
+
+		//levels the old image doesn't have come from a staging buffer
+		uint32_t uploadEnd = std::min(oldResidentMip, tex.mipCount);
+		VkDeviceSize uploadSize = 0;
+		for (uint32_t mip = newResidentMip; mip < uploadEnd; ++mip)
+		{
+			uploadSize += mipSize(tex, mip);
+		}
+
+		VkBuffer stagingBuffer = VK_NULL_HANDLE;
+		Allocation stagingMemory;
+		std::vector<VkBufferImageCopy> uploads;
+
+		if (uploadSize > 0)
+		{
+			createBuffer(stagingBuffer, stagingMemory, uploadSize, VK_BUFFER_USAGE_TRANSFER_SRC_BIT, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, ctxt);
+
+			char* mapped;
+			VkResult res = vkMapMemory(ctxt.device, stagingMemory.handle, stagingMemory.offset, uploadSize, 0, (void**)&mapped);
+			checkf(res == VK_SUCCESS, "Error mapping texture staging memory");
+
+			VkDeviceSize stagingOffset = 0;
+			for (uint32_t mip = newResidentMip; mip < uploadEnd; ++mip)
+			{
+				memcpy(mapped + stagingOffset, &tex.pixels[(size_t)tex.mipOffsets[mip]], (size_t)mipSize(tex, mip));
+
+				VkBufferImageCopy region = {};
+				region.bufferOffset = stagingOffset;
+				region.imageSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+				region.imageSubresource.mipLevel = mip - newResidentMip;
+				region.imageSubresource.layerCount = 1;
+				region.imageExtent = { mipWidth(tex, mip), mipHeight(tex, mip), 1 };
+				uploads.push_back(region);
+
+				stagingOffset += mipSize(tex, mip);
+			}
+
+			vkUnmapMemory(ctxt.device, stagingMemory.handle);
+		}
+
+		//copies and uploads go on the graphics queue, after the frames that are still reading the old image
+		VkhCommandBuffer scratch = beginScratchCommandBuffer(ECommandPoolType::Graphics, ctxt);
+
+		imageBarrier(scratch.buffer, tex.image, 0, levelCount, VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
+			0, VK_ACCESS_TRANSFER_WRITE_BIT, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT);
+
+		if (uploads.size() > 0)
+		{
+			vkCmdCopyBufferToImage(scratch.buffer, stagingBuffer, tex.image, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, static_cast<uint32_t>(uploads.size()), uploads.data());
+		}
+
+		if (hasOldImage)
+		{
+			uint32_t keepFirst = std::max(newResidentMip, oldResidentMip);
+			uint32_t oldLevelCount = tex.mipCount - oldResidentMip;
+
+			imageBarrier(scratch.buffer, oldImage, 0, oldLevelCount, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL,
+				VK_ACCESS_SHADER_READ_BIT, VK_ACCESS_TRANSFER_READ_BIT, VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT);
+
+			std::vector<VkImageCopy> copies;
+			for (uint32_t mip = keepFirst; mip < tex.mipCount; ++mip)
+			{
+				VkImageCopy region = {};
+				region.srcSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+				region.srcSubresource.mipLevel = mip - oldResidentMip;
+				region.srcSubresource.layerCount = 1;
+				region.dstSubresource = region.srcSubresource;
+				region.dstSubresource.mipLevel = mip - newResidentMip;
+				region.extent = { mipWidth(tex, mip), mipHeight(tex, mip), 1 };
+				copies.push_back(region);
+			}
+
+			vkCmdCopyImage(scratch.buffer, oldImage, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL, tex.image, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, static_cast<uint32_t>(copies.size()), copies.data());
+		}
+
+		imageBarrier(scratch.buffer, tex.image, 0, levelCount, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL,
+			VK_ACCESS_TRANSFER_WRITE_BIT, VK_ACCESS_SHADER_READ_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT);
+
+		uint64_t uploadValue = submitScratchCommandBufferAsync(scratch);
+		Timeline::markUpload(ECommandPoolType::Graphics, uploadValue);
+
+		createImageView(tex.view, tex.format, VK_IMAGE_ASPECT_COLOR_BIT, levelCount, tex.image, ctxt.device);
+
+		if (stagingBuffer != VK_NULL_HANDLE)
+		{
+			DeletionQueue::destroyBuffer(stagingBuffer, stagingMemory, ECommandPoolType::Graphics, uploadValue);
+		}
+
+		//the frame that's being recorded might have used the old view before this was called
+		if (hasOldImage)
+		{
+			DeletionQueue::destroyImage(oldImage, oldView, oldMemory, ECommandPoolType::Graphics, Timeline::nextValue(ECommandPoolType::Graphics));
+		}
+
+		state.stats.mipsUploaded += uploads.size();
+		state.stats.mipsDropped += newResidentMip > oldResidentMip && hasOldImage ? newResidentMip - oldResidentMip : 0;
+		state.stats.bytesUploaded += uploadSize;
+		tex.residentMip = newResidentMip;
+	}
+
+	//usable as soon as this returns, with just the tail mips resident
+	void create(StreamingTexture& outTexture, const char* filepath, VkhContext& ctxt)
+	{
+		StreamingTexture& tex = outTexture;
+
+		int texWidth, texHeight, texChannels;
+		stbi_uc* pixels = stbi_load(filepath, &texWidth, &texHeight, &texChannels, STBI_rgb_alpha);
+		checkf(pixels, "Could not load image");
+
+		tex.width = texWidth;
+		tex.height = texHeight;
+		tex.format = VK_FORMAT_R8G8B8A8_UNORM;
+		tex.image = VK_NULL_HANDLE;
+		tex.view = VK_NULL_HANDLE;
+		tex.priority = 0.0f;
+
+		tex.mipCount = 1;
+		while ((std::max(tex.width, tex.height) >> tex.mipCount) > 0 && tex.mipCount < STREAMING_TEXTURE_MAX_MIPS)
+		{
+			tex.mipCount++;
+		}
+
+		VkDeviceSize chainSize = 0;
+		for (uint32_t mip = 0; mip < tex.mipCount; ++mip)
+		{
+			tex.mipOffsets[mip] = chainSize;
+			chainSize += mipSize(tex, mip);
+		}
+
+		tex.pixels.resize((size_t)chainSize);
+		memcpy(tex.pixels.data(), pixels, (size_t)mipSize(tex, 0));
+		stbi_image_free(pixels);
+
+		for (uint32_t mip = 1; mip < tex.mipCount; ++mip)
+		{
+			downsample(&tex.pixels[(size_t)tex.mipOffsets[mip - 1]], mipWidth(tex, mip - 1), mipHeight(tex, mip - 1),
+				&tex.pixels[(size_t)tex.mipOffsets[mip]], mipWidth(tex, mip), mipHeight(tex, mip));
+		}
+
+		tex.tailMip = 0;
+		while (std::max(mipWidth(tex, tex.tailMip), mipHeight(tex, tex.tailMip)) > STREAMING_TEXTURE_TAIL_SIZE)
+		{
+			tex.tailMip++;
+		}
+
+		tex.desiredMip = tex.tailMip;
+		setResidentMip(tex, tex.tailMip, ctxt);
+	}
+
+	//the smallest level that still has at least as many texels as the texture covers pixels on screen
+	uint32_t mipForScreenSize(const StreamingTexture& tex, uint32_t screenPixels)
+	{
+		uint32_t mip = 0;
+		while (mip + 1 < tex.mipCount && std::max(mipWidth(tex, mip + 1), mipHeight(tex, mip + 1)) >= screenPixels)
+		{
+			mip++;
+		}
+		return mip;
+	}
+
+	//the tail always stays resident. Higher priority textures get their levels first
+	void requestMip(StreamingTexture& tex, uint32_t mip, float priority)
+	{
+		tex.desiredMip = std::min(mip, tex.tailMip);
+		tex.priority = priority;
+	}
+
+	bool higherPriority(const StreamingTexture* a, const StreamingTexture* b)
+	{
+		return a->priority > b->priority;
+	}
+
+	//moves up to maxSteps textures towards the level they want, one more level at a time, or straight down to it when
+	//they want less. Returns true if any views changed
+	bool update(StreamingTexture** textures, uint32_t count, uint32_t maxSteps, VkhContext& ctxt)
+	{
+		std::vector<StreamingTexture*> pending;
+		for (uint32_t i = 0; i < count; ++i)
+		{
+			if (textures[i]->residentMip != textures[i]->desiredMip)
+			{
+				pending.push_back(textures[i]);
+			}
+		}
+
+		std::stable_sort(pending.begin(), pending.end(), higherPriority);
+
+		uint32_t steps = std::min(maxSteps, static_cast<uint32_t>(pending.size()));
+		for (uint32_t i = 0; i < steps; ++i)
+		{
+			StreamingTexture& tex = *pending[i];
+			uint32_t target = tex.desiredMip < tex.residentMip ? tex.residentMip - 1 : tex.desiredMip;
+			setResidentMip(tex, target, ctxt);
+		}
+
+		return steps > 0;
+	}
+
+	void destroy(StreamingTexture& tex)
+	{
+		if (tex.image == VK_NULL_HANDLE) return;
+
+		DeletionQueue::destroyImage(tex.image, tex.view, tex.memory, ECommandPoolType::Graphics, Timeline::nextValue(ECommandPoolType::Graphics));
+		tex.image = VK_NULL_HANDLE;
+		tex.view = VK_NULL_HANDLE;
+		tex.pixels.clear();
+	}
+
+	//returns the totals since the last call
+	StreamingStats consumeStats()
+	{
+		StreamingStats stats = state.stats;
+		state.stats = {};
+		return stats;
+	}
+}
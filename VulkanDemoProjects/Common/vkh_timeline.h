@@ -0,0 +1,423 @@
+#pragma once
+#include "vkh_types.h"
+#include "debug.h"
+#include <vector>
+
+//Every queue gets a single, monotonically increasing timeline. Each submit through here signals the next value on
+//its queue's timeline, so "has this work finished" becomes "has the queue reached value X", and one query tells
+//us everything the gpu has finished on that queue, instead of polling a fence per submission.
+//When VK_KHR_timeline_semaphore isn't available, each submit gets a fence instead, and the completed value is
+//worked out by walking the outstanding fences in submission order
+
+//the vulkan headers in external/ predate VK_KHR_timeline_semaphore, so declare what we need from it here
+#ifndef VK_KHR_timeline_semaphore
+#define VK_KHR_timeline_semaphore 1
+#define VK_KHR_TIMELINE_SEMAPHORE_EXTENSION_NAME "VK_KHR_timeline_semaphore"
+
+#define VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_TIMELINE_SEMAPHORE_FEATURES_KHR ((VkStructureType)1000207000)
+#define VK_STRUCTURE_TYPE_SEMAPHORE_TYPE_CREATE_INFO_KHR ((VkStructureType)1000207002)
+#define VK_STRUCTURE_TYPE_TIMELINE_SEMAPHORE_SUBMIT_INFO_KHR ((VkStructureType)1000207003)
+#define VK_STRUCTURE_TYPE_SEMAPHORE_WAIT_INFO_KHR ((VkStructureType)1000207004)
+
+typedef enum VkSemaphoreTypeKHR
+{
+	VK_SEMAPHORE_TYPE_BINARY_KHR = 0,
+	VK_SEMAPHORE_TYPE_TIMELINE_KHR = 1,
+} VkSemaphoreTypeKHR;
+
+typedef VkFlags VkSemaphoreWaitFlagsKHR;
+
+typedef struct VkPhysicalDeviceTimelineSemaphoreFeaturesKHR
+{
+	VkStructureType		sType;
+	void*				pNext;
+	VkBool32			timelineSemaphore;
+} VkPhysicalDeviceTimelineSemaphoreFeaturesKHR;
+
+typedef struct VkSemaphoreTypeCreateInfoKHR
+{
+	VkStructureType		sType;
+	const void*			pNext;
+	VkSemaphoreTypeKHR	semaphoreType;
+	uint64_t			initialValue;
+} VkSemaphoreTypeCreateInfoKHR;
+
+typedef struct VkTimelineSemaphoreSubmitInfoKHR
+{
+	VkStructureType		sType;
+	const void*			pNext;
+	uint32_t			waitSemaphoreValueCount;
+	const uint64_t*		pWaitSemaphoreValues;
+	uint32_t			signalSemaphoreValueCount;
+	const uint64_t*		pSignalSemaphoreValues;
+} VkTimelineSemaphoreSubmitInfoKHR;
+
+typedef struct VkSemaphoreWaitInfoKHR
+{
+	VkStructureType			sType;
+	const void*				pNext;
+	VkSemaphoreWaitFlagsKHR	flags;
+	uint32_t				semaphoreCount;
+	const VkSemaphore*		pSemaphores;
+	const uint64_t*			pValues;
+} VkSemaphoreWaitInfoKHR;
+
+typedef VkResult (VKAPI_PTR *PFN_vkGetSemaphoreCounterValueKHR)(VkDevice device, VkSemaphore semaphore, uint64_t* pValue);
+typedef VkResult (VKAPI_PTR *PFN_vkWaitSemaphoresKHR)(VkDevice device, const VkSemaphoreWaitInfoKHR* pWaitInfo, uint64_t timeout);
+#endif
+
+#define TIMELINE_QUEUE_COUNT 3
+#define TIMELINE_MAX_SUBMIT_SEMAPHORES 8
+
+namespace vkh::Timeline
+{
+	//a dependency on another point on a timeline, which can be on a different queue
+	struct TimelineWait
+	{
+		ECommandPoolType		queue;
+		uint64_t				value;
+		VkPipelineStageFlags	stage;
+	};
+
+	struct PendingFence
+	{
+		VkFence		fence;
+		uint64_t	value;
+	};
+
+	struct QueueTimeline
+	{
+		VkQueue		queue;
+		uint64_t	submittedValue;
+		uint64_t	completedValue;
+
+		//the last submit on this queue that uploaded data other submits read from, see pendingUploadWaits
+		uint64_t	uploadValue;
+
+		//only used when timeline semaphores are supported
+		VkSemaphore	semaphore;
+
+		//only used for the fence fallback, pending is kept in submission order
+		std::vector<PendingFence>	pendingFences;
+		std::vector<VkFence>		freeFences;
+	};
+
+	struct TimelineState
+	{
+		bool				useTimelineSemaphores;
+		VkDevice			device;
+
+		//indexed by ECommandPoolType. If two queue types map to the same VkQueue, they share a timeline
+		QueueTimeline		timelines[TIMELINE_QUEUE_COUNT];
+		uint32_t			timelineForQueueType[TIMELINE_QUEUE_COUNT];
+
+		PFN_vkGetSemaphoreCounterValueKHR	getSemaphoreCounterValue;
+		PFN_vkWaitSemaphoresKHR				waitSemaphores;
+	};
+
+	TimelineState state;
+
+	//useTimelineSemaphores has to match whether the device was created with VK_KHR_timeline_semaphore enabled
+	void init(VkhContext& ctxt, bool useTimelineSemaphores)
+	{
+		state.useTimelineSemaphores = useTimelineSemaphores;
+		state.device = ctxt.device;
+
+		if (useTimelineSemaphores)
+		{
+			state.getSemaphoreCounterValue = (PFN_vkGetSemaphoreCounterValueKHR)vkGetDeviceProcAddr(ctxt.device, "vkGetSemaphoreCounterValueKHR");
+			state.waitSemaphores = (PFN_vkWaitSemaphoresKHR)vkGetDeviceProcAddr(ctxt.device, "vkWaitSemaphoresKHR");
+			checkf(state.getSemaphoreCounterValue && state.waitSemaphores, "Failed to load VK_KHR_timeline_semaphore functions");
+		}
+
+		VkQueue queues[TIMELINE_QUEUE_COUNT];
+		queues[ECommandPoolType::Graphics] = ctxt.deviceQueues.graphicsQueue;
+		queues[ECommandPoolType::Transfer] = ctxt.deviceQueues.transferQueue;
+		queues[ECommandPoolType::Present] = ctxt.deviceQueues.presentQueue;
+
+		for (uint32_t i = 0; i < TIMELINE_QUEUE_COUNT; ++i)
+		{
+			state.timelineForQueueType[i] = i;
+			for (uint32_t j = 0; j < i; ++j)
+			{
+				if (queues[j] == queues[i])
+				{
+					state.timelineForQueueType[i] = state.timelineForQueueType[j];
+					break;
+				}
+			}
+
+			QueueTimeline& timeline = state.timelines[i];
+			timeline.queue = queues[i];
+			timeline.submittedValue = 0;
+			timeline.completedValue = 0;
+			timeline.uploadValue = 0;
+			timeline.semaphore = VK_NULL_HANDLE;
+
+			if (useTimelineSemaphores && state.timelineForQueueType[i] == i)
+			{
+				VkSemaphoreTypeCreateInfoKHR typeInfo = {};
+				typeInfo.sType = VK_STRUCTURE_TYPE_SEMAPHORE_TYPE_CREATE_INFO_KHR;
+				typeInfo.semaphoreType = VK_SEMAPHORE_TYPE_TIMELINE_KHR;
+				typeInfo.initialValue = 0;
+
+				VkSemaphoreCreateInfo semaphoreInfo = {};
+				semaphoreInfo.sType = VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO;
+				semaphoreInfo.pNext = &typeInfo;
+
+				VkResult res = vkCreateSemaphore(ctxt.device, &semaphoreInfo, nullptr, &timeline.semaphore);
+				checkf(res == VK_SUCCESS, "Error creating timeline semaphore");
+			}
+		}
+	}
+
+	QueueTimeline& timelineFor(ECommandPoolType queueType)
+	{
+		return state.timelines[state.timelineForQueueType[queueType]];
+	}
+
+	VkFence getFence()
+	{
+		//fences are recycled from the free lists of every timeline, since they all come from the same device
+		for (uint32_t i = 0; i < TIMELINE_QUEUE_COUNT; ++i)
+		{
+			std::vector<VkFence>& freeFences = state.timelines[i].freeFences;
+			if (freeFences.size() > 0)
+			{
+				VkFence fence = freeFences.back();
+				freeFences.pop_back();
+				vkResetFences(state.device, 1, &fence);
+				return fence;
+			}
+		}
+
+		VkFenceCreateInfo fenceInfo = {};
+		fenceInfo.sType = VK_STRUCTURE_TYPE_FENCE_CREATE_INFO;
+
+		VkFence fence;
+		VkResult res = vkCreateFence(state.device, &fenceInfo, nullptr, &fence);
+		checkf(res == VK_SUCCESS, "Error creating timeline fallback fence");
+		return fence;
+	}
+
+	void wait(ECommandPoolType queueType, uint64_t value);
+
+	//submits the work in submitInfo, along with a signal of the queue's next timeline value, and returns that value.
+	//Any semaphores already in submitInfo are binary semaphores, and are waited on / signaled as normal.
+	//waits are done on the gpu with timeline semaphores, the fence fallback has to block on the cpu for them instead
+	uint64_t submit(ECommandPoolType queueType, const VkSubmitInfo& submitInfo, const TimelineWait* waits = nullptr, uint32_t waitCount = 0)
+	{
+		QueueTimeline& timeline = timelineFor(queueType);
+
+		VkSubmitInfo info = submitInfo;
+		VkResult res;
+
+		if (state.useTimelineSemaphores)
+		{
+			uint64_t value = ++timeline.submittedValue;
+
+			checkf(submitInfo.signalSemaphoreCount < TIMELINE_MAX_SUBMIT_SEMAPHORES && submitInfo.waitSemaphoreCount + waitCount <= TIMELINE_MAX_SUBMIT_SEMAPHORES, "Too many semaphores in a single timeline submit");
+
+			//values for binary semaphores are ignored, but every semaphore needs an entry
+			VkSemaphore signalSemaphores[TIMELINE_MAX_SUBMIT_SEMAPHORES];
+			VkSemaphore waitSemaphores[TIMELINE_MAX_SUBMIT_SEMAPHORES];
+			VkPipelineStageFlags waitStages[TIMELINE_MAX_SUBMIT_SEMAPHORES];
+			uint64_t signalValues[TIMELINE_MAX_SUBMIT_SEMAPHORES] = {};
+			uint64_t waitValues[TIMELINE_MAX_SUBMIT_SEMAPHORES] = {};
+
+			for (uint32_t i = 0; i < submitInfo.signalSemaphoreCount; ++i)
+			{
+				signalSemaphores[i] = submitInfo.pSignalSemaphores[i];
+			}
+
+			for (uint32_t i = 0; i < submitInfo.waitSemaphoreCount; ++i)
+			{
+				waitSemaphores[i] = submitInfo.pWaitSemaphores[i];
+				waitStages[i] = submitInfo.pWaitDstStageMask[i];
+			}
+
+			for (uint32_t i = 0; i < waitCount; ++i)
+			{
+				uint32_t waitIdx = submitInfo.waitSemaphoreCount + i;
+				waitSemaphores[waitIdx] = timelineFor(waits[i].queue).semaphore;
+				waitStages[waitIdx] = waits[i].stage;
+				waitValues[waitIdx] = waits[i].value;
+			}
+
+			signalSemaphores[submitInfo.signalSemaphoreCount] = timeline.semaphore;
+			signalValues[submitInfo.signalSemaphoreCount] = value;
+
+			VkTimelineSemaphoreSubmitInfoKHR timelineInfo = {};
+			timelineInfo.sType = VK_STRUCTURE_TYPE_TIMELINE_SEMAPHORE_SUBMIT_INFO_KHR;
+			timelineInfo.pNext = submitInfo.pNext;
+			timelineInfo.waitSemaphoreValueCount = submitInfo.waitSemaphoreCount + waitCount;
+			timelineInfo.pWaitSemaphoreValues = waitValues;
+			timelineInfo.signalSemaphoreValueCount = submitInfo.signalSemaphoreCount + 1;
+			timelineInfo.pSignalSemaphoreValues = signalValues;
+
+			info.pNext = &timelineInfo;
+			info.waitSemaphoreCount = submitInfo.waitSemaphoreCount + waitCount;
+			info.pWaitSemaphores = waitSemaphores;
+			info.pWaitDstStageMask = waitStages;
+			info.signalSemaphoreCount = submitInfo.signalSemaphoreCount + 1;
+			info.pSignalSemaphores = signalSemaphores;
+
+			res = vkQueueSubmit(timeline.queue, 1, &info, VK_NULL_HANDLE);
+			checkf(res == VK_SUCCESS, "Error submitting to queue timeline");
+			return value;
+		}
+		else
+		{
+			for (uint32_t i = 0; i < waitCount; ++i)
+			{
+				wait(waits[i].queue, waits[i].value);
+			}
+
+			uint64_t value = ++timeline.submittedValue;
+
+			PendingFence pending;
+			pending.fence = getFence();
+			pending.value = value;
+			timeline.pendingFences.push_back(pending);
+
+			res = vkQueueSubmit(timeline.queue, 1, &info, pending.fence);
+			checkf(res == VK_SUCCESS, "Error submitting to queue timeline");
+			return value;
+		}
+	}
+
+	//the highest value the gpu has finished on this queue. Cheap enough to call whenever
+	uint64_t completedValue(ECommandPoolType queueType)
+	{
+		QueueTimeline& timeline = timelineFor(queueType);
+
+		if (state.useTimelineSemaphores)
+		{
+			VkResult res = state.getSemaphoreCounterValue(state.device, timeline.semaphore, &timeline.completedValue);
+			checkf(res == VK_SUCCESS, "Error querying timeline semaphore value");
+			return timeline.completedValue;
+		}
+
+		//work on a queue finishes in order, so we can stop at the first fence that isn't signaled yet
+		uint32_t retired = 0;
+		while (retired < timeline.pendingFences.size() && vkGetFenceStatus(state.device, timeline.pendingFences[retired].fence) == VK_SUCCESS)
+		{
+			timeline.completedValue = timeline.pendingFences[retired].value;
+			timeline.freeFences.push_back(timeline.pendingFences[retired].fence);
+			retired++;
+		}
+
+		timeline.pendingFences.erase(timeline.pendingFences.begin(), timeline.pendingFences.begin() + retired);
+		return timeline.completedValue;
+	}
+
+	bool isComplete(ECommandPoolType queueType, uint64_t value)
+	{
+		return value <= timelineFor(queueType).completedValue || value <= completedValue(queueType);
+	}
+
+	//blocks until the queue's timeline has reached value
+	void wait(ECommandPoolType queueType, uint64_t value)
+	{
+		QueueTimeline& timeline = timelineFor(queueType);
+		checkf(value <= timeline.submittedValue, "Waiting on a timeline value that hasn't been submitted, this would never return");
+
+		if (value <= timeline.completedValue)
+		{
+			return;
+		}
+
+		if (state.useTimelineSemaphores)
+		{
+			VkSemaphoreWaitInfoKHR waitInfo = {};
+			waitInfo.sType = VK_STRUCTURE_TYPE_SEMAPHORE_WAIT_INFO_KHR;
+			waitInfo.semaphoreCount = 1;
+			waitInfo.pSemaphores = &timeline.semaphore;
+			waitInfo.pValues = &value;
+
+			VkResult res = state.waitSemaphores(state.device, &waitInfo, UINT64_MAX);
+			checkf(res == VK_SUCCESS, "Error waiting on timeline semaphore");
+			timeline.completedValue = value > timeline.completedValue ? value : timeline.completedValue;
+			return;
+		}
+
+		for (uint32_t i = 0; i < timeline.pendingFences.size(); ++i)
+		{
+			if (timeline.pendingFences[i].value >= value)
+			{
+				VkResult res = vkWaitForFences(state.device, 1, &timeline.pendingFences[i].fence, VK_TRUE, UINT64_MAX);
+				checkf(res == VK_SUCCESS, "Error waiting on timeline fallback fence");
+				break;
+			}
+		}
+
+		completedValue(queueType);
+	}
+
+	uint64_t submittedValue(ECommandPoolType queueType)
+	{
+		return timelineFor(queueType).submittedValue;
+	}
+
+	//the value the next submit on this queue will signal, eg: for tagging things used by the frame that's being recorded
+	uint64_t nextValue(ECommandPoolType queueType)
+	{
+		return timelineFor(queueType).submittedValue + 1;
+	}
+
+	//uploads are submitted without waiting for them to finish, so anything that reads uploaded data has to wait for
+	//them on the gpu instead. Marks value as an upload that later submits need to wait for
+	void markUpload(ECommandPoolType queueType, uint64_t value)
+	{
+		QueueTimeline& timeline = timelineFor(queueType);
+		timeline.uploadValue = value > timeline.uploadValue ? value : timeline.uploadValue;
+	}
+
+	//fills outWaits with a wait for every timeline with an upload that might still be running, and returns how many there are
+	uint32_t pendingUploadWaits(TimelineWait* outWaits, VkPipelineStageFlags stage)
+	{
+		uint32_t waitCount = 0;
+		for (uint32_t i = 0; i < TIMELINE_QUEUE_COUNT; ++i)
+		{
+			if (state.timelineForQueueType[i] != i) continue;
+
+			ECommandPoolType queueType = (ECommandPoolType)i;
+			uint64_t uploadValue = state.timelines[i].uploadValue;
+
+			if (uploadValue > 0 && !isComplete(queueType, uploadValue))
+			{
+				outWaits[waitCount].queue = queueType;
+				outWaits[waitCount].value = uploadValue;
+				outWaits[waitCount].stage = stage;
+				waitCount++;
+			}
+		}
+
+		return waitCount;
+	}
+
+	//waits for all outstanding work before destroying anything
+	void destroy()
+	{
+		for (uint32_t i = 0; i < TIMELINE_QUEUE_COUNT; ++i)
+		{
+			if (state.timelineForQueueType[i] != i) continue;
+
+			ECommandPoolType queueType = (ECommandPoolType)i;
+			wait(queueType, submittedValue(queueType));
+
+			QueueTimeline& timeline = state.timelines[i];
+			if (timeline.semaphore != VK_NULL_HANDLE)
+			{
+				vkDestroySemaphore(state.device, timeline.semaphore, nullptr);
+			}
+
+			for (uint32_t f = 0; f < timeline.freeFences.size(); ++f)
+			{
+				vkDestroyFence(state.device, timeline.freeFences[f], nullptr);
+			}
+
+			timeline.freeFences.clear();
+		}
+	}
+}
@@ -0,0 +1,222 @@
+#pragma once
+#include "vkh.h"
+#include "vkh_timeline.h"
+#include "vkh_deletion_queue.h"
+#include <algorithm>
+#include <vector>
+
+//A device local buffer with a cpu side shadow copy that remembers which bytes have been written since it was last
+//flushed. Flushing sorts the dirty ranges, merges the ones that overlap or touch, packs just those bytes into a
+//staging buffer, and copies them all across with a single vkCmdCopyBuffer that has a region per merged range, so
+//changing one entry of a large array only sends that entry's bytes over the bus. When the gpu has device local memory
+//the cpu can write to (see hasDirectUploadMemory), the buffer is created in it, and flushing writes the dirty ranges
+//straight into it instead, with no staging buffer or transfer submit.
+//
+//Like copyDataToBuffer, the copy isn't waited on. Frames submitted with submitFrame wait for it on the gpu, but the
+//copy doesn't wait for frames that are still reading the old contents, so anything that reads the buffer every frame
+//should double buffer it, or only flush when nothing in flight uses it
+
+namespace vkh
+{
+	struct TrackedRange
+	{
+		VkDeviceSize	offset;
+		VkDeviceSize	size;
+	};
+
+	struct TrackedBufferStats
+	{
+		uint64_t	flushes;
+		uint64_t	regions;
+		uint64_t	bytes;
+
+		//how many of the bytes were written straight to the buffer rather than staged
+		uint64_t	directBytes;
+	};
+
+	struct TrackedBuffer
+	{
+		VkBuffer					buffer;
+		Allocation					memory;
+		VkDeviceSize				size;
+
+		//what the buffer will hold once everything dirty has been flushed
+		std::vector<char>			shadow;
+		std::vector<TrackedRange>	dirty;
+
+		TrackedBufferStats			stats;
+	};
+
+	//TRANSFER_DST is added to usage, for when the buffer isn't host visible
+	void createTrackedBuffer(TrackedBuffer& outBuffer, VkDeviceSize size, VkBufferUsageFlags usage, VkhContext& ctxt)
+	{
+		outBuffer.size = size;
+		outBuffer.shadow.clear();
+		outBuffer.shadow.resize((size_t)size, 0);
+		outBuffer.dirty.clear();
+		outBuffer.stats = {};
+
+		createBuffer(outBuffer.buffer, outBuffer.memory, size, usage | VK_BUFFER_USAGE_TRANSFER_DST_BIT, uploadDestinationProperties(ctxt), ctxt);
+	}
+
+	//returns where in the shadow copy to write [offset, offset + size), and marks it to go up with the next flush
+	char* trackedBufferData(TrackedBuffer& buffer, VkDeviceSize offset, VkDeviceSize size)
+	{
+		checkf(offset + size <= buffer.size, "Writing past the end of a tracked buffer");
+
+		//writes tend to be sequential, so extend the last range when they carry straight on from it
+		TrackedRange* last = buffer.dirty.size() > 0 ? &buffer.dirty.back() : nullptr;
+		if (last && offset >= last->offset && offset <= last->offset + last->size)
+		{
+			VkDeviceSize end = offset + size;
+			last->size = end > last->offset + last->size ? end - last->offset : last->size;
+		}
+		else if (size > 0)
+		{
+			TrackedRange range = { offset, size };
+			buffer.dirty.push_back(range);
+		}
+
+		return &buffer.shadow[(size_t)offset];
+	}
+
+	void writeTrackedBuffer(TrackedBuffer& buffer, VkDeviceSize offset, const void* data, VkDeviceSize size)
+	{
+		memcpy(trackedBufferData(buffer, offset, size), data, (size_t)size);
+	}
+
+	bool trackedRangeLess(const TrackedRange& a, const TrackedRange& b)
+	{
+		return a.offset < b.offset;
+	}
+
+	//sorts and merges the dirty ranges in place
+	void mergeTrackedRanges(std::vector<TrackedRange>& ranges)
+	{
+		if (ranges.size() < 2) return;
+
+		std::sort(ranges.begin(), ranges.end(), trackedRangeLess);
+
+		uint32_t merged = 0;
+		for (uint32_t i = 1; i < ranges.size(); ++i)
+		{
+			TrackedRange& current = ranges[merged];
+			VkDeviceSize currentEnd = current.offset + current.size;
+
+			if (ranges[i].offset <= currentEnd)
+			{
+				VkDeviceSize end = ranges[i].offset + ranges[i].size;
+				current.size = end > currentEnd ? end - current.offset : current.size;
+			}
+			else
+			{
+				ranges[++merged] = ranges[i];
+			}
+		}
+
+		ranges.resize(merged + 1);
+	}
+
+	void writeTrackedRangesDirect(TrackedBuffer& buffer, VkhContext& ctxt)
+	{
+		const TrackedRange& first = buffer.dirty.front();
+		const TrackedRange& last = buffer.dirty.back();
+		VkDeviceSize mapSize = last.offset + last.size - first.offset;
+
+		char* mapped;
+		VkResult res = vkMapMemory(ctxt.device, buffer.memory.handle, buffer.memory.offset + first.offset, mapSize, 0, (void**)&mapped);
+		checkf(res == VK_SUCCESS, "Error mapping tracked buffer memory");
+
+		for (uint32_t i = 0; i < buffer.dirty.size(); ++i)
+		{
+			const TrackedRange& range = buffer.dirty[i];
+			memcpy(mapped + (range.offset - first.offset), &buffer.shadow[(size_t)range.offset], (size_t)range.size);
+
+			buffer.stats.bytes += range.size;
+			buffer.stats.directBytes += range.size;
+		}
+
+		vkUnmapMemory(ctxt.device, buffer.memory.handle);
+	}
+
+	//returns the transfer timeline value the copy signals, or 0 if nothing was dirty or it was written directly
+	uint64_t flushTrackedBuffer(TrackedBuffer& buffer, VkhContext& ctxt)
+	{
+		if (buffer.dirty.size() == 0) return 0;
+
+		mergeTrackedRanges(buffer.dirty);
+
+		if (isHostVisible(buffer.memory, ctxt))
+		{
+			writeTrackedRangesDirect(buffer, ctxt);
+
+			buffer.stats.flushes++;
+			buffer.stats.regions += buffer.dirty.size();
+			buffer.dirty.clear();
+			return 0;
+		}
+
+		VkDeviceSize stagingSize = 0;
+		for (uint32_t i = 0; i < buffer.dirty.size(); ++i)
+		{
+			stagingSize += buffer.dirty[i].size;
+		}
+
+		VkBuffer stagingBuffer;
+		Allocation stagingMemory;
+		createBuffer(stagingBuffer, stagingMemory, stagingSize, VK_BUFFER_USAGE_TRANSFER_SRC_BIT, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, ctxt);
+
+		char* mapped;
+		VkResult res = vkMapMemory(ctxt.device, stagingMemory.handle, stagingMemory.offset, stagingSize, 0, (void**)&mapped);
+		checkf(res == VK_SUCCESS, "Error mapping tracked buffer staging memory");
+
+		//the ranges are packed back to back in the staging buffer, each region copies one of them to where it belongs
+		std::vector<VkBufferCopy> regions(buffer.dirty.size());
+		VkDeviceSize stagingOffset = 0;
+		for (uint32_t i = 0; i < buffer.dirty.size(); ++i)
+		{
+			const TrackedRange& range = buffer.dirty[i];
+			memcpy(mapped + stagingOffset, &buffer.shadow[(size_t)range.offset], (size_t)range.size);
+
+			regions[i].srcOffset = stagingOffset;
+			regions[i].dstOffset = range.offset;
+			regions[i].size = range.size;
+			stagingOffset += range.size;
+		}
+
+		vkUnmapMemory(ctxt.device, stagingMemory.handle);
+
+		VkhCommandBuffer scratch = beginScratchCommandBuffer(ECommandPoolType::Transfer, ctxt);
+		vkCmdCopyBuffer(scratch.buffer, stagingBuffer, buffer.buffer, static_cast<uint32_t>(regions.size()), regions.data());
+
+		uint64_t copyValue = submitScratchCommandBufferAsync(scratch);
+		Timeline::markUpload(ECommandPoolType::Transfer, copyValue);
+		DeletionQueue::destroyBuffer(stagingBuffer, stagingMemory, ECommandPoolType::Transfer, copyValue);
+
+		buffer.stats.flushes++;
+		buffer.stats.regions += regions.size();
+		buffer.stats.bytes += stagingSize;
+		buffer.dirty.clear();
+
+		return copyValue;
+	}
+
+	//returns the totals since the last call
+	TrackedBufferStats consumeTrackedBufferStats(TrackedBuffer& buffer)
+	{
+		TrackedBufferStats stats = buffer.stats;
+		buffer.stats = {};
+		return stats;
+	}
+
+	//frames still in flight might be reading it, so the buffer goes through the deletion queue
+	void destroyTrackedBuffer(TrackedBuffer& buffer)
+	{
+		if (buffer.buffer == VK_NULL_HANDLE) return;
+
+		DeletionQueue::destroyBuffer(buffer.buffer, buffer.memory, ECommandPoolType::Graphics, Timeline::submittedValue(ECommandPoolType::Graphics));
+		buffer.buffer = VK_NULL_HANDLE;
+		buffer.shadow.clear();
+		buffer.dirty.clear();
+	}
+}
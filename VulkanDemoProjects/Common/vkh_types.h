@@ -31,6 +31,7 @@ namespace vkh
 		VkMemoryPropertyFlags usage;
 		uint32_t memoryTypeIndex;
 		VkDeviceSize size;
+		VkDeviceSize alignment;
 	};
 
 	struct AllocatorInterface
@@ -88,6 +89,9 @@ namespace vkh
 		uint32_t							presentQueueFamilyIdx;
 		uint32_t							graphicsQueueFamilyIdx;
 		uint32_t							transferQueueFamilyIdx;
+
+		//device local memory can be written by the cpu, see hasDirectUploadMemory
+		bool								directUpload;
 	};
 
 	struct VkhSwapChain
@@ -99,6 +103,47 @@ namespace vkh
 		std::vector<VkImageView>	imageViews;
 	};
 
+	//linear allocator over a persistently mapped, host visible buffer. Everything in it is thrown away
+	//when the frame that owns it comes around again, so it's only for data that lives for a single frame
+	struct VkhTransientBuffer
+	{
+		VkBuffer		buffer;
+		Allocation		memory;
+		char*			mapped;
+		VkDeviceSize	size;
+		VkDeviceSize	head;
+	};
+
+	struct TransientAllocation
+	{
+		VkBuffer		buffer;
+		VkDeviceSize	offset;
+		void*			data;
+	};
+
+	//everything that can't be touched by the cpu until the gpu has finished with the frame that used it
+	struct VkhFrameContext
+	{
+		VkSemaphore			imageAvailableSemaphore;
+		VkSemaphore			renderFinishedSemaphore;
+
+		//graphics timeline value signaled by the last submit that used this frame
+		uint64_t			timelineValue;
+		VkCommandPool		commandPool;
+		VkCommandBuffer		commandBuffer;
+		VkhTransientBuffer	transientBuffer;
+
+		//set by resetFrame, so submitFrame can measure how long the frame took to reset and record
+		double				recordStartMs;
+	};
+
+	struct VkhFrameStats
+	{
+		uint64_t	frameCount;
+		double		waitMs;
+		double		recordMs;
+	};
+
 	struct VkhContext
 	{
 		VkInstance				instance;
@@ -111,9 +156,17 @@ namespace vkh
 		VkCommandPool			transferCommandPool;
 		VkCommandPool			presentCommandPool;
 		VkDescriptorPool		descriptorPool;
-		VkSemaphore				imageAvailableSemaphore;
-		VkSemaphore				renderFinishedSemaphore;
-		std::vector<VkFence>	frameFences;
+
+		std::vector<VkhFrameContext>	frames;
+		uint32_t						frameIdx;
+		VkhFrameStats					frameStats;
+
+		//null unless the device supports VK_AMD_draw_indirect_count, which lets indirect draws read their count from a buffer
+		PFN_vkCmdDrawIndexedIndirectCountAMD	cmdDrawIndexedIndirectCount;
+
+		//whether VK_KHR_get_physical_device_properties2 was enabled on the instance. Optional device extensions that
+		//depend on it (timeline semaphores, the memory budget) can't be enabled without it
+		bool					physicalDeviceProperties2;
 
 		AllocatorInterface		allocator;
 	};
@@ -0,0 +1,112 @@
+#pragma once
+#include "vkh_types.h"
+#include "vkh.h"
+#include "vkh_frame.h"
+#include "vkh_initializers.h"
+#include "vkh_material.h"
+
+//Per draw uniforms that change every frame, without descriptor writes or staging copies. Every frame context already
+//has a persistently mapped transient buffer that's reset when the frame comes back around, so each frame gets a
+//descriptor set whose UNIFORM_BUFFER_DYNAMIC binding points at the start of that buffer, written once at startup.
+//A draw then allocates a block from the frame's transient buffer, writes its uniforms straight into it, and binds
+//the frame's set with the block's offset as the dynamic offset.
+//
+//The transient buffer has to be big enough for every block written in a frame, each rounded up to
+//minUniformBufferOffsetAlignment (which is 256 bytes on a lot of hardware, whatever the size of the block)
+
+namespace vkh
+{
+	struct UniformRingStats
+	{
+		uint64_t	blocksWritten;
+		uint64_t	bytesUsed;
+	};
+
+	struct UniformRing
+	{
+		VkDescriptorSetLayout	setLayout;
+		VkDescriptorSet			sets[MAX_FRAMES_IN_FLIGHT];
+		VkDeviceSize			blockSize;
+		VkDeviceSize			alignment;
+		UniformRingStats		stats;
+	};
+
+	struct UniformBlock
+	{
+		void*		data;
+		uint32_t	dynamicOffset;
+	};
+
+	//a set layout with a single dynamic uniform buffer at binding 0, for materials to use in place of the reflected one
+	VkDescriptorSetLayout getUniformRingSetLayout(VkShaderStageFlags stages, VkhContext& ctxt)
+	{
+		DescriptorSetLayoutKey setKey;
+		memset(&setKey, 0, sizeof(DescriptorSetLayoutKey));
+		setKey.bindingCount = 1;
+		setKey.bindings[0] = vkh::descriptorSetLayoutBinding(VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC, stages, 0, 1);
+
+		return PipelineRegistry::getOrCreateDescriptorSetLayout(setKey, ctxt);
+	}
+
+	//needs the frame contexts, and room in the descriptor pool for one dynamic uniform buffer per frame in flight
+	void createUniformRing(UniformRing& outRing, VkDescriptorSetLayout setLayout, VkDeviceSize blockSize, VkhContext& ctxt)
+	{
+		checkf(blockSize <= ctxt.gpu.deviceProps.limits.maxUniformBufferRange, "Uniform ring blocks are bigger than a uniform buffer can be");
+
+		outRing.setLayout = setLayout;
+		outRing.blockSize = blockSize;
+		outRing.alignment = ctxt.gpu.deviceProps.limits.minUniformBufferOffsetAlignment;
+		outRing.stats = {};
+
+		for (uint32_t i = 0; i < ctxt.frames.size(); ++i)
+		{
+			VkDescriptorSetAllocateInfo allocInfo = vkh::descriptorSetAllocateInfo(&outRing.setLayout, 1, ctxt.descriptorPool);
+			VkResult res = vkAllocateDescriptorSets(ctxt.device, &allocInfo, &outRing.sets[i]);
+			checkf(res == VK_SUCCESS, "Error allocating uniform ring descriptor set");
+
+			//the range is one block, the dynamic offset picks which one
+			VkDescriptorBufferInfo bufferInfo = {};
+			bufferInfo.buffer = ctxt.frames[i].transientBuffer.buffer;
+			bufferInfo.offset = 0;
+			bufferInfo.range = blockSize;
+
+			VkWriteDescriptorSet setWrite = {};
+			setWrite.sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+			setWrite.dstSet = outRing.sets[i];
+			setWrite.dstBinding = 0;
+			setWrite.dstArrayElement = 0;
+			setWrite.descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC;
+			setWrite.descriptorCount = 1;
+			setWrite.pBufferInfo = &bufferInfo;
+
+			vkUpdateDescriptorSets(ctxt.device, 1, &setWrite, 0, nullptr);
+		}
+	}
+
+	//valid until the frame comes back around. The memory is host coherent, so writing to data is all it takes
+	UniformBlock allocUniformBlock(UniformRing& ring, VkhFrameContext& frame)
+	{
+		TransientAllocation alloc = allocTransient(frame, ring.blockSize, ring.alignment);
+
+		ring.stats.blocksWritten++;
+		ring.stats.bytesUsed += (ring.blockSize + ring.alignment - 1) & ~(ring.alignment - 1);
+
+		UniformBlock block;
+		block.data = alloc.data;
+		block.dynamicOffset = static_cast<uint32_t>(alloc.offset);
+		return block;
+	}
+
+	void bindUniformBlock(UniformRing& ring, const UniformBlock& block, VkCommandBuffer commandBuffer, VkPipelineLayout layout, uint32_t set, VkhContext& ctxt)
+	{
+		vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, layout, set, 1, &ring.sets[ctxt.frameIdx], 1, &block.dynamicOffset);
+	}
+
+	//returns the totals since the last call
+	UniformRingStats consumeUniformRingStats(UniformRing& ring)
+	{
+		UniformRingStats stats = ring.stats;
+		ring.stats = {};
+		return stats;
+	}
+}
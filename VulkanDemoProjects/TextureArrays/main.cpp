@@ -2,6 +2,48 @@
 
 #define TEXTURE_ARRAY_SIZE 8
 #define FRAMES_PER_IMAGE 60
+
+//how many frames the cpu can get ahead of the gpu, higher values trade latency for fewer stalls
+#define FRAMES_IN_FLIGHT 2
+
+//keeps the recorded command buffer for each swap chain image and only records it again when something it uses changes
+#define CACHE_COMMAND_BUFFERS 1
+
+//loads the textures and the quad through the residency manager, limited to a few textures' worth of memory, so
+//cycling through the images evicts the least recently shown ones and loads them again when they come back around
+#define TEXTURE_RESIDENCY 0
+#define RESIDENCY_BYTE_LIMIT (3 * 1024 * 1024)
+
+//starts the textures off with just their smallest mips, and streams in the levels the image that's being shown needs,
+//one level per frame. The images that aren't shown drop back down to their smallest mips
+#define STREAMING_TEXTURES 0
+#define STREAMING_STEPS_PER_FRAME 1
+
+//packs the textures into power of two buddy heaps (vkh_buddy_alloc.h) instead of giving each one its own memory
+#define BUDDY_ALLOCATOR 0
+
+//runs synthetic allocation traces through the buddy, first fit and TLSF heaps on the cpu at startup, and prints how
+//fast and how fragmented each one is. Takes a few seconds
+#define BENCHMARK_ALLOCATORS 0
+
+//creates everything through the concurrent allocator (vkh_concurrent_alloc.h), which can be called from any thread
+#define CONCURRENT_ALLOCATOR 0
+
+//hammers the concurrent allocator with small allocations and frees at startup, from 1 thread up to one per core, with
+//and without the per thread caches, and prints how the throughput scales. Turns on the concurrent allocator too
+#define BENCHMARK_CONCURRENT_ALLOCATOR 0
+#define STRESS_OPS_PER_THREAD 200000
+
+#define USE_CONCURRENT_ALLOCATOR (CONCURRENT_ALLOCATOR || BENCHMARK_CONCURRENT_ALLOCATOR)
+
+#if BUDDY_ALLOCATOR && USE_CONCURRENT_ALLOCATOR
+#error BUDDY_ALLOCATOR and the concurrent allocator are both on, only turn on one of them
+#endif
+
+#if TEXTURE_RESIDENCY && STREAMING_TEXTURES
+#error TEXTURE_RESIDENCY and STREAMING_TEXTURES both manage the texture array, only turn on one of them
+#endif
+
 vkh::VkhContext appContext;
 
 struct DemoData
@@ -9,17 +51,31 @@ struct DemoData
 	vkh::MeshAsset quadMesh;
 	vkh::TextureAsset textures[8];
 
+#if TEXTURE_RESIDENCY
+	uint32_t						textureIds[TEXTURE_ARRAY_SIZE];
+	uint32_t						quadMeshId;
+
+	//bound in place of textures that aren't resident
+	vkh::TextureAsset				placeholderTexture;
+	uint64_t						residencyVersion;
+#endif
+
+#if STREAMING_TEXTURES
+	vkh::StreamingTexture			streamingTextures[TEXTURE_ARRAY_SIZE];
+#endif
+
 	std::vector<VkFramebuffer>		frameBuffers;
 	vkh::VkhRenderBuffer			depthBuffer;
-	std::vector<VkCommandBuffer>	commandBuffers;
 
 	VkRenderPass					mainRenderPass;
+	bool							swapChainOutOfDate;
 
 	//We only have 1 material, so this can be stored here.
 	VkPipelineLayout				pipelineLayout;
 	VkDescriptorSet					descriptorSet;
 	VkPipeline						graphicsPipeline;
 	VkDescriptorSetLayout			descSetLayout;
+	vkh::VkhSpecializationData		textureCountSpec;
 	VkSampler						sampler;
 	VkDescriptorImageInfo			descriptorImageInfos[TEXTURE_ARRAY_SIZE];
 	int								imageIdx;
@@ -36,24 +92,55 @@ void render();
 void setupDescriptorSet();
 void setupGraphicsPipeline();
 void writeDescriptorSet();
+void updateResidentTextures();
+void updateStreamingTextures();
+void benchmarkConcurrentAllocator();
+void onWindowResize(int width, int height);
+bool recreateSwapChain();
+void recordCommands(VkCommandBuffer commandBuffer, uint32_t imageIndex, VkCommandBufferUsageFlags usageFlags);
 
 int CALLBACK WinMain(HINSTANCE Instance, HINSTANCE pInstance, LPSTR cmdLine, int showCode)
 {
 	HWND wndHdl = OS::makeWindow(Instance, "Texture Array Demo", 800, 600);
 	OS::initializeInput();
 
+	//size the shader's texture array to match the number of textures we bind
+	vkh::addSpecializationConstant(demoData.textureCountSpec, 0, (uint32_t)TEXTURE_ARRAY_SIZE);
+
+	//the pool is sized from the specialized shader, so it matches the array size above
+	vkh::Reflection::ShaderInterface shaderInterface;
+	vkh::Reflection::reflectFile("shaders\\texture_array.spv", shaderInterface, &demoData.textureCountSpec.info);
+
 	vkh::VkhContextCreateInfo ctxtInfo = {};
-	ctxtInfo.types.push_back(VK_DESCRIPTOR_TYPE_SAMPLED_IMAGE);
-	ctxtInfo.types.push_back(VK_DESCRIPTOR_TYPE_SAMPLER);
-	ctxtInfo.typeCounts.push_back(8);
-	ctxtInfo.typeCounts.push_back(1);
+	ctxtInfo.framesInFlight = FRAMES_IN_FLIGHT;
+#if BUDDY_ALLOCATOR
+	ctxtInfo.allocator = &vkh::allocators::buddy::allocImpl;
+#endif
+#if USE_CONCURRENT_ALLOCATOR
+	ctxtInfo.allocator = &vkh::allocators::concurrent::allocImpl;
+#endif
+	vkh::Reflection::addDescriptorPoolSizes(shaderInterface, ctxtInfo.types, ctxtInfo.typeCounts);
 
 	initContext(ctxtInfo, "Texture Array Demo", Instance, wndHdl, appContext);
+
+#if BENCHMARK_ALLOCATORS
+	vkh::AllocBench::run();
+#endif
+
+#if BENCHMARK_CONCURRENT_ALLOCATOR
+	benchmarkConcurrentAllocator();
+#endif
 	setupDemo();
-	setupDescriptorSet();
 	setupGraphicsPipeline();
+	setupDescriptorSet();
 	writeDescriptorSet();
 
+#if CACHE_COMMAND_BUFFERS
+	vkh::CommandCache::init(appContext);
+#endif
+
+	OS::setResizeCallback(onWindowResize);
+
 	mainLoop();
 	shutdown();
 
@@ -65,13 +152,33 @@ void setupDemo()
 	createMainRenderPass();
 	vkh::createFrameBuffers(demoData.frameBuffers, appContext.swapChain, nullptr, demoData.mainRenderPass, appContext.device);
 
-	uint32_t swapChainImageCount = static_cast<uint32_t>(appContext.swapChain.imageViews.size());
-	demoData.commandBuffers.resize(swapChainImageCount);
-	for (uint32_t i = 0; i < swapChainImageCount; ++i)
+#if TEXTURE_RESIDENCY
+	vkh::Residency::init(RESIDENCY_BYTE_LIMIT, appContext);
+
+	vkh::Vertex quadVerts[4];
+	uint32_t quadIndices[6];
+	vkh::Mesh::quadVertices(quadVerts, quadIndices);
+	demoData.quadMeshId = vkh::Residency::addMesh(quadVerts, 4, quadIndices, 6);
+
+	for (uint32_t i = 0; i < TEXTURE_ARRAY_SIZE; ++i)
 	{
-		vkh::createCommandBuffer(demoData.commandBuffers[i], appContext.gfxCommandPool, appContext.device);
+		char filename[32];
+		sprintf_s(filename, 32, "textures\\%i.png", i);
+		demoData.textureIds[i] = vkh::Residency::addTexture(filename);
 	}
 
+	vkh::Texture::make(demoData.placeholderTexture, "textures\\9.png", appContext);
+	demoData.residencyVersion = UINT64_MAX;
+#elif STREAMING_TEXTURES
+	vkh::Mesh::quad(demoData.quadMesh, appContext);
+
+	for (uint32_t i = 0; i < TEXTURE_ARRAY_SIZE; ++i)
+	{
+		char filename[32];
+		sprintf_s(filename, 32, "textures\\%i.png", i);
+		vkh::TextureStreaming::create(demoData.streamingTextures[i], filename, appContext);
+	}
+#else
 	vkh::Mesh::quad(demoData.quadMesh, appContext);
 
 	for (uint32_t i = 0; i < TEXTURE_ARRAY_SIZE; ++i)
@@ -80,6 +187,7 @@ void setupDemo()
 		sprintf_s(filename, 32, "textures\\%i.png", i);
 		vkh::Texture::make(demoData.textures[i], filename, appContext);
 	}
+#endif
 
 	demoData.imageIdx = 5;
 	demoData.framesUntilNextImage = FRAMES_PER_IMAGE;
@@ -96,19 +204,18 @@ void setupDescriptorSet()
 	{
 		demoData.descriptorImageInfos[i].sampler = nullptr;
 		demoData.descriptorImageInfos[i].imageLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+#if TEXTURE_RESIDENCY
+		//nothing's resident yet, updateResidentTextures fills these in
+		demoData.descriptorImageInfos[i].imageView = demoData.placeholderTexture.view;
+#elif STREAMING_TEXTURES
+		demoData.descriptorImageInfos[i].imageView = demoData.streamingTextures[i].view;
+#else
 		demoData.descriptorImageInfos[i].imageView = demoData.textures[i].view;
+#endif
 	}
 
-	VkDescriptorSetLayoutBinding layoutBindings[2];
-	layoutBindings[0] = vkh::descriptorSetLayoutBinding(VK_DESCRIPTOR_TYPE_SAMPLER, VK_SHADER_STAGE_FRAGMENT_BIT, 0, 1);
-
-	//the descriptor count in the binding is the number of elements in your array
-	layoutBindings[1] = vkh::descriptorSetLayoutBinding(VK_DESCRIPTOR_TYPE_SAMPLED_IMAGE, VK_SHADER_STAGE_FRAGMENT_BIT, 1, TEXTURE_ARRAY_SIZE);
-
-	VkDescriptorSetLayoutCreateInfo layoutInfo = vkh::descriptorSetLayoutCreateInfo(layoutBindings, 2);
-	res = vkCreateDescriptorSetLayout(appContext.device, &layoutInfo, nullptr, &demoData.descSetLayout);
-	checkf(res == VK_SUCCESS, "Error creating desc set layout");
-	
+	//the layout comes from the material, reflected from the shader, where the descriptor count of binding 1 is
+	//the size of the texture array
 	VkDescriptorSetAllocateInfo allocInfo = vkh::descriptorSetAllocateInfo(&demoData.descSetLayout, 1, appContext.descriptorPool);
 	res = vkAllocateDescriptorSets(appContext.device, &allocInfo, &demoData.descriptorSet);
 	checkf(res == VK_SUCCESS, "Error allocating global descriptor set");
@@ -144,6 +251,71 @@ void writeDescriptorSet()
 	vkUpdateDescriptorSets(appContext.device, 2, setWrites, 0, nullptr);
 }
 
+#if TEXTURE_RESIDENCY
+//loads whatever this frame needs, and points the texture array at the resident textures again if anything was
+//loaded or evicted since the last time
+void updateResidentTextures()
+{
+	vkh::Residency::beginFrame();
+	demoData.quadMesh = vkh::Residency::useMesh(demoData.quadMeshId);
+	vkh::Residency::useTexture(demoData.textureIds[demoData.imageIdx]);
+
+	if (vkh::Residency::version() == demoData.residencyVersion) return;
+
+	//the descriptor set can't be written while frames in flight are using it. Residency only changes when the image
+	//does, so waiting for them here is cheaper than keeping a set per frame
+	vkh::Timeline::wait(vkh::ECommandPoolType::Graphics, vkh::Timeline::submittedValue(vkh::ECommandPoolType::Graphics));
+
+	for (uint32_t i = 0; i < TEXTURE_ARRAY_SIZE; ++i)
+	{
+		bool resident = vkh::Residency::isResident(demoData.textureIds[i]);
+		demoData.descriptorImageInfos[i].imageView = resident ? vkh::Residency::texture(demoData.textureIds[i]).view : demoData.placeholderTexture.view;
+	}
+
+	writeDescriptorSet();
+	demoData.residencyVersion = vkh::Residency::version();
+
+#if CACHE_COMMAND_BUFFERS
+	//recorded command buffers that bound the set are invalid once it's been written
+	vkh::CommandCache::invalidateAll();
+#endif
+}
+#endif
+
+#if STREAMING_TEXTURES
+//the image that's shown asks for the level that matches the window size, the others only need their tails
+void updateStreamingTextures()
+{
+	uint32_t screenSize = appContext.swapChain.extent.width > appContext.swapChain.extent.height ? appContext.swapChain.extent.width : appContext.swapChain.extent.height;
+
+	vkh::StreamingTexture* textures[TEXTURE_ARRAY_SIZE];
+	for (uint32_t i = 0; i < TEXTURE_ARRAY_SIZE; ++i)
+	{
+		vkh::StreamingTexture& tex = demoData.streamingTextures[i];
+		bool shown = i == demoData.imageIdx;
+
+		vkh::TextureStreaming::requestMip(tex, shown ? vkh::TextureStreaming::mipForScreenSize(tex, screenSize) : tex.tailMip, shown ? 1.0f : 0.0f);
+		textures[i] = &tex;
+	}
+
+	if (!vkh::TextureStreaming::update(textures, TEXTURE_ARRAY_SIZE, STREAMING_STEPS_PER_FRAME, appContext)) return;
+
+	//same as with residency, the set can't be written while frames in flight are using it
+	vkh::Timeline::wait(vkh::ECommandPoolType::Graphics, vkh::Timeline::submittedValue(vkh::ECommandPoolType::Graphics));
+
+	for (uint32_t i = 0; i < TEXTURE_ARRAY_SIZE; ++i)
+	{
+		demoData.descriptorImageInfos[i].imageView = demoData.streamingTextures[i].view;
+	}
+
+	writeDescriptorSet();
+
+#if CACHE_COMMAND_BUFFERS
+	vkh::CommandCache::invalidateAll();
+#endif
+}
+#endif
+
 void createMainRenderPass()
 {
 	VkAttachmentDescription colorAttachment = {};
@@ -165,88 +337,146 @@ void createMainRenderPass()
 
 void setupGraphicsPipeline()
 {
-	VkPipelineShaderStageCreateInfo shaderStages[2];
+	vkh::VkhMaterialCreateInfo createInfo = {};
+	createInfo.renderPass = demoData.mainRenderPass;
+	createInfo.outPipeline = &demoData.graphicsPipeline;
+	createInfo.outPipelineLayout = &demoData.pipelineLayout;
+	createInfo.fragSpecialization = &demoData.textureCountSpec.info;
 
-	shaderStages[0] = vkh::shaderPipelineStageCreateInfo(VK_SHADER_STAGE_VERTEX_BIT);
-	DataBuffer* vShaderData = loadBinaryFile("shaders\\vanilla_vertex.spv");
-	vkh::createShaderModule(shaderStages[0].module, vShaderData->data, vShaderData->size, appContext);
-	
-	shaderStages[1] = vkh::shaderPipelineStageCreateInfo(VK_SHADER_STAGE_FRAGMENT_BIT);
-	DataBuffer* fShaderData = loadBinaryFile("shaders\\texture_array.spv");
-	vkh::createShaderModule(shaderStages[1].module, fShaderData->data, fShaderData->size, appContext);
+	vkh::createBasicMaterial("shaders\\vanilla_vertex.spv", "shaders\\texture_array.spv", appContext, createInfo);
 
-	VkPipelineLayoutCreateInfo pipelineLayoutInfo = vkh::pipelineLayoutCreateInfo(&demoData.descSetLayout, 1);
+	demoData.descSetLayout = createInfo.descSetLayouts[0];
+}
 
-	VkPushConstantRange pushConstantRange = {};
-	pushConstantRange.offset = 0;
-	pushConstantRange.size = sizeof(int);
-	pushConstantRange.stageFlags = VK_SHADER_STAGE_FRAGMENT_BIT;
+//toggles random slots in a list of its own, freeing what's in them or allocating 1KB to 128KB into them, like a loader
+//thread creating and throwing away resources. rand() isn't meant to be shared between threads, so it has its own
+void stressAllocator(uint32_t seed, uint32_t memoryType)
+{
+	const uint32_t slotCount = 64;
+	vkh::Allocation allocs[slotCount];
+	bool live[slotCount] = {};
+	uint32_t rng = seed;
 
-	pipelineLayoutInfo.pPushConstantRanges = &pushConstantRange;
-	pipelineLayoutInfo.pushConstantRangeCount = 1;
+	for (uint32_t i = 0; i < STRESS_OPS_PER_THREAD; ++i)
+	{
+		rng = rng * 1664525u + 1013904223u;
+		uint32_t slot = (rng >> 8) % slotCount;
 
-	VkResult res = vkCreatePipelineLayout(appContext.device, &pipelineLayoutInfo, nullptr, &demoData.pipelineLayout);
-	checkf(res == VK_SUCCESS, "Error creating pipeline layout");
+		if (live[slot])
+		{
+			appContext.allocator.free(allocs[slot]);
+			live[slot] = false;
+			continue;
+		}
 
-	VkVertexInputBindingDescription bindingDescription = vkh::vertexInputBindingDescription(0, sizeof(vkh::Vertex), VK_VERTEX_INPUT_RATE_VERTEX);
-	
-	const vkh::VertexRenderData* vertexLayout = vkh::Mesh::vertexRenderData();
-
-	VkPipelineVertexInputStateCreateInfo vertexInputInfo = vkh::pipelineVertexInputStateCreateInfo();
-	vertexInputInfo.vertexBindingDescriptionCount = 1; 
-	vertexInputInfo.vertexAttributeDescriptionCount = vertexLayout->attrCount;
-	vertexInputInfo.pVertexBindingDescriptions = &bindingDescription;
-	vertexInputInfo.pVertexAttributeDescriptions = &vertexLayout->attrDescriptions[0];
-
-	VkPipelineInputAssemblyStateCreateInfo inputAssembly = vkh::pipelineInputAssemblyStateCreateInfo(VK_PRIMITIVE_TOPOLOGY_TRIANGLE_LIST, VK_FALSE);
-	VkViewport viewport = vkh::viewport(0, 0, static_cast<float>(appContext.swapChain.extent.width), static_cast<float>(appContext.swapChain.extent.height));
-	VkRect2D scissor = vkh::rect2D(0, 0, appContext.swapChain.extent.width, appContext.swapChain.extent.height);
-	VkPipelineViewportStateCreateInfo viewportState = vkh::pipelineViewportStateCreateInfo(&viewport, 1, &scissor, 1);
-
-	VkPipelineRasterizationStateCreateInfo rasterizer = vkh::pipelineRasterizationStateCreateInfo(VK_POLYGON_MODE_FILL);
-	VkPipelineMultisampleStateCreateInfo multisampling = vkh::pipelineMultisampleStateCreateInfo();
-
-	VkPipelineColorBlendAttachmentState colorBlendAttachment = vkh::pipelineColorBlendAttachmentState(VK_COLOR_COMPONENT_R_BIT | VK_COLOR_COMPONENT_G_BIT | VK_COLOR_COMPONENT_B_BIT | VK_COLOR_COMPONENT_A_BIT, VK_FALSE);
-	VkPipelineColorBlendStateCreateInfo colorBlending = vkh::pipelineColorBlendStateCreateInfo(colorBlendAttachment);
-
-	VkPipelineDepthStencilStateCreateInfo depthStencil = vkh::pipelineDepthStencilStateCreateInfo(
-		VK_TRUE,
-		VK_TRUE,
-		VK_COMPARE_OP_LESS);
-
-	VkGraphicsPipelineCreateInfo pipelineInfo = {};
-	pipelineInfo.sType = VK_STRUCTURE_TYPE_GRAPHICS_PIPELINE_CREATE_INFO;
-	pipelineInfo.stageCount = 2;
-	pipelineInfo.pStages = shaderStages;
-	pipelineInfo.pVertexInputState = &vertexInputInfo;
-	pipelineInfo.pInputAssemblyState = &inputAssembly;
-	pipelineInfo.pViewportState = &viewportState;
-	pipelineInfo.pRasterizationState = &rasterizer;
-	pipelineInfo.pMultisampleState = &multisampling;
-	pipelineInfo.pDepthStencilState = nullptr; // Optional
-	pipelineInfo.pColorBlendState = &colorBlending;
-	pipelineInfo.pDynamicState = nullptr; // Optional
-	pipelineInfo.layout = demoData.pipelineLayout;
-	pipelineInfo.renderPass = demoData.mainRenderPass;
-	pipelineInfo.pDepthStencilState = &depthStencil;
-
-	pipelineInfo.subpass = 0;
-
-	//can use this to create new pipelines by deriving from old ones
-	pipelineInfo.basePipelineHandle = VK_NULL_HANDLE;
-	pipelineInfo.basePipelineIndex = -1;
-
-	res = vkCreateGraphicsPipelines(appContext.device, VK_NULL_HANDLE, 1, &pipelineInfo, nullptr, &demoData.graphicsPipeline);
-	checkf(res == VK_SUCCESS, "Error creating graphics pipeline");
-
-	freeDataBuffer(vShaderData);
-	freeDataBuffer(fShaderData);
+		vkh::AllocationCreateInfo createInfo = {};
+		createInfo.usage = VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT;
+		createInfo.memoryTypeIndex = memoryType;
+		createInfo.size = 1024 + (rng >> 12) % (127 * 1024);
+		createInfo.alignment = 256;
+
+		appContext.allocator.alloc(allocs[slot], createInfo);
+		live[slot] = true;
+	}
+
+	for (uint32_t i = 0; i < slotCount; ++i)
+	{
+		if (live[i]) appContext.allocator.free(allocs[i]);
+	}
 
+	vkh::allocators::concurrent::flushThreadCache();
+}
+
+//on gpus where all the device local memory is host visible, everything takes the global path and this ends up
+//measuring vkAllocateMemory instead
+void benchmarkConcurrentAllocator()
+{
+	uint32_t memoryType = vkh::findMemoryType(appContext.gpu.memProps, UINT32_MAX, vkh::defaultMemoryTypePolicy(VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT));
+	uint32_t maxThreads = std::thread::hardware_concurrency();
+
+	for (int useCaches = 1; useCaches >= 0; --useCaches)
+	{
+		vkh::allocators::concurrent::state.useThreadCaches = useCaches != 0;
+		double oneThreadRate = 0.0;
+
+		for (uint32_t threadCount = 1; threadCount <= maxThreads; threadCount *= 2)
+		{
+			vkh::allocators::concurrent::consumeStats();
+			double start = OS::getMilliseconds();
+
+			std::vector<std::thread> threads;
+			for (uint32_t i = 0; i < threadCount; ++i)
+			{
+				threads.push_back(std::thread(stressAllocator, i + 1, memoryType));
+			}
+
+			for (uint32_t i = 0; i < threadCount; ++i)
+			{
+				threads[i].join();
+			}
+
+			double elapsedMs = OS::getMilliseconds() - start;
+			double rate = (threadCount * (double)STRESS_OPS_PER_THREAD) / elapsedMs;
+			if (threadCount == 1) oneThreadRate = rate;
+
+			vkh::allocators::concurrent::ConcurrentStats stats = vkh::allocators::concurrent::consumeStats();
+			printf("CONCURRENT ALLOCATOR: thread caches %-3s %2u threads, %9.0f ops per ms (%5.2fx one thread), %llu cache refills, %llu chunks allocated\n",
+				useCaches ? "on," : "off,", threadCount, rate, rate / oneThreadRate, (unsigned long long)stats.cacheRefills, (unsigned long long)stats.chunkAllocs);
+		}
+	}
+
+	vkh::allocators::concurrent::state.useThreadCaches = true;
 }
 
 void logFPSAverage(double avg)
 {
-	printf("AVG FRAMETIME FOR LAST %i FRAMES: %f ms\n", FPS_DATA_FRAME_HISTORY_SIZE, avg);
+	vkh::VkhFrameStats frameStats = vkh::consumeFrameStats(appContext);
+	double avgFrameWait = frameStats.frameCount > 0 ? frameStats.waitMs / (double)frameStats.frameCount : 0.0;
+	double avgFrameRecord = frameStats.frameCount > 0 ? frameStats.recordMs / (double)frameStats.frameCount : 0.0;
+
+	printf("AVG FRAMETIME FOR LAST %i FRAMES: %f ms (%f ms waiting on the gpu, %f ms recording, %i frames in flight)\n", FPS_DATA_FRAME_HISTORY_SIZE, avg, avgFrameWait, avgFrameRecord, FRAMES_IN_FLIGHT);
+
+	vkh::DeletionQueue::DeletionStats deletionStats = vkh::DeletionQueue::stats();
+	printf("DEFERRED DELETIONS: %u pending (%llu bytes), %llu destroyed so far\n", deletionStats.pendingCount, (unsigned long long)deletionStats.pendingBytes, (unsigned long long)deletionStats.totalDeleted);
+
+#if CACHE_COMMAND_BUFFERS
+	vkh::CommandCache::CacheStats cacheStats = vkh::CommandCache::stats();
+	printf("COMMAND BUFFERS: %llu re-recorded, %llu reused\n", (unsigned long long)cacheStats.reRecords, (unsigned long long)cacheStats.reuses);
+#endif
+
+#if TEXTURE_RESIDENCY
+	vkh::Residency::ResidencyStats residencyStats = vkh::Residency::consumeStats();
+	printf("RESIDENCY: %llu evictions (%llu bytes), %llu reloads (%llu bytes), %llu bytes resident\n",
+		(unsigned long long)residencyStats.evictions, (unsigned long long)residencyStats.evictedBytes,
+		(unsigned long long)residencyStats.reloads, (unsigned long long)residencyStats.reloadedBytes,
+		(unsigned long long)vkh::Residency::residentBytes());
+#endif
+
+#if USE_CONCURRENT_ALLOCATOR
+	vkh::allocators::concurrent::ConcurrentStats concurrentStats = vkh::allocators::concurrent::consumeStats();
+	printf("CONCURRENT ALLOCATOR: %llu cache refills, %llu cache flushes, %llu chunks allocated, %llu dedicated allocations\n",
+		(unsigned long long)concurrentStats.cacheRefills, (unsigned long long)concurrentStats.cacheFlushes,
+		(unsigned long long)concurrentStats.chunkAllocs, (unsigned long long)concurrentStats.dedicatedAllocs);
+#endif
+
+#if BUDDY_ALLOCATOR
+	vkh::allocators::buddy::BuddyUsage buddyUsage = vkh::allocators::buddy::usage();
+	printf("BUDDY ALLOCATOR: %u heaps, %llu bytes requested in %llu bytes of blocks\n",
+		buddyUsage.heapCount, (unsigned long long)buddyUsage.requestedBytes, (unsigned long long)buddyUsage.blockBytes);
+#endif
+
+#if STREAMING_TEXTURES
+	VkDeviceSize streamedBytes = 0;
+	for (uint32_t i = 0; i < TEXTURE_ARRAY_SIZE; ++i)
+	{
+		streamedBytes += demoData.streamingTextures[i].memory.size;
+	}
+
+	vkh::TextureStreaming::StreamingStats streamingStats = vkh::TextureStreaming::consumeStats();
+	printf("STREAMING: %llu mips uploaded (%llu bytes), %llu dropped, %llu bytes resident\n",
+		(unsigned long long)streamingStats.mipsUploaded, (unsigned long long)streamingStats.bytesUploaded,
+		(unsigned long long)streamingStats.mipsDropped, (unsigned long long)streamedBytes);
+#endif
 }
 
 void mainLoop()
@@ -255,7 +485,7 @@ void mainLoop()
 
 	FPSData fpsData = { 0 };
 
-	//fpsData.logCallback = logFPSAverage;
+	fpsData.logCallback = logFPSAverage;
 
 	startTimingFrame(fpsData);
 
@@ -286,27 +516,139 @@ void mainLoop()
 
 void shutdown()
 {
+#if CACHE_COMMAND_BUFFERS
+	vkh::CommandCache::destroy();
+#endif
+
+#if TEXTURE_RESIDENCY
+	vkh::Residency::destroy();
+#endif
+
+#if STREAMING_TEXTURES
+	for (uint32_t i = 0; i < TEXTURE_ARRAY_SIZE; ++i)
+	{
+		vkh::TextureStreaming::destroy(demoData.streamingTextures[i]);
+	}
+#endif
+
+	//everything above only queued its resources up, so wait for the gpu to finish before tearing down what they're tagged with
+	vkDeviceWaitIdle(appContext.device);
+	vkh::DeletionQueue::flush(appContext);
+	vkh::PipelineRegistry::destroyAll(appContext);
+	vkh::destroyFrameContexts(appContext);
+	vkh::Timeline::destroy();
+
 	OS::shutdownInput();
 }
 
 void render()
 {
+	if (demoData.swapChainOutOfDate && !recreateSwapChain())
+	{
+		return;
+	}
+
+	//blocks until the gpu is done with the last frame that used this slot in the ring
+	vkh::VkhFrameContext& frame = vkh::acquireFrame(appContext);
+
 	//acquire an image from the swap chain
 	uint32_t imageIndex;
 
 	//using uint64 max for timeout disables it
-	VkResult res = vkAcquireNextImageKHR(appContext.device, appContext.swapChain.swapChain, UINT64_MAX, appContext.imageAvailableSemaphore, VK_NULL_HANDLE, &imageIndex);
+	VkResult res = vkAcquireNextImageKHR(appContext.device, appContext.swapChain.swapChain, UINT64_MAX, frame.imageAvailableSemaphore, VK_NULL_HANDLE, &imageIndex);
+	if (res == VK_ERROR_OUT_OF_DATE_KHR)
+	{
+		demoData.swapChainOutOfDate = true;
+		return;
+	}
+
+	vkh::resetFrame(frame, appContext);
+
+#if TEXTURE_RESIDENCY
+	updateResidentTextures();
+#endif
+
+#if STREAMING_TEXTURES
+	updateStreamingTextures();
+#endif
+
+#if CACHE_COMMAND_BUFFERS
+	//everything the recorded commands depend on. Only imageIdx changes, once every FRAMES_PER_IMAGE frames,
+	//so most frames resubmit the buffer that was recorded the last time this swap chain image came around
+	uint64_t inputHash = HASH_FNV_OFFSET_BASIS;
+	inputHash = vkh::CommandCache::hashInput(inputHash, demoData.graphicsPipeline);
+	inputHash = vkh::CommandCache::hashInput(inputHash, demoData.pipelineLayout);
+	inputHash = vkh::CommandCache::hashInput(inputHash, demoData.descriptorSet);
+	inputHash = vkh::CommandCache::hashInput(inputHash, demoData.imageIdx);
+	inputHash = vkh::CommandCache::hashInput(inputHash, demoData.quadMesh.vBuffer);
+	inputHash = vkh::CommandCache::hashInput(inputHash, demoData.quadMesh.iBuffer);
+	inputHash = vkh::CommandCache::hashInput(inputHash, demoData.frameBuffers[imageIndex]);
+	inputHash = vkh::CommandCache::hashInput(inputHash, appContext.swapChain.extent);
+
+	VkCommandBuffer commandBuffer;
+	if (vkh::CommandCache::acquire(imageIndex, inputHash, commandBuffer))
+	{
+		recordCommands(commandBuffer, imageIndex, 0);
+	}
+#else
+	VkCommandBuffer commandBuffer = frame.commandBuffer;
+	recordCommands(commandBuffer, imageIndex, VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT);
+#endif
+
+
+	//submit
+
+	VkSubmitInfo submitInfo = {};
+	submitInfo.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
+	//wait on writing colours to the buffer until the semaphore says the buffer is available
+	VkSemaphore waitSemaphores[] = { frame.imageAvailableSemaphore };
+	VkPipelineStageFlags waitStages[] = { VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT };
+	submitInfo.waitSemaphoreCount = 1;
+	submitInfo.pWaitSemaphores = waitSemaphores;
+	submitInfo.pWaitDstStageMask = waitStages;
+
+	submitInfo.commandBufferCount = 1;
+
+	VkSemaphore signalSemaphores[] = { frame.renderFinishedSemaphore };
+	submitInfo.signalSemaphoreCount = 1;
+	submitInfo.pSignalSemaphores = signalSemaphores;
+	submitInfo.pCommandBuffers = &commandBuffer;
+	submitInfo.commandBufferCount = 1;
+
+	vkh::submitFrame(frame, submitInfo, appContext);
+
+#if CACHE_COMMAND_BUFFERS
+	vkh::CommandCache::markSubmitted(imageIndex, frame.timelineValue);
+#endif
+
+	//present
+
+	VkPresentInfoKHR presentInfo = {};
+	presentInfo.sType = VK_STRUCTURE_TYPE_PRESENT_INFO_KHR;
+
+	presentInfo.waitSemaphoreCount = 1;
+	presentInfo.pWaitSemaphores = signalSemaphores;
+
+	VkSwapchainKHR swapChains[] = { appContext.swapChain.swapChain };
+	presentInfo.swapchainCount = 1;
+	presentInfo.pSwapchains = swapChains;
+	presentInfo.pImageIndices = &imageIndex;
+	presentInfo.pResults = nullptr; // Optional
+	res = vkQueuePresentKHR(appContext.deviceQueues.transferQueue, &presentInfo);
 
-	vkh::waitForFence(appContext.frameFences[imageIndex], appContext.device);
-	vkResetFences(appContext.device, 1, &appContext.frameFences[imageIndex]);
+	if (res == VK_ERROR_OUT_OF_DATE_KHR || res == VK_SUBOPTIMAL_KHR)
+	{
+		demoData.swapChainOutOfDate = true;
+	}
+}
 
-	//record drawing
+void recordCommands(VkCommandBuffer commandBuffer, uint32_t imageIndex, VkCommandBufferUsageFlags usageFlags)
+{
 	VkCommandBufferBeginInfo beginInfo = {};
 	beginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
-	beginInfo.flags = VK_COMMAND_BUFFER_USAGE_SIMULTANEOUS_USE_BIT;
+	beginInfo.flags = usageFlags;
 	beginInfo.pInheritanceInfo = nullptr; // Optional
-	vkResetCommandBuffer(demoData.commandBuffers[imageIndex], VK_COMMAND_BUFFER_RESET_RELEASE_RESOURCES_BIT);
-	res = vkBeginCommandBuffer(demoData.commandBuffers[imageIndex], &beginInfo);
+	VkResult res = vkBeginCommandBuffer(commandBuffer, &beginInfo);
 
 
 	VkRenderPassBeginInfo renderPassInfo = {};
@@ -323,67 +665,59 @@ void render()
 
 	renderPassInfo.clearValueCount = static_cast<uint32_t>(clearColors.size());
 	renderPassInfo.pClearValues = &clearColors[0];
-	vkCmdBeginRenderPass(demoData.commandBuffers[imageIndex], &renderPassInfo, VK_SUBPASS_CONTENTS_INLINE);
+	vkCmdBeginRenderPass(commandBuffer, &renderPassInfo, VK_SUBPASS_CONTENTS_INLINE);
+	vkh::setViewportAndScissor(commandBuffer, appContext.swapChain.extent);
 
-	vkCmdBindPipeline(demoData.commandBuffers[imageIndex], VK_PIPELINE_BIND_POINT_GRAPHICS, demoData.graphicsPipeline);
+	vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, demoData.graphicsPipeline);
 	
 	vkCmdPushConstants(
-		demoData.commandBuffers[imageIndex],
+		commandBuffer,
 		demoData.pipelineLayout,
 		VK_SHADER_STAGE_FRAGMENT_BIT,
 		0,
 		sizeof(int),
 		(void*)&demoData.imageIdx);
 
-	vkCmdBindDescriptorSets(demoData.commandBuffers[imageIndex], VK_PIPELINE_BIND_POINT_GRAPHICS, demoData.pipelineLayout, 0, 1, &demoData.descriptorSet, 0, 0);
+	vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, demoData.pipelineLayout, 0, 1, &demoData.descriptorSet, 0, 0);
 
 	VkBuffer vertexBuffers[] = { demoData.quadMesh.vBuffer };
 	VkDeviceSize vertexOffsets[] = { 0 };
-	vkCmdBindVertexBuffers(demoData.commandBuffers[imageIndex], 0, 1, vertexBuffers, vertexOffsets);
-	vkCmdBindIndexBuffer(demoData.commandBuffers[imageIndex], demoData.quadMesh.iBuffer, 0, VK_INDEX_TYPE_UINT32);
-	vkCmdDrawIndexed(demoData.commandBuffers[imageIndex], static_cast<uint32_t>(demoData.quadMesh.iCount), 1, 0, 0, 0);
+	vkCmdBindVertexBuffers(commandBuffer, 0, 1, vertexBuffers, vertexOffsets);
+	vkCmdBindIndexBuffer(commandBuffer, demoData.quadMesh.iBuffer, 0, VK_INDEX_TYPE_UINT32);
+	vkCmdDrawIndexed(commandBuffer, static_cast<uint32_t>(demoData.quadMesh.iCount), 1, 0, 0, 0);
 
-
-
-	vkCmdEndRenderPass(demoData.commandBuffers[imageIndex]);
-	res = vkEndCommandBuffer(demoData.commandBuffers[imageIndex]);
-	assert(res == VK_SUCCESS);
-
-
-	//submit
-
-	VkSubmitInfo submitInfo = {};
-	submitInfo.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
-	//wait on writing colours to the buffer until the semaphore says the buffer is available
-	VkSemaphore waitSemaphores[] = { appContext.imageAvailableSemaphore };
-	VkPipelineStageFlags waitStages[] = { VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT };
-	submitInfo.waitSemaphoreCount = 1;
-	submitInfo.pWaitSemaphores = waitSemaphores;
-	submitInfo.pWaitDstStageMask = waitStages;
-
-	submitInfo.commandBufferCount = 1;
-
-	VkSemaphore signalSemaphores[] = { appContext.renderFinishedSemaphore };
-	submitInfo.signalSemaphoreCount = 1;
-	submitInfo.pSignalSemaphores = signalSemaphores;
-	submitInfo.pCommandBuffers = &demoData.commandBuffers[imageIndex];
-	submitInfo.commandBufferCount = 1;
-
-	res = vkQueueSubmit(appContext.deviceQueues.graphicsQueue, 1, &submitInfo, appContext.frameFences[imageIndex]);
+	vkCmdEndRenderPass(commandBuffer);
+	res = vkEndCommandBuffer(commandBuffer);
 	assert(res == VK_SUCCESS);
+}
 
-	//present
+void onWindowResize(int width, int height)
+{
+	//this gets called from inside the window proc, so just flag the swap chain and deal with it at the start of the next frame
+	demoData.swapChainOutOfDate = true;
+}
 
-	VkPresentInfoKHR presentInfo = {};
-	presentInfo.sType = VK_STRUCTURE_TYPE_PRESENT_INFO_KHR;
+bool recreateSwapChain()
+{
+	if (!vkh::recreateSwapchain(appContext))
+	{
+		return false;
+	}
 
-	presentInfo.waitSemaphoreCount = 1;
-	presentInfo.pWaitSemaphores = signalSemaphores;
+	//pipelines don't need to be touched here, they use dynamic viewport / scissor state
+	for (uint32_t i = 0; i < demoData.frameBuffers.size(); ++i)
+	{
+		vkDestroyFramebuffer(appContext.device, demoData.frameBuffers[i], nullptr);
+	}
 
-	VkSwapchainKHR swapChains[] = { appContext.swapChain.swapChain };
-	presentInfo.swapchainCount = 1;
-	presentInfo.pSwapchains = swapChains;
-	presentInfo.pImageIndices = &imageIndex;
-	presentInfo.pResults = nullptr; // Optional
-	res = vkQueuePresentKHR(appContext.deviceQueues.transferQueue, &presentInfo);
+	vkh::createFrameBuffers(demoData.frameBuffers, appContext.swapChain, nullptr, demoData.mainRenderPass, appContext.device);
+	demoData.swapChainOutOfDate = false;
+
+#if CACHE_COMMAND_BUFFERS
+	//the image count can change, and new framebuffers can come back with the same handles as the destroyed ones,
+	//so don't rely on the input hash here
+	vkh::CommandCache::resize(static_cast<uint32_t>(appContext.swapChain.imageViews.size()));
+	vkh::CommandCache::invalidateAll();
+#endif
+	return true;
 }
@@ -1,8 +1,11 @@
 #version 450 core
 #extension GL_ARB_separate_shader_objects : enable
 
+//overridden by the application to match the number of images it binds
+layout(constant_id = 0) const uint TEXTURE_COUNT = 8;
+
 layout(set = 0, binding = 0) uniform sampler samp;
-layout(set = 0, binding = 1) uniform texture2D textures[78];
+layout(set = 0, binding = 1) uniform texture2D textures[TEXTURE_COUNT];
 
 layout(push_constant) uniform PER_OBJECT 
 { 
@@ -1,3 +1,9 @@
 ..\..\utils\glslangvalidator.exe -V -o shaders\common_vert.spv shaders\common_vert.vert
-..\..\utils\glslangvalidator.exe -V -o shaders\frag1.spv shaders\frag1.frag
-..\..\utils\glslangvalidator.exe -V -o shaders\frag2.spv shaders\frag2.frag
\ No newline at end of file
+..\..\utils\glslangvalidator.exe -V -o shaders\shared_data.spv shaders\shared_data.frag
+..\..\utils\glslangvalidator.exe -V -o shaders\instanced_vert.spv shaders\instanced_vert.vert
+..\..\utils\glslangvalidator.exe -V -o shaders\instanced_data.spv shaders\instanced_data.frag
+..\..\utils\glslangvalidator.exe -V -o shaders\cull_instances.spv shaders\cull_instances.comp
+..\..\utils\glslangvalidator.exe -V -o shaders\animated_data.spv shaders\animated_data.frag
+..\..\utils\glslangvalidator.exe -V -o shaders\storage_data.spv shaders\storage_data.frag
+..\..\utils\glslangvalidator.exe -V -o shaders\instanced_storage_data.spv shaders\instanced_storage_data.frag
+..\..\utils\glslangvalidator.exe -V -o shaders\object_data_bench.spv shaders\object_data_bench.comp
\ No newline at end of file
@@ -4,16 +4,97 @@
 #define BUFFER_ARRAY_SIZE 8
 #define SHARED_UNIFORM_SIZE 48
 
+//how many frames the cpu can get ahead of the gpu, higher values trade latency for fewer stalls
+#define FRAMES_IN_FLIGHT 2
+
+//draws cycle through the 4 quads and alternate between the 2 materials, raise this to make recording cpu bound
+//enough for the worker threads to kick in
+#define DRAW_COUNT 4
+
+//0 records every draw inline in the primary command buffer, 1 splits them across threads that record into
+//secondary command buffers. RECORD_THREADS includes the main thread, 0 uses one thread per core. Only takes effect
+//with CACHE_COMMAND_BUFFERS, BATCHED_DRAWS (and so GPU_CULLING) and ANIMATED_UNIFORMS all set to 0, see RECORD_IN_PARALLEL
+#define PARALLEL_RECORDING 1
+#define RECORD_THREADS 0
+
+//keeps the recorded command buffer for each swap chain image and only records it again when something it uses changes
+#define CACHE_COMMAND_BUFFERS 1
+
+//1 draws the quads from a single shared mesh pool as instanced, indirect batches (one draw call per material),
+//0 records one vkCmdDrawIndexed per draw from the render queue
+#define BATCHED_DRAWS 1
+
+//frustum culls the batched instances in a compute pass before they're drawn. Hold C to shrink the cull frustum to
+//the left edge of the screen, which culls the right hand quads. VERIFY_CULLING reads the results back every time
+//the frame times are logged (stalling on the gpu) and checks them against the cpu version of the test. Devices
+//without drawIndirectFirstInstance draw the batches unculled instead
+#define GPU_CULLING 1
+#define VERIFY_CULLING 1
+
+//times each of the cpu culling paths at startup, over 10k to 1M random spheres in and around the view
+#define BENCHMARK_CPU_CULLING 0
+
+//1 gives every draw its own block of uniforms, rewritten every frame with an animated colour and bound with a dynamic
+//offset into the frame's uniform ring. Raise DRAW_COUNT to see how it holds up with thousands of them
+#define ANIMATED_UNIFORMS 0
+
+//0 reads each draw's Data48 entry from the uniform buffer array, 1 from an object store instead, a storage buffer
+//that can hold far more entries than a uniform buffer can
+#define OBJECT_DATA_STORAGE_BUFFER 0
+
+//times push constants, a uniform buffer array, a dynamic uniform buffer and a storage buffer as ways of getting each
+//object's data into a shader, from 8 up to 1M objects, at startup. Takes a few seconds
+#define BENCHMARK_OBJECT_DATA 0
+
+//packs device local allocations into shared blocks (vkh_block_alloc.h) instead of giving each one its own memory, and
+//leaves them fragmented at startup by freeing three quarters of a few hundred buffers. What's left gets moved into
+//denser blocks a little every frame, spending up to DEFRAG_BUDGET_MS on it, until the sparse blocks have been released
+#define DEFRAGMENT_ALLOCATIONS 0
+#define DEFRAG_BUDGET_MS 0.5
+#define DEFRAG_DEMO_BUFFERS 256
+
+#if OBJECT_DATA_STORAGE_BUFFER
+#define OBJECT_DATA_SHADER "shaders\\storage_data.spv"
+#define INSTANCED_OBJECT_DATA_SHADER "shaders\\instanced_storage_data.spv"
+#define OBJECT_DATA_DESCRIPTOR_TYPE VK_DESCRIPTOR_TYPE_STORAGE_BUFFER
+#else
+#define OBJECT_DATA_SHADER "shaders\\shared_data.spv"
+#define INSTANCED_OBJECT_DATA_SHADER "shaders\\instanced_data.spv"
+#define OBJECT_DATA_DESCRIPTOR_TYPE VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER
+#endif
+
+#if GPU_CULLING && !BATCHED_DRAWS
+#error GPU_CULLING only works on batched draws
+#endif
+
+#if ANIMATED_UNIFORMS && BATCHED_DRAWS
+#error ANIMATED_UNIFORMS records its own draws, turn off BATCHED_DRAWS (and GPU_CULLING) to use it
+#endif
+
+//the parallel path's secondaries come from per frame pools that are reset every frame, so they can't be kept inside
+//a cached primary. With caching on, the cached buffers are recorded inline instead. Batched draws are only a couple
+//of calls no matter how many draws there are, so there's nothing worth splitting across threads
+#define RECORD_IN_PARALLEL (PARALLEL_RECORDING && !CACHE_COMMAND_BUFFERS && !BATCHED_DRAWS && !ANIMATED_UNIFORMS)
+
+#if PARALLEL_RECORDING && !RECORD_IN_PARALLEL
+#pragma message("PARALLEL_RECORDING is on but draws are recorded inline, turn off CACHE_COMMAND_BUFFERS, BATCHED_DRAWS, GPU_CULLING and ANIMATED_UNIFORMS to record in parallel")
+#endif
+
+//animated uniforms are written while recording and live in the frame's transient buffer, so there's nothing to keep
+#define USE_COMMAND_CACHE (CACHE_COMMAND_BUFFERS && !ANIMATED_UNIFORMS)
+
 vkh::VkhContext appContext;
 
+const float quadOffsets[4][2] = { { -0.5f, 0.5f }, { 0.5f, 0.5f }, { -0.5f, -0.5f }, { 0.5f, -0.5f } };
+
 struct DemoData
 {
 	vkh::MeshAsset quadMeshes[4];
 
 	std::vector<VkFramebuffer>		frameBuffers;
-	std::vector<VkCommandBuffer>	commandBuffers;
 
 	VkRenderPass					mainRenderPass;
+	bool							swapChainOutOfDate;
 
 	VkDescriptorSet					descriptorSet;
 	VkDescriptorSetLayout			descSetLayout;
@@ -23,6 +104,40 @@ struct DemoData
 
 	VkBuffer						sharedBuffer;
 	vkh::Allocation					bufferMemory;
+
+	//takes the shared buffer's place with OBJECT_DATA_STORAGE_BUFFER on
+	vkh::ObjectStore				objectStore;
+
+	//sorted so draws sharing a material (and then a mesh) end up next to each other
+	vkh::RenderQueue				renderQueue;
+
+	//the same quads, but sharing one vertex and index buffer so they can go in the same batch
+	vkh::MeshPool					meshPool;
+	vkh::PooledMesh					pooledQuads[4];
+
+	//instanced versions of the two materials, which read the array index from the instance buffer
+	//instead of a push constant
+	VkDescriptorSet					instancedDescriptorSet;
+	VkDescriptorSetLayout			instancedDescSetLayout;
+	VkPipelineLayout				instancedPipelineLayout[2];
+	VkPipeline						instancedPipeline[2];
+
+	vkh::BatchedDraws				batches;
+
+	vkh::GpuCulling					culling;
+	glm::vec4						cullPlanes[6];
+
+	//false when GPU_CULLING is on but the device can't draw culled batches
+	bool							useGpuCulling;
+
+	//one descriptor set per frame in flight, all pointing at their frame's transient buffer
+	vkh::UniformRing				uniformRing;
+	VkPipelineLayout				animatedPipelineLayout;
+	VkPipeline						animatedPipeline;
+
+	//only every fourth one is kept, the rest are freed to leave holes in the blocks
+	VkBuffer						defragBuffers[DEFRAG_DEMO_BUFFERS];
+	vkh::Allocation					defragMemory[DEFRAG_DEMO_BUFFERS];
 };
 
 DemoData demoData;
@@ -31,22 +146,100 @@ void setupDemo();
 void createMainRenderPass();
 void setupDescriptorSet();
 void writeDescriptorSet();
+void buildRenderQueue();
+void setupBatchedDraws();
+void writeInstancedDescriptorSet();
+void updateCullPlanes();
+void benchmarkCpuCulling();
+void benchmarkObjectData();
+void fragmentMemory();
+void setupAnimatedUniforms();
+void recordAnimatedQuads(VkCommandBuffer commandBuffer);
 void mainLoop();
 void shutdown();
 void logFPSAverage(double avg);
 void render();
+void onWindowResize(int width, int height);
+bool recreateSwapChain();
+void recordQuads(VkCommandBuffer commandBuffer, uint32_t firstDraw, uint32_t drawCount, void* userData);
+void recordCommands(VkCommandBuffer commandBuffer, uint32_t imageIndex, VkCommandBufferUsageFlags usageFlags);
 
 int CALLBACK WinMain(HINSTANCE Instance, HINSTANCE pInstance, LPSTR cmdLine, int showCode)
 {
 	HWND wndHdl = OS::makeWindow(Instance, "Uniform Buffer Array Demo", 800, 600);
 	OS::initializeInput();
 
+	//both materials share a single descriptor set, so the pool only needs room for one copy of what the shader uses
+	vkh::Reflection::ShaderInterface shaderInterface;
+	vkh::Reflection::reflectFile(OBJECT_DATA_SHADER, shaderInterface);
+
+#if BATCHED_DRAWS
+	//the instanced materials need a second set, with the instance buffer in it too
+	vkh::Reflection::ShaderInterface instancedInterface;
+	vkh::Reflection::ShaderInterface instancedFragInterface;
+	vkh::Reflection::reflectFile("shaders\\instanced_vert.spv", instancedInterface);
+	vkh::Reflection::reflectFile(INSTANCED_OBJECT_DATA_SHADER, instancedFragInterface);
+	vkh::Reflection::merge(instancedInterface, instancedFragInterface);
+#endif
+
+#if GPU_CULLING
+	vkh::Reflection::ShaderInterface cullInterface;
+	vkh::Reflection::reflectFile("shaders\\cull_instances.spv", cullInterface);
+#endif
+
 	vkh::VkhContextCreateInfo ctxtInfo = {};
-	ctxtInfo.types.push_back(VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER);
-	ctxtInfo.typeCounts.push_back(32);
+	ctxtInfo.framesInFlight = FRAMES_IN_FLIGHT;
+#if DEFRAGMENT_ALLOCATIONS
+	ctxtInfo.allocator = &vkh::allocators::block::allocImpl;
+#endif
+	vkh::Reflection::addDescriptorPoolSizes(shaderInterface, ctxtInfo.types, ctxtInfo.typeCounts);
+#if BATCHED_DRAWS
+	vkh::Reflection::addDescriptorPoolSizes(instancedInterface, ctxtInfo.types, ctxtInfo.typeCounts);
+#endif
+#if GPU_CULLING
+	vkh::Reflection::addDescriptorPoolSizes(cullInterface, ctxtInfo.types, ctxtInfo.typeCounts);
+#endif
+#if BENCHMARK_OBJECT_DATA
+	//the benchmark's second uniform buffer is a dynamic one, which reflection can't tell apart
+	vkh::Reflection::ShaderInterface benchInterface;
+	vkh::Reflection::reflectFile("shaders\\object_data_bench.spv", benchInterface);
+	vkh::Reflection::addDescriptorPoolSizes(benchInterface, ctxtInfo.types, ctxtInfo.typeCounts);
+	ctxtInfo.types.push_back(VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC);
+	ctxtInfo.typeCounts.push_back(1);
+#endif
+#if ANIMATED_UNIFORMS
+	//reflection only ever sees a plain uniform buffer, the ring's sets are dynamic ones. Every block gets rounded up
+	//to minUniformBufferOffsetAlignment, which the spec caps at 256 bytes
+	ctxtInfo.types.push_back(VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC);
+	ctxtInfo.typeCounts.push_back(FRAMES_IN_FLIGHT);
+	ctxtInfo.transientBufferSize = glm::max<VkDeviceSize>(DEFAULT_TRANSIENT_BUFFER_SIZE, DRAW_COUNT * 256);
+#endif
 
 	initContext(ctxtInfo, "Uniform Buffer Array Demo", Instance, wndHdl, appContext);
 	setupDemo();
+	OS::setResizeCallback(onWindowResize);
+
+#if BENCHMARK_CPU_CULLING
+	benchmarkCpuCulling();
+#endif
+
+#if BENCHMARK_OBJECT_DATA
+	benchmarkObjectData();
+#endif
+
+#if DEFRAGMENT_ALLOCATIONS
+	fragmentMemory();
+#endif
+
+#if USE_COMMAND_CACHE
+	vkh::CommandCache::init(appContext);
+#endif
+
+#if RECORD_IN_PARALLEL
+	vkh::ParallelRecord::init(appContext, RECORD_THREADS);
+	printf("Recording %i draws on up to %u threads\n", DRAW_COUNT, vkh::ParallelRecord::threadCount());
+#endif
+
 	mainLoop();
 	shutdown();
 
@@ -64,89 +257,553 @@ void setupDemo()
 
 	vkh::createFrameBuffers(demoData.frameBuffers, appContext.swapChain, nullptr, demoData.mainRenderPass, appContext.device);
 
-	uint32_t swapChainImageCount = static_cast<uint32_t>(appContext.swapChain.imageViews.size());
-	demoData.commandBuffers.resize(swapChainImageCount);
-	for (uint32_t i = 0; i < swapChainImageCount; ++i)
-	{
-		vkh::createCommandBuffer(demoData.commandBuffers[i], appContext.gfxCommandPool, appContext.device);
-	}
+	//both materials are built from the same fragment shader, LAYOUT_VARIANT (constant_id 0) picks
+	//which of the two data layouts it reads the shared buffer as
+	vkh::VkhSpecializationData layoutA = {};
+	vkh::addSpecializationConstant(layoutA, 0, 0);
 
-	setupDescriptorSet();
+	vkh::VkhSpecializationData layoutB = {};
+	vkh::addSpecializationConstant(layoutB, 0, 1);
 
 	vkh::VkhMaterialCreateInfo createInfo = {};
 	createInfo.renderPass = demoData.mainRenderPass;
 	createInfo.outPipeline = &demoData.graphicsPipeline[0];
 	createInfo.outPipelineLayout = &demoData.pipelineLayout[0];
-	createInfo.descSetLayouts.push_back(demoData.descSetLayout);
+	createInfo.fragSpecialization = &layoutA.info;
 
-	vkh::createBasicMaterial("shaders\\common_vert.spv", "shaders\\frag1.spv", appContext, createInfo);
+	vkh::createBasicMaterial("shaders\\common_vert.spv", OBJECT_DATA_SHADER, appContext, createInfo);
 
 	vkh::VkhMaterialCreateInfo createInfo2 = {};
 	createInfo2.renderPass = demoData.mainRenderPass;
 	createInfo2.outPipeline = &demoData.graphicsPipeline[1];
 	createInfo2.outPipelineLayout = &demoData.pipelineLayout[1];
-	createInfo2.descSetLayouts.push_back(demoData.descSetLayout);
+	createInfo2.fragSpecialization = &layoutB.info;
+
+	vkh::createBasicMaterial("shaders\\common_vert.spv", OBJECT_DATA_SHADER, appContext, createInfo2);
+
+	//descriptor set layouts are reflected from the shaders, and the registry owns them
+	demoData.descSetLayout = createInfo.descSetLayouts[0];
+	setupDescriptorSet();
+
+	//both materials use the same shader modules, so they should end up sharing a descriptor set layout,
+	//a pipeline layout and a single fragment module, but still get a pipeline each
+	vkh::PipelineRegistry::RegistryStats registryStats = vkh::PipelineRegistry::stats();
+	printf("Descriptor set layouts: %u requested, %u created\n", registryStats.descSetLayoutRequests, registryStats.descSetLayoutsCreated);
+	printf("Pipeline layouts: %u requested, %u created\n", registryStats.layoutRequests, registryStats.layoutsCreated);
+	printf("Pipelines: %u requested, %u created\n", registryStats.pipelineRequests, registryStats.pipelinesCreated);
 
-	vkh::createBasicMaterial("shaders\\common_vert.spv", "shaders\\frag2.spv", appContext, createInfo2);
+	vkh::ShaderCache::CacheStats shaderStats = vkh::ShaderCache::stats();
+	printf("Shader modules: %u requested, %u files loaded, %u created\n", shaderStats.acquires, shaderStats.fileLoads, shaderStats.modulesCreated);
 
 	writeDescriptorSet();
+
+#if BATCHED_DRAWS
+	setupBatchedDraws();
+#endif
+
+#if ANIMATED_UNIFORMS
+	setupAnimatedUniforms();
+#endif
+
+	buildRenderQueue();
 }
 
+void setupAnimatedUniforms()
+{
+	vkh::VkhMaterialCreateInfo createInfo = {};
+	createInfo.renderPass = demoData.mainRenderPass;
+	createInfo.outPipeline = &demoData.animatedPipeline;
+	createInfo.outPipelineLayout = &demoData.animatedPipelineLayout;
+	createInfo.descSetLayouts.push_back(vkh::getUniformRingSetLayout(VK_SHADER_STAGE_FRAGMENT_BIT, appContext));
 
-void setupDescriptorSet()
+	vkh::createBasicMaterial("shaders\\common_vert.spv", "shaders\\animated_data.spv", appContext, createInfo);
+	vkh::createUniformRing(demoData.uniformRing, createInfo.descSetLayouts[0], sizeof(glm::vec4), appContext);
+}
+
+void setupBatchedDraws()
 {
-	VkDescriptorSetLayoutBinding layoutBinding;
-	layoutBinding = vkh::descriptorSetLayoutBinding(VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER, VK_SHADER_STAGE_FRAGMENT_BIT, 0, 1);
+	vkh::Mesh::createPool(demoData.meshPool, 16, 24, appContext);
+	for (uint32_t i = 0; i < 4; ++i)
+	{
+		vkh::Vertex verts[4];
+		uint32_t indices[6];
+		vkh::Mesh::quadVertices(verts, indices, 1.0f, 1.0f, quadOffsets[i][0], quadOffsets[i][1]);
+		demoData.pooledQuads[i] = vkh::Mesh::addToPool(demoData.meshPool, appContext, verts, 4, indices, 6);
+	}
 
-	VkDescriptorSetLayoutCreateInfo layoutInfo = vkh::descriptorSetLayoutCreateInfo(&layoutBinding, 1);
-	VkResult res = vkCreateDescriptorSetLayout(appContext.device, &layoutInfo, nullptr, &demoData.descSetLayout);
-	checkf(res == VK_SUCCESS, "Error creating desc set layout");
+	vkh::VkhSpecializationData layoutA = {};
+	vkh::addSpecializationConstant(layoutA, 0, 0);
 
-	VkDescriptorSetAllocateInfo allocInfo = vkh::descriptorSetAllocateInfo(&demoData.descSetLayout, 1, appContext.descriptorPool);
-	res = vkAllocateDescriptorSets(appContext.device, &allocInfo, &demoData.descriptorSet);
-	checkf(res == VK_SUCCESS, "Error allocating global descriptor set");
+	vkh::VkhSpecializationData layoutB = {};
+	vkh::addSpecializationConstant(layoutB, 0, 1);
+
+	const VkSpecializationInfo* specializations[2] = { &layoutA.info, &layoutB.info };
+
+	for (uint32_t i = 0; i < 2; ++i)
+	{
+		vkh::VkhMaterialCreateInfo createInfo = {};
+		createInfo.renderPass = demoData.mainRenderPass;
+		createInfo.outPipeline = &demoData.instancedPipeline[i];
+		createInfo.outPipelineLayout = &demoData.instancedPipelineLayout[i];
+		createInfo.fragSpecialization = specializations[i];
+
+		vkh::createBasicMaterial("shaders\\instanced_vert.spv", INSTANCED_OBJECT_DATA_SHADER, appContext, createInfo);
+		demoData.instancedDescSetLayout = createInfo.descSetLayouts[0];
+	}
+
+	VkDescriptorSetAllocateInfo allocInfo = vkh::descriptorSetAllocateInfo(&demoData.instancedDescSetLayout, 1, appContext.descriptorPool);
+	VkResult res = vkAllocateDescriptorSets(appContext.device, &allocInfo, &demoData.instancedDescriptorSet);
+	checkf(res == VK_SUCCESS, "Error allocating instanced descriptor set");
+
+#if GPU_CULLING
+	demoData.useGpuCulling = vkh::gpuCullingSupported(appContext);
+	if (demoData.useGpuCulling)
+	{
+		vkh::createGpuCulling(demoData.culling, "shaders\\cull_instances.spv", appContext);
+		updateCullPlanes();
+	}
+	else
+	{
+		printf("GPU_CULLING: drawIndirectFirstInstance isn't supported, drawing the batches unculled\n");
+	}
+#endif
 }
 
-void writeDescriptorSet()
+
+//the scene never changes, so the queue is only built once
+void buildRenderQueue()
 {
-	struct LayoutA
+	vkh::resetRenderQueue(demoData.renderQueue);
+
+	//the quads are already positioned in the mesh, so the transforms are all identity and the spheres sit on their centres
+	std::vector<vkh::CullBounds> bounds(DRAW_COUNT);
+
+	for (uint32_t i = 0; i < DRAW_COUNT; ++i)
 	{
-		__declspec(align(16)) glm::vec4 colorA;
-		__declspec(align(16)) glm::vec4 colorB;
-		__declspec(align(16)) glm::vec4 colorC;
-	};
+		uint32_t quad = i % 4;
+		uint32_t material = quad % 2;
+		int arrayIdx = quad;
+
+		vkh::DrawPacket packet = {};
+#if BATCHED_DRAWS
+		packet.pipeline = demoData.instancedPipeline[material];
+		packet.pipelineLayout = demoData.instancedPipelineLayout[material];
+		packet.descriptorSet = demoData.instancedDescriptorSet;
+		packet.vertexBuffer = demoData.pooledQuads[quad].vBuffer;
+		packet.indexBuffer = demoData.pooledQuads[quad].iBuffer;
+		packet.indexCount = demoData.pooledQuads[quad].iCount;
+		packet.firstIndex = demoData.pooledQuads[quad].firstIndex;
+		packet.vertexOffset = demoData.pooledQuads[quad].vertexOffset;
+#else
+		packet.pipeline = demoData.graphicsPipeline[material];
+		packet.pipelineLayout = demoData.pipelineLayout[material];
+		packet.descriptorSet = demoData.descriptorSet;
+		packet.vertexBuffer = demoData.quadMeshes[quad].vBuffer;
+		packet.indexBuffer = demoData.quadMeshes[quad].iBuffer;
+		packet.indexCount = demoData.quadMeshes[quad].iCount;
+#endif
+		packet.pushConstantStages = VK_SHADER_STAGE_FRAGMENT_BIT;
+		packet.pushConstantSize = sizeof(int);
+		memcpy(packet.pushConstants, &arrayIdx, sizeof(int));
+
+		bounds[i].transform = glm::mat4(1.0f);
+		bounds[i].sphere = glm::vec4(quadOffsets[quad][0], quadOffsets[quad][1], 0.0f, 0.7072f);
+
+		vkh::addDraw(demoData.renderQueue, packet);
+	}
 
-	struct LayoutB
+	vkh::sortRenderQueue(demoData.renderQueue);
+
+#if BATCHED_DRAWS
+	//the array index each packet would have pushed ends up in the instance buffer, which gets a new handle every build
+	vkh::buildBatches(demoData.batches, demoData.renderQueue, appContext);
+#if GPU_CULLING
+	if (demoData.useGpuCulling)
+	{
+		vkh::buildCullObjects(demoData.culling, demoData.batches, demoData.renderQueue, bounds.data(), appContext);
+	}
+#endif
+	writeInstancedDescriptorSet();
+#endif
+}
+
+void writeInstancedDescriptorSet()
+{
+	VkDescriptorBufferInfo bufferInfos[2] = {};
+#if OBJECT_DATA_STORAGE_BUFFER
+	bufferInfos[0].buffer = demoData.objectStore.tracked.buffer;
+#else
+	bufferInfos[0].buffer = demoData.sharedBuffer;
+#endif
+	bufferInfos[0].offset = 0;
+	bufferInfos[0].range = VK_WHOLE_SIZE;
+
+#if GPU_CULLING
+	bufferInfos[1].buffer = demoData.useGpuCulling ? demoData.culling.culledInstanceBuffer : demoData.batches.instanceBuffer;
+#else
+	bufferInfos[1].buffer = demoData.batches.instanceBuffer;
+#endif
+	bufferInfos[1].offset = 0;
+	bufferInfos[1].range = VK_WHOLE_SIZE;
+
+	VkDescriptorType types[2] = { OBJECT_DATA_DESCRIPTOR_TYPE, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER };
+	VkWriteDescriptorSet setWrites[2];
+
+	for (uint32_t i = 0; i < 2; ++i)
 	{
-		__declspec(align(16)) float r;
-		__declspec(align(16)) glm::vec4 colorA;
-		__declspec(align(16)) int x;
+		setWrites[i] = {};
+		setWrites[i].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+		setWrites[i].dstBinding = i;
+		setWrites[i].dstArrayElement = 0;
+		setWrites[i].descriptorType = types[i];
+		setWrites[i].descriptorCount = 1;
+		setWrites[i].dstSet = demoData.instancedDescriptorSet;
+		setWrites[i].pBufferInfo = &bufferInfos[i];
+	}
+
+	vkUpdateDescriptorSets(appContext.device, 2, setWrites, 0, nullptr);
+}
+
+//the quads are drawn straight into clip space, so the cull frustum is normally just the screen
+void updateCullPlanes()
+{
+	glm::mat4 cullViewProj = glm::mat4(1.0f);
+
+	if (OS::getKey(KEY_C))
+	{
+		//maps x from [-1, -0.5] to [-1, 1], so only the left quads' spheres reach into the frustum
+		cullViewProj[0][0] = 4.0f;
+		cullViewProj[3][0] = 3.0f;
+	}
+
+	vkh::extractFrustumPlanes(cullViewProj, demoData.cullPlanes);
+}
+
+void benchmarkCpuCulling()
+{
+	//a camera looking down +z from the origin, with spheres scattered in a box a little larger than what it sees
+	glm::mat4 viewProj = glm::mat4(1.0f);
+	viewProj[0][0] = 0.25f;
+	viewProj[1][1] = 0.25f;
+	viewProj[2][2] = 0.1f;
+
+	glm::vec4 planes[6];
+	vkh::extractFrustumPlanes(viewProj, planes);
+
+	const uint32_t objectCounts[] = { 10000, 100000, 1000000 };
+	const char* pathNames[] = { "scalar", "SSE", "AVX2" };
+	const uint32_t pathCount = vkh::cpuSupportsAVX2() ? 3 : 2;
+
+	//every test culls about this many spheres in total, so the small counts get enough repeats to time
+	const uint32_t spheresPerTest = 10000000;
+
+	srand(1);
+	for (uint32_t c = 0; c < 3; ++c)
+	{
+		vkh::CullSpheres spheres;
+		for (uint32_t i = 0; i < objectCounts[c]; ++i)
+		{
+			glm::vec3 center = glm::vec3(rand() / (float)RAND_MAX * 12.0f - 6.0f, rand() / (float)RAND_MAX * 12.0f - 6.0f, rand() / (float)RAND_MAX * 14.0f - 2.0f);
+			vkh::addCullSphere(spheres, center, rand() / (float)RAND_MAX * 0.5f);
+		}
+
+		std::vector<uint32_t> visible;
+		uint32_t repeats = spheresPerTest / objectCounts[c];
+
+		for (uint32_t p = 0; p < pathCount; ++p)
+		{
+			uint32_t visibleCount = 0;
+
+			double start = OS::getMilliseconds();
+			for (uint32_t r = 0; r < repeats; ++r)
+			{
+				visibleCount = vkh::cullSpheres(spheres, planes, visible, (vkh::ECullPath)p);
+			}
+			double elapsedMs = OS::getMilliseconds() - start;
+
+			printf("CPU CULLING: %7u objects, %-6s %8.1f objects/us (%u visible)\n", objectCounts[c], pathNames[p],
+				(objectCounts[c] * (double)repeats) / (elapsedMs * 1000.0), visibleCount);
+		}
+	}
+}
+
+//1MB buffers, four blocks' worth. Keeping every fourth one leaves the blocks a quarter full, and the kept buffers are
+//registered as movable. Nothing reads them, so there's nothing to update when they move
+void fragmentMemory()
+{
+	const VkDeviceSize size = 1024 * 1024;
+	const VkBufferUsageFlags usage = VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_SRC_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT;
+
+	for (uint32_t i = 0; i < DEFRAG_DEMO_BUFFERS; ++i)
+	{
+		vkh::createBuffer(demoData.defragBuffers[i], demoData.defragMemory[i], size, usage, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, appContext);
+	}
+
+	for (uint32_t i = 0; i < DEFRAG_DEMO_BUFFERS; ++i)
+	{
+		if (i % 4 == 0)
+		{
+			vkh::allocators::block::registerMovableBuffer(&demoData.defragMemory[i], &demoData.defragBuffers[i], size, usage, nullptr, nullptr);
+			continue;
+		}
+
+		vkDestroyBuffer(appContext.device, demoData.defragBuffers[i], nullptr);
+		vkh::freeDeviceMemory(demoData.defragMemory[i]);
+		demoData.defragBuffers[i] = VK_NULL_HANDLE;
+	}
+
+	printf("DEFRAG: %u driver allocations, %.0f%% of block memory in use\n", vkh::allocators::block::numAllocs(), vkh::allocators::block::blockUsage() * 100.0f);
+}
+
+//each object's Data48 entry is either pushed or bound with a dynamic offset before a dispatch of its own, like per draw
+//data would be, or read by one invocation of a single dispatch from an array indexed by object, like instance data.
+//The shader (object_data_bench.comp) adds the entry's vectors up and writes them out, so none of the reads get skipped
+void benchmarkObjectData()
+{
+	const uint32_t objectCounts[] = { 8, 64, 512, 4096, 32768, 262144, 1048576 };
+	const uint32_t maxObjects = 1048576;
+	const char* modeNames[] = { "push constant", "uniform array", "dynamic uniform", "storage buffer" };
+	const uint32_t runs = 3;
+
+	//the uniform array holds as many entries as fit in maxUniformBufferRange, and stops working at all past that
+	uint32_t uniformEntries = glm::min<uint32_t>(appContext.gpu.deviceProps.limits.maxUniformBufferRange / SHARED_UNIFORM_SIZE, maxObjects);
+
+	//a block per object would take 256MB at 1M objects with 256 byte alignment, so the blocks get reused past this.
+	//The cost being measured is the bind per object, not where its offset points
+	const uint32_t dynamicBlocks = 65536;
+	VkDeviceSize alignment = appContext.gpu.deviceProps.limits.minUniformBufferOffsetAlignment;
+	uint32_t dynamicStride = static_cast<uint32_t>((SHARED_UNIFORM_SIZE + alignment - 1) & ~(alignment - 1));
+
+	struct BenchPushConstants
+	{
+		glm::vec4	entry[3];
+		uint32_t	firstObject;
+		uint32_t	objectCount;
 	};
 
-	static_assert(sizeof(LayoutA) == sizeof(LayoutB), "Both shader uniform layouts must be the same size");
-	static_assert(sizeof(LayoutA) == SHARED_UNIFORM_SIZE, "LayoutA is an unexpected size");
-	
-	char* sharedData = (char*)malloc(sizeof(LayoutA) * BUFFER_ARRAY_SIZE);
-	LayoutA first = { glm::vec4(0.5,0,0,0), glm::vec4(0.25,0.5,0,0), glm::vec4(0.0,0.25,0.25,1) };
-	LayoutB second = { 1.0, glm::vec4(1,1,1,1), 1};
-	LayoutA third = { glm::vec4(0.0,0,0,0), glm::vec4(0.0,0.75,0,0), glm::vec4(0.0,0.25,0.25,1) };
-	LayoutB fourth = { 0.0, glm::vec4(0,0,1,1), 1 };
-
-	char* writeLocation = sharedData;
-	memcpy(writeLocation, &first, SHARED_UNIFORM_SIZE);
-	memcpy((writeLocation += SHARED_UNIFORM_SIZE), &second, SHARED_UNIFORM_SIZE);
-	memcpy((writeLocation += SHARED_UNIFORM_SIZE), &third, SHARED_UNIFORM_SIZE);
-	memcpy((writeLocation += SHARED_UNIFORM_SIZE), &fourth, SHARED_UNIFORM_SIZE);
+	typedef vkh::Std430Block<glm::vec4[3], uint32_t, uint32_t> BenchPushConstantLayout;
+	static_assert(sizeof(BenchPushConstants) == BenchPushConstantLayout::size && offsetof(BenchPushConstants, firstObject) == BenchPushConstantLayout::offset(1), "BenchPushConstants doesn't match the shader");
+
+	std::vector<char> entries((size_t)maxObjects * SHARED_UNIFORM_SIZE);
+	float* entryFloats = (float*)entries.data();
+	for (size_t i = 0; i < entries.size() / sizeof(float); ++i)
+	{
+		entryFloats[i] = (float)(i % 251) / 251.0f;
+	}
+
+	VkBuffer uniformBuffer;
+	vkh::Allocation uniformMemory;
+	vkh::createBuffer(uniformBuffer, uniformMemory, uniformEntries * SHARED_UNIFORM_SIZE, VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, appContext);
+	vkh::copyDataToBuffer(&uniformBuffer, uniformEntries * SHARED_UNIFORM_SIZE, 0, entries.data(), appContext);
 
+	VkBuffer dynamicBuffer;
+	vkh::Allocation dynamicMemory;
+	vkh::createBuffer(dynamicBuffer, dynamicMemory, dynamicBlocks * dynamicStride, VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, appContext);
+
+	char* dynamicData;
+	VkResult res = vkMapMemory(appContext.device, dynamicMemory.handle, dynamicMemory.offset, dynamicBlocks * dynamicStride, 0, (void**)&dynamicData);
+	checkf(res == VK_SUCCESS, "Error mapping dynamic uniform buffer");
+	for (uint32_t i = 0; i < dynamicBlocks; ++i)
+	{
+		memcpy(dynamicData + i * dynamicStride, &entries[i * SHARED_UNIFORM_SIZE], SHARED_UNIFORM_SIZE);
+	}
+	vkUnmapMemory(appContext.device, dynamicMemory.handle);
+
+	vkh::ObjectStore store = {};
+	vkh::createObjectStore(store, SHARED_UNIFORM_SIZE, maxObjects, appContext);
+	vkh::writeObjects(store, 0, maxObjects, entries.data());
+	vkh::uploadObjectStore(store, appContext);
+
+	VkBuffer resultBuffer;
+	vkh::Allocation resultMemory;
+	vkh::createBuffer(resultBuffer, resultMemory, maxObjects * sizeof(glm::vec4), VK_BUFFER_USAGE_STORAGE_BUFFER_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, appContext);
+
+	//the uploads are on the transfer queue
+	vkh::Timeline::wait(vkh::ECommandPoolType::Transfer, vkh::Timeline::submittedValue(vkh::ECommandPoolType::Transfer));
+
+	vkh::DescriptorSetLayoutKey setKey;
+	memset(&setKey, 0, sizeof(vkh::DescriptorSetLayoutKey));
+	setKey.bindingCount = 4;
+	setKey.bindings[0] = vkh::descriptorSetLayoutBinding(VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER, VK_SHADER_STAGE_COMPUTE_BIT, 0, 1);
+	setKey.bindings[1] = vkh::descriptorSetLayoutBinding(VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC, VK_SHADER_STAGE_COMPUTE_BIT, 1, 1);
+	setKey.bindings[2] = vkh::descriptorSetLayoutBinding(VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, VK_SHADER_STAGE_COMPUTE_BIT, 2, 1);
+	setKey.bindings[3] = vkh::descriptorSetLayoutBinding(VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, VK_SHADER_STAGE_COMPUTE_BIT, 3, 1);
+	VkDescriptorSetLayout setLayout = vkh::PipelineRegistry::getOrCreateDescriptorSetLayout(setKey, appContext);
+
+	VkDescriptorSet descriptorSet;
+	VkDescriptorSetAllocateInfo allocInfo = vkh::descriptorSetAllocateInfo(&setLayout, 1, appContext.descriptorPool);
+	res = vkAllocateDescriptorSets(appContext.device, &allocInfo, &descriptorSet);
+	checkf(res == VK_SUCCESS, "Error allocating benchmark descriptor set");
+
+	VkDescriptorBufferInfo bufferInfos[4] = {};
+	bufferInfos[0] = { uniformBuffer, 0, VK_WHOLE_SIZE };
+	bufferInfos[1] = { dynamicBuffer, 0, SHARED_UNIFORM_SIZE };
+	bufferInfos[2] = { store.tracked.buffer, 0, VK_WHOLE_SIZE };
+	bufferInfos[3] = { resultBuffer, 0, VK_WHOLE_SIZE };
+
+	VkWriteDescriptorSet setWrites[4];
+	for (uint32_t i = 0; i < 4; ++i)
+	{
+		setWrites[i] = {};
+		setWrites[i].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+		setWrites[i].dstSet = descriptorSet;
+		setWrites[i].dstBinding = i;
+		setWrites[i].descriptorType = setKey.bindings[i].descriptorType;
+		setWrites[i].descriptorCount = 1;
+		setWrites[i].pBufferInfo = &bufferInfos[i];
+	}
+	vkUpdateDescriptorSets(appContext.device, 4, setWrites, 0, nullptr);
+
+	//MODE (constant_id 0) picks where the shader reads from, UNIFORM_ENTRIES (constant_id 1) sizes the uniform array
+	VkPipeline pipelines[4];
+	VkPipelineLayout pipelineLayout;
+	for (int32_t m = 0; m < 4; ++m)
+	{
+		vkh::VkhSpecializationData specialization = {};
+		vkh::addSpecializationConstant(specialization, 0, m);
+		vkh::addSpecializationConstant(specialization, 1, (int32_t)uniformEntries);
+
+		vkh::VkhComputeCreateInfo createInfo = {};
+		createInfo.descSetLayouts.push_back(setLayout);
+		createInfo.outPipeline = &pipelines[m];
+		createInfo.outPipelineLayout = &pipelineLayout;
+		createInfo.specialization = &specialization.info;
+
+		vkh::createComputeMaterial("shaders\\object_data_bench.spv", appContext, createInfo);
+	}
+
+	vkh::GpuTimer timer;
+	vkh::createGpuTimer(timer, 2, appContext);
+
+	for (uint32_t c = 0; c < sizeof(objectCounts) / sizeof(objectCounts[0]); ++c)
+	{
+		uint32_t objectCount = objectCounts[c];
+
+		for (uint32_t m = 0; m < 4; ++m)
+		{
+			if (m == 1 && objectCount > uniformEntries)
+			{
+				printf("OBJECT DATA: %7u objects, %-15s n/a, only %u entries fit in a uniform buffer\n", objectCount, modeNames[m], uniformEntries);
+				continue;
+			}
+
+			double bestGpuMs = 0.0;
+			double bestRecordMs = 0.0;
+
+			for (uint32_t r = 0; r < runs; ++r)
+			{
+				double recordStart = OS::getMilliseconds();
+
+				vkh::VkhCommandBuffer scratch = vkh::beginScratchCommandBuffer(vkh::ECommandPoolType::Graphics, appContext);
+				VkCommandBuffer commandBuffer = scratch.buffer;
+
+				vkh::resetGpuTimer(timer, commandBuffer);
+				vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, pipelines[m]);
+
+				uint32_t dynamicOffset = 0;
+				vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, pipelineLayout, 0, 1, &descriptorSet, 1, &dynamicOffset);
+
+				vkh::writeGpuTimestamp(timer, commandBuffer, 0, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT);
+
+				BenchPushConstants pushConstants = {};
+				if (m == 0 || m == 2)
+				{
+					for (uint32_t i = 0; i < objectCount; ++i)
+					{
+						pushConstants.firstObject = i;
+						pushConstants.objectCount = i + 1;
+
+						if (m == 0)
+						{
+							memcpy(pushConstants.entry, &entries[i * SHARED_UNIFORM_SIZE], SHARED_UNIFORM_SIZE);
+							vkCmdPushConstants(commandBuffer, pipelineLayout, VK_SHADER_STAGE_COMPUTE_BIT, 0, sizeof(BenchPushConstants), &pushConstants);
+						}
+						else
+						{
+							dynamicOffset = (i % dynamicBlocks) * dynamicStride;
+							vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, pipelineLayout, 0, 1, &descriptorSet, 1, &dynamicOffset);
+							vkCmdPushConstants(commandBuffer, pipelineLayout, VK_SHADER_STAGE_COMPUTE_BIT, offsetof(BenchPushConstants, firstObject), 2 * sizeof(uint32_t), &pushConstants.firstObject);
+						}
+
+						vkCmdDispatch(commandBuffer, 1, 1, 1);
+					}
+				}
+				else
+				{
+					pushConstants.firstObject = 0;
+					pushConstants.objectCount = objectCount;
+					vkCmdPushConstants(commandBuffer, pipelineLayout, VK_SHADER_STAGE_COMPUTE_BIT, 0, sizeof(BenchPushConstants), &pushConstants);
+					vkCmdDispatch(commandBuffer, (objectCount + 63) / 64, 1, 1);
+				}
+
+				vkh::writeGpuTimestamp(timer, commandBuffer, 1, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT);
+				double recordMs = OS::getMilliseconds() - recordStart;
+
+				vkh::submitScratchCommandBuffer(scratch);
+				double gpuMs = vkh::gpuTimerMs(timer, 0, 1, appContext);
+
+				bestGpuMs = (r == 0 || gpuMs < bestGpuMs) ? gpuMs : bestGpuMs;
+				bestRecordMs = (r == 0 || recordMs < bestRecordMs) ? recordMs : bestRecordMs;
+			}
+
+			printf("OBJECT DATA: %7u objects, %-15s %9.3f ms gpu (%8.2f ns/object), %9.3f ms recording\n", objectCount, modeNames[m],
+				bestGpuMs, (bestGpuMs * 1000000.0) / objectCount, bestRecordMs);
+		}
+	}
+
+	vkh::destroyGpuTimer(timer, appContext);
+	for (uint32_t m = 0; m < 4; ++m)
+	{
+		vkDestroyPipeline(appContext.device, pipelines[m], nullptr);
+	}
+
+	uint64_t lastUse = vkh::Timeline::submittedValue(vkh::ECommandPoolType::Graphics);
+	vkh::DeletionQueue::destroyBuffer(uniformBuffer, uniformMemory, vkh::ECommandPoolType::Graphics, lastUse);
+	vkh::DeletionQueue::destroyBuffer(dynamicBuffer, dynamicMemory, vkh::ECommandPoolType::Graphics, lastUse);
+	vkh::DeletionQueue::destroyBuffer(resultBuffer, resultMemory, vkh::ECommandPoolType::Graphics, lastUse);
+	vkh::destroyObjectStore(store);
+}
+
+void setupDescriptorSet()
+{
+	VkDescriptorSetAllocateInfo allocInfo = vkh::descriptorSetAllocateInfo(&demoData.descSetLayout, 1, appContext.descriptorPool);
+	VkResult res = vkAllocateDescriptorSets(appContext.device, &allocInfo, &demoData.descriptorSet);
+	checkf(res == VK_SUCCESS, "Error allocating global descriptor set");
+}
+
+void writeDescriptorSet()
+{
+	//the two ways shared_data.frag reads a Data48 entry. They index the same array, so they have to agree on its stride,
+	//and LayoutB's members have to land on the first component of colorA, colorB and colorC
+	typedef vkh::Std140Block<glm::vec4, glm::vec4, glm::vec4> LayoutA;
+	typedef vkh::Std140Block<float, glm::vec4, int32_t> LayoutB;
+
+	static_assert(LayoutA::stride == SHARED_UNIFORM_SIZE && LayoutB::stride == SHARED_UNIFORM_SIZE, "Both shader uniform layouts must match Data48's size");
+	static_assert(LayoutB::offset(1) == 16 && LayoutB::offset(2) == 32, "LayoutB doesn't line up with Data48's members");
+	static_assert(vkh::Std430Block<float, glm::vec4, int32_t>::stride == LayoutB::stride, "The object store's std430 entries have to match too");
+
+	//entries past the last one written are never read, but they're still uploaded, so start from zeroes
+	std::vector<char> sharedData(SHARED_UNIFORM_SIZE * BUFFER_ARRAY_SIZE, 0);
+	vkh::writeBlockElement<LayoutA>(sharedData.data(), 0, glm::vec4(0.5, 0, 0, 0), glm::vec4(0.25, 0.5, 0, 0), glm::vec4(0.0, 0.25, 0.25, 1));
+	vkh::writeBlockElement<LayoutB>(sharedData.data(), 1, 1.0f, glm::vec4(1, 1, 1, 1), 1);
+	vkh::writeBlockElement<LayoutA>(sharedData.data(), 2, glm::vec4(0.0, 0, 0, 0), glm::vec4(0.0, 0.75, 0, 0), glm::vec4(0.0, 0.25, 0.25, 1));
+	vkh::writeBlockElement<LayoutB>(sharedData.data(), 3, 0.0f, glm::vec4(0, 0, 1, 1), 1);
+
+#if OBJECT_DATA_STORAGE_BUFFER
+	vkh::createObjectStore(demoData.objectStore, SHARED_UNIFORM_SIZE, BUFFER_ARRAY_SIZE, appContext);
+	vkh::writeObjects(demoData.objectStore, 0, BUFFER_ARRAY_SIZE, sharedData.data());
+	vkh::uploadObjectStore(demoData.objectStore, appContext);
+	vkh::writeObjectStoreDescriptor(demoData.objectStore, demoData.descriptorSet, 0, appContext);
+#else
 	vkh::createBuffer(demoData.sharedBuffer,
 		demoData.bufferMemory,
 		SHARED_UNIFORM_SIZE * BUFFER_ARRAY_SIZE,
 		VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT,
-		VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,
+		vkh::uploadDestinationProperties(appContext),
 		appContext);
 
 
-	vkh::copyDataToBuffer(&demoData.sharedBuffer, SHARED_UNIFORM_SIZE * BUFFER_ARRAY_SIZE, 0, sharedData, appContext);
+	vkh::uploadToBuffer(demoData.sharedBuffer, demoData.bufferMemory, 0, sharedData.data(), SHARED_UNIFORM_SIZE * BUFFER_ARRAY_SIZE, appContext);
 
 	VkWriteDescriptorSet setWrite;
 
@@ -166,7 +823,7 @@ void writeDescriptorSet()
 	setWrite.pImageInfo = 0;
 
 	vkUpdateDescriptorSets(appContext.device, 1, &setWrite, 0, nullptr);
-
+#endif
 }
 
 void createMainRenderPass()
@@ -190,7 +847,71 @@ void createMainRenderPass()
 
 void logFPSAverage(double avg)
 {
-	printf("AVG FRAMETIME FOR LAST %i FRAMES: %f ms\n", FPS_DATA_FRAME_HISTORY_SIZE, avg);
+	vkh::VkhFrameStats frameStats = vkh::consumeFrameStats(appContext);
+	double avgFrameWait = frameStats.frameCount > 0 ? frameStats.waitMs / (double)frameStats.frameCount : 0.0;
+	double avgFrameRecord = frameStats.frameCount > 0 ? frameStats.recordMs / (double)frameStats.frameCount : 0.0;
+
+	printf("AVG FRAMETIME FOR LAST %i FRAMES: %f ms (%f ms waiting on the gpu, %f ms recording, %i frames in flight)\n", FPS_DATA_FRAME_HISTORY_SIZE, avg, avgFrameWait, avgFrameRecord, FRAMES_IN_FLIGHT);
+
+	vkh::DeletionQueue::DeletionStats deletionStats = vkh::DeletionQueue::stats();
+	printf("DEFERRED DELETIONS: %u pending (%llu bytes), %llu destroyed so far\n", deletionStats.pendingCount, (unsigned long long)deletionStats.pendingBytes, (unsigned long long)deletionStats.totalDeleted);
+
+	vkh::RenderQueueStats queueStats = vkh::consumeRenderQueueStats(demoData.renderQueue);
+	printf("RENDER QUEUE: %llu draws recorded, pipeline binds %llu issued / %llu avoided, descriptor set binds %llu / %llu, mesh binds %llu / %llu\n",
+		(unsigned long long)queueStats.draws,
+		(unsigned long long)queueStats.pipelineBinds, (unsigned long long)queueStats.pipelineBindsAvoided,
+		(unsigned long long)queueStats.descriptorSetBinds, (unsigned long long)queueStats.descriptorSetBindsAvoided,
+		(unsigned long long)queueStats.meshBinds, (unsigned long long)queueStats.meshBindsAvoided);
+
+#if BATCHED_DRAWS
+	vkh::BatchStats batchStats = vkh::consumeBatchStats(demoData.batches);
+	printf("BATCHES: %llu draw calls, %llu binds, %llu instances\n",
+		(unsigned long long)batchStats.drawCalls, (unsigned long long)batchStats.binds, (unsigned long long)batchStats.instances);
+#endif
+
+#if OBJECT_DATA_STORAGE_BUFFER
+	vkh::TrackedBufferStats storeStats = vkh::consumeTrackedBufferStats(demoData.objectStore.tracked);
+	printf("OBJECT STORE: %llu uploads, %llu copy regions, %llu bytes (%llu written directly)\n",
+		(unsigned long long)storeStats.flushes, (unsigned long long)storeStats.regions, (unsigned long long)storeStats.bytes, (unsigned long long)storeStats.directBytes);
+#endif
+
+#if ANIMATED_UNIFORMS
+	vkh::UniformRingStats ringStats = vkh::consumeUniformRingStats(demoData.uniformRing);
+	printf("UNIFORM RING: %llu blocks written, %llu bytes\n", (unsigned long long)ringStats.blocksWritten, (unsigned long long)ringStats.bytesUsed);
+#endif
+
+#if GPU_CULLING && VERIFY_CULLING
+	if (demoData.useGpuCulling)
+	{
+		//the indirect buffer is shared between frames, so everything submitted so far has to finish before reading it
+		vkh::Timeline::wait(vkh::ECommandPoolType::Graphics, vkh::Timeline::submittedValue(vkh::ECommandPoolType::Graphics));
+
+		std::vector<uint32_t> gpuCounts;
+		std::vector<uint32_t> cpuCounts;
+		vkh::readCulledCounts(demoData.batches, appContext, gpuCounts);
+		vkh::cullReference(demoData.culling, demoData.batches, demoData.cullPlanes, cpuCounts);
+
+		uint32_t visible = 0;
+		for (uint32_t i = 0; i < gpuCounts.size(); ++i)
+		{
+			visible += gpuCounts[i];
+		}
+
+		printf("CULLING: %u of %u instances visible, %s the cpu reference\n", visible, (uint32_t)demoData.culling.objects.size(), gpuCounts == cpuCounts ? "matches" : "DOES NOT MATCH");
+	}
+#endif
+
+#if DEFRAGMENT_ALLOCATIONS
+	vkh::allocators::block::DefragStats defragStats = vkh::allocators::block::consumeDefragStats();
+	printf("DEFRAG: %llu allocations moved (%llu bytes), %llu blocks released, %u driver allocations, %.0f%% of block memory in use\n",
+		(unsigned long long)defragStats.moves, (unsigned long long)defragStats.bytesMoved, (unsigned long long)defragStats.blocksReleased,
+		vkh::allocators::block::numAllocs(), vkh::allocators::block::blockUsage() * 100.0f);
+#endif
+
+#if USE_COMMAND_CACHE
+	vkh::CommandCache::CacheStats cacheStats = vkh::CommandCache::stats();
+	printf("COMMAND BUFFERS: %llu re-recorded, %llu reused\n", (unsigned long long)cacheStats.reRecords, (unsigned long long)cacheStats.reuses);
+#endif
 }
 
 void mainLoop()
@@ -223,70 +944,55 @@ void mainLoop()
 
 void render()
 {
-	//acquire an image from the swap chain
-	uint32_t imageIndex;
-
-	//using uint64 max for timeout disables it
-	VkResult res = vkAcquireNextImageKHR(appContext.device, appContext.swapChain.swapChain, UINT64_MAX, appContext.imageAvailableSemaphore, VK_NULL_HANDLE, &imageIndex);
-
-	vkh::waitForFence(appContext.frameFences[imageIndex], appContext.device);
-	vkResetFences(appContext.device, 1, &appContext.frameFences[imageIndex]);
-
-	//record drawing
-	VkCommandBufferBeginInfo beginInfo = {};
-	beginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
-	beginInfo.flags = VK_COMMAND_BUFFER_USAGE_SIMULTANEOUS_USE_BIT;
-	beginInfo.pInheritanceInfo = nullptr; // Optional
-	vkResetCommandBuffer(demoData.commandBuffers[imageIndex], VK_COMMAND_BUFFER_RESET_RELEASE_RESOURCES_BIT);
-	res = vkBeginCommandBuffer(demoData.commandBuffers[imageIndex], &beginInfo);
-
-
-	VkRenderPassBeginInfo renderPassInfo = {};
-	renderPassInfo.sType = VK_STRUCTURE_TYPE_RENDER_PASS_BEGIN_INFO;
-	renderPassInfo.renderPass = demoData.mainRenderPass;
-	renderPassInfo.framebuffer = demoData.frameBuffers[imageIndex];
-	renderPassInfo.renderArea.offset = { 0, 0 };
-	renderPassInfo.renderArea.extent = appContext.swapChain.extent;
-
-	std::vector<VkClearValue> clearColors;
-
-	//color
-	clearColors.push_back({ 0.0f, 0.0f, 0.0f, 1.0f });
-
-	renderPassInfo.clearValueCount = static_cast<uint32_t>(clearColors.size());
-	renderPassInfo.pClearValues = &clearColors[0];
-	vkCmdBeginRenderPass(demoData.commandBuffers[imageIndex], &renderPassInfo, VK_SUBPASS_CONTENTS_INLINE);
-
-	vkCmdBindDescriptorSets(demoData.commandBuffers[imageIndex], VK_PIPELINE_BIND_POINT_GRAPHICS, demoData.pipelineLayout[0], 0, 1, &demoData.descriptorSet, 0, 0);
-
-	for (uint32_t i = 0; i < 4; ++i)
+	if (demoData.swapChainOutOfDate && !recreateSwapChain())
 	{
-		uint32_t material = i % 2;
-
-		vkCmdBindPipeline(demoData.commandBuffers[imageIndex], VK_PIPELINE_BIND_POINT_GRAPHICS, demoData.graphicsPipeline[material]);
-
-		int arrayIdx = i;
+		return;
+	}
 
-		vkCmdPushConstants(
-			demoData.commandBuffers[imageIndex],
-			demoData.pipelineLayout[material],
-			VK_SHADER_STAGE_FRAGMENT_BIT,
-			0,
-			sizeof(int),
-			(void*)&arrayIdx);
+	//blocks until the gpu is done with the last frame that used this slot in the ring
+	vkh::VkhFrameContext& frame = vkh::acquireFrame(appContext);
 
+#if DEFRAGMENT_ALLOCATIONS
+	vkh::allocators::block::defragment(appContext, DEFRAG_BUDGET_MS);
+#endif
 
-		VkBuffer vertexBuffers[] = { demoData.quadMeshes[i].vBuffer };
-		VkDeviceSize vertexOffsets[] = { 0 };
-		vkCmdBindVertexBuffers(demoData.commandBuffers[imageIndex], 0, 1, vertexBuffers, vertexOffsets);
-		vkCmdBindIndexBuffer(demoData.commandBuffers[imageIndex], demoData.quadMeshes[i].iBuffer, 0, VK_INDEX_TYPE_UINT32);
-		vkCmdDrawIndexed(demoData.commandBuffers[imageIndex], static_cast<uint32_t>(demoData.quadMeshes[i].iCount), 1, 0, 0, 0);
+	//acquire an image from the swap chain
+	uint32_t imageIndex;
 
+	//using uint64 max for timeout disables it
+	VkResult res = vkAcquireNextImageKHR(appContext.device, appContext.swapChain.swapChain, UINT64_MAX, frame.imageAvailableSemaphore, VK_NULL_HANDLE, &imageIndex);
+	if (res == VK_ERROR_OUT_OF_DATE_KHR)
+	{
+		demoData.swapChainOutOfDate = true;
+		return;
 	}
 
-	vkCmdEndRenderPass(demoData.commandBuffers[imageIndex]);
-	res = vkEndCommandBuffer(demoData.commandBuffers[imageIndex]);
-	assert(res == VK_SUCCESS);
+	vkh::resetFrame(frame, appContext);
+
+#if GPU_CULLING
+	if (demoData.useGpuCulling) updateCullPlanes();
+#endif
+
+#if USE_COMMAND_CACHE
+	//nothing in this demo changes after setup, so each swap chain image's buffer only gets recorded once.
+	//The render queue's version covers every pipeline, descriptor set, mesh and push constant the draws use
+	uint64_t inputHash = HASH_FNV_OFFSET_BASIS;
+	inputHash = vkh::CommandCache::hashInput(inputHash, demoData.renderQueue.version);
+	inputHash = vkh::CommandCache::hashInput(inputHash, demoData.batches.version);
+	inputHash = vkh::CommandCache::hashInput(inputHash, demoData.culling.version);
+	inputHash = vkh::CommandCache::hashInput(inputHash, demoData.cullPlanes);
+	inputHash = vkh::CommandCache::hashInput(inputHash, demoData.frameBuffers[imageIndex]);
+	inputHash = vkh::CommandCache::hashInput(inputHash, appContext.swapChain.extent);
+
+	VkCommandBuffer commandBuffer;
+	if (vkh::CommandCache::acquire(imageIndex, inputHash, commandBuffer))
+	{
+		recordCommands(commandBuffer, imageIndex, 0);
+	}
+#else
+	VkCommandBuffer commandBuffer = frame.commandBuffer;
+	recordCommands(commandBuffer, imageIndex, VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT);
+#endif
 
 
 	//submit
@@ -294,7 +1000,7 @@ void render()
 	VkSubmitInfo submitInfo = {};
 	submitInfo.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
 	//wait on writing colours to the buffer until the semaphore says the buffer is available
-	VkSemaphore waitSemaphores[] = { appContext.imageAvailableSemaphore };
+	VkSemaphore waitSemaphores[] = { frame.imageAvailableSemaphore };
 	VkPipelineStageFlags waitStages[] = { VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT };
 	submitInfo.waitSemaphoreCount = 1;
 	submitInfo.pWaitSemaphores = waitSemaphores;
@@ -302,14 +1008,17 @@ void render()
 
 	submitInfo.commandBufferCount = 1;
 
-	VkSemaphore signalSemaphores[] = { appContext.renderFinishedSemaphore };
+	VkSemaphore signalSemaphores[] = { frame.renderFinishedSemaphore };
 	submitInfo.signalSemaphoreCount = 1;
 	submitInfo.pSignalSemaphores = signalSemaphores;
-	submitInfo.pCommandBuffers = &demoData.commandBuffers[imageIndex];
+	submitInfo.pCommandBuffers = &commandBuffer;
 	submitInfo.commandBufferCount = 1;
 
-	res = vkQueueSubmit(appContext.deviceQueues.graphicsQueue, 1, &submitInfo, appContext.frameFences[imageIndex]);
-	assert(res == VK_SUCCESS);
+	vkh::submitFrame(frame, submitInfo, appContext);
+
+#if USE_COMMAND_CACHE
+	vkh::CommandCache::markSubmitted(imageIndex, frame.timelineValue);
+#endif
 
 	//present
 
@@ -325,9 +1034,179 @@ void render()
 	presentInfo.pImageIndices = &imageIndex;
 	presentInfo.pResults = nullptr; // Optional
 	res = vkQueuePresentKHR(appContext.deviceQueues.transferQueue, &presentInfo);
+
+	if (res == VK_ERROR_OUT_OF_DATE_KHR || res == VK_SUBOPTIMAL_KHR)
+	{
+		demoData.swapChainOutOfDate = true;
+	}
+}
+
+void recordCommands(VkCommandBuffer commandBuffer, uint32_t imageIndex, VkCommandBufferUsageFlags usageFlags)
+{
+	VkCommandBufferBeginInfo beginInfo = {};
+	beginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+	beginInfo.flags = usageFlags;
+	beginInfo.pInheritanceInfo = nullptr; // Optional
+	VkResult res = vkBeginCommandBuffer(commandBuffer, &beginInfo);
+
+
+	VkRenderPassBeginInfo renderPassInfo = {};
+	renderPassInfo.sType = VK_STRUCTURE_TYPE_RENDER_PASS_BEGIN_INFO;
+	renderPassInfo.renderPass = demoData.mainRenderPass;
+	renderPassInfo.framebuffer = demoData.frameBuffers[imageIndex];
+	renderPassInfo.renderArea.offset = { 0, 0 };
+	renderPassInfo.renderArea.extent = appContext.swapChain.extent;
+
+	std::vector<VkClearValue> clearColors;
+
+	//color
+	clearColors.push_back({ 0.0f, 0.0f, 0.0f, 1.0f });
+
+	renderPassInfo.clearValueCount = static_cast<uint32_t>(clearColors.size());
+	renderPassInfo.pClearValues = &clearColors[0];
+
+#if GPU_CULLING
+	if (demoData.useGpuCulling)
+	{
+		vkh::recordCulling(demoData.culling, demoData.batches, commandBuffer, demoData.cullPlanes);
+	}
+#endif
+
+#if RECORD_IN_PARALLEL
+	vkCmdBeginRenderPass(commandBuffer, &renderPassInfo, VK_SUBPASS_CONTENTS_SECONDARY_COMMAND_BUFFERS);
+
+	VkCommandBufferInheritanceInfo inheritance = {};
+	inheritance.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_INHERITANCE_INFO;
+	inheritance.renderPass = demoData.mainRenderPass;
+	inheritance.subpass = 0;
+	inheritance.framebuffer = demoData.frameBuffers[imageIndex];
+
+	VkCommandBuffer secondaries[MAX_RECORD_THREADS];
+	uint32_t secondaryCount = vkh::ParallelRecord::record(appContext, inheritance, vkh::renderQueueSize(demoData.renderQueue), recordQuads, nullptr, secondaries);
+	vkCmdExecuteCommands(commandBuffer, secondaryCount, secondaries);
+#elif ANIMATED_UNIFORMS
+	vkCmdBeginRenderPass(commandBuffer, &renderPassInfo, VK_SUBPASS_CONTENTS_INLINE);
+	recordAnimatedQuads(commandBuffer);
+#elif BATCHED_DRAWS
+	vkCmdBeginRenderPass(commandBuffer, &renderPassInfo, VK_SUBPASS_CONTENTS_INLINE);
+	vkh::setViewportAndScissor(commandBuffer, appContext.swapChain.extent);
+	vkh::recordBatches(demoData.batches, commandBuffer, appContext);
+#else
+	vkCmdBeginRenderPass(commandBuffer, &renderPassInfo, VK_SUBPASS_CONTENTS_INLINE);
+	recordQuads(commandBuffer, 0, vkh::renderQueueSize(demoData.renderQueue), nullptr);
+#endif
+
+	vkCmdEndRenderPass(commandBuffer);
+	res = vkEndCommandBuffer(commandBuffer);
+	assert(res == VK_SUCCESS);
+}
+
+//runs on the record worker threads when RECORD_IN_PARALLEL is on, so it can only read demoData
+void recordQuads(VkCommandBuffer commandBuffer, uint32_t firstDraw, uint32_t drawCount, void* userData)
+{
+	vkh::setViewportAndScissor(commandBuffer, appContext.swapChain.extent);
+	vkh::recordRenderQueue(demoData.renderQueue, commandBuffer, firstDraw, drawCount);
+}
+
+//every draw writes this frame's colour straight into the ring, so there's no descriptor write or staging copy per draw,
+//just a different dynamic offset when the set is bound
+void recordAnimatedQuads(VkCommandBuffer commandBuffer)
+{
+	vkh::VkhFrameContext& frame = appContext.frames[appContext.frameIdx];
+	float time = static_cast<float>(OS::getMilliseconds() / 1000.0);
+
+	vkh::setViewportAndScissor(commandBuffer, appContext.swapChain.extent);
+	vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, demoData.animatedPipeline);
+
+	for (uint32_t i = 0; i < DRAW_COUNT; ++i)
+	{
+		const vkh::MeshAsset& quad = demoData.quadMeshes[i % 4];
+
+		float phase = time * 2.0f + i * 0.5f;
+		glm::vec4 color = glm::vec4(0.5f + 0.5f * sinf(phase), 0.5f + 0.5f * sinf(phase + 2.094f), 0.5f + 0.5f * sinf(phase + 4.189f), 1.0f);
+
+		vkh::UniformBlock block = vkh::allocUniformBlock(demoData.uniformRing, frame);
+		memcpy(block.data, &color, sizeof(glm::vec4));
+		vkh::bindUniformBlock(demoData.uniformRing, block, commandBuffer, demoData.animatedPipelineLayout, 0, appContext);
+
+		VkDeviceSize vertexOffset = 0;
+		vkCmdBindVertexBuffers(commandBuffer, 0, 1, &quad.vBuffer, &vertexOffset);
+		vkCmdBindIndexBuffer(commandBuffer, quad.iBuffer, 0, VK_INDEX_TYPE_UINT32);
+		vkCmdDrawIndexed(commandBuffer, quad.iCount, 1, 0, 0, 0);
+	}
+}
+
+void onWindowResize(int width, int height)
+{
+	//this gets called from inside the window proc, so just flag the swap chain and deal with it at the start of the next frame
+	demoData.swapChainOutOfDate = true;
+}
+
+bool recreateSwapChain()
+{
+	if (!vkh::recreateSwapchain(appContext))
+	{
+		return false;
+	}
+
+	//pipelines don't need to be touched here, they use dynamic viewport / scissor state
+	for (uint32_t i = 0; i < demoData.frameBuffers.size(); ++i)
+	{
+		vkDestroyFramebuffer(appContext.device, demoData.frameBuffers[i], nullptr);
+	}
+
+	vkh::createFrameBuffers(demoData.frameBuffers, appContext.swapChain, nullptr, demoData.mainRenderPass, appContext.device);
+	demoData.swapChainOutOfDate = false;
+
+#if USE_COMMAND_CACHE
+	//the image count can change, and new framebuffers can come back with the same handles as the destroyed ones,
+	//so don't rely on the input hash here
+	vkh::CommandCache::resize(static_cast<uint32_t>(appContext.swapChain.imageViews.size()));
+	vkh::CommandCache::invalidateAll();
+#endif
+	return true;
 }
 
 void shutdown()
 {
+#if RECORD_IN_PARALLEL
+	vkh::ParallelRecord::destroy(appContext);
+#endif
+
+#if USE_COMMAND_CACHE
+	vkh::CommandCache::destroy();
+#endif
 
+#if GPU_CULLING
+	if (demoData.useGpuCulling)
+	{
+		vkh::destroyGpuCulling(demoData.culling, appContext);
+	}
+#endif
+
+#if BATCHED_DRAWS
+	vkh::destroyBatches(demoData.batches);
+	vkh::Mesh::destroyPool(demoData.meshPool);
+#endif
+
+#if OBJECT_DATA_STORAGE_BUFFER
+	vkh::destroyObjectStore(demoData.objectStore);
+#endif
+
+#if DEFRAGMENT_ALLOCATIONS
+	for (uint32_t i = 0; i < DEFRAG_DEMO_BUFFERS; ++i)
+	{
+		if (demoData.defragBuffers[i] == VK_NULL_HANDLE) continue;
+
+		vkh::allocators::block::unregisterMovable(demoData.defragMemory[i]);
+		vkh::DeletionQueue::destroyBuffer(demoData.defragBuffers[i], demoData.defragMemory[i], vkh::ECommandPoolType::Graphics, vkh::Timeline::submittedValue(vkh::ECommandPoolType::Graphics));
+	}
+#endif
+
+	//everything above only queued its resources up, so wait for the gpu to finish before tearing down what they're tagged with
+	vkDeviceWaitIdle(appContext.device);
+	vkh::DeletionQueue::flush(appContext);
+	vkh::PipelineRegistry::destroyAll(appContext);
+	vkh::destroyFrameContexts(appContext);
+	vkh::Timeline::destroy();
 }
\ No newline at end of file
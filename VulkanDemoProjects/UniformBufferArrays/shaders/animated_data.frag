@@ -0,0 +1,15 @@
+#version 450 core
+#extension GL_ARB_separate_shader_objects : enable
+
+//written by the cpu every frame, one block per draw, picked out with a dynamic offset when the set is bound
+layout(binding = 0, set = 0) uniform ANIMATED
+{
+	vec4 color;
+}data;
+
+layout(location=0) out vec4 outColor;
+
+void main()
+{
+	outColor = data.color;
+}
\ No newline at end of file
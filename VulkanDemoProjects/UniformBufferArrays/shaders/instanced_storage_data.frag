@@ -0,0 +1,44 @@
+#version 450 core
+#extension GL_ARB_separate_shader_objects : enable
+
+//the instanced version of storage_data.frag, the only difference is where the entry index comes from.
+//selects how each 48 byte entry in the shared buffer is interpreted, so that one module
+//can be specialized into both materials instead of compiling a fragment shader for each:
+//0 - three colours, 1 - a float, a colour and an int (each padded out to 16 bytes)
+layout(constant_id = 0) const int LAYOUT_VARIANT = 0;
+
+struct Data48
+{
+	vec4 colorA;
+	vec4 colorB;
+	vec4 colorC;
+};
+
+layout(binding = 0, set = 0) readonly buffer OBJECTS
+{
+	Data48 entries[];
+}data;
+
+//written by instanced_vert from the instance buffer, instead of coming from a push constant
+layout(location=1) flat in int dataIdx;
+
+
+layout(location=0) out vec4 outColor;
+
+void main()
+{
+	vec4 a = data.entries[dataIdx].colorA;
+	vec4 b = data.entries[dataIdx].colorB;
+	vec4 c = data.entries[dataIdx].colorC;
+
+	if (LAYOUT_VARIANT == 0)
+	{
+		outColor = a + b + c;
+	}
+	else
+	{
+		float red = a.x;
+		float intCast = float(floatBitsToInt(c.x));
+		outColor = b * vec4(red, intCast, intCast, intCast);
+	}
+}
@@ -0,0 +1,27 @@
+#version 450 core
+#extension GL_ARB_separate_shader_objects : enable
+
+layout(location=0) in vec3 vertex;
+layout(location=1) in vec2 uv;
+
+layout(location=0) out vec2 fragUV;
+layout(location=1) flat out int fragDataIdx;
+
+//one entry per instance, replacing the per object push constant. Indirect draw commands set firstInstance,
+//so gl_InstanceIndex already includes the offset to each command's first entry
+layout(binding = 1, set = 0) readonly buffer INSTANCES
+{
+	int dataIdx[];
+}instances;
+
+out gl_PerVertex
+{
+	vec4 gl_Position;
+};
+
+void main()
+{
+	gl_Position = vec4(vertex, 1.0);
+	fragUV = uv;
+	fragDataIdx = instances.dataIdx[gl_InstanceIndex];
+}
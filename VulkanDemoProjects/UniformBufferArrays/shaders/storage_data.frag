@@ -0,0 +1,47 @@
+#version 450 core
+#extension GL_ARB_separate_shader_objects : enable
+
+//the storage buffer version of shared_data.frag, which reads its entries from an object store so there can be as
+//many of them as memory allows.
+//selects how each 48 byte entry in the shared buffer is interpreted, so that one module
+//can be specialized into both materials instead of compiling a fragment shader for each:
+//0 - three colours, 1 - a float, a colour and an int (each padded out to 16 bytes)
+layout(constant_id = 0) const int LAYOUT_VARIANT = 0;
+
+struct Data48
+{
+	vec4 colorA;
+	vec4 colorB;
+	vec4 colorC;
+};
+
+layout(binding = 0, set = 0) readonly buffer OBJECTS
+{
+	Data48 entries[];
+}data;
+
+layout(push_constant) uniform PER_OBJECT 
+{ 
+	int dataIdx;
+}pc;
+
+
+layout(location=0) out vec4 outColor;
+
+void main()
+{
+	vec4 a = data.entries[pc.dataIdx].colorA;
+	vec4 b = data.entries[pc.dataIdx].colorB;
+	vec4 c = data.entries[pc.dataIdx].colorC;
+
+	if (LAYOUT_VARIANT == 0)
+	{
+		outColor = a + b + c;
+	}
+	else
+	{
+		float red = a.x;
+		float intCast = float(floatBitsToInt(c.x));
+		outColor = b * vec4(red, intCast, intCast, intCast);
+	}
+}